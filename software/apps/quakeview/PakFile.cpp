@@ -336,10 +336,18 @@ void PakFile::loadTextureAtlas(const bspheader_t *bspHeader, const uint8_t *data
 
     delete[] palette;
 
+    // The floors and walls are often viewed at an angle, which causes many
+    // cache misses with a linear layout. The sizes of all atlas mip levels
+    // are multiples of four, so the texture copies each into the tiled
+    // layout, and the original surfaces aren't needed afterward.
     fTextureAtlasTexture = new Texture();
     fTextureAtlasTexture->enableBilinearFiltering(true);
+    fTextureAtlasTexture->enableTiledLayout(true);
     for (int mipLevel = 0; mipLevel < kNumMipLevels; mipLevel++)
+    {
         fTextureAtlasTexture->setMipSurface(mipLevel, atlasSurfaces[mipLevel]);
+        delete atlasSurfaces[mipLevel];
+    }
 
     delete[] texArray;
 }
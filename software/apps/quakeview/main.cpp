@@ -55,6 +55,7 @@ bool gWireframeRendering = false;
 bool gBilinearFiltering = true;
 bool gEnableLightmap = true;
 bool gEnableTexture = true;
+bool gIndexedShading = true;
 
 void processKeyboardEvents()
 {
@@ -127,6 +128,13 @@ void processKeyboardEvents()
 
                 break;
 
+            // Toggle indexed shading
+            case 'i':
+                if (keyCode & KBD_PRESSED)
+                    gIndexedShading = !gIndexedShading;
+
+                break;
+
         }
     }
     // Handle movement
@@ -239,6 +247,7 @@ int main()
         processKeyboardEvents();
 
         context->enableWireframeMode(gWireframeRendering);
+        context->enableIndexedShading(gIndexedShading);
         atlasTexture->enableBilinearFiltering(gBilinearFiltering);
 
         // Set up uniforms
@@ -20,17 +20,24 @@
 The output is read by the viewer program.
 """
 
+import argparse
 import math
 import os
 import re
 import struct
-import sys
 from PIL import Image
 
 NUM_MIP_LEVELS = 4
 
+# These must match the values sceneview.cpp checks.
+TEXTURE_FORMAT_RGBA8888 = 0
+TEXTURE_FORMAT_BC1 = 1
+
+# Set from the command line
+compress_textures = False
+
 # This is the final output of the parsing stage
-texture_list = []  # (width, height, data)
+texture_list = []  # (width, height, format, data)
 mesh_list = []		# (texture index, vertex list, index list)
 
 material_name_to_texture_idx = {}
@@ -69,30 +76,155 @@ def read_image_file(filename, resize_to_width=None, resize_to_height=None):
     return (image.size[0], image.size[1], image.convert("RGBA").tobytes())
 
 
+def to_rgb565(color):
+    """Convert an (r, g, b) tuple with 8 bit components to a 16 bit value."""
+    red, green, blue = [min(max(int(round(x)), 0), 255) for x in color]
+    return (((red * 31 + 127) // 255) << 11) | (((green * 63 + 127) // 255) << 5) \
+        | ((blue * 31 + 127) // 255)
+
+
+def from_rgb565(value):
+    """Convert a 16 bit color to an (r, g, b) tuple with 8 bit components."""
+    return (((value >> 11) & 31) * 255 / 31, ((value >> 5) & 63) * 255 / 63,
+            (value & 31) * 255 / 31)
+
+
+def encode_bc1_block(pixels):
+    """Compress a 4x4 block of pixels in the BC1 (DXT1) format.
+
+    This picks endpoints from the corners of the bounding box of the colors,
+    choosing the diagonal that follows how the color channels vary together,
+    then assigns each pixel to the nearest of the four interpolated colors.
+    If any pixels are mostly transparent, this uses the mode with three
+    colors and transparent black. librender/Surface.h decodes these.
+
+    Args:
+        pixels: list of (r, g, b, a)
+            16 pixels, in rows.
+
+    Returns:
+        bytes: 8 bytes of compressed data
+    """
+    has_alpha = any(pixel[3] < 128 for pixel in pixels)
+    opaque = [pixel[:3] for pixel in pixels if pixel[3] >= 128]
+    if not opaque:
+        return struct.pack('<II', 0, 0xffffffff)
+
+    low = [min(pixel[channel] for pixel in opaque) for channel in range(3)]
+    high = [max(pixel[channel] for pixel in opaque) for channel in range(3)]
+    means = [sum(pixel[channel] for pixel in opaque) / len(opaque)
+             for channel in range(3)]
+    primary = max(range(3), key=lambda channel: high[channel] - low[channel])
+    for channel in range(3):
+        covariance = sum((pixel[primary] - means[primary]) * (pixel[channel] - means[channel])
+                         for pixel in opaque)
+        if covariance < 0:
+            low[channel], high[channel] = high[channel], low[channel]
+
+    # Move the endpoints in slightly, which reduces the error for the colors
+    # in between.
+    for channel in range(3):
+        inset = (high[channel] - low[channel]) / 16
+        low[channel] += inset
+        high[channel] -= inset
+
+    color0 = to_rgb565(high)
+    color1 = to_rgb565(low)
+    if has_alpha:
+        # Three color mode is selected by color0 <= color1
+        if color0 > color1:
+            color0, color1 = color1, color0
+    else:
+        if color0 < color1:
+            color0, color1 = color1, color0
+        elif color0 == color1:
+            return struct.pack('<II', color0 | (color1 << 16), 0)
+
+    endpoint0 = from_rgb565(color0)
+    endpoint1 = from_rgb565(color1)
+    if has_alpha:
+        weights = [0, 1, 0.5]
+    else:
+        weights = [0, 1, 1 / 3, 2 / 3]
+
+    palette = [tuple(a + (b - a) * weight for a, b in zip(endpoint0, endpoint1))
+               for weight in weights]
+    indices = 0
+    for pixel_index, pixel in enumerate(pixels):
+        if pixel[3] < 128:
+            selector = 3
+        else:
+            selector = min(range(len(palette)), key=lambda entry: sum(
+                (pixel[channel] - palette[entry][channel]) ** 2 for channel in range(3)))
+
+        indices |= selector << (pixel_index * 2)
+
+    return struct.pack('<II', color0 | (color1 << 16), indices)
+
+
+def encode_bc1(width, height, data):
+    """Compress an RGBA image in the BC1 format.
+
+    Args:
+        width: int
+            Width of the image in pixels. Must be a multiple of 4.
+        height: int
+            Height of the image in pixels. Must be a multiple of 4.
+        data: bytes
+            RGBA 32-bit raster data.
+
+    Returns:
+        bytes: The compressed blocks, in rows.
+    """
+    result = bytearray()
+    for block_y in range(0, height, 4):
+        for block_x in range(0, width, 4):
+            pixels = []
+            for y in range(block_y, block_y + 4):
+                offset = (y * width + block_x) * 4
+                for x in range(4):
+                    pixels.append(tuple(data[offset + x * 4:offset + x * 4 + 4]))
+
+            result += encode_bc1_block(pixels)
+
+    return bytes(result)
+
+
 def read_texture(filename):
     """Read an image file at multiple resolutions to create mip maps
 
     This is read at the original resolution, then progressively at scaled
     down by halves for MIP map levels. These will be stored as RGBA 32-bit
-    raster data.
+    raster data, or compressed in the BC1 format if compress_textures is
+    set and all levels are multiples of four pixels.
 
     Args:
         filename: string
             Path to file to open.
 
     Returns:
-        (width: int, height: int, image data: bytes)
+        (width: int, height: int, format: int, image data: bytes)
     """
     print('read texture ' + filename)
     width, height, data = read_image_file(filename)
+    levels = [data]
 
     # Read in lower mip levels
     for level in range(1, NUM_MIP_LEVELS + 1):
         _, _, sub_data = read_image_file(
             filename, width >> level, height >> level)
-        data += sub_data
+        levels.append(sub_data)
 
-    return width, height, data
+    block_align = 4 << NUM_MIP_LEVELS
+    if compress_textures:
+        if width % block_align == 0 and height % block_align == 0:
+            data = b''.join(encode_bc1(width >> level, height >> level, level_data)
+                            for level, level_data in enumerate(levels))
+            return width, height, TEXTURE_FORMAT_BC1, data
+
+        print('texture size is not a multiple of {}, not compressing'.format(block_align))
+
+    return width, height, TEXTURE_FORMAT_RGBA8888, b''.join(levels)
 
 
 def read_mtl_file(filename):
@@ -377,11 +509,11 @@ def write_resource_file(filename):
 
     with open(filename, 'wb') as f:
         # Write textures
-        for width, height, data in texture_list:
+        for width, height, texture_format, data in texture_list:
             # Write file header
             f.seek(current_header_offset)
-            f.write(struct.pack('iihh', current_data_offset,
-                                NUM_MIP_LEVELS, width, height))
+            f.write(struct.pack('iHHhh', current_data_offset,
+                                NUM_MIP_LEVELS, texture_format, width, height))
             current_header_offset += 12
 
             # Write data
@@ -419,11 +551,17 @@ def write_resource_file(filename):
         print('wrote ' + filename)
 
 def main():
-    if len(sys.argv) < 2:
-        print('enter the name of a .OBJ file')
-        sys.exit(1)
+    global compress_textures
+
+    parser = argparse.ArgumentParser(
+        description='Convert an OBJ file to a resource file for sceneview')
+    parser.add_argument('obj_file', help='Path to the OBJ file')
+    parser.add_argument('--compress', action='store_true',
+                        help='Compress textures in the BC1 format')
+    args = parser.parse_args()
+    compress_textures = args.compress
 
-    read_obj_file(sys.argv[1])
+    read_obj_file(args.obj_file)
     print_stats()
     write_resource_file('resource.bin')
 
@@ -38,10 +38,18 @@ struct FileHeader
     uint32_t numMeshes;
 };
 
+// Values for TextureEntry::format. These must match make_resource_file.py.
+enum TextureFormat
+{
+    kTextureRGBA8888 = 0,
+    kTextureBC1 = 1
+};
+
 struct TextureEntry
 {
     uint32_t offset;
-    uint32_t mipLevels;
+    uint16_t mipLevels;
+    uint16_t format;
     uint16_t width;
     uint16_t height;
 };
@@ -170,14 +178,17 @@ int main()
         textures[textureIndex] = new Texture();
         textures[textureIndex]->enableBilinearFiltering(true);
         int offset = texHeader[textureIndex].offset;
+        const bool compressed = texHeader[textureIndex].format == kTextureBC1;
         for (unsigned int mipLevel = 0; mipLevel < texHeader[textureIndex].mipLevels; mipLevel++)
         {
             int width = texHeader[textureIndex].width >> mipLevel;
             int height = texHeader[textureIndex].height >> mipLevel;
-            Surface *surface = new Surface(width, height, Surface::RGBA8888,
-                resourceData + offset);
+            Surface *surface = new Surface(width, height, compressed ? Surface::BC1
+                : Surface::RGBA8888, resourceData + offset);
             textures[textureIndex]->setMipSurface(mipLevel, surface);
-            offset += width * height * 4;
+
+            // BC1 uses 8 bytes for each 4x4 block
+            offset += compressed ? width * height / 2 : width * height * 4;
         }
 #endif
     }
@@ -185,6 +196,8 @@ int main()
     // Create Render Buffers
     RenderBuffer *vertexBuffers = new RenderBuffer[fileHeader->numMeshes];
     RenderBuffer *indexBuffers = new RenderBuffer[fileHeader->numMeshes];
+    Vec3 *meshMin = new Vec3[fileHeader->numMeshes];
+    Vec3 *meshMax = new Vec3[fileHeader->numMeshes];
     for (unsigned int meshIndex = 0; meshIndex < fileHeader->numMeshes; meshIndex++)
     {
         const MeshEntry &entry = meshHeader[meshIndex];
@@ -192,6 +205,20 @@ int main()
                                          entry.numVertices, sizeof(float) * kAttrsPerVertex);
         indexBuffers[meshIndex].setData(resourceData + entry.offset + entry.numVertices
                                         * kAttrsPerVertex * sizeof(float), entry.numIndices, sizeof(int));
+
+        // Compute bounding box, so the renderer can skip meshes that are
+        // out of view.
+        const float *vertex = reinterpret_cast<const float*>(resourceData + entry.offset);
+        meshMin[meshIndex] = Vec3(vertex[0], vertex[1], vertex[2]);
+        meshMax[meshIndex] = meshMin[meshIndex];
+        for (unsigned int i = 0; i < entry.numVertices; i++, vertex += kAttrsPerVertex)
+        {
+            for (int axis = 0; axis < 3; axis++)
+            {
+                meshMin[meshIndex][axis] = min(meshMin[meshIndex][axis], vertex[axis]);
+                meshMax[meshIndex][axis] = max(meshMax[meshIndex][axis], vertex[axis]);
+            }
+        }
     }
 
     // Set up render state
@@ -203,6 +230,7 @@ int main()
     renderTarget->setDepthBuffer(depthBuffer);
     context->bindTarget(renderTarget);
     context->enableDepthBuffer(true);
+    context->enableIndexedShading(true);
 #if SHOW_DEPTH
     context->bindShader(new DepthShader());
 #else
@@ -245,13 +273,16 @@ int main()
                 uniforms.fHasTexture = false;
 
             context->bindUniforms(&uniforms, sizeof(uniforms));
+            context->setBoundingBox(meshMin[meshIndex], meshMax[meshIndex], uniforms.fMVPMatrix);
             context->bindVertexAttrs(&vertexBuffers[meshIndex]);
             context->drawElements(&indexBuffers[meshIndex]);
         }
 
         clock_t startTime = clock();
         context->finish();
-        printf("rendered frame in %d uS\n", clock() - startTime);
+        printf("rendered frame in %d uS, culled %d meshes (%d triangles)\n",
+               clock() - startTime, context->getCulledDrawCount(),
+               context->getCulledTriangleCount());
     }
 
     delete[] textures;
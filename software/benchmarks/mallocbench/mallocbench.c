@@ -0,0 +1,144 @@
+//
+// Copyright 2018 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+//
+// Measures allocation throughput with all hardware threads allocating and
+// freeing at once, comparing the thread caching malloc with calling
+// dlmalloc directly. The work is split into a fixed number of tasks, so
+// the cycle count should drop as threads are added, for example:
+//
+//     nyuzi_emulator -t 4 -p 2 mallocbench.hex
+//
+// Each round, a task frees the blocks that the next task allocated in the
+// previous round, which was probably on another thread, and allocates new
+// ones. It also allocates and frees a short lived block each time.
+// Most blocks are small, but some are large enough to go to dlmalloc.
+//
+
+#include <nyuzi.h>
+#include <schedule.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NUM_TASKS 64
+#define BLOCKS_PER_TASK 128
+#define NUM_ROUNDS 8
+
+// These are the underlying dlmalloc functions that malloc uses for large
+// blocks.
+void *dlmalloc(size_t size);
+void dlfree(void *ptr);
+
+struct allocator
+{
+    const char *name;
+    void *(*alloc)(size_t size);
+    void (*release)(void *ptr);
+};
+
+static const struct allocator allocators[] = {
+    { "dlmalloc", dlmalloc, dlfree },
+    { "malloc", malloc, free }
+};
+
+// Blocks allocated in the current round and the previous one.
+static void *blocks[2][NUM_TASKS][BLOCKS_PER_TASK];
+static const struct allocator *current_allocator;
+static int current_round;
+
+static size_t next_size(unsigned int *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    if ((*seed >> 8) % 16 == 0)
+        return 2048;
+
+    return 8 + (*seed >> 16) % 248;
+}
+
+static void round_task(void *context, int task)
+{
+    void **to_free = blocks[(current_round + 1) & 1][(task + 1) % NUM_TASKS];
+    void **to_fill = blocks[current_round & 1][task];
+    unsigned int seed = task * 7919 + current_round;
+    int *temp;
+    int i;
+
+    (void) context;
+    for (i = 0; i < BLOCKS_PER_TASK; i++)
+    {
+        current_allocator->release(to_free[i]);
+        to_free[i] = NULL;
+        to_fill[i] = current_allocator->alloc(next_size(&seed));
+        *((int*) to_fill[i]) = i;
+
+        temp = (int*) current_allocator->alloc(next_size(&seed));
+        *temp = i;
+        current_allocator->release(temp);
+    }
+}
+
+static void free_task(void *context, int task)
+{
+    int i;
+
+    (void) context;
+    for (i = 0; i < BLOCKS_PER_TASK; i++)
+    {
+        current_allocator->release(blocks[0][task][i]);
+        current_allocator->release(blocks[1][task][i]);
+        blocks[0][task][i] = NULL;
+        blocks[1][task][i] = NULL;
+    }
+}
+
+static void run_test(const struct allocator *allocator)
+{
+    unsigned int start_cycles;
+    unsigned int total_cycles;
+
+    current_allocator = allocator;
+    start_cycles = get_cycle_count();
+    for (current_round = 0; current_round < NUM_ROUNDS; current_round++)
+        parallel_execute(round_task, NULL, NUM_TASKS);
+
+    total_cycles = get_cycle_count() - start_cycles;
+    parallel_execute(free_task, NULL, NUM_TASKS);
+
+    printf("%s: %u allocations in %u cycles\n", allocator->name,
+           NUM_ROUNDS * NUM_TASKS * BLOCKS_PER_TASK * 2, total_cycles);
+}
+
+int main()
+{
+    unsigned int i;
+
+    if (get_current_thread_id() != 0)
+        worker_thread();
+
+    start_all_threads();
+
+    // Run each test twice. The first run of malloc includes filling the
+    // thread caches.
+    for (i = 0; i < sizeof(allocators) / sizeof(allocators[0]); i++)
+    {
+        run_test(&allocators[i]);
+        run_test(&allocators[i]);
+    }
+
+    return 0;
+}
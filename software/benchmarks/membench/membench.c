@@ -18,16 +18,20 @@
 // This benchmark tests raw memory transfer speeds for reads, writes, and copies.
 // It attempts to saturate the memory interface by using vector wide transfers and
 // splitting the copy between multiple hardware threads to hide memory latency.
+// When built with ALIGNMENT_TEST defined (the MEMBENCH_ALIGNMENT_TEST cmake
+// option), it instead measures memcpy and memmove at unaligned addresses.
 //
 
 #include <nyuzi.h>
 #include <schedule.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 #define NUM_THREADS 4
 #define LOOP_UNROLL 16
 #define CR_SUSPEND_THREAD 20
+#define ALIGNMENT_TRANSFER_SIZE 4096
 
 const int TRANSFER_SIZE = 0x200000;
 void * const region_1_base = (void*) 0x200000;
@@ -201,13 +205,86 @@ void io_write_test()
     }
 }
 
+#ifdef ALIGNMENT_TEST
+
+// Measure single threaded memcpy and memmove speed for every combination of
+// source and destination offset within a cache line. This prints the result
+// for each pair, then totals grouped by whether the pointers have the same
+// alignment modulo 64, the same modulo 4, or neither, which use different
+// copy loops. The memmove regions overlap with the destination above the
+// source, so it must copy backward.
+void alignment_test(void)
+{
+    static const char * const class_names[] = { "aligned", "word aligned", "unaligned" };
+    unsigned int memcpy_cycles[3] = { 0, 0, 0 };
+    unsigned int memmove_cycles[3] = { 0, 0, 0 };
+    unsigned int copy_count[3] = { 0, 0, 0 };
+    char *dest;
+    char *src;
+    int dest_offset;
+    int src_offset;
+    int alignment_class;
+    unsigned int start_time;
+    unsigned int memcpy_time;
+    unsigned int memmove_time;
+
+    for (src_offset = 0; src_offset < 64; src_offset++)
+    {
+        for (dest_offset = 0; dest_offset < 64; dest_offset++)
+        {
+            if (src_offset == dest_offset)
+                alignment_class = 0;
+            else if ((src_offset & 3) == (dest_offset & 3))
+                alignment_class = 1;
+            else
+                alignment_class = 2;
+
+            dest = (char*) region_1_base + dest_offset;
+            src = (char*) region_2_base + src_offset;
+            start_time = get_cycle_count();
+            memcpy(dest, src, ALIGNMENT_TRANSFER_SIZE);
+            memcpy_time = get_cycle_count() - start_time;
+
+            dest = (char*) region_1_base + 64 + dest_offset;
+            src = (char*) region_1_base + src_offset;
+            start_time = get_cycle_count();
+            memmove(dest, src, ALIGNMENT_TRANSFER_SIZE);
+            memmove_time = get_cycle_count() - start_time;
+
+            printf("src %d dest %d: memcpy %g memmove %g bytes/cycle\n",
+                   src_offset, dest_offset,
+                   (float) ALIGNMENT_TRANSFER_SIZE / memcpy_time,
+                   (float) ALIGNMENT_TRANSFER_SIZE / memmove_time);
+            memcpy_cycles[alignment_class] += memcpy_time;
+            memmove_cycles[alignment_class] += memmove_time;
+            copy_count[alignment_class]++;
+        }
+    }
+
+    for (alignment_class = 0; alignment_class < 3; alignment_class++)
+    {
+        printf("memcpy %s: %g bytes/cycle\n", class_names[alignment_class],
+               (float) ALIGNMENT_TRANSFER_SIZE * copy_count[alignment_class]
+               / memcpy_cycles[alignment_class]);
+        printf("memmove %s: %g bytes/cycle\n", class_names[alignment_class],
+               (float) ALIGNMENT_TRANSFER_SIZE * copy_count[alignment_class]
+               / memmove_cycles[alignment_class]);
+    }
+}
+
+#endif
+
 int main(void)
 {
+#ifdef ALIGNMENT_TEST
+    alignment_test();
+#else
     copy_test();
     read_test();
     write_test();
     io_read_test();
     io_write_test();
+#endif
 
     return 0;
 }
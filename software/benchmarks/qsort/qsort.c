@@ -0,0 +1,159 @@
+//
+// Copyright 2018 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+//
+// Compares the cycle counts of the original exchange sort that libc used,
+// qsort, and parallel_qsort, for small integer elements and for larger
+// records. The exchange sort is quadratic, so it only runs on the small
+// array.
+//
+
+#include <nyuzi.h>
+#include <schedule.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SMALL_COUNT 2048
+#define LARGE_COUNT 32768
+
+struct record
+{
+    int key;
+    char payload[60];
+};
+
+typedef void (*sort_func_t)(void *base, size_t nel, size_t width, cmpfun cmp);
+
+static void exchange_sort(void *base, size_t nel, size_t width, cmpfun cmp)
+{
+    unsigned int i, j, k;
+    char tmp;
+
+    if (nel == 0)
+        return;
+
+    for (i = 0; i < nel - 1; i++)
+    {
+        for (j = i + 1; j < nel; j++)
+        {
+            char *elem1 = (char*) base + i * width;
+            char *elem2 = (char*) base + j * width;
+            if (cmp(elem1, elem2) > 0)
+            {
+                for (k = 0; k < width; k++)
+                {
+                    tmp = elem1[k];
+                    elem1[k] = elem2[k];
+                    elem2[k] = tmp;
+                }
+            }
+        }
+    }
+}
+
+static int compare_int(const void *a, const void *b)
+{
+    int value1 = *((const int*) a);
+    int value2 = *((const int*) b);
+    if (value1 < value2)
+        return -1;
+    else if (value1 > value2)
+        return 1;
+    else
+        return 0;
+}
+
+static int compare_record(const void *a, const void *b)
+{
+    return compare_int(&((const struct record*) a)->key,
+                       &((const struct record*) b)->key);
+}
+
+static void run_test(const char *name, sort_func_t sort, void *array,
+                     const void *source, size_t nel, size_t width, cmpfun cmp)
+{
+    unsigned int start_cycles;
+    unsigned int total_cycles;
+    size_t i;
+
+    memcpy(array, source, nel * width);
+    start_cycles = get_cycle_count();
+    sort(array, nel, width, cmp);
+    total_cycles = get_cycle_count() - start_cycles;
+
+    for (i = 1; i < nel; i++)
+    {
+        if (cmp((char*) array + (i - 1) * width, (char*) array + i * width) > 0)
+        {
+            printf("%s: not sorted at index %u\n", name, i);
+            return;
+        }
+    }
+
+    printf("%s, %u elements of %u bytes: %u cycles\n", name, nel, width,
+           total_cycles);
+}
+
+int main()
+{
+    int *int_source;
+    int *int_array;
+    struct record *record_source;
+    struct record *record_array;
+    int i;
+
+    if (get_current_thread_id() != 0)
+        worker_thread();
+
+    int_source = (int*) malloc(LARGE_COUNT * sizeof(int));
+    int_array = (int*) malloc(LARGE_COUNT * sizeof(int));
+    for (i = 0; i < LARGE_COUNT; i++)
+        int_source[i] = rand();
+
+    // memalign so the records can be swapped a vector at a time.
+    record_source = (struct record*) memalign(64, LARGE_COUNT * sizeof(struct record));
+    record_array = (struct record*) memalign(64, LARGE_COUNT * sizeof(struct record));
+    for (i = 0; i < LARGE_COUNT; i++)
+    {
+        record_source[i].key = rand();
+        memset(record_source[i].payload, i, sizeof(record_source[i].payload));
+    }
+
+    start_all_threads();
+
+    run_test("exchange sort", exchange_sort, int_array, int_source, SMALL_COUNT,
+             sizeof(int), compare_int);
+    run_test("qsort", qsort, int_array, int_source, SMALL_COUNT, sizeof(int),
+             compare_int);
+    run_test("exchange sort", exchange_sort, record_array, record_source,
+             SMALL_COUNT, sizeof(struct record), compare_record);
+    run_test("qsort", qsort, record_array, record_source, SMALL_COUNT,
+             sizeof(struct record), compare_record);
+
+    run_test("qsort", qsort, int_array, int_source, LARGE_COUNT, sizeof(int),
+             compare_int);
+    run_test("parallel_qsort", parallel_qsort, int_array, int_source, LARGE_COUNT,
+             sizeof(int), compare_int);
+    run_test("qsort", qsort, record_array, record_source, LARGE_COUNT,
+             sizeof(struct record), compare_record);
+    run_test("parallel_qsort", parallel_qsort, record_array, record_source,
+             LARGE_COUNT, sizeof(struct record), compare_record);
+
+    return 0;
+}
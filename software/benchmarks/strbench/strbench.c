@@ -0,0 +1,211 @@
+//
+// Copyright 2018 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+//
+// Measures cycles per byte for string and memory search functions in libc,
+// compared to simple byte at a time versions, for several lengths. The
+// comparisons are between equal strings, and the searches are for a
+// character that isn't present, so each call processes the whole string.
+//
+
+#include <nyuzi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_LENGTH 4096
+#define BYTES_PER_TEST 65536
+
+typedef int (*test_func_t)(const char *str1, const char *str2, int length);
+
+struct test
+{
+    const char *name;
+    test_func_t byte_func;
+    test_func_t libc_func;
+};
+
+static int byte_strlen(const char *str1, const char *str2, int length)
+{
+    int len = 0;
+
+    (void) str2;
+    (void) length;
+    while (*str1++)
+        len++;
+
+    return len;
+}
+
+static int byte_strcmp(const char *str1, const char *str2, int length)
+{
+    (void) length;
+    while (*str1 && *str1 == *str2)
+    {
+        str1++;
+        str2++;
+    }
+
+    return *str1 - *str2;
+}
+
+static int byte_strncmp(const char *str1, const char *str2, int length)
+{
+    if (length-- == 0)
+        return 0;
+
+    while (*str1 && length && *str1 == *str2)
+    {
+        str1++;
+        str2++;
+        length--;
+    }
+
+    return *str1 - *str2;
+}
+
+static int byte_memcmp(const char *str1, const char *str2, int length)
+{
+    while (length--)
+    {
+        int diff = *str1++ - *str2++;
+        if (diff)
+            return diff;
+    }
+
+    return 0;
+}
+
+static int byte_strchr(const char *str1, const char *str2, int length)
+{
+    (void) str2;
+    (void) length;
+    for (; *str1; str1++)
+    {
+        if (*str1 == 'x')
+            return 1;
+    }
+
+    return 0;
+}
+
+static int byte_memchr(const char *str1, const char *str2, int length)
+{
+    int i;
+
+    (void) str2;
+    for (i = 0; i < length; i++)
+    {
+        if (str1[i] == 'x')
+            return 1;
+    }
+
+    return 0;
+}
+
+static int libc_strlen(const char *str1, const char *str2, int length)
+{
+    (void) str2;
+    (void) length;
+    return strlen(str1);
+}
+
+static int libc_strcmp(const char *str1, const char *str2, int length)
+{
+    (void) length;
+    return strcmp(str1, str2);
+}
+
+static int libc_strncmp(const char *str1, const char *str2, int length)
+{
+    return strncmp(str1, str2, length);
+}
+
+static int libc_memcmp(const char *str1, const char *str2, int length)
+{
+    return memcmp(str1, str2, length);
+}
+
+static int libc_strchr(const char *str1, const char *str2, int length)
+{
+    (void) str2;
+    (void) length;
+    return strchr(str1, 'x') != 0;
+}
+
+static int libc_memchr(const char *str1, const char *str2, int length)
+{
+    (void) str2;
+    return memchr(str1, 'x', length) != 0;
+}
+
+static const struct test TESTS[] = {
+    { "strlen", byte_strlen, libc_strlen },
+    { "strcmp", byte_strcmp, libc_strcmp },
+    { "strncmp", byte_strncmp, libc_strncmp },
+    { "memcmp", byte_memcmp, libc_memcmp },
+    { "strchr", byte_strchr, libc_strchr },
+    { "memchr", byte_memchr, libc_memchr }
+};
+
+static const int LENGTHS[] = { 16, 256, MAX_LENGTH };
+
+static volatile int result_sink;
+
+static float cycles_per_byte(test_func_t func, const char *str1, const char *str2,
+                             int length)
+{
+    int iterations = BYTES_PER_TEST / length;
+    unsigned int start_cycles;
+    int i;
+
+    start_cycles = get_cycle_count();
+    for (i = 0; i < iterations; i++)
+        result_sink = func(str1, str2, length);
+
+    return (float) (get_cycle_count() - start_cycles) / BYTES_PER_TEST;
+}
+
+int main()
+{
+    // Aligned, so the libc versions can use vector loads.
+    char *str1 = (char*) memalign(64, MAX_LENGTH + 1);
+    char *str2 = (char*) memalign(64, MAX_LENGTH + 1);
+    unsigned int test_index;
+    unsigned int length_index;
+    int length;
+
+    for (test_index = 0; test_index < sizeof(TESTS) / sizeof(TESTS[0]); test_index++)
+    {
+        const struct test *test = &TESTS[test_index];
+        for (length_index = 0; length_index < sizeof(LENGTHS) / sizeof(LENGTHS[0]);
+                length_index++)
+        {
+            length = LENGTHS[length_index];
+            memset(str1, 'a', length);
+            str1[length] = '\0';
+            memcpy(str2, str1, length + 1);
+
+            printf("%s %d bytes: byte loop %g cycles/byte, libc %g cycles/byte\n",
+                   test->name, length,
+                   cycles_per_byte(test->byte_func, str1, str2, length),
+                   cycles_per_byte(test->libc_func, str1, str2, length));
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,165 @@
+//
+// Copyright 2018 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+//
+// Compares texture sampling speed and L1 data cache misses with the LINEAR
+// and TILED surface layouts and the compressed BC1 color space. This samples
+// a texture with bilinear filtering at several rotations and scales, which is
+// where the linear layout touches the most cache lines. When running in the
+// emulator, pass --cache-model, otherwise the cache events will always read
+// as zero. The performance counters belong to the core that reads them, so
+// with more than one core the cache counts only cover the core thread 0 runs
+// on, while the cycle counts still cover the whole pass.
+//
+
+#include <math.h>
+#include <nyuzi.h>
+#include <performance_counters.h>
+#include <schedule.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <Surface.h>
+#include <Texture.h>
+
+using namespace librender;
+
+// Not static, so the compiler can't remove the stores to it.
+float gOutput[256 * 256];
+
+namespace
+{
+
+const int kTextureSize = 512;
+const int kOutputSize = 256;
+const int kBlocksPerRow = kOutputSize / 4;
+const float kAngles[] = { 0.0f, 0.5236f, 1.0472f };   // 0, 30, 60 degrees
+const float kScales[] = { 1.0f, 3.0f };
+
+struct SampleParams
+{
+    const Texture *texture;
+    float dudx;
+    float dvdx;
+    float dudy;
+    float dvdy;
+};
+
+// Sample a row of 4x4 blocks.
+void sampleRow(void *_params, int blockRow)
+{
+    const SampleParams *params = static_cast<const SampleParams*>(_params);
+    const vecf16_t xOffsets = { 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3 };
+    const vecf16_t yOffsets = { 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3 };
+    vecf16_t color[4];
+
+    const int top = blockRow * 4;
+    const vecf16_t y = yOffsets + static_cast<float>(top);
+    for (int left = 0; left < kOutputSize; left += 4)
+    {
+        const vecf16_t x = xOffsets + static_cast<float>(left);
+        const vecf16_t u = x * params->dudx + y * params->dudy;
+        const vecf16_t v = x * params->dvdx + y * params->dvdy;
+        params->texture->readPixels(u, v, 0xffff, color);
+        for (int lane = 0; lane < 16; lane++)
+            gOutput[(top + lane / 4) * kOutputSize + left + lane % 4] = color[0][lane];
+    }
+}
+
+void runTest(const char *name, const Texture *texture)
+{
+    unsigned int totalCycles = 0;
+    unsigned int totalMisses = 0;
+    unsigned int totalHits = 0;
+
+    for (float angle : kAngles)
+    {
+        for (float scale : kScales)
+        {
+            // Texture coordinates step by one texel per output pixel at
+            // scale 1.
+            const float step = scale / kTextureSize;
+            SampleParams params;
+            params.texture = texture;
+            params.dudx = cosf(angle) * step;
+            params.dvdx = sinf(angle) * step;
+            params.dudy = -sinf(angle) * step;
+            params.dvdy = cosf(angle) * step;
+
+            const unsigned int startMisses = read_perf_counter(0);
+            const unsigned int startHits = read_perf_counter(1);
+            const unsigned int startCycles = get_cycle_count();
+            parallel_execute(sampleRow, &params, kBlocksPerRow);
+            totalCycles += get_cycle_count() - startCycles;
+            totalMisses += read_perf_counter(0) - startMisses;
+            totalHits += read_perf_counter(1) - startHits;
+        }
+    }
+
+    printf("%s: %u cycles, %u dcache misses, %u hits", name, totalCycles,
+           totalMisses, totalHits);
+    if (totalMisses + totalHits != 0)
+    {
+        printf(", miss rate %g%%", static_cast<double>(totalMisses) * 100.0
+               / (totalMisses + totalHits));
+    }
+
+    printf("\n");
+}
+
+} // namespace
+
+int main()
+{
+    if (get_current_thread_id() != 0)
+        worker_thread();
+
+    // Random pixels, so there is nothing for caching or prediction to exploit
+    // other than the layout.
+    Surface *source = new Surface(kTextureSize, kTextureSize, Surface::RGBA8888);
+    uint32_t *pixels = static_cast<uint32_t*>(source->bits());
+    for (int i = 0; i < kTextureSize * kTextureSize; i++)
+        pixels[i] = static_cast<uint32_t>(rand());
+
+    Texture linearTexture;
+    linearTexture.enableBilinearFiltering(true);
+    linearTexture.setMipSurface(0, source);
+
+    Texture tiledTexture;
+    tiledTexture.enableBilinearFiltering(true);
+    tiledTexture.enableTiledLayout(true);
+    tiledTexture.setMipSurface(0, source);
+
+    // The random bits are valid BC1 blocks.
+    Surface *compressedSource = new Surface(kTextureSize, kTextureSize, Surface::BC1);
+    uint32_t *blocks = static_cast<uint32_t*>(compressedSource->bits());
+    for (int i = 0; i < kTextureSize * kTextureSize / 8; i++)
+        blocks[i] = static_cast<uint32_t>(rand());
+
+    Texture compressedTexture;
+    compressedTexture.enableBilinearFiltering(true);
+    compressedTexture.setMipSurface(0, compressedSource);
+
+    set_perf_counter_event(0, PERF_DCACHE_MISS);
+    set_perf_counter_event(1, PERF_DCACHE_HIT);
+    start_all_threads();
+
+    runTest("linear", &linearTexture);
+    runTest("tiled", &tiledTexture);
+    runTest("bc1", &compressedTexture);
+
+    return 0;
+}
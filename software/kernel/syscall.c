@@ -38,21 +38,36 @@ int handle_syscall(int index, int arg0, int arg1, int arg2, int arg3, int arg4,
     {
         // int write_console(const char *data, int length);
         case SYS_write_console:
-            if ((unsigned int) arg1 >= sizeof(tmp) - 2)
+        {
+            // libc buffers console output, so this is usually a whole line
+            // or more. Copy it in pieces that fit in tmp.
+            const char *data = (const char*) arg0;
+            int remaining = arg1;
+            int length;
+
+            if (remaining < 0)
             {
                 kprintf("size out of range\n");
                 return -EINVAL;
             }
 
-            if (user_copy(tmp, (void*) arg0, arg1) < 0)
+            while (remaining > 0)
             {
-                kprintf("user copy failed\n");
-                return -EFAULT;
+                length = remaining < (int) sizeof(tmp) - 1 ? remaining : (int) sizeof(tmp) - 1;
+                if (user_copy(tmp, data, length) < 0)
+                {
+                    kprintf("user copy failed\n");
+                    return -EFAULT;
+                }
+
+                tmp[length] = '\0';
+                kprintf("%s", tmp);
+                data += length;
+                remaining -= length;
             }
 
-            tmp[arg1] = '\0';
-            kprintf("%s", tmp);
             return 0;
+        }
 
         // int spawn_user_thread(const char *name, function, void *arg);
         case SYS_spawn_thread:
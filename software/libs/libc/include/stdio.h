@@ -25,6 +25,11 @@
 
 #define EOF -1
 
+// Buffering modes for setvbuf
+#define _IOFBF 0
+#define _IOLBF 1
+#define _IONBF 2
+
 #define SEEK_SET 0
 #define SEEK_CUR 1
 #define SEEK_END 2
@@ -52,6 +57,8 @@ int fputc(int ch, FILE*);
 int fputs(const char *s, FILE*);
 int fgetc(FILE*);
 int fflush(FILE*);
+int setvbuf(FILE*, char *buf, int mode, size_t size);
+void setbuf(FILE*, char *buf);
 FILE *fopen(const char *filename, const char *mode);
 size_t fread(void *ptr, size_t size, size_t nelem, FILE *stream);
 size_t fwrite(const void *ptr, size_t size, size_t nelem, FILE *stream);
@@ -24,6 +24,7 @@ extern "C" {
 #endif
 
 void *memcpy(void *dest, const void *src, size_t length);
+void *memmove(void *dest, const void *src, size_t length);
 void *memset(void *dest, int value, size_t length);
 int strcmp(const char *str1, const char *str2);
 int memcmp(const void *a, const void *b, size_t length);
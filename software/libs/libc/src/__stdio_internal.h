@@ -19,14 +19,37 @@
 #ifndef __STDIO_INTERNAL_H
 #define __STDIO_INTERNAL_H
 
+// Flags for struct __file
+#define __FILE_STRING 1     // Writes go to write_buf only (sprintf)
+#define __FILE_CONSOLE 2    // Flush with write_console instead of write
+#define __FILE_OWNS_BUF 4   // write_buf was allocated by the library
+#define __FILE_ERROR 8
+
+// For a string, write_buf is the destination and write_buf_len is its size.
+// Otherwise, it buffers writes as determined by buf_mode (_IOFBF, _IOLBF,
+// or _IONBF). It is allocated on the first write if setvbuf didn't provide
+// one. Streams other than strings are on a list, linked by next, so
+// fflush(NULL) can find them.
 struct __file
 {
     char *write_buf;
     int write_offset;
     int write_buf_len;
     int fd;
+    int buf_mode;
+    int flags;
+    volatile int lock;
+    struct __file *next;
 };
 
+// The stream functions hold the lock while they run, so output from
+// different threads isn't interleaved or lost. The _unlocked functions
+// must be called with it held.
+void __lock_file(FILE *file);
+void __unlock_file(FILE *file);
+void __write_unlocked(FILE *file, const char *data, int length);
+void __flush_unlocked(FILE *file);
+
 #endif
 
 
@@ -0,0 +1,45 @@
+//
+// Copyright 2018 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef __STRING_INTERNAL_H
+#define __STRING_INTERNAL_H
+
+#include <stdint.h>
+
+//
+// Helpers for string functions that check a word or a vector at a time.
+// They only use aligned loads. An aligned word or vector never crosses a
+// page boundary, so reading past the end of a string or buffer can't fault.
+//
+
+// Nonzero if any byte of x is zero. If x is a vector, this is done for each
+// lane independently.
+#define HAS_ZERO_BYTE(x) (((x) - 0x01010101u) & ~(x) & 0x80808080u)
+
+// A word with all four bytes set to c.
+#define REPLICATE_BYTE(c) (((unsigned int) (c) & 0xff) * 0x01010101u)
+
+#define IS_ALIGNED(ptr, alignment) ((((unsigned int) (ptr)) & ((alignment) - 1)) == 0)
+
+// Returns a bitmask with a bit set for each lane in which x is not zero.
+#define NONZERO_LANES(x) __builtin_nyuzi_mask_cmpi_ne((x), (vecu16_t) 0)
+
+// Byte offset of the first lane set in a lane mask. Bit 0 is the lane at
+// the lowest address.
+#define FIRST_LANE_OFFSET(mask) (__builtin_ctz(mask) * 4)
+
+#endif
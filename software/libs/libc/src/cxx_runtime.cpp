@@ -96,6 +96,9 @@ extern "C" void call_atexit_functions()
     for (AtExitCallback *callback = gAtExitList; callback;
         callback = callback->next)
         callback->func(callback->data);
+
+    // Write anything left in the stdio buffers
+    fflush(NULL);
 }
 
 extern "C" void __cxa_pure_virtual()
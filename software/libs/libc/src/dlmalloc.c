@@ -544,6 +544,10 @@ MAX_RELEASE_CHECK_RATE   default: 4095 unless not HAVE_MMAP
 #define NO_MALLOC_STATS 1
 #define MALLOC_FAILURE_ACTION ;
 
+// malloc.c provides the public allocation functions and uses dlmalloc for
+// large blocks and for the spans it carves into small ones.
+#define USE_DL_PREFIX 1
+
 /* Version identifier to allow people to support multiple versions */
 #ifndef DLMALLOC_VERSION
 #define DLMALLOC_VERSION 20806
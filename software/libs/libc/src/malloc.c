@@ -0,0 +1,425 @@
+//
+// Copyright 2018 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+//
+// Thread caching allocator. dlmalloc has a single lock, so when many hardware
+// threads allocate at the same time, they spend most of their time waiting
+// for it. This handles small blocks without touching dlmalloc in the common
+// case:
+// - Small requests are rounded up to one of a set of size classes. Each
+//   thread has a cache with a free list per size class. malloc pops a
+//   block from the current thread's list, and free pushes it onto the list
+//   of the thread that frees it, which may not be the one that allocated
+//   it.
+// - When a thread's list is empty, it takes a batch of blocks from a
+//   central list for that size class. When it has more than two batches,
+//   it returns one. This bounds how much memory sits idle in each cache.
+// - When the central list is empty, a span (a SPAN_SIZE aligned block from
+//   dlmalloc) is split into blocks of that size class. A page map records
+//   the size class of each span, so free can find the size of a block from
+//   its address. Spans are not returned to dlmalloc.
+// - Larger requests go directly to dlmalloc.
+//
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// dlmalloc.c is built with USE_DL_PREFIX, so these are its entry points.
+void *dlmalloc(size_t size);
+void dlfree(void *ptr);
+void *dlcalloc(size_t numElements, size_t size);
+void *dlrealloc(void *ptr, size_t size);
+void *dlmemalign(size_t alignment, size_t size);
+
+#define MAX_SMALL_SIZE 1024
+#define NUM_SIZE_CLASSES 20
+#define SPAN_SHIFT 14
+#define SPAN_SIZE (1 << SPAN_SHIFT)
+
+// The page map has an entry for every SPAN_SIZE region of the address space.
+// The top level is an array of leaves, which are allocated on demand.
+#define LEAF_BITS 10
+#define LEAF_SIZE (1 << LEAF_BITS)
+#define NUM_LEAVES (1 << (32 - SPAN_SHIFT - LEAF_BITS))
+
+// Threads whose stacks hash to the same index share a cache. The lock
+// keeps that correct, but slower.
+#define NUM_THREAD_CACHES 64
+
+// Bare metal programs have a 16k stack per hardware thread. Under the
+// kernel, each thread's stack is a separate 64k area.
+#define STACK_REGION_SHIFT 14
+
+#define MIN_BATCH 4
+#define MAX_BATCH 32
+
+// A free block. Blocks are at least 16 bytes, so all fields fit.
+struct free_block
+{
+    struct free_block *next;
+
+    // These are only valid in the first block of a batch on a central list.
+    struct free_block *next_batch;
+    int batch_count;
+};
+
+struct thread_cache
+{
+    volatile int lock;
+    struct free_block *free_list[NUM_SIZE_CLASSES];
+    int free_count[NUM_SIZE_CLASSES];
+} __attribute__((aligned(64)));
+
+struct central_list
+{
+    volatile int lock;
+    struct free_block *batches;
+};
+
+// Multiples of 16 up to 128, then four classes per power of two. The
+// largest rounding waste is 25%.
+static const int class_sizes[NUM_SIZE_CLASSES] = {
+    16, 32, 48, 64, 80, 96, 112, 128,
+    160, 192, 224, 256,
+    320, 384, 448, 512,
+    640, 768, 896, 1024
+};
+
+static struct thread_cache thread_caches[NUM_THREAD_CACHES];
+static struct central_list central_lists[NUM_SIZE_CLASSES];
+
+// Each leaf entry is the size class of the span plus one, or zero if the
+// region is not a span.
+static uint8_t * volatile span_map[NUM_LEAVES];
+static volatile int span_map_lock;
+
+static void acquire_lock(volatile int *lock)
+{
+    while (__sync_lock_test_and_set(lock, 1))
+    {
+        while (*lock)
+            ;
+    }
+}
+
+static void release_lock(volatile int *lock)
+{
+    __sync_lock_release(lock);
+}
+
+// size must be between 1 and MAX_SMALL_SIZE.
+static int get_size_class(size_t size)
+{
+    int shift;
+
+    if (size <= 128)
+        return (size - 1) >> 4;
+
+    // shift is 7 for 129-256, 8 for 257-512, 9 for 513-1024. The two bits
+    // below the leading one select the class within that range.
+    shift = 31 - __builtin_clz(size - 1);
+    return 8 + (shift - 7) * 4 + (((size - 1) >> (shift - 2)) & 3);
+}
+
+// Number of blocks moved between a thread cache and the central list at
+// once. This is smaller for larger blocks, so caches hold a similar number
+// of bytes for each size class.
+static int get_batch_size(int size_class)
+{
+    int count = 2048 / class_sizes[size_class];
+    if (count < MIN_BATCH)
+        return MIN_BATCH;
+    else if (count > MAX_BATCH)
+        return MAX_BATCH;
+    else
+        return count;
+}
+
+// Returns -1 if ptr was not allocated from a span.
+static int get_span_class(const void *ptr)
+{
+    unsigned int index = (unsigned int) ptr >> SPAN_SHIFT;
+    const uint8_t *leaf = span_map[index >> LEAF_BITS];
+
+    if (leaf == NULL)
+        return -1;
+
+    return leaf[index & (LEAF_SIZE - 1)] - 1;
+}
+
+static int set_span_class(const void *span, int size_class)
+{
+    unsigned int index = (unsigned int) span >> SPAN_SHIFT;
+    uint8_t *leaf;
+
+    acquire_lock(&span_map_lock);
+    leaf = span_map[index >> LEAF_BITS];
+    if (leaf == NULL)
+    {
+        leaf = (uint8_t*) dlcalloc(LEAF_SIZE, 1);
+        if (leaf == NULL)
+        {
+            release_lock(&span_map_lock);
+            return -1;
+        }
+
+        span_map[index >> LEAF_BITS] = leaf;
+    }
+
+    leaf[index & (LEAF_SIZE - 1)] = size_class + 1;
+    release_lock(&span_map_lock);
+    return 0;
+}
+
+// This is called on every malloc and free, so it doesn't use
+// get_current_thread_id, which is a system call under the kernel (control
+// registers can't be read in user mode). The stack pointer identifies the
+// thread just as well: each thread's stack is in a different region. The
+// upper bits are folded in so threads with 64k stacks don't only use every
+// fourth cache. If a deep call chain crosses into another region, the
+// thread uses a different cache for a while, which is only slower.
+static struct thread_cache *get_thread_cache(void)
+{
+    unsigned int region = (unsigned int) __builtin_frame_address(0) >> STACK_REGION_SHIFT;
+
+    return &thread_caches[(region ^ (region >> 6)) % NUM_THREAD_CACHES];
+}
+
+// Split a new span into batches of blocks. The first is returned and the
+// rest are put on the central list.
+static struct free_block *allocate_span(int size_class, int *out_count)
+{
+    const int block_size = class_sizes[size_class];
+    const int batch_size = get_batch_size(size_class);
+    const int num_blocks = SPAN_SIZE / block_size;
+    struct central_list *central = &central_lists[size_class];
+    struct free_block *first_batch = NULL;
+    struct free_block *other_batches = NULL;
+    struct free_block *last_batch = NULL;
+    char *span;
+    int i;
+
+    span = (char*) dlmemalign(SPAN_SIZE, SPAN_SIZE);
+    if (span == NULL)
+        return NULL;
+
+    if (set_span_class(span, size_class) < 0)
+    {
+        dlfree(span);
+        return NULL;
+    }
+
+    // Link the blocks in address order, breaking the chain every batch_size
+    // blocks.
+    for (i = 0; i < num_blocks; i++)
+    {
+        struct free_block *block = (struct free_block*) (span + i * block_size);
+        if (i % batch_size == batch_size - 1 || i == num_blocks - 1)
+            block->next = NULL;
+        else
+            block->next = (struct free_block*) (span + (i + 1) * block_size);
+
+        if (i % batch_size == 0)
+        {
+            if (first_batch == NULL)
+            {
+                first_batch = block;
+                *out_count = num_blocks < batch_size ? num_blocks : batch_size;
+            }
+            else
+            {
+                block->batch_count = num_blocks - i < batch_size ? num_blocks - i
+                                     : batch_size;
+                block->next_batch = NULL;
+                if (last_batch)
+                    last_batch->next_batch = block;
+                else
+                    other_batches = block;
+
+                last_batch = block;
+            }
+        }
+    }
+
+    if (other_batches)
+    {
+        acquire_lock(&central->lock);
+        last_batch->next_batch = central->batches;
+        central->batches = other_batches;
+        release_lock(&central->lock);
+    }
+
+    return first_batch;
+}
+
+// Called with the cache lock held when the thread's list for this size
+// class is empty.
+static int refill_cache(struct thread_cache *cache, int size_class)
+{
+    struct central_list *central = &central_lists[size_class];
+    struct free_block *batch;
+    int count = 0;
+
+    acquire_lock(&central->lock);
+    batch = central->batches;
+    if (batch)
+    {
+        central->batches = batch->next_batch;
+        count = batch->batch_count;
+    }
+
+    release_lock(&central->lock);
+    if (batch == NULL)
+    {
+        batch = allocate_span(size_class, &count);
+        if (batch == NULL)
+            return -1;
+    }
+
+    cache->free_list[size_class] = batch;
+    cache->free_count[size_class] = count;
+    return 0;
+}
+
+// Called with the cache lock held. Move one batch from the front of the
+// thread's list to the central list.
+static void release_batch(struct thread_cache *cache, int size_class)
+{
+    struct central_list *central = &central_lists[size_class];
+    const int batch_size = get_batch_size(size_class);
+    struct free_block *batch = cache->free_list[size_class];
+    struct free_block *last = batch;
+    int i;
+
+    for (i = 1; i < batch_size; i++)
+        last = last->next;
+
+    cache->free_list[size_class] = last->next;
+    cache->free_count[size_class] -= batch_size;
+    last->next = NULL;
+    batch->batch_count = batch_size;
+
+    acquire_lock(&central->lock);
+    batch->next_batch = central->batches;
+    central->batches = batch;
+    release_lock(&central->lock);
+}
+
+void *malloc(size_t size)
+{
+    struct thread_cache *cache;
+    struct free_block *block;
+    int size_class;
+
+    if (size > MAX_SMALL_SIZE)
+        return dlmalloc(size);
+
+    size_class = get_size_class(size ? size : 1);
+    cache = get_thread_cache();
+    acquire_lock(&cache->lock);
+    if (cache->free_list[size_class] == NULL && refill_cache(cache, size_class) < 0)
+    {
+        release_lock(&cache->lock);
+        return NULL;
+    }
+
+    block = cache->free_list[size_class];
+    cache->free_list[size_class] = block->next;
+    cache->free_count[size_class]--;
+    release_lock(&cache->lock);
+
+    return block;
+}
+
+void free(void *ptr)
+{
+    struct thread_cache *cache;
+    struct free_block *block = (struct free_block*) ptr;
+    int size_class;
+
+    if (ptr == NULL)
+        return;
+
+    size_class = get_span_class(ptr);
+    if (size_class < 0)
+    {
+        dlfree(ptr);
+        return;
+    }
+
+    cache = get_thread_cache();
+    acquire_lock(&cache->lock);
+    block->next = cache->free_list[size_class];
+    cache->free_list[size_class] = block;
+    if (++cache->free_count[size_class] > get_batch_size(size_class) * 2)
+        release_batch(cache, size_class);
+
+    release_lock(&cache->lock);
+}
+
+void *calloc(size_t size, size_t numElements)
+{
+    size_t total = size * numElements;
+    void *ptr;
+
+    if (numElements != 0 && total / numElements != size)
+        return NULL;
+
+    if (total > MAX_SMALL_SIZE)
+        return dlcalloc(size, numElements);
+
+    ptr = malloc(total);
+    if (ptr)
+        memset(ptr, 0, total);
+
+    return ptr;
+}
+
+void *realloc(void *oldmem, size_t bytes)
+{
+    void *newmem;
+    int size_class;
+
+    if (oldmem == NULL)
+        return malloc(bytes);
+
+    size_class = get_span_class(oldmem);
+    if (size_class < 0)
+        return dlrealloc(oldmem, bytes);
+
+    if (bytes <= (size_t) class_sizes[size_class])
+        return oldmem;
+
+    newmem = malloc(bytes);
+    if (newmem)
+    {
+        memcpy(newmem, oldmem, class_sizes[size_class]);
+        free(oldmem);
+    }
+
+    return newmem;
+}
+
+// Blocks in spans are aligned to 16 bytes. dlmalloc handles larger
+// alignments.
+void *memalign(size_t alignment, size_t size)
+{
+    if (alignment <= 16 && size <= MAX_SMALL_SIZE)
+        return malloc(size);
+
+    return dlmemalign(alignment, size);
+}
@@ -14,10 +14,63 @@
 // limitations under the License.
 //
 
+#include "__string_internal.h"
+
 int memcmp(const void *_str1, const void *_str2, unsigned int len)
 {
     const char *str1 = _str1;
     const char *str2 = _str2;
+    int mask;
+
+    // If the buffers have the same alignment, skip equal words, or vectors
+    // if possible. The byte loop below then finds the first difference.
+    if (IS_ALIGNED((unsigned int) str1 ^ (unsigned int) str2, 4))
+    {
+        while (len > 0 && !IS_ALIGNED(str1, 4) && *str1 == *str2)
+        {
+            str1++;
+            str2++;
+            len--;
+        }
+
+        if (IS_ALIGNED(str1, 4))
+        {
+            while (len >= 4 && !IS_ALIGNED(str1, 64)
+                    && *((const unsigned int*) str1) == *((const unsigned int*) str2))
+            {
+                str1 += 4;
+                str2 += 4;
+                len -= 4;
+            }
+
+            if (IS_ALIGNED(str1, 64) && IS_ALIGNED(str2, 64))
+            {
+                while (len >= 64)
+                {
+                    mask = __builtin_nyuzi_mask_cmpi_ne(*((const vecu16_t*) str1),
+                                                        *((const vecu16_t*) str2));
+                    if (mask)
+                    {
+                        str1 += FIRST_LANE_OFFSET(mask);
+                        str2 += FIRST_LANE_OFFSET(mask);
+                        len -= FIRST_LANE_OFFSET(mask);
+                        break;
+                    }
+
+                    str1 += 64;
+                    str2 += 64;
+                    len -= 64;
+                }
+            }
+
+            while (len >= 4 && *((const unsigned int*) str1) == *((const unsigned int*) str2))
+            {
+                str1 += 4;
+                str2 += 4;
+                len -= 4;
+            }
+        }
+    }
 
     while (len--)
     {
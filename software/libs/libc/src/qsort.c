@@ -14,34 +14,237 @@
 // limitations under the License.
 //
 
+#include <stdint.h>
 #include <stdlib.h>
 
-void qsort(void *base, size_t nel, size_t width, cmpfun cmp)
+//
+// Introsort: quicksort with a median of three pivot, which switches to
+// heapsort if the recursion gets too deep (so the worst case is O(n log n)),
+// and insertion sort for small partitions.
+//
+
+#define INSERTION_SORT_THRESHOLD 16
+
+enum swap_type
 {
-    unsigned int i, j, k;
-    char tmp;
+    SWAP_BYTES,
+    SWAP_WORDS,
+    SWAP_VECTORS
+};
 
-    if (nel == 0)
-        return;
+struct sort_params
+{
+    size_t width;
+    cmpfun cmp;
+    enum swap_type swap_type;
+};
+
+// Pick the widest swap that the element size and alignment allow. All
+// elements have the same alignment as base, because width is a multiple of
+// it.
+static enum swap_type get_swap_type(const void *base, size_t width)
+{
+    unsigned int alignment = ((unsigned int) base) | width;
+
+    if ((alignment & 63) == 0)
+        return SWAP_VECTORS;
+    else if ((alignment & 3) == 0)
+        return SWAP_WORDS;
+    else
+        return SWAP_BYTES;
+}
 
-    for (i = 0; i < nel - 1; i++)
+static void swap(const struct sort_params *params, char *elem1, char *elem2)
+{
+    size_t i;
+
+    switch (params->swap_type)
     {
-        for (j = i + 1; j < nel; j++)
+        case SWAP_VECTORS:
         {
-            char *elem1 = (char*) base + i * width;
-            char *elem2 = (char*) base + j * width;
-            if (cmp(elem1, elem2) > 0)
+            veci16_t *vec1 = (veci16_t*) elem1;
+            veci16_t *vec2 = (veci16_t*) elem2;
+            for (i = 0; i < params->width / 64; i++)
+            {
+                veci16_t tmp = vec1[i];
+                vec1[i] = vec2[i];
+                vec2[i] = tmp;
+            }
+
+            break;
+        }
+
+        case SWAP_WORDS:
+        {
+            uint32_t *word1 = (uint32_t*) elem1;
+            uint32_t *word2 = (uint32_t*) elem2;
+            for (i = 0; i < params->width / 4; i++)
+            {
+                uint32_t tmp = word1[i];
+                word1[i] = word2[i];
+                word2[i] = tmp;
+            }
+
+            break;
+        }
+
+        case SWAP_BYTES:
+            for (i = 0; i < params->width; i++)
             {
-                // swap
-                for (k = 0; k < width; k++)
-                {
-                    tmp = elem1[k];
-                    elem1[k] = elem2[k];
-                    elem2[k] = tmp;
-                }
+                char tmp = elem1[i];
+                elem1[i] = elem2[i];
+                elem2[i] = tmp;
             }
+
+            break;
+    }
+}
+
+static void insertion_sort(const struct sort_params *params, char *base, size_t nel)
+{
+    size_t i;
+    char *elem;
+
+    for (i = 1; i < nel; i++)
+    {
+        for (elem = base + i * params->width; elem > base
+                && params->cmp(elem - params->width, elem) > 0; elem -= params->width)
+        {
+            swap(params, elem - params->width, elem);
+        }
+    }
+}
+
+static void sift_down(const struct sort_params *params, char *base, size_t root, size_t nel)
+{
+    size_t child;
+
+    while ((child = root * 2 + 1) < nel)
+    {
+        if (child + 1 < nel && params->cmp(base + child * params->width,
+                                           base + (child + 1) * params->width) < 0)
+        {
+            child++;
         }
+
+        if (params->cmp(base + root * params->width, base + child * params->width) >= 0)
+            break;
+
+        swap(params, base + root * params->width, base + child * params->width);
+        root = child;
     }
 }
 
+static void heap_sort(const struct sort_params *params, char *base, size_t nel)
+{
+    size_t i;
+
+    for (i = nel / 2; i > 0; i--)
+        sift_down(params, base, i - 1, nel);
 
+    for (i = nel - 1; i > 0; i--)
+    {
+        swap(params, base, base + i * params->width);
+        sift_down(params, base, 0, i);
+    }
+}
+
+// Sort the first, middle, and last elements, then move the median to the
+// start to use as the pivot. Afterward, the first element is not greater
+// than the pivot and the last is not less, so the partition loops don't
+// need bounds checks.
+static void choose_pivot(const struct sort_params *params, char *base, size_t nel)
+{
+    char *mid = base + (nel / 2) * params->width;
+    char *last = base + (nel - 1) * params->width;
+
+    if (params->cmp(mid, base) < 0)
+        swap(params, mid, base);
+
+    if (params->cmp(last, mid) < 0)
+    {
+        swap(params, last, mid);
+        if (params->cmp(mid, base) < 0)
+            swap(params, mid, base);
+    }
+
+    swap(params, base, mid);
+}
+
+// Returns the index of the pivot after partitioning.
+static size_t partition(const struct sort_params *params, char *base, size_t nel)
+{
+    const size_t width = params->width;
+    char *left = base;
+    char *right = base + nel * width;
+
+    choose_pivot(params, base, nel);
+    while (1)
+    {
+        do
+            left += width;
+        while (params->cmp(left, base) < 0);
+
+        do
+            right -= width;
+        while (params->cmp(right, base) > 0);
+
+        if (left >= right)
+            break;
+
+        swap(params, left, right);
+    }
+
+    swap(params, base, right);
+    return (size_t) (right - base) / width;
+}
+
+static void intro_sort(const struct sort_params *params, char *base, size_t nel,
+                       int depth_limit)
+{
+    size_t pivot;
+
+    while (nel > INSERTION_SORT_THRESHOLD)
+    {
+        if (depth_limit-- == 0)
+        {
+            heap_sort(params, base, nel);
+            return;
+        }
+
+        // Recurse into the smaller side and loop on the larger one, so the
+        // stack depth is O(log n).
+        pivot = partition(params, base, nel);
+        if (pivot < nel - pivot - 1)
+        {
+            intro_sort(params, base, pivot, depth_limit);
+            base += (pivot + 1) * params->width;
+            nel -= pivot + 1;
+        }
+        else
+        {
+            intro_sort(params, base + (pivot + 1) * params->width, nel - pivot - 1,
+                       depth_limit);
+            nel = pivot;
+        }
+    }
+
+    insertion_sort(params, base, nel);
+}
+
+void qsort(void *base, size_t nel, size_t width, cmpfun cmp)
+{
+    struct sort_params params;
+    int depth_limit;
+
+    if (nel < 2 || width == 0)
+        return;
+
+    params.width = width;
+    params.cmp = cmp;
+    params.swap_type = get_swap_type(base, width);
+
+    // 2 * log2(nel)
+    depth_limit = (31 - __builtin_clz(nel)) * 2;
+    intro_sort(&params, (char*) base, nel, depth_limit);
+}
@@ -39,7 +39,8 @@ int sprintf(char *buf, const char *fmt, ...)
     FILE str = {
         .write_buf = buf,
         .write_offset = 0,
-        .write_buf_len = 0x7fffffff
+        .write_buf_len = 0x7fffffff,
+        .flags = __FILE_STRING
     };
 
     va_start(arglist, fmt);
@@ -56,7 +57,8 @@ int snprintf(char *buf, size_t length, const char *fmt, ...)
     FILE str = {
         .write_buf = buf,
         .write_offset = 0,
-        .write_buf_len = length
+        .write_buf_len = length,
+        .flags = __FILE_STRING
     };
 
     va_start(arglist, fmt);
@@ -72,7 +74,8 @@ int vsnprintf(char *buf, size_t length, const char *fmt, va_list arglist)
     FILE str = {
         .write_buf = buf,
         .write_offset = 0,
-        .write_buf_len = length
+        .write_buf_len = length,
+        .flags = __FILE_STRING
     };
 
     vfprintf(&str, fmt, arglist);
@@ -81,10 +84,25 @@ int vsnprintf(char *buf, size_t length, const char *fmt, va_list arglist)
     return str.write_offset;
 }
 
-static FILE __stdout = {
+static char __stdout_buf[BUFSIZ];
+
+// stdout is line buffered, so each line is written to the console with one
+// call, and output before a crash or hang is not lost.
+static FILE __stderr = {
     .write_buf = NULL,
     .write_offset = 0,
-    .write_buf_len = 0
+    .write_buf_len = 0,
+    .buf_mode = _IONBF,
+    .flags = __FILE_CONSOLE
+};
+
+static FILE __stdout = {
+    .write_buf = __stdout_buf,
+    .write_offset = 0,
+    .write_buf_len = BUFSIZ,
+    .buf_mode = _IOLBF,
+    .flags = __FILE_CONSOLE,
+    .next = &__stderr
 };
 
 static FILE __stdin = {
@@ -94,50 +112,157 @@ static FILE __stdin = {
 };
 
 FILE *stdout = &__stdout;
-FILE *stderr = &__stdout;
+FILE *stderr = &__stderr;
 FILE *stdin = &__stdin;
 
-int putchar(int ch)
+// All open streams that can have buffered output. fopen adds to the front
+// and fclose removes. stdin never has buffered output, so it isn't on it.
+static FILE *open_files = &__stdout;
+static volatile int open_files_lock;
+
+static void lock_open_files(void)
 {
-    fputc(ch, stdout);
-    return 1;
+    while (__sync_lock_test_and_set(&open_files_lock, 1))
+    {
+        while (open_files_lock)
+            ;
+    }
 }
 
-int puts(const char *s)
+static void unlock_open_files(void)
 {
-    const char *c;
-    for (c = s; *c; c++)
-        putchar(*c);
+    __sync_lock_release(&open_files_lock);
+}
 
-    putchar('\n');
-    return c - s + 1;
+void __lock_file(FILE *file)
+{
+    while (__sync_lock_test_and_set(&file->lock, 1))
+    {
+        while (file->lock)
+            ;
+    }
 }
 
-int fputc(int ch, FILE *file)
+void __unlock_file(FILE *file)
 {
-    if (file == stdout)
+    __sync_lock_release(&file->lock);
+}
+
+static void write_through(FILE *file, const char *data, int length)
+{
+    int result;
+
+    if (file->flags & __FILE_CONSOLE)
+        result = write_console(data, length);
+    else
+        result = write(file->fd, data, length);
+
+    if (result < 0)
+        file->flags |= __FILE_ERROR;
+}
+
+void __flush_unlocked(FILE *file)
+{
+    if ((file->flags & __FILE_STRING) == 0 && file->write_offset > 0)
     {
-        char _ch = ch;
-        write_console(&_ch, 1);
+        write_through(file, file->write_buf, file->write_offset);
+        file->write_offset = 0;
     }
-    else if (file->write_buf)
+}
+
+void __write_unlocked(FILE *file, const char *data, int length)
+{
+    int copy_len;
+
+    if (file->flags & __FILE_STRING)
     {
-        if (file->write_offset < file->write_buf_len)
-            file->write_buf[file->write_offset++] = ch;
+        // Truncate if the string is full.
+        copy_len = file->write_buf_len - file->write_offset;
+        if (copy_len > length)
+            copy_len = length;
+
+        if (copy_len > 0)
+        {
+            memcpy(file->write_buf + file->write_offset, data, copy_len);
+            file->write_offset += copy_len;
+        }
+
+        return;
     }
-    else
-        write(file->fd, &ch, 1);
 
-    return 1;
+    if (file->buf_mode != _IONBF && file->write_buf == NULL)
+    {
+        file->write_buf = (char*) malloc(BUFSIZ);
+        if (file->write_buf)
+        {
+            file->write_buf_len = BUFSIZ;
+            file->flags |= __FILE_OWNS_BUF;
+        }
+        else
+            file->buf_mode = _IONBF;
+    }
+
+    if (file->buf_mode == _IONBF)
+    {
+        write_through(file, data, length);
+        return;
+    }
+
+    if (file->write_offset + length > file->write_buf_len)
+    {
+        __flush_unlocked(file);
+
+        // Don't copy data that won't fit in the buffer anyway.
+        if (length >= file->write_buf_len)
+        {
+            write_through(file, data, length);
+            return;
+        }
+    }
+
+    memcpy(file->write_buf + file->write_offset, data, length);
+    file->write_offset += length;
+    if (file->buf_mode == _IOLBF && memchr(data, '\n', length))
+        __flush_unlocked(file);
+}
+
+int putchar(int ch)
+{
+    return fputc(ch, stdout);
+}
+
+int puts(const char *s)
+{
+    int length = strlen(s);
+
+    __lock_file(stdout);
+    __write_unlocked(stdout, s, length);
+    __write_unlocked(stdout, "\n", 1);
+    __unlock_file(stdout);
+
+    return length + 1;
+}
+
+int fputc(int ch, FILE *file)
+{
+    char c = ch;
+
+    __lock_file(file);
+    __write_unlocked(file, &c, 1);
+    __unlock_file(file);
+
+    return (unsigned char) ch;
 }
 
 int fputs(const char *str, FILE *file)
 {
-    const char *c;
-    for (c = str; *c; c++)
-        fputc(*c, file);
+    int length = strlen(str);
+
+    __lock_file(file);
+    __write_unlocked(file, str, length);
+    __unlock_file(file);
 
-    return c - str;
+    return length;
 }
 
 int fgetc(FILE *f)
@@ -158,25 +283,36 @@ FILE *fopen(const char *filename, const char *mode)
     if (fd < 0)
         return NULL;
 
-    FILE *fptr = (FILE*) malloc(sizeof(FILE));
-    fptr->write_buf = 0;
+    FILE *fptr = (FILE*) calloc(1, sizeof(FILE));
+    if (fptr == NULL)
+    {
+        close(fd);
+        return NULL;
+    }
+
     fptr->fd = fd;
+    fptr->buf_mode = _IOFBF;
+
+    lock_open_files();
+    fptr->next = open_files;
+    open_files = fptr;
+    unlock_open_files();
 
     return fptr;
 }
 
 size_t fwrite(const void *ptr, size_t size, size_t count, FILE *file)
 {
-    size_t left = size * count;
-    const char *out = ptr;
-    while (left--)
-        fputc(*out++, file);
+    __lock_file(file);
+    __write_unlocked(file, (const char*) ptr, size * count);
+    __unlock_file(file);
 
     return count;
 }
 
 size_t fread(void *ptr, size_t size, size_t nelem, FILE *f)
 {
+    fflush(f);
     int got = read(f->fd, ptr, size * nelem);
     if (got < 0)
         return 0;
@@ -186,18 +322,37 @@ size_t fread(void *ptr, size_t size, size_t nelem, FILE *f)
 
 int fclose(FILE *f)
 {
+    FILE **link;
+
+    fflush(f);
+    lock_open_files();
+    for (link = &open_files; *link != NULL; link = &(*link)->next)
+    {
+        if (*link == f)
+        {
+            *link = f->next;
+            break;
+        }
+    }
+
+    unlock_open_files();
     int result = close(f->fd);
+    if (f->flags & __FILE_OWNS_BUF)
+        free(f->write_buf);
+
     free(f);
     return result;
 }
 
 off_t fseek(FILE *f, off_t offset, int whence)
 {
+    fflush(f);
     return lseek(f->fd, offset, whence);
 }
 
 off_t ftell(FILE *f)
 {
+    fflush(f);
     return lseek(f->fd, 0, SEEK_CUR);
 }
 
@@ -211,16 +366,73 @@ int fprintf(FILE *f, const char *fmt, ...)
     return 0;	// XXX
 }
 
+// If file is NULL, this flushes all open streams. The list lock is held
+// while each is flushed, so none can be closed in the middle.
 int fflush(FILE *file)
 {
-    (void) file;
+    FILE *f;
+    int result = 0;
+
+    if (file == NULL)
+    {
+        lock_open_files();
+        for (f = open_files; f != NULL; f = f->next)
+        {
+            if (fflush(f) != 0)
+                result = EOF;
+        }
+
+        unlock_open_files();
+        return result;
+    }
+
+    __lock_file(file);
+    __flush_unlocked(file);
+    __unlock_file(file);
+
+    return (file->flags & __FILE_ERROR) ? EOF : 0;
+}
+
+// This flushes anything already buffered. If buf is NULL, a buffer is
+// allocated on the first write.
+int setvbuf(FILE *file, char *buf, int mode, size_t size)
+{
+    if (mode != _IOFBF && mode != _IOLBF && mode != _IONBF)
+        return -1;
+
+    __lock_file(file);
+    __flush_unlocked(file);
+    if (file->flags & __FILE_OWNS_BUF)
+    {
+        free(file->write_buf);
+        file->flags &= ~__FILE_OWNS_BUF;
+    }
+
+    file->buf_mode = mode;
+    if (mode == _IONBF || buf == NULL || size == 0)
+    {
+        file->write_buf = NULL;
+        file->write_buf_len = 0;
+    }
+    else
+    {
+        file->write_buf = buf;
+        file->write_buf_len = size;
+    }
+
+    __unlock_file(file);
+
     return 0;
 }
 
+void setbuf(FILE *file, char *buf)
+{
+    setvbuf(file, buf, buf ? _IOFBF : _IONBF, BUFSIZ);
+}
+
 int ferror(FILE *file)
 {
-    (void) file;
-    return 0;	// XXX not implemented
+    return (file->flags & __FILE_ERROR) != 0;
 }
 
 int ungetc(int character, FILE *file)
@@ -18,9 +18,68 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
+#include "__string_internal.h"
+
+// True if the words at str1 and str2 are equal and neither contains the
+// terminator.
+static int words_match(const char *str1, const char *str2)
+{
+    unsigned int word1 = *((const unsigned int*) str1);
+    return word1 == *((const unsigned int*) str2) && !HAS_ZERO_BYTE(word1);
+}
+
+// Mask of lanes where the vectors at str1 and str2 differ or str1 contains
+// the terminator.
+static int vector_mismatches(const char *str1, const char *str2)
+{
+    vecu16_t vec1 = *((const vecu16_t*) str1);
+    vecu16_t vec2 = *((const vecu16_t*) str2);
+    return __builtin_nyuzi_mask_cmpi_ne(vec1, vec2) | NONZERO_LANES(HAS_ZERO_BYTE(vec1));
+}
 
 int strcmp(const char *str1, const char *str2)
 {
+    int mask;
+
+    // If the strings have the same alignment, compare words, or vectors if
+    // possible, until one differs or contains the terminator. The byte loop
+    // below then finds the exact position.
+    if (IS_ALIGNED((unsigned int) str1 ^ (unsigned int) str2, 4))
+    {
+        while (!IS_ALIGNED(str1, 4) && *str1 && *str1 == *str2)
+        {
+            str1++;
+            str2++;
+        }
+
+        if (IS_ALIGNED(str1, 4))
+        {
+            while (!IS_ALIGNED(str1, 64) && words_match(str1, str2))
+            {
+                str1 += 4;
+                str2 += 4;
+            }
+
+            if (IS_ALIGNED(str1, 64) && IS_ALIGNED(str2, 64))
+            {
+                while ((mask = vector_mismatches(str1, str2)) == 0)
+                {
+                    str1 += 64;
+                    str2 += 64;
+                }
+
+                str1 += FIRST_LANE_OFFSET(mask);
+                str2 += FIRST_LANE_OFFSET(mask);
+            }
+
+            while (words_match(str1, str2))
+            {
+                str1 += 4;
+                str2 += 4;
+            }
+        }
+    }
+
     while (*str1 && *str1 == *str2)
     {
         str1++;
@@ -32,10 +91,60 @@ int strcmp(const char *str1, const char *str2)
 
 int strncmp(const char *str1, const char *str2, size_t length)
 {
-    if (length-- == 0)
+    int mask;
+
+    if (length == 0)
         return 0;
 
-    while (*str1 && length && *str1 == *str2)
+    // Same as strcmp. Whole words and vectors are only skipped if at least
+    // one more character is left to compare after them.
+    if (IS_ALIGNED((unsigned int) str1 ^ (unsigned int) str2, 4))
+    {
+        while (!IS_ALIGNED(str1, 4) && length > 1 && *str1 && *str1 == *str2)
+        {
+            str1++;
+            str2++;
+            length--;
+        }
+
+        if (IS_ALIGNED(str1, 4))
+        {
+            while (!IS_ALIGNED(str1, 64) && length > 4 && words_match(str1, str2))
+            {
+                str1 += 4;
+                str2 += 4;
+                length -= 4;
+            }
+
+            if (IS_ALIGNED(str1, 64) && IS_ALIGNED(str2, 64))
+            {
+                while (length > 64)
+                {
+                    mask = vector_mismatches(str1, str2);
+                    if (mask)
+                    {
+                        str1 += FIRST_LANE_OFFSET(mask);
+                        str2 += FIRST_LANE_OFFSET(mask);
+                        length -= FIRST_LANE_OFFSET(mask);
+                        break;
+                    }
+
+                    str1 += 64;
+                    str2 += 64;
+                    length -= 64;
+                }
+            }
+
+            while (length > 4 && words_match(str1, str2))
+            {
+                str1 += 4;
+                str2 += 4;
+                length -= 4;
+            }
+        }
+    }
+
+    while (*str1 && length > 1 && *str1 == *str2)
     {
         str1++;
         str2++;
@@ -71,13 +180,50 @@ int strncasecmp(const char *str1, const char *str2, size_t length)
     return toupper(*str1) - toupper(*str2);
 }
 
+// Return a pointer to the first word at or after str, which must be word
+// aligned, that contains a zero byte or a byte equal to c.
+static const char *find_word(const char *str, int c)
+{
+    const unsigned int pattern = REPLICATE_BYTE(c);
+    unsigned int word;
+    vecu16_t vec;
+    int mask;
+
+    while (!IS_ALIGNED(str, 64))
+    {
+        word = *((const unsigned int*) str);
+        if (HAS_ZERO_BYTE(word) | HAS_ZERO_BYTE(word ^ pattern))
+            return str;
+
+        str += 4;
+    }
+
+    while (1)
+    {
+        vec = *((const vecu16_t*) str);
+        mask = NONZERO_LANES(HAS_ZERO_BYTE(vec) | HAS_ZERO_BYTE(vec ^ pattern));
+        if (mask)
+            return str + FIRST_LANE_OFFSET(mask);
+
+        str += 64;
+    }
+}
+
 size_t strlen(const char *str)
 {
-    long len = 0;
-    while (*str++)
-        len++;
+    const char *s = str;
+
+    while (!IS_ALIGNED(s, 4) && *s)
+        s++;
+
+    if (*s)
+    {
+        s = find_word(s, 0);
+        while (*s)
+            s++;
+    }
 
-    return len;
+    return s - str;
 }
 
 char* strcpy(char *dest, const char *src)
@@ -107,21 +253,70 @@ char* strncpy(char *dest, const char *src, size_t length)
 
 char *strchr(const char *string, int c)
 {
-    for (const char *s = string; *s; s++)
-        if (*s == c)
-            return (char*) s;
+    const char ch = (char) c;
+    const char *s = string;
 
-    return 0;
+    while (!IS_ALIGNED(s, 4) && *s && *s != ch)
+        s++;
+
+    if (IS_ALIGNED(s, 4))
+        s = find_word(s, ch);
+
+    while (*s != ch)
+    {
+        if (*s == 0)
+            return 0;
+
+        s++;
+    }
+
+    return (char*) s;
 }
 
 void *memchr(const void *_s, int c, size_t n)
 {
+    const char ch = (char) c;
     const char *s = (const char*) _s;
+    const char *end = s + n;
+    const unsigned int pattern = REPLICATE_BYTE(c);
+    int mask;
+
+    // Skip words, then vectors, then words, that don't contain c. The
+    // byte loop at the end finds the exact position.
+    while (s < end && !IS_ALIGNED(s, 4) && *s != ch)
+        s++;
+
+    if (IS_ALIGNED(s, 4))
+    {
+        while (end - s >= 4 && !IS_ALIGNED(s, 64)
+                && !HAS_ZERO_BYTE(*((const unsigned int*) s) ^ pattern))
+        {
+            s += 4;
+        }
+
+        if (IS_ALIGNED(s, 64))
+        {
+            while (end - s >= 64)
+            {
+                mask = NONZERO_LANES(HAS_ZERO_BYTE(*((const vecu16_t*) s) ^ pattern));
+                if (mask)
+                {
+                    s += FIRST_LANE_OFFSET(mask);
+                    break;
+                }
+
+                s += 64;
+            }
+        }
+
+        while (end - s >= 4 && !HAS_ZERO_BYTE(*((const unsigned int*) s) ^ pattern))
+            s += 4;
+    }
 
-    for (unsigned int i = 0; i < n; i++)
+    for (; s < end; s++)
     {
-        if (s[i] == c)
-            return (void*) &s[i];
+        if (*s == ch)
+            return (void*) s;
     }
 
     return 0;
@@ -34,6 +34,12 @@
 #define MIN(x, y) ((x) < (y) ? (x) : (y))
 #define MAX(x, y) ((x) > (y) ? (x) : (y))
 
+// Callers hold the file lock
+static void put_char(FILE *f, char c)
+{
+    __write_unlocked(f, &c, 1);
+}
+
 static const char *kHexDigits = "0123456789abcdef";
 static const char *kFlagCharacters = "-+ 0";
 static const char *kPrefixCharacters = "FNhlLzt";
@@ -41,7 +47,7 @@ static const char *kPrefixCharacters = "FNhlLzt";
 /*
  *	 % flags width .precision prefix format
  */
-int vfprintf(FILE *f, const char *format, va_list args)
+static void vfprintf_unlocked(FILE *f, const char *format, va_list args)
 {
     int flags = 0;
     int prefixes = 0;
@@ -67,8 +73,14 @@ int vfprintf(FILE *f, const char *format, va_list args)
                     prefixes = 0;
                     width = 0;
                     precision = 0;
-                } else
-                    fputc(*format++, f);
+                } else {
+                    /* write literal text up to the next format in one call */
+                    const char *start = format;
+                    while (*format && *format != '%')
+                        format++;
+
+                    __write_unlocked(f, start, format - start);
+                }
 
                 break;
 
@@ -76,7 +88,7 @@ int vfprintf(FILE *f, const char *format, va_list args)
                 const char *c;
 
                 if (*format == '%') {
-                    fputc(*format++, f);
+                    put_char(f, *format++);
                     state = kScanText;
                     break;
                 }
@@ -163,7 +175,7 @@ int vfprintf(FILE *f, const char *format, va_list args)
                         if ((*format == 'd' || *format == 'i')) {
                             if ((long long int) value < 0) {
                                 value = (unsigned long long) (-(long long int) value);
-                                fputc('-', f);
+                                put_char(f, '-');
                             }
                         }
 
@@ -189,22 +201,21 @@ int vfprintf(FILE *f, const char *format, va_list args)
 
                         /* write width padding */
                         for (pad_count = (64 - index); pad_count < width; pad_count++)
-                            fputc(pad_char, f);
+                            put_char(f, pad_char);
 
                         /* write precision padding */
                         for (; pad_count < precision; pad_count++)
-                            fputc('0', f);
+                            put_char(f, '0');
 
                         /* write the string */
-                        while (index < 64)
-                            fputc(temp_string[index++], f);
+                        __write_unlocked(f, temp_string + index, 64 - index);
 
                         break;
                     }
 
 
                     case 'c':	/* Single character */
-                        fputc(va_arg(args, int), f);
+                        put_char(f, va_arg(args, int));
                         break;
 
                     case 's': {	/* string */
@@ -216,11 +227,13 @@ int vfprintf(FILE *f, const char *format, va_list args)
                         else
                             max_width = precision;
 
-                        for (index = 0; index < max_width && *c; index++)
-                            fputc(*c++, f);
+                        for (index = 0; index < max_width && c[index]; index++)
+                            ;
+
+                        __write_unlocked(f, c, index);
 
                         while (index < MIN(width, max_width)) {
-                            fputc(' ', f);
+                            put_char(f, ' ');
                             index++;
                         }
 
@@ -241,7 +254,7 @@ int vfprintf(FILE *f, const char *format, va_list args)
 
                         if (floatval < 0.0f)
                         {
-                            fputc('-', f);
+                            put_char(f, '-');
                             floatval = -floatval;
                         }
 
@@ -250,7 +263,7 @@ int vfprintf(FILE *f, const char *format, va_list args)
 
                         // Print the whole part (XXX ignores padding)
                         if (wholePart == 0)
-                            fputc('0', f);
+                            put_char(f, '0');
                         else
                         {
                             char wholeStr[20];
@@ -262,11 +275,11 @@ int vfprintf(FILE *f, const char *format, va_list args)
                                 wholePart /= 10;
                             }
 
-                            while (wholeOffs < sizeof(wholeStr))
-                                fputc(wholeStr[wholeOffs++], f);
+                            __write_unlocked(f, wholeStr + wholeOffs,
+                                             sizeof(wholeStr) - wholeOffs);
                         }
 
-                        fputc('.', f);
+                        put_char(f, '.');
 
                         // Print the fractional part, not especially accurately
                         int maxDigits = precision > 0 ? precision : 7;
@@ -275,7 +288,7 @@ int vfprintf(FILE *f, const char *format, va_list args)
                             frac = frac * 10;
                             int digit = (int) frac;
                             frac -= digit;
-                            fputc((digit + '0'), f);
+                            put_char(f, (digit + '0'));
                         }
                         while (frac > 0.0f && maxDigits-- > 0);
 
@@ -289,6 +302,13 @@ int vfprintf(FILE *f, const char *format, va_list args)
             }
         }
     }
+}
+
+int vfprintf(FILE *f, const char *format, va_list args)
+{
+    __lock_file(f);
+    vfprintf_unlocked(f, format, args);
+    __unlock_file(f);
 
     return 0;
 }
\ No newline at end of file
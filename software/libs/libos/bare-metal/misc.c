@@ -15,6 +15,7 @@
 //
 
 #include "nyuzi.h"
+#include <stdio.h>
 #include <time.h>
 #include "registers.h"
 #include "unistd.h"
@@ -44,6 +45,7 @@ void exit(int status)
 {
     (void) status;
 
+    fflush(NULL);
     __builtin_nyuzi_write_control_reg(CR_SUSPEND_THREAD, 0xffffffff);
     while (1)
         ;
@@ -14,60 +14,28 @@
 // limitations under the License.
 //
 
-#include <stdio.h>
-#include "registers.h"
+#include "nyuzi.h"
 #include "schedule.h"
 
+#define CR_SUSPEND_THREAD 20
 #define CR_RESUME_THREAD 21
 
-static parallel_func_t current_func;
-static volatile int current_index;
-static volatile int max_index;
-static volatile int active_jobs;
-static void * volatile context;
+// Hooks for task_scheduler.c. Worker indices are hardware thread IDs. Threads
+// halt, so they don't use any issue slots while they wait.
 
-static int dispatch_job(void)
+int __get_worker_index(void)
 {
-    int this_index;
-
-    do
-    {
-        this_index = current_index;
-        if (this_index == max_index)
-            return 0;	// No more jobs in this batch
-    }
-    while (!__sync_bool_compare_and_swap(&current_index, this_index, this_index + 1));
-
-    current_func(context, this_index);
-
-    return 1;
+    return get_current_thread_id();
 }
 
-void parallel_execute(parallel_func_t func, void *_context, int num_elements)
+void __suspend_worker(int index)
 {
-    current_func = func;
-    context = _context;
-    current_index = 0;
-    max_index = num_elements;
-
-    while (current_index != max_index)
-        dispatch_job();
-
-    while (active_jobs)
-        ; // Wait for threads to finish
+    __builtin_nyuzi_write_control_reg(CR_SUSPEND_THREAD, 1u << index);
 }
 
-void worker_thread(void)
+void __resume_workers(unsigned int mask)
 {
-    while (1)
-    {
-        while (current_index == max_index)
-            ;
-
-        __sync_fetch_and_add(&active_jobs, 1);
-        dispatch_job();
-        __sync_fetch_and_add(&active_jobs, -1);
-    }
+    __builtin_nyuzi_write_control_reg(CR_RESUME_THREAD, mask);
 }
 
 void start_all_threads(void)
@@ -14,6 +14,7 @@
 // limitations under the License.
 //
 
+#include <stdio.h>
 #include <time.h>
 #include "nyuzi.h"
 #include "unistd.h"
@@ -36,6 +37,7 @@ int usleep(useconds_t delay)
 
 void exit(int status)
 {
+    fflush(NULL);
     thread_exit();
 }
 
@@ -14,58 +14,76 @@
 // limitations under the License.
 //
 
+#include <assert.h>
 #include <stdio.h>
 #include "schedule.h"
 #include "nyuzi.h"
 
-static parallel_func_t current_func;
-static volatile int current_index;
-static volatile int max_index;
-static volatile int active_jobs;
-static void * volatile context;
+#define STACK_PAGE_SIZE 0x1000
+#define INDEX_CACHE_SIZE 64
 
-static int dispatch_job(void)
+// Thread ID plus one for each worker index. Zero means the index is unused.
+static volatile int worker_thread_ids[MAX_WORKER_THREADS];
+
+// Each entry is the address of a stack page, the worker index shifted left
+// by one, and a valid bit in bit 0. It is a single word so it can be
+// updated without a lock.
+static volatile unsigned int index_cache[INDEX_CACHE_SIZE];
+
+// Hooks for task_scheduler.c. Kernel thread IDs are not small numbers, so
+// assign each thread a worker index the first time it asks for one. User
+// mode programs can't halt threads, so idle workers poll for work.
+
+// Threads only claim slots for themselves, and slots are never released,
+// so if a thread's ID is in the table, it is before the first unused slot.
+static int lookup_worker_index(int thread_id)
 {
-    int this_index;
+    int index;
 
-    do
+    for (index = 0; index < MAX_WORKER_THREADS; index++)
     {
-        this_index = current_index;
-        if (this_index == max_index)
-            return 0;	// No more jobs in this batch
-    }
-    while (!__sync_bool_compare_and_swap(&current_index, this_index, this_index + 1));
+        if (worker_thread_ids[index] == thread_id + 1)
+            return index;
 
-    current_func(context, this_index);
+        if (worker_thread_ids[index] == 0
+                && __sync_bool_compare_and_swap(&worker_thread_ids[index], 0, thread_id + 1))
+            return index;
+    }
 
-    return 1;
+    // More than MAX_WORKER_THREADS threads have asked for an index.
+    assert(0);
+    return 0;
 }
 
-void parallel_execute(parallel_func_t func, void *_context, int num_elements)
+// get_current_thread_id is a system call, and this is called often (for
+// example, once per triangle by the renderer). There's no thread local
+// storage, so this remembers the index for each stack page it is called
+// from. A stack page only belongs to one thread, so a match is always that
+// thread's index.
+int __get_worker_index(void)
 {
-    current_func = func;
-    context = _context;
-    current_index = 0;
-    max_index = num_elements;
+    unsigned int page = (unsigned int) __builtin_frame_address(0) & ~(STACK_PAGE_SIZE - 1);
+    volatile unsigned int *entry = &index_cache[(page / STACK_PAGE_SIZE) % INDEX_CACHE_SIZE];
+    unsigned int value = *entry;
+    int index;
 
-    while (current_index != max_index)
-        dispatch_job();
+    if ((value & ~(STACK_PAGE_SIZE - 1)) == page && (value & 1))
+        return (value >> 1) & (STACK_PAGE_SIZE / 2 - 1);
 
-    while (active_jobs)
-        ; // Wait for threads to finish
+    index = lookup_worker_index(get_current_thread_id());
+    *entry = page | ((unsigned int) index << 1) | 1;
+
+    return index;
 }
 
-void worker_thread(void)
+void __suspend_worker(int index)
 {
-    while (1)
-    {
-        while (current_index == max_index)
-            ;
+    (void) index;
+}
 
-        __sync_fetch_and_add(&active_jobs, 1);
-        dispatch_job();
-        __sync_fetch_and_add(&active_jobs, -1);
-    }
+void __resume_workers(unsigned int mask)
+{
+    (void) mask;
 }
 
 extern int __other_thread_start();
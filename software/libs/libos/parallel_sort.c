@@ -0,0 +1,223 @@
+//
+// Copyright 2018 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+//
+// Parallel sample sort. This picks bucket boundaries (splitters) from a
+// random sample of the array, then:
+// 1. Splits the array into chunks, and for each chunk in parallel, finds
+//    the bucket of each element and counts the elements in each bucket.
+// 2. Computes where each chunk's elements for each bucket go in a temporary
+//    array, so the buckets are contiguous and in order.
+// 3. Copies elements to their positions in the temporary array, in parallel
+//    by chunk.
+// 4. Sorts each bucket with qsort and copies it back, in parallel by bucket.
+//
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "schedule.h"
+
+#define NUM_BUCKETS 64
+#define NUM_CHUNKS 64
+#define SAMPLES_PER_BUCKET 8
+#define NUM_SAMPLES (NUM_BUCKETS * SAMPLES_PER_BUCKET)
+
+// Below this, the overhead of sampling and copying is higher than the
+// benefit of sorting in parallel.
+#define MIN_PARALLEL_ELEMENTS 4096
+
+struct sort_state
+{
+    char *base;
+    char *temp;
+    size_t nel;
+    size_t width;
+    int (*cmp)(const void*, const void*);
+
+    // NUM_BUCKETS - 1 elements. Bucket i holds elements greater than
+    // splitter i - 1 and not greater than splitter i.
+    char *splitters;
+    uint8_t *bucket_ids;
+
+    // Element counts after classification, then the next destination index
+    // after computing offsets.
+    size_t chunk_offsets[NUM_CHUNKS][NUM_BUCKETS];
+    size_t bucket_start[NUM_BUCKETS + 1];
+};
+
+static size_t chunk_start(const struct sort_state *state, int chunk)
+{
+    return (size_t) (((uint64_t) state->nel * chunk) / NUM_CHUNKS);
+}
+
+static int find_bucket(const struct sort_state *state, const void *elem)
+{
+    int low = 0;
+    int high = NUM_BUCKETS - 1;
+
+    while (low < high)
+    {
+        int mid = (low + high) / 2;
+        if (state->cmp(state->splitters + mid * state->width, elem) < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return low;
+}
+
+static void classify_chunk(void *_state, int chunk)
+{
+    struct sort_state *state = (struct sort_state*) _state;
+    size_t *counts = state->chunk_offsets[chunk];
+    size_t end = chunk_start(state, chunk + 1);
+    size_t i;
+    int bucket;
+
+    for (bucket = 0; bucket < NUM_BUCKETS; bucket++)
+        counts[bucket] = 0;
+
+    for (i = chunk_start(state, chunk); i < end; i++)
+    {
+        bucket = find_bucket(state, state->base + i * state->width);
+        state->bucket_ids[i] = bucket;
+        counts[bucket]++;
+    }
+}
+
+static void scatter_chunk(void *_state, int chunk)
+{
+    struct sort_state *state = (struct sort_state*) _state;
+    size_t *offsets = state->chunk_offsets[chunk];
+    size_t end = chunk_start(state, chunk + 1);
+    size_t i;
+
+    for (i = chunk_start(state, chunk); i < end; i++)
+    {
+        memcpy(state->temp + offsets[state->bucket_ids[i]]++ * state->width,
+               state->base + i * state->width, state->width);
+    }
+}
+
+static void sort_bucket(void *_state, int bucket)
+{
+    struct sort_state *state = (struct sort_state*) _state;
+    size_t offset = state->bucket_start[bucket] * state->width;
+    size_t count = state->bucket_start[bucket + 1] - state->bucket_start[bucket];
+
+    qsort(state->temp + offset, count, state->width, state->cmp);
+    memcpy(state->base + offset, state->temp + offset, count * state->width);
+}
+
+// Sort a random sample of the array and take evenly spaced elements from it
+// as splitters.
+static void choose_splitters(struct sort_state *state, char *samples)
+{
+    unsigned int seed = 0x12345678;
+    int i;
+
+    for (i = 0; i < NUM_SAMPLES; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        memcpy(samples + i * state->width, state->base + (seed % state->nel)
+               * state->width, state->width);
+    }
+
+    qsort(samples, NUM_SAMPLES, state->width, state->cmp);
+    for (i = 0; i < NUM_BUCKETS - 1; i++)
+    {
+        memcpy(state->splitters + i * state->width, samples + (i + 1)
+               * SAMPLES_PER_BUCKET * state->width, state->width);
+    }
+}
+
+void parallel_qsort(void *base, size_t nel, size_t width,
+                    int (*cmp)(const void*, const void*))
+{
+    struct sort_state *state;
+    char *samples;
+    size_t offset;
+    int bucket;
+    int chunk;
+
+    if (nel < MIN_PARALLEL_ELEMENTS || width == 0)
+    {
+        qsort(base, nel, width, cmp);
+        return;
+    }
+
+    state = (struct sort_state*) malloc(sizeof(struct sort_state));
+    samples = (char*) malloc(NUM_SAMPLES * width);
+    if (state)
+    {
+        state->temp = (char*) malloc(nel * width);
+        state->splitters = (char*) malloc((NUM_BUCKETS - 1) * width);
+        state->bucket_ids = (uint8_t*) malloc(nel);
+    }
+
+    if (state == NULL || samples == NULL || state->temp == NULL
+            || state->splitters == NULL || state->bucket_ids == NULL)
+    {
+        // Not enough memory. Sort in place on this thread instead.
+        if (state)
+        {
+            free(state->temp);
+            free(state->splitters);
+            free(state->bucket_ids);
+            free(state);
+        }
+
+        free(samples);
+        qsort(base, nel, width, cmp);
+        return;
+    }
+
+    state->base = (char*) base;
+    state->nel = nel;
+    state->width = width;
+    state->cmp = cmp;
+
+    choose_splitters(state, samples);
+    free(samples);
+
+    parallel_execute(classify_chunk, state, NUM_CHUNKS);
+
+    // Convert counts to destination indices. Elements from lower chunks go
+    // first within each bucket.
+    offset = 0;
+    for (bucket = 0; bucket < NUM_BUCKETS; bucket++)
+    {
+        state->bucket_start[bucket] = offset;
+        for (chunk = 0; chunk < NUM_CHUNKS; chunk++)
+        {
+            size_t count = state->chunk_offsets[chunk][bucket];
+            state->chunk_offsets[chunk][bucket] = offset;
+            offset += count;
+        }
+    }
+
+    state->bucket_start[NUM_BUCKETS] = nel;
+
+    parallel_execute(scatter_chunk, state, NUM_CHUNKS);
+    parallel_execute(sort_bucket, state, NUM_BUCKETS);
+
+    free(state->temp);
+    free(state->splitters);
+    free(state->bucket_ids);
+    free(state);
+}
@@ -17,16 +17,84 @@
 
 #pragma once
 
+#include <stddef.h>
+
 typedef void (*parallel_func_t)(void *context, int index);
 
+#define MAX_TASK_SUCCESSORS 4
+#define MAX_WORKER_THREADS 32
+
+// A set of tasks that can be waited for together.
+struct task_group
+{
+    volatile int pending_tasks;
+};
+
+// A task calls func(context, index) for each index from 0 to
+// num_elements - 1. The calls may run on any thread, in parallel, and in
+// any order. A task can depend on other tasks, in which case it starts
+// after they complete. The fields are used by the scheduler and should
+// only be set with the functions below. The caller owns the memory, which
+// must remain valid until the task's group completes.
+struct task
+{
+    parallel_func_t func;
+    void *context;
+    int num_elements;
+    int grain_size;
+    struct task_group *group;
+    volatile int elements_remaining;
+    volatile int unfinished_dependencies;
+    int num_successors;
+    struct task *successors[MAX_TASK_SUCCESSORS];
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-// parallel_spawn should only be called from the main thread. It waits for
-// all jobs to complete before returning.
+// Return a number from 0 to MAX_WORKER_THREADS - 1 that identifies the
+// calling thread. Tasks can use this to index per-thread data.
+int get_worker_index(void);
+
+void task_group_init(struct task_group *group);
+void task_init(struct task *task, struct task_group *group, parallel_func_t func,
+               void *context, int num_elements);
+
+// Make task start after dependency completes. This must be called before
+// either is submitted. A task can have up to MAX_TASK_SUCCESSORS others
+// depending on it. Adding more fails an assertion.
+void task_add_dependency(struct task *task, struct task *dependency);
+
+// Queue the task to run once its dependencies complete. This returns
+// without waiting for it. Any thread, including one running a task, can
+// call this.
+void task_submit(struct task *task);
+
+// Wait for all submitted tasks in the group to complete. The calling thread
+// runs queued tasks (which may be from other groups) while it waits.
+void task_group_wait(struct task_group *group);
+
+// Call func for each element on all threads, and wait for all calls to
+// complete. This can be called from any thread.
 void parallel_execute(parallel_func_t func, void *context, int num_elements);
 
+// Start running func for each element on the worker threads and return
+// without waiting for them. Only one asynchronous batch runs at a time: this
+// waits for the previous one first. This should only be called from the
+// main thread.
+void parallel_execute_async(parallel_func_t func, void *context, int num_elements);
+
+// Wait for the batch started by parallel_execute_async to complete. The
+// calling thread also runs tasks while it waits.
+void parallel_wait(void);
+
+// Sort like qsort, but split the work between all threads. This uses
+// qsort directly for small arrays, or if it can't allocate a temporary copy
+// of the array. Like parallel_execute, this can be called from any thread.
+void parallel_qsort(void *base, size_t nel, size_t width,
+                    int (*cmp)(const void*, const void*));
+
 // main should call this function for all threads other than 0.
 void worker_thread(void) __attribute__ ((noreturn));
 
@@ -0,0 +1,387 @@
+//
+// Copyright 2018 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+//
+// Work stealing task scheduler, shared by the bare-metal and kernel versions
+// of the library.
+//
+// Each thread has a queue of work items. A work item is a range of element
+// indices of one task. A thread runs the newest item in its own queue. Before
+// it runs an item, it splits it in half, pushes the upper half back on its
+// queue, and repeats until the range is small. When a thread's queue is
+// empty, it steals the oldest item from another thread's queue, which is
+// the largest remaining range. This keeps threads working on nearby
+// elements, and only needs synchronization when they run out of work.
+//
+// The queues have a spinlock. Threads only take another thread's lock when
+// stealing, so there is little contention. Threads that can't find work
+// sleep until something is queued, so they don't take issue slots from
+// threads on the same core that are running tasks.
+//
+
+#include <assert.h>
+#include "schedule.h"
+
+#define WORK_QUEUE_SIZE 64
+#define SPLITS_PER_WORKER 4
+
+// Each version of the library implements these. __get_worker_index returns
+// a number from 0 to MAX_WORKER_THREADS - 1 that is unique to the calling
+// thread. __suspend_worker stops the thread until another calls __resume_workers
+// with its bit set in the mask. It may also return early. Resuming a thread
+// that isn't suspended has no effect.
+int __get_worker_index(void);
+void __suspend_worker(int index);
+void __resume_workers(unsigned int mask);
+
+struct work_item
+{
+    struct task *task;
+    int begin;
+    int end;
+};
+
+// Indices wrap. The owning thread adds and removes items at the tail, and
+// other threads steal from the head.
+struct work_queue
+{
+    volatile int lock;
+    volatile int head;
+    volatile int tail;
+    struct work_item items[WORK_QUEUE_SIZE];
+} __attribute__((aligned(64)));
+
+static struct work_queue queues[MAX_WORKER_THREADS];
+static volatile int num_queues;
+static volatile int num_workers = 1;
+static volatile int queued_items;
+static volatile unsigned int sleeping_workers;
+static volatile int wake_counts[MAX_WORKER_THREADS];
+static struct task_group async_group;
+static struct task async_task;
+
+static void lock_queue(struct work_queue *queue)
+{
+    while (__sync_lock_test_and_set(&queue->lock, 1))
+    {
+        while (queue->lock)
+            ;
+    }
+}
+
+static void unlock_queue(struct work_queue *queue)
+{
+    __sync_lock_release(&queue->lock);
+}
+
+int get_worker_index(void)
+{
+    int index = __get_worker_index();
+    int count;
+
+    // Track the highest index so stealing doesn't need to check every queue.
+    do
+    {
+        count = num_queues;
+        if (index < count)
+            break;
+    }
+    while (!__sync_bool_compare_and_swap(&num_queues, count, index + 1));
+
+    return index;
+}
+
+// A worker may have checked for work, but not suspended yet, when it is
+// resumed. That resume has no effect. To make sure the item isn't left
+// while every worker sleeps, keep resuming one of them until it leaves the
+// sleep code in worker_thread, which it signals by clearing its bit and
+// incrementing its wake count. If it didn't see the item before suspending,
+// it rechecks afterward, and it keeps running items until the queues are
+// empty, waking the others when it splits them.
+static void wake_workers(void)
+{
+    unsigned int mask = sleeping_workers;
+    unsigned int bit;
+    int worker;
+    int count;
+
+    if (mask == 0)
+        return;
+
+    worker = __builtin_ctz(mask);
+    bit = 1u << worker;
+    count = wake_counts[worker];
+    __resume_workers(mask);
+    while ((sleeping_workers & bit) && wake_counts[worker] == count)
+        __resume_workers(bit);
+}
+
+// Returns 0 if the queue is full.
+static int push_work(int worker, struct task *task, int begin, int end)
+{
+    struct work_queue *queue = &queues[worker];
+    struct work_item *item;
+
+    lock_queue(queue);
+    if (queue->tail - queue->head == WORK_QUEUE_SIZE)
+    {
+        unlock_queue(queue);
+        return 0;
+    }
+
+    item = &queue->items[queue->tail % WORK_QUEUE_SIZE];
+    item->task = task;
+    item->begin = begin;
+    item->end = end;
+    queue->tail++;
+    unlock_queue(queue);
+
+    __sync_fetch_and_add(&queued_items, 1);
+    wake_workers();
+
+    return 1;
+}
+
+static int pop_work(int worker, struct work_item *out_item)
+{
+    struct work_queue *queue = &queues[worker];
+    int found = 0;
+
+    if (queue->tail == queue->head)
+        return 0;
+
+    lock_queue(queue);
+    if (queue->tail != queue->head)
+    {
+        queue->tail--;
+        *out_item = queue->items[queue->tail % WORK_QUEUE_SIZE];
+        found = 1;
+    }
+
+    unlock_queue(queue);
+    if (found)
+        __sync_fetch_and_add(&queued_items, -1);
+
+    return found;
+}
+
+static int steal_work(int worker, struct work_item *out_item)
+{
+    int count = num_queues;
+    int i;
+    int victim;
+    struct work_queue *queue;
+    int found;
+
+    for (i = 1; i < count; i++)
+    {
+        victim = (worker + i) % count;
+        queue = &queues[victim];
+        if (queue->tail == queue->head)
+            continue;
+
+        found = 0;
+        lock_queue(queue);
+        if (queue->tail != queue->head)
+        {
+            *out_item = queue->items[queue->head % WORK_QUEUE_SIZE];
+            queue->head++;
+            found = 1;
+        }
+
+        unlock_queue(queue);
+        if (found)
+        {
+            __sync_fetch_and_add(&queued_items, -1);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int find_work(int worker, struct work_item *out_item)
+{
+    return pop_work(worker, out_item) || steal_work(worker, out_item);
+}
+
+static void run_work(int worker, struct work_item *item);
+static void complete_task(int worker, struct task *task);
+
+// Called when all dependencies of a task are complete and it has been
+// submitted. This queues the task rather than running it, so functions that
+// submit tasks return right away.
+static void start_task(int worker, struct task *task)
+{
+    struct work_item item;
+
+    if (task->num_elements == 0)
+        complete_task(worker, task);
+    else if (!push_work(worker, task, 0, task->num_elements))
+    {
+        item.task = task;
+        item.begin = 0;
+        item.end = task->num_elements;
+        run_work(worker, &item);
+    }
+}
+
+static void release_task(int worker, struct task *task)
+{
+    if (__sync_sub_and_fetch(&task->unfinished_dependencies, 1) == 0)
+        start_task(worker, task);
+}
+
+static void complete_task(int worker, struct task *task)
+{
+    struct task_group *group = task->group;
+    int i;
+
+    for (i = 0; i < task->num_successors; i++)
+        release_task(worker, task->successors[i]);
+
+    // The task may be freed once the group is complete, so this must be
+    // the last thing that accesses it.
+    __sync_fetch_and_add(&group->pending_tasks, -1);
+}
+
+static void run_work(int worker, struct work_item *item)
+{
+    struct task *task = item->task;
+    int begin = item->begin;
+    int end = item->end;
+    int mid;
+    int index;
+
+    // Give away the upper half of the range until what is left is small.
+    // If the queue is full, run the rest here.
+    while (end - begin > task->grain_size)
+    {
+        mid = begin + (end - begin) / 2;
+        if (!push_work(worker, task, mid, end))
+            break;
+
+        end = mid;
+    }
+
+    for (index = begin; index < end; index++)
+        task->func(task->context, index);
+
+    if (__sync_sub_and_fetch(&task->elements_remaining, end - begin) == 0)
+        complete_task(worker, task);
+}
+
+void task_group_init(struct task_group *group)
+{
+    group->pending_tasks = 0;
+}
+
+void task_init(struct task *task, struct task_group *group, parallel_func_t func,
+               void *context, int num_elements)
+{
+    task->func = func;
+    task->context = context;
+    task->num_elements = num_elements;
+    task->grain_size = 1;
+    task->group = group;
+    task->elements_remaining = num_elements;
+
+    // This includes one for submitting the task.
+    task->unfinished_dependencies = 1;
+    task->num_successors = 0;
+}
+
+void task_add_dependency(struct task *task, struct task *dependency)
+{
+    // Dropping the edge would let the task run too early.
+    assert(dependency->num_successors < MAX_TASK_SUCCESSORS);
+    __sync_fetch_and_add(&task->unfinished_dependencies, 1);
+    dependency->successors[dependency->num_successors++] = task;
+}
+
+void task_submit(struct task *task)
+{
+    // Split into enough pieces to balance the load, but not so many that
+    // scheduling dominates.
+    task->grain_size = task->num_elements / (num_workers * SPLITS_PER_WORKER);
+    if (task->grain_size < 1)
+        task->grain_size = 1;
+
+    __sync_fetch_and_add(&task->group->pending_tasks, 1);
+    release_task(get_worker_index(), task);
+}
+
+void task_group_wait(struct task_group *group)
+{
+    int worker = get_worker_index();
+    struct work_item item;
+
+    while (group->pending_tasks)
+    {
+        if (find_work(worker, &item))
+            run_work(worker, &item);
+    }
+}
+
+void parallel_execute(parallel_func_t func, void *context, int num_elements)
+{
+    struct task_group group;
+    struct task task;
+
+    task_group_init(&group);
+    task_init(&task, &group, func, context, num_elements);
+    task_submit(&task);
+    task_group_wait(&group);
+}
+
+void parallel_execute_async(parallel_func_t func, void *context, int num_elements)
+{
+    parallel_wait();
+    task_init(&async_task, &async_group, func, context, num_elements);
+    task_submit(&async_task);
+}
+
+void parallel_wait(void)
+{
+    task_group_wait(&async_group);
+}
+
+void worker_thread(void)
+{
+    int worker = get_worker_index();
+    unsigned int worker_bit = 1u << worker;
+    struct work_item item;
+
+    __sync_fetch_and_add(&num_workers, 1);
+    while (1)
+    {
+        if (find_work(worker, &item))
+        {
+            run_work(worker, &item);
+            continue;
+        }
+
+        // Set the sleeping bit before checking for work. If another thread
+        // queues an item after the check, it will see the bit and wake this
+        // thread or another sleeping one (see wake_workers).
+        __sync_fetch_and_or(&sleeping_workers, worker_bit);
+        if (queued_items == 0)
+            __suspend_worker(worker);
+
+        __sync_fetch_and_and(&sleeping_workers, ~worker_bit);
+        __sync_fetch_and_add(&wake_counts[worker], 1);
+    }
+}
@@ -112,6 +112,8 @@ public:
     class iterator
     {
     public:
+        iterator() = default;
+
         bool operator!=(const iterator &iter) const
         {
             return fBucket != iter.fBucket || fIndex != iter.fIndex;
@@ -174,8 +176,8 @@ public:
                 fIndex(index)
         {}
 
-        Bucket *fBucket;
-        int fIndex;	// Index in current bucket
+        Bucket *fBucket = nullptr;
+        int fIndex = 0;	// Index in current bucket
     };
 
     iterator begin() const
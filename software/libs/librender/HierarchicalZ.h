@@ -0,0 +1,125 @@
+//
+// Copyright 2018 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#pragma once
+
+#include "SIMDMath.h"
+#include "Surface.h"
+
+namespace librender
+{
+
+static_assert(kTileSize == 64, "HierarchicalZ assumes 16x16 pixel regions");
+
+//
+// Coarse copy of the depth buffer for one tile, used to reject triangles
+// and parts of triangles that are hidden before setting up, rasterizing,
+// and shading them. The tile is divided into 16 regions of 16x16 pixels,
+// numbered like the lanes of a 4x4 pixel block, so the rasterizer can test
+// all of them at once. This tracks the lowest and highest depth value in
+// each region, and the lowest in each 4x4 block.
+//
+// A pixel passes the depth test if its value is greater than the one in the
+// depth buffer, so depth buffer values never decrease. Because of this,
+// the bounds are exact, and updating them only requires the new values
+// for the block that was written.
+//
+class HierarchicalZ
+{
+public:
+    // The depth buffer for the tile was cleared to clearValue. Blocks that
+    // are outside the render target (at or past clipRight/clipBottom) are
+    // never drawn, so they are set to hide everything.
+    void reset(int tileLeft, int tileTop, int clipRight, int clipBottom, float clearValue)
+    {
+        fTileLeft = tileLeft;
+        fTileTop = tileTop;
+        fRegionMax = vecf16_t(clearValue);
+        if (clipRight - tileLeft >= kTileSize && clipBottom - tileTop >= kTileSize)
+        {
+            for (int region = 0; region < 16; region++)
+                fBlockMin[region] = vecf16_t(clearValue);
+
+            fRegionMin = vecf16_t(clearValue);
+            return;
+        }
+
+        for (int region = 0; region < 16; region++)
+        {
+            const int regionLeft = tileLeft + (region & 3) * 16;
+            const int regionTop = tileTop + (region >> 2) * 16;
+            for (int block = 0; block < 16; block++)
+            {
+                if (regionLeft + (block & 3) * 4 < clipRight
+                        && regionTop + (block >> 2) * 4 < clipBottom)
+                    fBlockMin[region][block] = clearValue;
+                else
+                    fBlockMin[region][block] = __builtin_inff();
+            }
+
+            fRegionMin[region] = horizontalMin(fBlockMin[region]);
+        }
+    }
+
+    // Return a mask of regions where every depth value is greater than or
+    // equal to maxZ. A triangle with no vertex depth greater than maxZ
+    // fails the depth test in all of them.
+    vmask_t getHiddenRegions(float maxZ) const
+    {
+        return __builtin_nyuzi_mask_cmpf_ge(fRegionMin, vecf16_t(maxZ));
+    }
+
+    // Return true if every depth value in the region containing the 4x4
+    // block at left, top (raster coordinates) is less than minZ, which
+    // means all pixels with at least that depth pass the depth test.
+    bool isRegionBelow(int left, int top, float minZ) const
+    {
+        return fRegionMax[getRegionIndex(left, top)] < minZ;
+    }
+
+    // Call after writing to the depth buffer. depthValues contains all
+    // values now in the 4x4 block at left, top.
+    void update(int left, int top, vecf16_t depthValues)
+    {
+        const int region = getRegionIndex(left, top);
+        const int block = (((top - fTileTop) >> 2) & 3) * 4 + (((left - fTileLeft) >> 2) & 3);
+        const float oldBlockMin = fBlockMin[region][block];
+
+        fBlockMin[region][block] = horizontalMin(depthValues);
+
+        // Values only increase, so the region minimum can only change if
+        // this block held it.
+        if (oldBlockMin == fRegionMin[region])
+            fRegionMin[region] = horizontalMin(fBlockMin[region]);
+
+        fRegionMax[region] = max(fRegionMax[region], horizontalMax(depthValues));
+    }
+
+private:
+    int getRegionIndex(int left, int top) const
+    {
+        return ((top - fTileTop) >> 4) * 4 + ((left - fTileLeft) >> 4);
+    }
+
+    vecf16_t fBlockMin[16];     // Indexed by region, then block within it
+    vecf16_t fRegionMin;
+    vecf16_t fRegionMax;
+    int fTileLeft = 0;
+    int fTileTop = 0;
+};
+
+} // namespace librender
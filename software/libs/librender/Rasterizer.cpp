@@ -98,7 +98,10 @@ void setupRecurseEdge(int tileLeft, int tileTop, int x1, int y1,
 }
 
 // Workhorse of recursive rasterization.  Subdivides tile into 4x4 grids.
-void subdivideTile(
+// Sub-blocks with bits set in skipMask are not drawn. Returns the number of
+// those that the triangle overlapped.
+template <int kVariant>
+int subdivideTile(
     TriangleFiller &filler,
     const int acceptCornerValue1,
     const int acceptCornerValue2,
@@ -116,7 +119,8 @@ void subdivideTile(
     const int tileLeft,
     const int tileTop,
     const int clipRight,
-    const int clipBottom)
+    const int clipBottom,
+    const vmask_t skipMask)
 {
     // Compute accept masks
     const veci16_t acceptEdgeValue1 = acceptStep1 + acceptCornerValue1;
@@ -131,12 +135,13 @@ void subdivideTile(
     {
         // End recursion
         if (trivialAcceptMask)
-            filler.fillMasked(tileLeft, tileTop, trivialAcceptMask);
+            filler.fillMasked<kVariant>(tileLeft, tileTop, trivialAcceptMask);
 
-        return;
+        return 0;
     }
 
     const int subTileSizeBits = tileSizeBits - 2;
+    int skippedCount = 0;
 
     // Process all trivially accepted blocks
     if (trivialAcceptMask != 0)
@@ -149,13 +154,21 @@ void subdivideTile(
             currentMask &= ~(1 << index);
             const int subTileLeft = tileLeft + ((index & 3) << subTileSizeBits);
             const int subTileTop = tileTop + ((index >> 2) << subTileSizeBits);
+            if (skipMask & (1 << index))
+            {
+                if (subTileLeft < clipRight && subTileTop < clipBottom)
+                    skippedCount++;
+
+                continue;
+            }
+
             const int tileCount = 1 << subTileSizeBits;
             const int hcount = min(tileCount, clipRight - subTileLeft);
             const int vcount = min(tileCount, clipBottom - subTileTop);
             for (int y = 0; y < vcount; y += 4)
             {
                 for (int x = 0; x < hcount; x += 4)
-                    filler.fillMasked(subTileLeft + x, subTileTop + y, 0xffff);
+                    filler.fillMasked<kVariant>(subTileLeft + x, subTileTop + y, 0xffff);
             }
         }
     }
@@ -191,7 +204,13 @@ void subdivideTile(
             if (x >= clipRight || y >= clipBottom)
                 continue;	// Clip tiles that are outside viewport
 
-            subdivideTile(
+            if (skipMask & (1 << index))
+            {
+                skippedCount++;
+                continue;
+            }
+
+            subdivideTile<kVariant>(
                 filler,
                 acceptEdgeValue1[index],
                 acceptEdgeValue2[index],
@@ -209,14 +228,19 @@ void subdivideTile(
                 x,
                 y,
                 clipRight,
-                clipBottom);
+                clipBottom,
+                0);
         }
     }
+
+    return skippedCount;
 }
 
-void rasterizeRecursive(TriangleFiller &filler,
-                        int tileLeft, int tileTop, int clipRight, int clipBottom,
-                        int x1, int y1, int x2, int y2, int x3, int y3)
+template <int kVariant>
+int rasterizeRecursive(TriangleFiller &filler,
+                       int tileLeft, int tileTop, int clipRight, int clipBottom,
+                       int x1, int y1, int x2, int y2, int x3, int y3,
+                       vmask_t hiddenRegions)
 {
     int acceptValue1;
     int rejectValue1;
@@ -240,7 +264,7 @@ void rasterizeRecursive(TriangleFiller &filler,
     setupRecurseEdge(tileLeft, tileTop, x2, y2, x1, y1, acceptValue3, rejectValue3,
                      acceptStepMatrix3, rejectStepMatrix3);
 
-    subdivideTile(
+    return subdivideTile<kVariant>(
         filler,
         acceptValue1,
         acceptValue2,
@@ -258,7 +282,8 @@ void rasterizeRecursive(TriangleFiller &filler,
         tileLeft,
         tileTop,
         clipRight,
-        clipBottom);
+        clipBottom,
+        hiddenRegions);
 }
 
 inline int min3(int a, int b, int c)
@@ -293,6 +318,7 @@ inline void setupSweepEdge(int left, int top, int x1, int y1, int x2, int y2,
 // pattern.
 // Currently disabled.
 //
+template <int kVariant>
 void rasterizeSweep(TriangleFiller &filler,
                     int bbLeft, int bbTop, int bbRight, int bbBottom,
                     int x1, int y1, int x2, int y2, int x3, int y3)
@@ -323,7 +349,7 @@ void rasterizeSweep(TriangleFiller &filler,
                        & __builtin_nyuzi_mask_cmpi_sge(edgeValue2, veci16_t(0))
                        & __builtin_nyuzi_mask_cmpi_sge(edgeValue3, veci16_t(0));
             if (mask)
-                filler.fillMasked(col, row, mask);
+                filler.fillMasked<kVariant>(col, row, mask);
 
             if (colCount == numCols)
                 break;
@@ -348,25 +374,67 @@ void rasterizeSweep(TriangleFiller &filler,
     while (row < bbBottom);
 }
 
-} // namespace
-
-void fillTriangle(TriangleFiller &filler,
-                  int tileLeft, int tileTop,
-                  int x1, int y1, int x2, int y2, int x3, int y3,
-                  int clipRight, int clipBottom)
+template <int kVariant>
+int fillTriangleVariant(TriangleFiller &filler,
+                        int tileLeft, int tileTop,
+                        int x1, int y1, int x2, int y2, int x3, int y3,
+                        int clipRight, int clipBottom, vmask_t hiddenRegions)
 {
     int bbLeft = max(min3(x1, x2, x3) & ~3, tileLeft);
     int bbTop = max(min3(y1, y2, y3) & ~3, tileTop);
     int bbRight = min3((max3(x1, x2, x3) + 3) & ~3, clipRight, tileLeft + kTileSize);
     int bbBottom = min3((max3(y1, y2, y3) + 3) & ~3, clipBottom, tileTop + kTileSize);
 
+    // The sweep rasterizer doesn't skip hidden regions, but only handles
+    // triangles that are small enough that it rarely matters.
     if (bbRight - bbLeft < kMaxSweep && bbBottom - bbTop < kMaxSweep)
-        rasterizeSweep(filler, bbLeft, bbTop, bbRight, bbBottom, x1, y1, x2, y2, x3, y3);
-    else
     {
-        rasterizeRecursive(filler, tileLeft, tileTop, clipRight, clipBottom,
-                           x1, y1, x2, y2, x3, y3);
+        rasterizeSweep<kVariant>(filler, bbLeft, bbTop, bbRight, bbBottom, x1, y1, x2, y2, x3, y3);
+        return 0;
     }
+
+    return rasterizeRecursive<kVariant>(filler, tileLeft, tileTop, clipRight, clipBottom,
+                                        x1, y1, x2, y2, x3, y3, hiddenRegions);
+}
+
+typedef int (*FillTriangleFunc)(TriangleFiller &filler,
+                                int tileLeft, int tileTop,
+                                int x1, int y1, int x2, int y2, int x3, int y3,
+                                int clipRight, int clipBottom, vmask_t hiddenRegions);
+
+// Indexed by TriangleFiller::getVariant
+const FillTriangleFunc kFillTriangleVariants[TriangleFiller::kNumVariants] =
+{
+    fillTriangleVariant<0>,
+    fillTriangleVariant<1>,
+    fillTriangleVariant<2>,
+    fillTriangleVariant<3>,
+    fillTriangleVariant<4>,
+    fillTriangleVariant<5>,
+    fillTriangleVariant<6>,
+    fillTriangleVariant<7>,
+    fillTriangleVariant<8>,
+    fillTriangleVariant<9>,
+    fillTriangleVariant<10>,
+    fillTriangleVariant<11>,
+    fillTriangleVariant<12>,
+    fillTriangleVariant<13>,
+    fillTriangleVariant<14>,
+    fillTriangleVariant<15>
+};
+
+} // namespace
+
+int fillTriangle(TriangleFiller &filler,
+                 int tileLeft, int tileTop,
+                 int x1, int y1, int x2, int y2, int x3, int y3,
+                 int clipRight, int clipBottom, vmask_t hiddenRegions)
+{
+    // Select the rasterizer instance for this triangle's state once, rather
+    // than checking it for every block.
+    return kFillTriangleVariants[filler.getVariant()](filler, tileLeft, tileTop,
+                                                      x1, y1, x2, y2, x3, y3,
+                                                      clipRight, clipBottom, hiddenRegions);
 }
 
 } // namespace librender
\ No newline at end of file
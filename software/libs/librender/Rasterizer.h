@@ -26,10 +26,14 @@ namespace librender
 // Determine all pixels covered by a triangle and call
 // TriangleFiller::fillMasked.
 // Triangles are wound counter-clockwise
-void fillTriangle(TriangleFiller &filler,
-                  int left, int top,
-                  int x1, int y1, int x2, int y2, int x3, int y3,
-                  int clipRight, int clipBottom);
+// hiddenRegions has a bit for each 16x16 region of the tile, numbered
+// like the lanes of a 4x4 block, that should not be drawn because the
+// triangle is hidden there. Returns how many of those regions the triangle
+// covered.
+int fillTriangle(TriangleFiller &filler,
+                 int left, int top,
+                 int x1, int y1, int x2, int y2, int x3, int y3,
+                 int clipRight, int clipBottom, vmask_t hiddenRegions);
 
 } // namespace librender
 
@@ -15,7 +15,9 @@
 //
 
 #include <schedule.h>
+#include <stdlib.h>
 #include <string.h>
+#include "HierarchicalZ.h"
 #include "line.h"
 #include "Rasterizer.h"
 #include "RenderContext.h"
@@ -25,11 +27,67 @@
 namespace librender
 {
 
+namespace
+{
+
+const float kNearWClip = 1.0;
+
+// Return true if the draw call's bounding box is completely on the outside of
+// one of the planes that triangles are clipped or culled against. Each lane
+// transforms one corner of the box. There are eight, so lanes 8-15 repeat
+// them.
+bool isOutsideView(const RenderState &state)
+{
+    const vecf16_t kCornerX = { 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1 };
+    const vecf16_t kCornerY = { 0, 0, 1, 1, 0, 0, 1, 1, 0, 0, 1, 1, 0, 0, 1, 1 };
+    const vecf16_t kCornerZ = { 0, 0, 0, 0, 1, 1, 1, 1, 0, 0, 0, 0, 1, 1, 1, 1 };
+    const Vec3 size = state.fBoundsMax - state.fBoundsMin;
+    vecf16_t corners[4];
+    corners[0] = kCornerX * size[0] + state.fBoundsMin[0];
+    corners[1] = kCornerY * size[1] + state.fBoundsMin[1];
+    corners[2] = kCornerZ * size[2] + state.fBoundsMin[2];
+    corners[3] = 1.0f;
+
+    vecf16_t clipCorners[4];
+    state.fBoundsTransform.mulVec(clipCorners, corners);
+    const vecf16_t &x = clipCorners[0];
+    const vecf16_t &y = clipCorners[1];
+    const vecf16_t &w = clipCorners[3];
+    const vmask_t kAllCorners = 0xffff;
+    return __builtin_nyuzi_mask_cmpf_gt(x, w) == kAllCorners
+           || __builtin_nyuzi_mask_cmpf_lt(x, -w) == kAllCorners
+           || __builtin_nyuzi_mask_cmpf_gt(y, w) == kAllCorners
+           || __builtin_nyuzi_mask_cmpf_lt(y, -w) == kAllCorners
+           || __builtin_nyuzi_mask_cmpf_lt(w, vecf16_t(kNearWClip)) == kAllCorners;
+}
+
+} // namespace
+
 RenderContext::RenderContext(size_t workingMemSize)
     : 	fClearColorBuffer(false),
-       fAllocator(workingMemSize)
+       fWorkingMemSize(workingMemSize)
+{
+    for (Frame &frame : fFrames)
+        frame.context = this;
+
+    // The second frame is only used for pipelining, so its memory is
+    // allocated when that is enabled.
+    fFrames[0].allocator = new RegionAllocator(workingMemSize);
+    fFrames[0].drawQueue.setAllocator(fFrames[0].allocator);
+    fAllocator = fFrames[0].allocator;
+}
+
+RenderContext::~RenderContext()
 {
-    fDrawQueue.setAllocator(&fAllocator);
+    waitForFrame();
+    for (Frame &frame : fFrames)
+    {
+        frame.drawQueue.reset();
+        delete frame.allocator;
+    }
+
+    for (veci16_t *visibilityBuffer : fVisibilityBuffers)
+        ::free(visibilityBuffer);
 }
 
 void RenderContext::setClearColor(float r, float g, float b)
@@ -49,7 +107,7 @@ void RenderContext::bindVertexAttrs(const RenderBuffer *vertexAttrs)
 
 void RenderContext::bindUniforms(const void *uniforms, size_t size)
 {
-    void *uniformCopy = fAllocator.alloc(size);
+    void *uniformCopy = fAllocator->alloc(size);
     ::memcpy(uniformCopy, uniforms, size);
     fCurrentState.fUniforms = uniformCopy;
 }
@@ -72,84 +130,220 @@ void RenderContext::bindShader(Shader *shader)
 void RenderContext::drawElements(const RenderBuffer *indices)
 {
     fCurrentState.fIndexBuffer = indices;
-    fDrawQueue.append(fCurrentState);
+    fFrames[fSubmitFrame].drawQueue.append(fCurrentState);
 }
 
-void RenderContext::_shadeVertices(void *_castToContext, int index)
+void RenderContext::_shadeVertices(void *_castToCommand, int index)
 {
-    static_cast<RenderContext*>(_castToContext)->shadeVertices(index);
+    const DrawCommand *command = static_cast<const DrawCommand*>(_castToCommand);
+    command->frame->context->shadeVertices(*command, index);
 }
 
-void RenderContext::_setUpTriangle(void *_castToContext, int index)
+void RenderContext::_setUpTriangle(void *_castToCommand, int index)
 {
-    static_cast<RenderContext*>(_castToContext)->setUpTriangle(index);
+    const DrawCommand *command = static_cast<const DrawCommand*>(_castToCommand);
+    command->frame->context->setUpTriangle(*command, index);
 }
 
-void RenderContext::_fillTile(void *_castToContext, int index)
+void RenderContext::_fillTile(void *_castToFrame, int index)
 {
-    static_cast<RenderContext*>(_castToContext)->fillTile(index);
+    Frame *frame = static_cast<Frame*>(_castToFrame);
+    frame->context->fillTile(*frame, index);
 }
 
-void RenderContext::_wireframeTile(void *_castToContext, int index)
+void RenderContext::_wireframeTile(void *_castToFrame, int index)
 {
-    static_cast<RenderContext*>(_castToContext)->wireframeTile(index);
+    const Frame *frame = static_cast<const Frame*>(_castToFrame);
+    frame->context->wireframeTile(*frame, index);
 }
 
-void RenderContext::finish()
+void RenderContext::enablePipelining(bool enable)
+{
+    waitForFrame();
+    if (enable && !fFrames[1].allocator)
+    {
+        fFrames[1].allocator = new RegionAllocator(fWorkingMemSize);
+        fFrames[1].drawQueue.setAllocator(fFrames[1].allocator);
+    }
+
+    fEnablePipelining = enable;
+}
+
+void RenderContext::waitForFrame()
 {
-    unsigned int kMaxTiles = static_cast<unsigned int>(fTileColumns * fTileRows);
-    fTiles = new (fAllocator) TriangleArray[kMaxTiles];
-    for (int i = 0; i < kMaxTiles; i++)
-        fTiles[i].setAllocator(&fAllocator);
+    if (!fRenderingFrame)
+        return;
+
+    Frame &frame = *fRenderingFrame;
+    task_group_wait(&frame.tasks);
+
+#if DISPLAY_STATS
+    printf("used %zu bytes\n", frame.allocator->bytesUsed());
+    printf("hierarchical Z: %d hidden triangles, %d hidden 16x16 regions, "
+           "%d skipped depth reads\n", frame.hiddenTriangles, frame.hiddenRegions,
+           frame.skippedDepthReads);
+#endif
+
+    fHiddenTriangles = frame.hiddenTriangles;
+    fHiddenRegions = frame.hiddenRegions;
+    fSkippedDepthReads = frame.skippedDepthReads;
+    frame.hiddenTriangles = 0;
+    frame.hiddenRegions = 0;
+    frame.skippedDepthReads = 0;
+
+    // Clean up memory
+    // First reset draw queue to clean up, then allocator, which frees
+    // memory it is using.
+    frame.drawQueue.reset();
+    frame.allocator->reset();
+    fRenderingFrame = nullptr;
+}
 
-    // Geometry phase.  Walk through each draw command and perform two steps
-    // for each one:
+void RenderContext::finish()
+{
+    Frame &frame = fFrames[fSubmitFrame];
+    const int numTiles = fTileColumns * fTileRows;
+    const int numBins = numTiles * MAX_WORKER_THREADS;
+    frame.bins = new (*fAllocator) TriangleArray*[static_cast<unsigned int>(numBins)];
+    for (int i = 0; i < numBins; i++)
+        frame.bins[i] = nullptr;
+
+    frame.renderTarget = fRenderTarget;
+    frame.fbWidth = fFbWidth;
+    frame.fbHeight = fFbHeight;
+    frame.tileColumns = fTileColumns;
+    frame.tileRows = fTileRows;
+    frame.clearColorBuffer = fClearColorBuffer;
+    frame.clearColor = fClearColor;
+    frame.visibilityBuffer = fEnableVisibilityBuffer;
+
+    // The frame is rendered by a graph of tasks. The geometry phase has two
+    // for each draw command:
     // 1. Call vertex shader on attributes (shadeVertices)
     // 2. Perform triangle setup and binning (setUpTriangle)
-    fBaseSequenceNumber = 0;
-    for (fRenderCommandIterator = fDrawQueue.begin(); fRenderCommandIterator != fDrawQueue.end();
-            ++fRenderCommandIterator)
+    // The second depends on the first. Draw commands are independent of each
+    // other, so their tasks may run at the same time. The pixel phase task
+    // depends on all triangle setup tasks.
+    task_group_init(&frame.tasks);
+    task_init(&frame.pixelTask, &frame.tasks, fWireframeMode ? _wireframeTile : _fillTile,
+              &frame, numTiles);
+    int baseSequenceNumber = 0;
+    fShadedVertices = 0;
+    fAttributeVertices = 0;
+    fCulledDraws = 0;
+    fCulledTriangles = 0;
+    for (RenderState &state : frame.drawQueue)
     {
-        RenderState &state = *fRenderCommandIterator;
         int numVertices = state.fVertexAttrBuffer->getNumElements();
         int numTriangles = state.fIndexBuffer->getNumElements() / 3;
-        state.fVertexParams = static_cast<float*>(fAllocator.alloc(
-                                  static_cast<unsigned int>(numVertices)
+        if (state.fCullToBounds && isOutsideView(state))
+        {
+            fCulledDraws++;
+            fCulledTriangles += numTriangles;
+            continue;
+        }
+
+        if (state.fShadeReferencedVertices)
+            state.fNumShadedVertices = assignVertexSlots(state);
+        else
+            state.fNumShadedVertices = numVertices;
+
+        state.fVertexParams = static_cast<float*>(fAllocator->alloc(
+                                  static_cast<unsigned int>(state.fNumShadedVertices)
                                   * static_cast<unsigned int>(state.fShader->getNumParams())
                                   * sizeof(int)));
-        parallel_execute(_shadeVertices, this, (numVertices + 15) / 16);
-        parallel_execute(_setUpTriangle, this, numTriangles);
-        fBaseSequenceNumber += numTriangles;
-    }
 
-    // Pixel phase.  Shade the pixels and write back.
-    if (fWireframeMode)
-        parallel_execute(_wireframeTile, this, fTileColumns * fTileRows);
-    else
-        parallel_execute(_fillTile, this, fTileColumns * fTileRows);
+        DrawCommand *command = new (*fAllocator) DrawCommand;
+        command->frame = &frame;
+        command->state = &state;
+        command->baseSequenceNumber = baseSequenceNumber;
+        task_init(&command->shadeTask, &frame.tasks, _shadeVertices, command,
+                  (state.fNumShadedVertices + 15) / 16);
+        task_init(&command->setUpTask, &frame.tasks, _setUpTriangle, command, numTriangles);
+        task_add_dependency(&command->setUpTask, &command->shadeTask);
+        task_add_dependency(&frame.pixelTask, &command->setUpTask);
+        task_submit(&command->setUpTask);
+        task_submit(&command->shadeTask);
+
+        baseSequenceNumber += numTriangles;
+        fShadedVertices += state.fNumShadedVertices;
+        fAttributeVertices += numVertices;
+    }
 
 #if DISPLAY_STATS
-    printf("total triangles = %d\n", fBaseSequenceNumber);
-    printf("used %zu bytes\n", fAllocator.bytesUsed());
+    printf("total triangles = %d\n", baseSequenceNumber);
+    printf("shaded %d vertices, %d in attribute buffers\n", fShadedVertices,
+           fAttributeVertices);
+    printf("culled %d draw calls, %d triangles\n", fCulledDraws, fCulledTriangles);
 #endif
 
-    // Clean up memory
-    // First reset draw queue to clean up, then allocator, which frees
-    // memory it is using.
-    fDrawQueue.reset();
-    fAllocator.reset();
+    // The previous frame may still be rendering if pipelining is enabled.
+    // This frame's pixel phase can't start until it is done, because it may
+    // use the same render target. This thread runs tasks from both frames
+    // while it waits.
+    waitForFrame();
+    fRenderingFrame = &frame;
+    task_submit(&frame.pixelTask);
+    if (fEnablePipelining)
+    {
+        // Submit the next frame to the other working memory area.
+        fSubmitFrame ^= 1;
+        fAllocator = fFrames[fSubmitFrame].allocator;
+    }
+    else
+        waitForFrame();
+
     fCurrentState.fUniforms = nullptr;	// Remove dangling pointer
     fClearColorBuffer = false;
 }
 
 //
-// Compute vertex parameters.  This shades all vertices in the attribute array,
-// even if they are not referenced by the index array.
+// Build the list of vertices that the index buffer references, in the
+// order they are first used, and map each one to a slot in the vertex
+// parameter array. This acts as a vertex cache that is big enough to hold
+// every vertex: a vertex that several triangles share is shaded once, and
+// triangle setup reads the results from its slot. Returns the number of
+// vertices to shade.
+//
+int RenderContext::assignVertexSlots(RenderState &state)
+{
+    const int numVertices = state.fVertexAttrBuffer->getNumElements();
+    const int numIndices = state.fIndexBuffer->getNumElements();
+    const int *indices = static_cast<const int*>(state.fIndexBuffer->getData());
+
+    int *slots = static_cast<int*>(fAllocator->alloc(static_cast<unsigned int>(numVertices)
+                                   * sizeof(int)));
+    memset(slots, 0xff, static_cast<unsigned int>(numVertices) * sizeof(int));
+
+    // shadeVertices loads these as vectors, so round up to a whole vector.
+    int *shadedVertices = static_cast<int*>(fAllocator->alloc(
+                              static_cast<unsigned int>((numIndices + 15) & ~15) * sizeof(int),
+                              sizeof(veci16_t)));
+    int numShaded = 0;
+    for (int i = 0; i < numIndices; i++)
+    {
+        const int vertexIndex = indices[i];
+        if (slots[vertexIndex] < 0)
+        {
+            slots[vertexIndex] = numShaded;
+            shadedVertices[numShaded++] = vertexIndex;
+        }
+    }
+
+    state.fVertexSlots = slots;
+    state.fShadedVertices = shadedVertices;
+    return numShaded;
+}
+
+//
+// Compute vertex parameters. Unless indexed shading is enabled, this shades
+// all vertices in the attribute array, even if they are not referenced by
+// the index array.
 //
-void RenderContext::shadeVertices(int index)
+void RenderContext::shadeVertices(const DrawCommand &command, int index)
 {
-    const RenderState &state = *fRenderCommandIterator;
-    int numVertices = state.fVertexAttrBuffer->getNumElements() - index * 16;
+    const RenderState &state = *command.state;
+    int numVertices = state.fNumShadedVertices - index * 16;
     vmask_t mask;
     if (numVertices < 16)
         mask = (1 << numVertices) - 1;
@@ -159,10 +353,23 @@ void RenderContext::shadeVertices(int index)
     int attribsPerVertex = state.fShader->getNumAttribs();
     vecf16_t packedAttribs[attribsPerVertex];
     int startIndex = index * 16;
-    for (int attrib = 0; attrib < attribsPerVertex; attrib++)
+    if (state.fShadeReferencedVertices)
     {
-        packedAttribs[attrib] = vecf16_t(state.fVertexAttrBuffer->gatherElements(startIndex,
-                                         attrib, mask));
+        const veci16_t vertexIndices = *reinterpret_cast<const veci16_t*>(
+                                           state.fShadedVertices + startIndex);
+        for (int attrib = 0; attrib < attribsPerVertex; attrib++)
+        {
+            packedAttribs[attrib] = vecf16_t(state.fVertexAttrBuffer->gatherElements(
+                                             vertexIndices, attrib, mask));
+        }
+    }
+    else
+    {
+        for (int attrib = 0; attrib < attribsPerVertex; attrib++)
+        {
+            packedAttribs[attrib] = vecf16_t(state.fVertexAttrBuffer->gatherElements(startIndex,
+                                             attrib, mask));
+        }
     }
 
     int paramsPerVertex = state.fShader->getNumParams();
@@ -183,8 +390,6 @@ void RenderContext::shadeVertices(int index)
 namespace
 {
 
-const float kNearWClip = 1.0;
-
 void interpolate(float *outParams, const float *inParams0, const float *inParams1, int numParams,
                  float distance)
 {
@@ -210,8 +415,8 @@ void interpolate(float *outParams, const float *inParams0, const float *inParams
 //      0
 //
 
-void RenderContext::clipOne(int sequence, const RenderState &state, const float *params0,
-                            const float *params1, const float *params2)
+void RenderContext::clipOne(Frame &frame, int sequence, const RenderState &state,
+                            const float *params0, const float *params1, const float *params2)
 {
     float newPoint1[kMaxParams];
     float newPoint2[kMaxParams];
@@ -220,8 +425,8 @@ void RenderContext::clipOne(int sequence, const RenderState &state, const float
                 / (params1[kParamW] - params0[kParamW]));
     interpolate(newPoint2, params2, params0, state.fParamsPerVertex, (params2[kParamW] - kNearWClip)
                 / (params2[kParamW] - params0[kParamW]));
-    enqueueTriangle(sequence, state, newPoint1, params1, newPoint2);
-    enqueueTriangle(sequence, state, newPoint2, params1, params2);
+    enqueueTriangle(frame, sequence, state, newPoint1, params1, newPoint2);
+    enqueueTriangle(frame, sequence, state, newPoint2, params1, params2);
 }
 
 //
@@ -242,8 +447,8 @@ void RenderContext::clipOne(int sequence, const RenderState &state, const float
 //        1        0
 //
 
-void RenderContext::clipTwo(int sequence, const RenderState &state, const float *params0,
-                            const float *params1, const float *params2)
+void RenderContext::clipTwo(Frame &frame, int sequence, const RenderState &state,
+                            const float *params0, const float *params1, const float *params2)
 {
     float newPoint1[kMaxParams];
     float newPoint2[kMaxParams];
@@ -252,17 +457,29 @@ void RenderContext::clipTwo(int sequence, const RenderState &state, const float
                 / (params2[kParamW] - params1[kParamW]));
     interpolate(newPoint2, params2, params0, state.fParamsPerVertex, (params2[kParamW] - kNearWClip)
                 / (params2[kParamW] - params0[kParamW]));
-    enqueueTriangle(sequence, state, newPoint2, newPoint1, params2);
+    enqueueTriangle(frame, sequence, state, newPoint2, newPoint1, params2);
 }
 
-void RenderContext::setUpTriangle(int triangleIndex)
+void RenderContext::setUpTriangle(const DrawCommand &command, int triangleIndex)
 {
-    RenderState &state = *fRenderCommandIterator;
+    Frame &frame = *command.frame;
+    const RenderState &state = *command.state;
+    const int sequence = command.baseSequenceNumber + triangleIndex;
     int vertexIndex = triangleIndex * 3;
     const int *indices = static_cast<const int*>(state.fIndexBuffer->getData());
-    int offset0 = indices[vertexIndex] * state.fParamsPerVertex;
-    int offset1 = indices[vertexIndex + 1] * state.fParamsPerVertex;
-    int offset2 = indices[vertexIndex + 2] * state.fParamsPerVertex;
+    int slot0 = indices[vertexIndex];
+    int slot1 = indices[vertexIndex + 1];
+    int slot2 = indices[vertexIndex + 2];
+    if (state.fShadeReferencedVertices)
+    {
+        slot0 = state.fVertexSlots[slot0];
+        slot1 = state.fVertexSlots[slot1];
+        slot2 = state.fVertexSlots[slot2];
+    }
+
+    int offset0 = slot0 * state.fParamsPerVertex;
+    int offset1 = slot1 * state.fParamsPerVertex;
+    int offset2 = slot2 * state.fParamsPerVertex;
     const float *params0 = &state.fVertexParams[offset0];
     const float *params1 = &state.fVertexParams[offset1];
     const float *params2 = &state.fVertexParams[offset2];
@@ -278,32 +495,31 @@ void RenderContext::setUpTriangle(int triangleIndex)
     {
     case 0:
         // Not clipped at all.
-        enqueueTriangle(fBaseSequenceNumber + triangleIndex, state,
-                        params0, params1, params2);
+        enqueueTriangle(frame, sequence, state, params0, params1, params2);
         break;
 
     case 1:
-        clipOne(fBaseSequenceNumber + triangleIndex, state, params0, params1, params2);
+        clipOne(frame, sequence, state, params0, params1, params2);
         break;
 
     case 2:
-        clipOne(fBaseSequenceNumber + triangleIndex, state, params1, params2, params0);
+        clipOne(frame, sequence, state, params1, params2, params0);
         break;
 
     case 4:
-        clipOne(fBaseSequenceNumber + triangleIndex, state, params2, params0, params1);
+        clipOne(frame, sequence, state, params2, params0, params1);
         break;
 
     case 3:
-        clipTwo(fBaseSequenceNumber + triangleIndex, state, params0, params1, params2);
+        clipTwo(frame, sequence, state, params0, params1, params2);
         break;
 
     case 6:
-        clipTwo(fBaseSequenceNumber + triangleIndex, state, params1, params2, params0);
+        clipTwo(frame, sequence, state, params1, params2, params0);
         break;
 
     case 5:
-        clipTwo(fBaseSequenceNumber + triangleIndex, state, params2, params0, params1);
+        clipTwo(frame, sequence, state, params2, params0, params1);
         break;
 
         // Else is totally clipped, ignore
@@ -315,8 +531,9 @@ void RenderContext::setUpTriangle(int triangleIndex)
 // division, backface culling, and binning.
 //
 
-void RenderContext::enqueueTriangle(int sequence, const RenderState &state, const float *params0,
-                                    const float *params1, const float *params2)
+void RenderContext::enqueueTriangle(Frame &frame, int sequence, const RenderState &state,
+                                    const float *params0, const float *params1,
+                                    const float *params2)
 {
     Triangle tri;
     tri.sequenceNumber = sequence;
@@ -338,8 +555,8 @@ void RenderContext::enqueueTriangle(int sequence, const RenderState &state, cons
     tri.z2 = params2[kParamZ];
 
     // Convert screen space coordinates to raster coordinates
-    int halfWidth = fFbWidth / 2;
-    int halfHeight = fFbHeight / 2;
+    int halfWidth = frame.fbWidth / 2;
+    int halfHeight = frame.fbHeight / 2;
     tri.x0Rast = tri.x0 * halfWidth + halfWidth;
     tri.y0Rast = -tri.y0 * halfHeight + halfHeight;
     tri.x1Rast = tri.x1 * halfWidth + halfWidth;
@@ -370,28 +587,39 @@ void RenderContext::enqueueTriangle(int sequence, const RenderState &state, cons
     bbBottom = tri.y2Rast > bbBottom ? tri.y2Rast : bbBottom;
 
     // Cull triangles that are outside the sides of the view frustum
-    if (bbRight < 0 || bbLeft >= fFbWidth || bbBottom < 0 || bbTop >= fFbHeight)
+    if (bbRight < 0 || bbLeft >= frame.fbWidth || bbBottom < 0 || bbTop >= frame.fbHeight)
         return;
 
     // Copy parameters into triangle structure, skipping position which is already
     // in x0/y0/z0/x1...
     unsigned int paramSize = sizeof(float) * static_cast<unsigned int>(state.fParamsPerVertex - 4);
-    float *params = static_cast<float*>(fAllocator.alloc(paramSize * 3));
+    float *params = static_cast<float*>(frame.allocator->alloc(paramSize * 3));
     memcpy(params, params0 + 4, paramSize);
     memcpy(params + state.fParamsPerVertex - 4, params1 + 4, paramSize);
     memcpy(params + (state.fParamsPerVertex - 4) * 2, params2 + 4, paramSize);
     tri.params = params;
 
     // Determine which tiles this triangle may overlap with a simple
-    // bounding box check.  Enqueue it in the queues for each tile.
+    // bounding box check.  Add it to this thread's bin for each tile.
     int minTileX = max(bbLeft / kTileSize, 0);
-    int maxTileX = min(bbRight / kTileSize, fTileColumns - 1);
+    int maxTileX = min(bbRight / kTileSize, frame.tileColumns - 1);
     int minTileY = max(bbTop / kTileSize, 0);
-    int maxTileY = min(bbBottom / kTileSize, fTileRows - 1);
+    int maxTileY = min(bbBottom / kTileSize, frame.tileRows - 1);
+    const int worker = get_worker_index();
     for (int tiley = minTileY; tiley <= maxTileY; tiley++)
     {
         for (int tilex = minTileX; tilex <= maxTileX; tilex++)
-            fTiles[tiley * fTileColumns + tilex].append(tri);
+        {
+            TriangleArray *&bin = frame.bins[(tiley * frame.tileColumns + tilex)
+                                             * MAX_WORKER_THREADS + worker];
+            if (bin == nullptr)
+            {
+                bin = new (*frame.allocator) TriangleArray;
+                bin->setAllocator(frame.allocator);
+            }
+
+            bin->append(tri);
+        }
     }
 }
 
@@ -417,96 +645,331 @@ bool triangleRejected(int left, int top, int right, int bottom,
            || edgeRejected(left, top, right, bottom, x3, y3, x1, y1);
 }
 
+// Return a mask of the 16x16 regions of a tile (numbered like the lanes
+// of a 4x4 block) that a triangle's bounding box overlaps.
+vmask_t getOverlappedRegions(int tileLeft, int tileTop, int x1, int y1, int x2,
+                             int y2, int x3, int y3)
+{
+    const int left = max((min(min(x1, x2), x3) - tileLeft) >> 4, 0);
+    const int top = max((min(min(y1, y2), y3) - tileTop) >> 4, 0);
+    const int right = min((max(max(x1, x2), x3) - tileLeft) >> 4, 3);
+    const int bottom = min((max(max(y1, y2), y3) - tileTop) >> 4, 3);
+    const int rowMask = ((2 << right) - 1) & ~((1 << left) - 1);
+    int mask = 0;
+    for (int row = top; row <= bottom; row++)
+        mask |= rowMask << (row * 4);
+
+    return static_cast<vmask_t>(mask);
+}
+
 } // namespace
 
-void RenderContext::fillTile(int index)
+// Find the parts of the bin where triangles are in submit order. One thread
+// fills a bin, so a run is usually a range of triangles from one draw
+// command. A new one starts when the thread moves to an earlier draw command
+// or steals an earlier range of triangles. If outRuns is null, this only
+// counts them.
+int RenderContext::splitRuns(const TriangleArray &bin, TriangleRun *outRuns)
 {
-    const int x = index % fTileColumns;
-    const int y = index / fTileColumns;
+    int numRuns = 0;
+    TriangleArray::iterator runStart = bin.begin();
+    const TriangleArray::iterator end = bin.end();
+    int lastSequence = (*runStart).sequenceNumber;
+    for (TriangleArray::iterator i = runStart.next(); i != end; ++i)
+    {
+        if ((*i).sequenceNumber < lastSequence)
+        {
+            if (outRuns)
+            {
+                outRuns[numRuns].next = runStart;
+                outRuns[numRuns].end = i;
+            }
+
+            numRuns++;
+            runStart = i;
+        }
+
+        lastSequence = (*i).sequenceNumber;
+    }
+
+    if (outRuns)
+    {
+        outRuns[numRuns].next = runStart;
+        outRuns[numRuns].end = end;
+    }
+
+    return numRuns + 1;
+}
+
+// Return the triangle with the lowest sequence number from the heads of all
+// runs, or null if they are all empty. Runs are removed as they run out. There
+// are only a few runs for each tile, so a linear search is faster than a heap.
+const RenderContext::Triangle *RenderContext::mergeRuns(TriangleRun *runs, int &numRuns)
+{
+    if (numRuns == 0)
+        return nullptr;
+
+    int lowest = 0;
+    for (int i = 1; i < numRuns; i++)
+    {
+        if ((*runs[i].next).sequenceNumber < (*runs[lowest].next).sequenceNumber)
+            lowest = i;
+    }
+
+    const Triangle *tri = &*runs[lowest].next;
+    if (++runs[lowest].next == runs[lowest].end)
+        runs[lowest] = runs[--numRuns];
+
+    return tri;
+}
+
+// Return false if the triangle doesn't overlap the tile, or if the depth
+// buffer is enabled and it is behind what has already been drawn everywhere
+// it overlaps (which increments hiddenTriangles). Otherwise, set
+// outHiddenRegions to the parts of the tile it is hidden in, for the
+// rasterizer to skip.
+bool RenderContext::overlapsTile(const Triangle &tri, int tileX, int tileY,
+                                 const HierarchicalZ &hierarchicalZ,
+                                 vmask_t &outHiddenRegions, int &hiddenTriangles)
+{
+    // Do a better check to see if this triangle overlaps the tile.
+    // If not, skip setting up interpolators.
+    if (tri.woundCCW)
+    {
+        if (triangleRejected(tileX, tileY, tileX + kTileSize,
+                             tileY + kTileSize, tri.x0Rast, tri.y0Rast, tri.x1Rast,
+                             tri.y1Rast, tri.x2Rast, tri.y2Rast))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        if (triangleRejected(tileX, tileY, tileX + kTileSize,
+                             tileY + kTileSize, tri.x0Rast, tri.y0Rast, tri.x2Rast,
+                             tri.y2Rast, tri.x1Rast, tri.y1Rast))
+        {
+            return false;
+        }
+    }
+
+    outHiddenRegions = 0;
+    if (tri.state->fEnableDepthBuffer)
+    {
+        const vmask_t overlapped = getOverlappedRegions(tileX, tileY, tri.x0Rast,
+                                   tri.y0Rast, tri.x1Rast, tri.y1Rast, tri.x2Rast,
+                                   tri.y2Rast);
+        outHiddenRegions = hierarchicalZ.getHiddenRegions(max(max(tri.z0, tri.z1),
+                           tri.z2));
+        if ((outHiddenRegions & overlapped) == overlapped)
+        {
+            hiddenTriangles++;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void RenderContext::setUpFiller(TriangleFiller &filler, const Triangle &tri)
+{
+    const RenderState &state = *tri.state;
+    filler.setUpTriangle(&state, tri.x0, tri.y0, tri.z0, tri.x1, tri.y1, tri.z1, tri.x2,
+                         tri.y2, tri.z2);
+    for (int paramI = 0; paramI < state.fParamsPerVertex; paramI++)
+    {
+        filler.setUpParam(tri.params[paramI],
+                          tri.params[(state.fParamsPerVertex - 4) + paramI],
+                          tri.params[(state.fParamsPerVertex - 4) * 2 + paramI]);
+    }
+}
+
+// Returns the number of hidden regions that the rasterizer skipped.
+int RenderContext::rasterizeTriangle(const Frame &frame, TriangleFiller &filler,
+                                     const Triangle &tri, int tileX, int tileY,
+                                     vmask_t hiddenRegions)
+{
+    if (tri.woundCCW)
+    {
+        return fillTriangle(filler, tileX, tileY,
+                            tri.x0Rast, tri.y0Rast, tri.x1Rast, tri.y1Rast,
+                            tri.x2Rast, tri.y2Rast, frame.fbWidth,
+                            frame.fbHeight, hiddenRegions);
+    }
+
+    return fillTriangle(filler, tileX, tileY,
+                        tri.x0Rast, tri.y0Rast, tri.x2Rast, tri.y2Rast,
+                        tri.x1Rast, tri.y1Rast, frame.fbWidth,
+                        frame.fbHeight, hiddenRegions);
+}
+
+void RenderContext::fillTile(Frame &frame, int index)
+{
+    const int x = index % frame.tileColumns;
+    const int y = index / frame.tileColumns;
     const int tileX = x * kTileSize;
     const int tileY = y * kTileSize;
-    TriangleArray &tile = fTiles[y * fTileColumns + x];
-    Surface *colorBuffer = fRenderTarget->getColorBuffer();
+    TriangleArray **bins = frame.bins + index * MAX_WORKER_THREADS;
+    Surface *colorBuffer = frame.renderTarget->getColorBuffer();
 
-    if (fClearColorBuffer)
-        colorBuffer->clearTile(tileX, tileY, fClearColor);
+    if (frame.clearColorBuffer)
+        colorBuffer->clearTile(tileX, tileY, frame.clearColor);
 
     // Initialize Z-Buffer to -infinity
-    if (fRenderTarget->getDepthBuffer())
-        fRenderTarget->getDepthBuffer()->clearTile(tileX, tileY, 0xff800000);
+    HierarchicalZ hierarchicalZ;
+    if (frame.renderTarget->getDepthBuffer())
+    {
+        frame.renderTarget->getDepthBuffer()->clearTile(tileX, tileY, 0xff800000);
+        hierarchicalZ.reset(tileX, tileY, frame.fbWidth, frame.fbHeight, -__builtin_inff());
+    }
 
-    // The triangles may have been reordered during the parallel vertex shading
-    // phase.  Put them back in the order they were submitted.
-    tile.sort();
+    // The geometry phase runs in parallel, so the triangles are split
+    // between bins in arbitrary order. Merge the sorted runs in each
+    // bin to render them in the order they were submitted.
+    int numRuns = 0;
+    for (int i = 0; i < MAX_WORKER_THREADS; i++)
+    {
+        if (bins[i])
+            numRuns += splitRuns(*bins[i], nullptr);
+    }
 
-    // Walk through all triangles that overlap this tile and render
-    TriangleFiller filler(fRenderTarget);
-    for (const Triangle &tri : tile)
+    TriangleRun *runs = new (*frame.allocator) TriangleRun[static_cast<unsigned int>(numRuns)];
+    TriangleRun *nextRun = runs;
+    for (int i = 0; i < MAX_WORKER_THREADS; i++)
     {
-        const RenderState &state = *tri.state;
+        if (bins[i])
+            nextRun += splitRuns(*bins[i], nextRun);
+    }
 
-        // Do a better check to see if this triangle overlaps the tile.
-        // If not, skip setting up interpolators.
-        if (tri.woundCCW)
+    // Walk through all triangles that overlap this tile and render
+    TriangleFiller filler(frame.renderTarget, &hierarchicalZ);
+    int hiddenTriangles = 0;
+    int hiddenRegions = 0;
+    if (!frame.visibilityBuffer)
+    {
+        while (const Triangle *tri = mergeRuns(runs, numRuns))
         {
-            if (triangleRejected(tileX, tileY, tileX + kTileSize,
-                                 tileY + kTileSize, tri.x0Rast, tri.y0Rast, tri.x1Rast,
-                                 tri.y1Rast, tri.x2Rast, tri.y2Rast))
+            vmask_t triHiddenRegions;
+            if (!overlapsTile(*tri, tileX, tileY, hierarchicalZ, triHiddenRegions,
+                              hiddenTriangles))
             {
                 continue;
             }
+
+            setUpFiller(filler, *tri);
+            hiddenRegions += rasterizeTriangle(frame, filler, *tri, tileX, tileY,
+                                               triHiddenRegions);
         }
-        else
+    }
+    else
+    {
+        // Draw triangles that can be deferred into the visibility buffer,
+        // then shade the visible pixels of each. Triangles that can't be
+        // deferred are drawn directly. To keep everything in the order it
+        // was submitted, the deferred triangles before one of those are
+        // shaded before it is drawn. IDs aren't reused within the tile, so
+        // pixels left over from an earlier batch, which have already been
+        // shaded, don't match triangles in later ones.
+        const int kVisibilityBlocks = (kTileSize / 4) * (kTileSize / 4);
+        veci16_t *&visibilityBuffer = fVisibilityBuffers[get_worker_index()];
+        if (visibilityBuffer == nullptr)
         {
-            if (triangleRejected(tileX, tileY, tileX + kTileSize,
-                                 tileY + kTileSize, tri.x0Rast, tri.y0Rast, tri.x2Rast,
-                                 tri.y2Rast, tri.x1Rast, tri.y1Rast))
+            visibilityBuffer = static_cast<veci16_t*>(memalign(sizeof(veci16_t),
+                sizeof(veci16_t) * kVisibilityBlocks));
+        }
+
+        for (int i = 0; i < kVisibilityBlocks; i++)
+            visibilityBuffer[i] = veci16_t(-1);
+
+        TriangleRefArray deferredTriangles;
+        deferredTriangles.setAllocator(frame.allocator);
+        int numDeferred = 0;
+        int firstDeferredId = 0;
+        filler.setVisibilityBuffer(visibilityBuffer, tileX, tileY);
+        while (const Triangle *tri = mergeRuns(runs, numRuns))
+        {
+            const RenderState &state = *tri->state;
+            vmask_t triHiddenRegions;
+            if (!overlapsTile(*tri, tileX, tileY, hierarchicalZ, triHiddenRegions,
+                              hiddenTriangles))
             {
                 continue;
             }
-        }
 
-        // Set up parameters and rasterize triangle.
-        filler.setUpTriangle(&state, tri.x0, tri.y0, tri.z0, tri.x1, tri.y1, tri.z1, tri.x2,
-                             tri.y2, tri.z2);
-        for (int paramI = 0; paramI < state.fParamsPerVertex; paramI++)
-        {
-            filler.setUpParam(tri.params[paramI],
-                              tri.params[(state.fParamsPerVertex - 4) + paramI],
-                              tri.params[(state.fParamsPerVertex - 4) * 2 + paramI]);
-        }
+            if (!state.fEnableDepthBuffer || state.fEnableBlend)
+            {
+                if (numDeferred != firstDeferredId)
+                {
+                    shadeDeferredTriangles(frame, filler, deferredTriangles, firstDeferredId,
+                                           tileX, tileY);
+                    deferredTriangles.reset();
+                    firstDeferredId = numDeferred;
+                }
+
+                filler.setVisibilityBuffer(nullptr, 0, 0);
+                setUpFiller(filler, *tri);
+                hiddenRegions += rasterizeTriangle(frame, filler, *tri, tileX, tileY,
+                                                   triHiddenRegions);
+                filler.setVisibilityBuffer(visibilityBuffer, tileX, tileY);
+                continue;
+            }
 
-        if (tri.woundCCW)
-        {
-            fillTriangle(filler, tileX, tileY,
-                         tri.x0Rast, tri.y0Rast, tri.x1Rast, tri.y1Rast, tri.x2Rast, tri.y2Rast,
-                         fFbWidth, fFbHeight);
-        }
-        else
-        {
-            fillTriangle(filler, tileX, tileY,
-                         tri.x0Rast, tri.y0Rast, tri.x2Rast, tri.y2Rast, tri.x1Rast, tri.y1Rast,
-                         fFbWidth, fFbHeight);
+            // Parameters aren't needed until the triangle is shaded.
+            filler.setUpTriangle(&state, tri->x0, tri->y0, tri->z0, tri->x1, tri->y1,
+                                 tri->z1, tri->x2, tri->y2, tri->z2);
+            filler.setTriangleId(numDeferred++);
+            hiddenRegions += rasterizeTriangle(frame, filler, *tri, tileX, tileY,
+                                               triHiddenRegions);
+            deferredTriangles.append(tri);
         }
+
+        shadeDeferredTriangles(frame, filler, deferredTriangles, firstDeferredId, tileX, tileY);
+        filler.setVisibilityBuffer(nullptr, 0, 0);
     }
 
     colorBuffer->flushTile(tileX, tileY);
+
+    __sync_fetch_and_add(&frame.hiddenTriangles, hiddenTriangles);
+    __sync_fetch_and_add(&frame.hiddenRegions, hiddenRegions);
+    __sync_fetch_and_add(&frame.skippedDepthReads, filler.getSkippedDepthReads());
+}
+
+// Run the pixel shader for the visible pixels of each triangle in the
+// visibility buffer. The first triangle in the array has ID firstId, and the
+// rest follow in order.
+void RenderContext::shadeDeferredTriangles(const Frame &frame, TriangleFiller &filler,
+                                           TriangleRefArray &triangles, int firstId,
+                                           int tileX, int tileY)
+{
+    const int clipRight = min(tileX + kTileSize, frame.fbWidth);
+    const int clipBottom = min(tileY + kTileSize, frame.fbHeight);
+    int id = firstId;
+    for (const Triangle *tri : triangles)
+    {
+        setUpFiller(filler, *tri);
+        filler.setTriangleId(id++);
+        filler.shadeVisiblePixels(
+            max(min(min(tri->x0Rast, tri->x1Rast), tri->x2Rast) & ~3, tileX),
+            max(min(min(tri->y0Rast, tri->y1Rast), tri->y2Rast) & ~3, tileY),
+            min(max(max(tri->x0Rast, tri->x1Rast), tri->x2Rast) + 1, clipRight),
+            min(max(max(tri->y0Rast, tri->y1Rast), tri->y2Rast) + 1, clipBottom));
+    }
 }
 
 //
 // Fill a tile, except with wireframe only
 //
 
-void RenderContext::wireframeTile(int index)
+void RenderContext::wireframeTile(const Frame &frame, int index)
 {
-    const int x = index % fTileColumns;
-    const int y = index / fTileColumns;
+    const int x = index % frame.tileColumns;
+    const int y = index / frame.tileColumns;
     const int tileX = x * kTileSize;
     const int tileY = y * kTileSize;
-    const TriangleArray &tile = fTiles[y * fTileColumns + x];
+    TriangleArray *const *bins = frame.bins + index * MAX_WORKER_THREADS;
 
-    Surface *colorBuffer = fRenderTarget->getColorBuffer();
-    colorBuffer->clearTile(tileX, tileY, fClearColor);
+    Surface *colorBuffer = frame.renderTarget->getColorBuffer();
+    colorBuffer->clearTile(tileX, tileY, frame.clearColor);
     int bottomClip = tileY + kTileSize - 1;
     int rightClip = tileX + kTileSize - 1;
     if (bottomClip >= colorBuffer->getHeight())
@@ -515,14 +978,21 @@ void RenderContext::wireframeTile(int index)
     if (rightClip >= colorBuffer->getWidth())
         rightClip = colorBuffer->getWidth() - 1;
 
-    for (const Triangle &tri : tile)
+    // Order doesn't matter here, because all lines are the same color.
+    for (int i = 0; i < MAX_WORKER_THREADS; i++)
     {
-        drawLineClipped(colorBuffer, tri.x0Rast, tri.y0Rast, tri.x1Rast, tri.y1Rast, 0xffffffff,
-                        tileX, tileY, rightClip, bottomClip);
-        drawLineClipped(colorBuffer, tri.x1Rast, tri.y1Rast, tri.x2Rast, tri.y2Rast, 0xffffffff,
-                        tileX, tileY, rightClip, bottomClip);
-        drawLineClipped(colorBuffer, tri.x2Rast, tri.y2Rast, tri.x0Rast, tri.y0Rast, 0xffffffff,
-                        tileX, tileY, rightClip, bottomClip);
+        if (bins[i] == nullptr)
+            continue;
+
+        for (const Triangle &tri : *bins[i])
+        {
+            drawLineClipped(colorBuffer, tri.x0Rast, tri.y0Rast, tri.x1Rast, tri.y1Rast, 0xffffffff,
+                            tileX, tileY, rightClip, bottomClip);
+            drawLineClipped(colorBuffer, tri.x1Rast, tri.y1Rast, tri.x2Rast, tri.y2Rast, 0xffffffff,
+                            tileX, tileY, rightClip, bottomClip);
+            drawLineClipped(colorBuffer, tri.x2Rast, tri.y2Rast, tri.x0Rast, tri.y0Rast, 0xffffffff,
+                            tileX, tileY, rightClip, bottomClip);
+        }
     }
 
     colorBuffer->flushTile(tileX, tileY);
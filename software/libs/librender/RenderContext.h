@@ -17,6 +17,7 @@
 
 #pragma once
 
+#include <schedule.h>
 #include "CommandQueue.h"
 #include "RegionAllocator.h"
 #include "RenderState.h"
@@ -26,6 +27,9 @@
 namespace librender
 {
 
+class HierarchicalZ;
+class TriangleFiller;
+
 //
 // Interface for client applications to enqueue rendering commands.
 // State set with bindXXX will apply for any drawing calls
@@ -35,6 +39,7 @@ class RenderContext
 {
 public:
     explicit RenderContext(unsigned int workingMemSize = 0x400000);
+    ~RenderContext();
     RenderContext(const RenderContext&) = delete;
     RenderContext& operator=(const RenderContext&) = delete;
 
@@ -84,14 +89,116 @@ public:
         fCurrentState.fEnableBlend = enabled;
     }
 
+    // If enabled, draw calls only run the vertex shader on vertices
+    // their index buffer references, rather than every vertex in the
+    // attribute buffer. This is faster when a draw call uses a small part
+    // of a large vertex buffer, but it requires a scalar pass over the
+    // index buffer, so it is slower when most vertices are referenced.
+    void enableIndexedShading(bool enabled)
+    {
+        fCurrentState.fShadeReferencedVertices = enabled;
+    }
+
+    // Set an object space box that contains every vertex of the following
+    // draw calls, and the matrix that transforms it to clip space, which is
+    // usually the model-view-projection matrix passed to the vertex shader.
+    // finish() skips draw calls whose box is completely outside the view,
+    // without running the vertex shader.
+    void setBoundingBox(const Vec3 &min, const Vec3 &max, const Matrix &transform)
+    {
+        fCurrentState.fCullToBounds = true;
+        fCurrentState.fBoundsMin = min;
+        fCurrentState.fBoundsMax = max;
+        fCurrentState.fBoundsTransform = transform;
+    }
+
+    // Draw all following draw calls, as before setBoundingBox was called.
+    void clearBoundingBox()
+    {
+        fCurrentState.fCullToBounds = false;
+    }
+
     // Draw primitives using currently configured state set by bindXXX calls.
     // Indices reference into bound vertex attribute buffer.
     void drawElements(const RenderBuffer *indices);
 
     // Execute all submitted drawing commands. No rendering occurs until
-    // this is called.
+    // this is called. If pipelining is enabled, this may return before the
+    // pixels are written.
     void finish();
 
+    // If enabled, finish() returns after the geometry phase (vertex shading
+    // and triangle setup), and the pixel phase runs on the other threads
+    // while the application submits the next frame and that frame's geometry
+    // phase runs. The pixel phase of a frame doesn't start until the previous
+    // frame's completes. This allocates a second working memory area, the
+    // size passed to the constructor, so one frame can be submitted while
+    // another renders.
+    void enablePipelining(bool enable);
+
+    // Number of vertices the last call to finish() ran the vertex shader on,
+    // and the number in the attribute buffers of its draw calls, which is
+    // how many would be shaded without indexed shading.
+    int getShadedVertexCount() const
+    {
+        return fShadedVertices;
+    }
+
+    int getAttributeVertexCount() const
+    {
+        return fAttributeVertices;
+    }
+
+    // Number of draw calls, and the triangles in them, that the last call to
+    // finish() skipped because their bounding boxes were outside the view.
+    int getCulledDrawCount() const
+    {
+        return fCulledDraws;
+    }
+
+    int getCulledTriangleCount() const
+    {
+        return fCulledTriangles;
+    }
+
+    // Work that hierarchical Z skipped in the last frame that finished
+    // rendering: triangles rejected from a tile, 16x16 regions of triangles
+    // that weren't rasterized, and depth buffer reads for 4x4 blocks that
+    // were known to pass. With pipelining, call waitForFrame() first.
+    int getHiddenTriangleCount() const
+    {
+        return fHiddenTriangles;
+    }
+
+    int getHiddenRegionCount() const
+    {
+        return fHiddenRegions;
+    }
+
+    int getSkippedDepthReadCount() const
+    {
+        return fSkippedDepthReads;
+    }
+
+    // Wait until all frames passed to finish() are completely rendered. With
+    // pipelining, call this before reading or displaying the color buffer,
+    // or modifying textures or render targets that frames use.
+    void waitForFrame();
+
+    // If enabled, the pixel shader runs once for each visible pixel of
+    // triangles that use the depth buffer and don't blend, rather than for
+    // every pixel that passes the depth test when it is drawn. Each tile is
+    // drawn in two passes: the first records which triangle is in front at
+    // each pixel, and the second shades them. Other triangles are drawn
+    // directly, after shading the triangles submitted before them, so the
+    // result is the same as without this. This helps scenes with a lot of
+    // overdraw. Each worker thread allocates a 16k buffer for this the first
+    // time it draws a tile, and reuses it.
+    void enableVisibilityBuffer(bool enable)
+    {
+        fEnableVisibilityBuffer = enable;
+    }
+
     // If this is set, no pixels will be rendered, but lines will be drawn at the
     // edge of rendered triangles.
     void enableWireframeMode(bool enable)
@@ -119,38 +226,120 @@ private:
         }
     };
 
-    void shadeVertices(int index);
-    void setUpTriangle(int triangleIndex);
-    void fillTile(int index);
-    void wireframeTile(int index);
-    static void _shadeVertices(void *_castToContext, int index);
-    static void _setUpTriangle(void *_castToContext, int index);
-    static void _fillTile(void *_castToContext, int index);
-    static void _wireframeTile(void *_castToContext, int index);
-    void clipOne(int sequence, const RenderState &command, const float *params0, const float *params1,
-                 const float *params2);
-    void clipTwo(int sequence, const RenderState &command, const float *params0, const float *params1,
-                 const float *params2);
-    void enqueueTriangle(int sequence, const RenderState &command, const float *params0,
-                         const float *params1, const float *params2);
-
     typedef CommandQueue<Triangle, 64> TriangleArray;
+    typedef CommandQueue<const Triangle*, 64> TriangleRefArray;
     typedef CommandQueue<RenderState, 32> DrawQueue;
 
+    // Everything used to render a frame after finish() is called, which
+    // must remain valid until it is complete. With pipelining, two of these
+    // alternate: the application submits commands for one while the other is
+    // rendered.
+    struct Frame
+    {
+        RenderContext *context = nullptr;
+        RegionAllocator *allocator = nullptr;
+        DrawQueue drawQueue;
+        // Each thread adds triangles to its own bin for each tile, so
+        // they don't contend. These are indexed by
+        // tile * MAX_WORKER_THREADS + worker, and are null until the worker
+        // adds a triangle.
+        TriangleArray **bins = nullptr;
+        RenderTarget *renderTarget = nullptr;
+        int fbWidth = 0;
+        int fbHeight = 0;
+        int tileColumns = 0;
+        int tileRows = 0;
+        bool clearColorBuffer = false;
+        unsigned int clearColor = 0;
+        bool visibilityBuffer = false;
+        task_group tasks;
+        task pixelTask;
+
+        // Work skipped by hierarchical Z
+        int hiddenTriangles = 0;
+        int hiddenRegions = 0;
+        int skippedDepthReads = 0;
+    };
+
+    // Part of a bin where triangles are in submit order
+    struct TriangleRun
+    {
+        TriangleArray::iterator next;
+        TriangleArray::iterator end;
+    };
+
+    // Geometry phase tasks for one draw command
+    struct DrawCommand
+    {
+        Frame *frame;
+        RenderState *state;
+        int baseSequenceNumber;
+        task shadeTask;
+        task setUpTask;
+    };
+
+    int assignVertexSlots(RenderState &state);
+    void shadeVertices(const DrawCommand &command, int index);
+    void setUpTriangle(const DrawCommand &command, int triangleIndex);
+    static bool overlapsTile(const Triangle &tri, int tileX, int tileY,
+                             const HierarchicalZ &hierarchicalZ,
+                             vmask_t &outHiddenRegions, int &hiddenTriangles);
+    static void setUpFiller(TriangleFiller &filler, const Triangle &tri);
+    static int rasterizeTriangle(const Frame &frame, TriangleFiller &filler,
+                                 const Triangle &tri, int tileX, int tileY,
+                                 vmask_t hiddenRegions);
+    void fillTile(Frame &frame, int index);
+    static void shadeDeferredTriangles(const Frame &frame, TriangleFiller &filler,
+                                       TriangleRefArray &triangles, int firstId,
+                                       int tileX, int tileY);
+    static int splitRuns(const TriangleArray &bin, TriangleRun *outRuns);
+    static const Triangle *mergeRuns(TriangleRun *runs, int &numRuns);
+    void wireframeTile(const Frame &frame, int index);
+    static void _shadeVertices(void *_castToCommand, int index);
+    static void _setUpTriangle(void *_castToCommand, int index);
+    static void _fillTile(void *_castToFrame, int index);
+    static void _wireframeTile(void *_castToFrame, int index);
+    void clipOne(Frame &frame, int sequence, const RenderState &command, const float *params0,
+                 const float *params1, const float *params2);
+    void clipTwo(Frame &frame, int sequence, const RenderState &command, const float *params0,
+                 const float *params1, const float *params2);
+    void enqueueTriangle(Frame &frame, int sequence, const RenderState &command,
+                         const float *params0, const float *params1, const float *params2);
+
     bool fClearColorBuffer;
     RenderTarget *fRenderTarget = nullptr;
-    TriangleArray *fTiles = nullptr;
     int fFbWidth = 0;
     int fFbHeight = 0;
     int fTileColumns = 0;
     int fTileRows = 0;
-    RegionAllocator fAllocator;
+    unsigned int fWorkingMemSize;
+    Frame fFrames[2];
+    int fSubmitFrame = 0;               // Index of frame receiving commands
+    Frame *fRenderingFrame = nullptr;   // Frame in the pixel phase, if any
+    RegionAllocator *fAllocator;        // fFrames[fSubmitFrame].allocator
+    bool fEnablePipelining = false;
     RenderState fCurrentState;
-    DrawQueue fDrawQueue;
-    DrawQueue::iterator fRenderCommandIterator = fDrawQueue.end();
-    int fBaseSequenceNumber = 0;
     unsigned int fClearColor = 0xff000000;
     bool fWireframeMode = false;
+    bool fEnableVisibilityBuffer = false;
+
+    // Indexed by get_worker_index(). Null until that worker uses it.
+    veci16_t *fVisibilityBuffers[MAX_WORKER_THREADS] = {};
+
+    // Vertices shaded in the last frame, and the number that would have been
+    // shaded without indexed shading.
+    int fShadedVertices = 0;
+    int fAttributeVertices = 0;
+
+    // Draw calls and triangles skipped by bounding box culling in the last
+    // frame.
+    int fCulledDraws = 0;
+    int fCulledTriangles = 0;
+
+    // Copied from the Frame when it finishes rendering.
+    int fHiddenTriangles = 0;
+    int fHiddenRegions = 0;
+    int fSkippedDepthReads = 0;
 };
 
 } // namespace librender
@@ -17,6 +17,7 @@
 
 #pragma once
 
+#include "Matrix.h"
 #include "RenderBuffer.h"
 #include "Texture.h"
 
@@ -29,11 +30,26 @@ struct RenderState
 {
     bool fEnableDepthBuffer = false;
     bool fEnableBlend = false;
+    bool fShadeReferencedVertices = false;
     const RenderBuffer *fVertexAttrBuffer = nullptr;
     const RenderBuffer *fIndexBuffer = nullptr;
     const void *fUniforms = nullptr;
     int fParamsPerVertex = 0;
     float *fVertexParams = nullptr;
+
+    // If fShadeReferencedVertices is set, fVertexParams only contains the
+    // vertices the index buffer references. fVertexSlots maps a vertex index
+    // to its position in fVertexParams, and fShadedVertices is the reverse.
+    int fNumShadedVertices = 0;
+    const int *fVertexSlots = nullptr;
+    const int *fShadedVertices = nullptr;
+    // If fCullToBounds is set, all vertices are inside the box from
+    // fBoundsMin to fBoundsMax, and fBoundsTransform converts it to the
+    // same clip space coordinates that the vertex shader outputs.
+    bool fCullToBounds = false;
+    Vec3 fBoundsMin;
+    Vec3 fBoundsMax;
+    Matrix fBoundsTransform;
     const class Shader *fShader = nullptr;
     const Texture *fTextures[kMaxActiveTextures];
     enum CullingMode
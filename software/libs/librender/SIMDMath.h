@@ -96,6 +96,36 @@ inline vecf16_t absfv(vecf16_t in)
     return vecf16_t(veci16_t(in) & 0x7fffffff);
 }
 
+// Smallest value in any lane
+inline float horizontalMin(vecf16_t in)
+{
+    const veci16_t kSwap8 = { 8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7 };
+    const veci16_t kSwap4 = { 4, 5, 6, 7, 0, 1, 2, 3, 12, 13, 14, 15, 8, 9, 10, 11 };
+    const veci16_t kSwap2 = { 2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13 };
+    const veci16_t kSwap1 = { 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14 };
+
+    in = min(in, __builtin_nyuzi_shufflef(in, kSwap8));
+    in = min(in, __builtin_nyuzi_shufflef(in, kSwap4));
+    in = min(in, __builtin_nyuzi_shufflef(in, kSwap2));
+    in = min(in, __builtin_nyuzi_shufflef(in, kSwap1));
+    return in[0];
+}
+
+// Largest value in any lane
+inline float horizontalMax(vecf16_t in)
+{
+    const veci16_t kSwap8 = { 8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7 };
+    const veci16_t kSwap4 = { 4, 5, 6, 7, 0, 1, 2, 3, 12, 13, 14, 15, 8, 9, 10, 11 };
+    const veci16_t kSwap2 = { 2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13 };
+    const veci16_t kSwap1 = { 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14 };
+
+    in = max(in, __builtin_nyuzi_shufflef(in, kSwap8));
+    in = max(in, __builtin_nyuzi_shufflef(in, kSwap4));
+    in = max(in, __builtin_nyuzi_shufflef(in, kSwap2));
+    in = max(in, __builtin_nyuzi_shufflef(in, kSwap1));
+    return in[0];
+}
+
 // "Quake" fast inverse square root
 // The integer casts here do not perform float/int conversions
 // but just interpret the numbers directly as the opposite type.
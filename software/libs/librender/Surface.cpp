@@ -22,11 +22,13 @@
 namespace librender
 {
 
-Surface::Surface(int width, int height, ColorSpace colorSpace, void *base)
+Surface::Surface(int width, int height, ColorSpace colorSpace, void *base, Layout layout)
     : fWidth(width),
       fHeight(height)
 {
     fColorSpace = colorSpace;
+    fLayout = layout;
+    assert(layout == LINEAR || canUseTiledLayout(width, height, colorSpace));
     switch (colorSpace)
     {
         case RGBA8888:
@@ -38,15 +40,25 @@ Surface::Surface(int width, int height, ColorSpace colorSpace, void *base)
             fBytesPerPixel = 1;
             break;
 
+        case BC1:
+            // Not meaningful for blocks. The stride is the size of one row
+            // of blocks.
+            assert((width & 3) == 0 && (height & 3) == 0);
+            fBytesPerPixel = 0;
+            break;
+
         default:
             assert(0);
     }
 
-    fStride = width * fBytesPerPixel;
+    if (colorSpace == BC1)
+        fStride = width * 2;
+    else
+        fStride = width * fBytesPerPixel;
+
     if (base == nullptr)
     {
-        fBaseAddress = reinterpret_cast<int>(memalign(kCacheLineSize,
-             static_cast<size_t>(width * height * fBytesPerPixel)));
+        fBaseAddress = reinterpret_cast<int>(memalign(kCacheLineSize, getSizeInBytes()));
         fOwnedPointer = true;
     }
     else
@@ -64,6 +76,14 @@ Surface::~Surface()
         ::free(reinterpret_cast<void*>(fBaseAddress));
 }
 
+size_t Surface::getSizeInBytes() const
+{
+    if (fColorSpace == BC1)
+        return static_cast<size_t>(fStride * (fHeight / 4));
+
+    return static_cast<size_t>(fStride * fHeight);
+}
+
 void Surface::initializeOffsetVectors()
 {
     // Screen space coordinate offset vector
@@ -144,9 +164,47 @@ void Surface::slowClearTile(int left, int top, unsigned int value)
 
             break;
         }
+
+        default:
+            assert(0);  // Not supported for compressed surfaces
+    }
+
+
+}
+
+// Return a pointer to the pixel at x, y. x must be a multiple of four and
+// the color space 32 bits per pixel. In both layouts, the four pixels that
+// start here are contiguous.
+uint32_t *Surface::getRowPointer(int x, int y) const
+{
+    if (fLayout == TILED)
+    {
+        return reinterpret_cast<uint32_t*>(fBaseAddress + (y >> 2) * fStride * 4
+                                           + (x >> 2) * kCacheLineSize + (y & 3) * 16);
     }
 
+    return reinterpret_cast<uint32_t*>(fBaseAddress + y * fStride + x * 4);
+}
+
+void Surface::copyPixels(const Surface &source)
+{
+    assert(source.fWidth == fWidth && source.fHeight == fHeight
+           && source.fColorSpace == fColorSpace);
+    if (source.fLayout == fLayout)
+    {
+        ::memcpy(reinterpret_cast<void*>(fBaseAddress),
+                 reinterpret_cast<const void*>(source.fBaseAddress),
+                 getSizeInBytes());
+        return;
+    }
 
+    // Layouts can only differ for surfaces with 32 bpp and sizes that are
+    // multiples of four.
+    for (int y = 0; y < fHeight; y++)
+    {
+        for (int x = 0; x < fWidth; x += 4)
+            ::memcpy(getRowPointer(x, y), source.getRowPointer(x, y), 16);
+    }
 }
 
 // Push a NxN tile from the L2 cache back to system memory
@@ -48,13 +48,41 @@ inline veci16_t wrapiv(veci16_t in, int max)
 Texture::Texture()
 {
     for (int i = 0; i < kMaxMipLevels; i++)
+    {
         fMipSurfaces[i] = nullptr;
+        fOwnedSurfaces[i] = nullptr;
+    }
+}
+
+Texture::~Texture()
+{
+    for (int i = 0; i < kMaxMipLevels; i++)
+        freeMipSurface(i);
+}
+
+void Texture::freeMipSurface(int mipLevel)
+{
+    delete fOwnedSurfaces[mipLevel];
+    fOwnedSurfaces[mipLevel] = nullptr;
+    fMipSurfaces[mipLevel] = nullptr;
 }
 
 void Texture::setMipSurface(int mipLevel, const Surface *surface)
 {
     assert(mipLevel < kMaxMipLevels);
 
+    freeMipSurface(mipLevel);
+    if (fEnableTiledLayout && surface->getLayout() == Surface::LINEAR
+            && Surface::canUseTiledLayout(surface->getWidth(), surface->getHeight(),
+                                          surface->getColorSpace()))
+    {
+        fOwnedSurfaces[mipLevel] = new Surface(surface->getWidth(), surface->getHeight(),
+                                               surface->getColorSpace(), nullptr,
+                                               Surface::TILED);
+        fOwnedSurfaces[mipLevel]->copyPixels(*surface);
+        surface = fOwnedSurfaces[mipLevel];
+    }
+
     fMipSurfaces[mipLevel] = surface;
     if (mipLevel > fMaxMipLevel)
         fMaxMipLevel = mipLevel;
@@ -64,8 +92,8 @@ void Texture::setMipSurface(int mipLevel, const Surface *surface)
         fBaseMipBits = __builtin_clz(static_cast<unsigned int>(surface->getWidth())) + 1;
 
         // Clear out lower mip levels
-        for (int i = 1; i < fMaxMipLevel; i++)
-            fMipSurfaces[i] = 0;
+        for (int i = 1; i <= fMaxMipLevel; i++)
+            freeMipSurface(i);
 
         fMaxMipLevel = 0;
     }
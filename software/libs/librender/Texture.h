@@ -29,6 +29,7 @@ class Texture
 {
 public:
     Texture();
+    ~Texture();
     Texture(const Texture&) = delete;
     Texture& operator=(const Texture&) = delete;
 
@@ -36,6 +37,9 @@ public:
     // This does not take ownership of the surfaces and will not free them.
     // mipLevel 0 must be set before higher levels. Calling this with miplevel
     // 0 after setting other levels will clear the other levels.
+    // If the tiled layout is enabled, this copies the surface into a new
+    // surface with the TILED layout (if its size and format allow it). In that
+    // case, the texture doesn't use the original surface after this returns.
     void setMipSurface(int mipLevel, const Surface *surface);
 
     // Read up to 16 pixel values
@@ -55,9 +59,20 @@ public:
         fEnableBilinearFiltering = enable;
     }
 
+    // If enable is true, surfaces set after this call are converted to the
+    // cache friendly TILED layout (see Surface.h).
+    void enableTiledLayout(bool enable)
+    {
+        fEnableTiledLayout = enable;
+    }
+
 private:
+    void freeMipSurface(int mipLevel);
+
     const Surface *fMipSurfaces[kMaxMipLevels];
+    Surface *fOwnedSurfaces[kMaxMipLevels];
     bool fEnableBilinearFiltering = false;
+    bool fEnableTiledLayout = false;
     int fBaseMipBits = 0;
     int fMaxMipLevel = 0;
 };
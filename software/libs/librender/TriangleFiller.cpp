@@ -21,8 +21,9 @@
 namespace librender
 {
 
-TriangleFiller::TriangleFiller(RenderTarget *target)
+TriangleFiller::TriangleFiller(RenderTarget *target, HierarchicalZ *hierarchicalZ)
     :  fTarget(target),
+       fHierarchicalZ(hierarchicalZ),
        fTwoOverWidth(2.0f / target->getColorBuffer()->getWidth()),
        fTwoOverHeight(2.0f / target->getColorBuffer()->getHeight()),
        fOneOverZInterpolator()
@@ -52,7 +53,7 @@ void TriangleFiller::setUpTriangle(const RenderState *state,
     fZ0 = z0;
     fZ1 = z1;
     fZ2 = z2;
-
+    fMinZ = min(min(z0, z1), z2);
 
     // The following system of equations describes the relationship
     // between the vertical and horizontal gradients (gx, gy),
@@ -85,6 +86,7 @@ void TriangleFiller::setUpTriangle(const RenderState *state,
     }
 
     fNumParams = 0;
+    fNumInterpolatedParams = 0;
 }
 
 void TriangleFiller::setUpInterpolator(LinearInterpolator &interpolator, float c0, float c1,
@@ -109,77 +111,102 @@ void TriangleFiller::setUpParam(float c0, float c1, float c2)
     if (c0 == c1 && c0 == c2)
     {
         // If this is a constant, we can skip interpolation.
-        fParameters[fNumParams].isConstant = true;
-        fParameters[fNumParams].constantValue = c0;
-    }
-    else if (fNeedPerspective)
-    {
-        // Perspective interpolator.
-        // These must be divided by Z to be perspective correct, as described above.
-        fParameters[fNumParams].isConstant = false;
-        setUpInterpolator(fParameters[fNumParams].linearInterpolator,
-                          c0 / fZ0, c1 / fZ1, c2 / fZ2);
+        fParamValues[fNumParams] = c0;
     }
     else
     {
-        // Non-perspective interpolator. If all Zs are the same, we can just do linear
-        // interpolation and save extra divisions.
-        fParameters[fNumParams].isConstant = false;
-        setUpInterpolator(fParameters[fNumParams].linearInterpolator,
-                          c0, c1, c2);
+        fInterpolatedParams[fNumInterpolatedParams].paramIndex = fNumParams;
+        if (fNeedPerspective)
+        {
+            // Perspective interpolator.
+            // These must be divided by Z to be perspective correct, as described above.
+            setUpInterpolator(fInterpolatedParams[fNumInterpolatedParams].linearInterpolator,
+                              c0 / fZ0, c1 / fZ1, c2 / fZ2);
+        }
+        else
+        {
+            // Non-perspective interpolator. If all Zs are the same, we can just do linear
+            // interpolation and save extra divisions.
+            setUpInterpolator(fInterpolatedParams[fNumInterpolatedParams].linearInterpolator,
+                              c0, c1, c2);
+        }
+
+        fNumInterpolatedParams++;
     }
 
     fNumParams++;
 }
 
+template <int kVariant>
 void TriangleFiller::fillMasked(int left, int top, vmask_t mask)
 {
+    const bool kDepthBuffer = (kVariant & kDepthBufferVariant) != 0;
+    const bool kBlend = (kVariant & kBlendVariant) != 0;
+    const bool kPerspective = (kVariant & kPerspectiveVariant) != 0;
+    const bool kVisibility = (kVariant & kVisibilityVariant) != 0;
+
     // Convert from raster to screen space coordinates.
     vecf16_t x = fTarget->getColorBuffer()->getXStep() + (left * fTwoOverWidth - 1.0f);
     vecf16_t y = 1.0f - top * fTwoOverHeight - fTarget->getColorBuffer()->getYStep();
 
     // Depth buffer
     vecf16_t zValues;
-    if (fNeedPerspective)
+    if (kPerspective)
         zValues = 1.0f / fOneOverZInterpolator.getValuesAt(x, y);
     else
         zValues = fZ0;
 
-    if (fState->fEnableDepthBuffer)
-    {
-        vecf16_t depthBufferValues = vecf16_t(fTarget->getDepthBuffer()->readBlock(left, top));
-        int passDepthTest = __builtin_nyuzi_mask_cmpf_gt(zValues, depthBufferValues);
-
-        // Early Z optimization: any pixels that fail the Z test are removed
-        // from the pixel mask.
-        mask &= passDepthTest;
-        if (mask == 0)
-            return; // All pixels are occluded
-
-        fTarget->getDepthBuffer()->writeBlockMasked(left, top, mask, vecu16_t(zValues));
-    }
-
-    // Interpolate parameters
-    vecf16_t interpolatedParams[kMaxParams];
-    for (int paramIndex = 0; paramIndex < fNumParams; paramIndex++)
+    if (kDepthBuffer)
     {
-        if (fParameters[paramIndex].isConstant)
-            interpolatedParams[paramIndex] = fParameters[paramIndex].constantValue;
-        else if (fNeedPerspective)
+        Surface *depthBuffer = fTarget->getDepthBuffer();
+        vecf16_t newDepthValues;
+        if (mask == 0xffff && fHierarchicalZ->isRegionBelow(left, top, fMinZ))
         {
-            interpolatedParams[paramIndex] = fParameters[paramIndex].linearInterpolator
-                                             .getValuesAt(x, y) * zValues;
+            // All pixels are in front of everything drawn so far, so
+            // they pass the depth test.
+            newDepthValues = zValues;
+            fSkippedDepthReads++;
         }
         else
         {
-            interpolatedParams[paramIndex] = fParameters[paramIndex].linearInterpolator
-                                             .getValuesAt(x, y);
+            vecf16_t depthBufferValues = vecf16_t(depthBuffer->readBlock(left, top));
+            int passDepthTest = __builtin_nyuzi_mask_cmpf_gt(zValues, depthBufferValues);
+
+            // Early Z optimization: any pixels that fail the Z test are removed
+            // from the pixel mask.
+            mask &= passDepthTest;
+            if (mask == 0)
+                return; // All pixels are occluded
+
+            newDepthValues = __builtin_nyuzi_vector_mixf(mask, zValues, depthBufferValues);
         }
+
+        depthBuffer->writeBlockMasked(left, top, mask, vecu16_t(zValues));
+        fHierarchicalZ->update(left, top, newDepthValues);
+    }
+
+    if (kVisibility)
+    {
+        // Shading happens later, in shadeVisiblePixels
+        veci16_t &ids = fVisibilityBuffer[((top - fTileTop) >> 2) * (kTileSize / 4)
+                                          + ((left - fTileLeft) >> 2)];
+        ids = __builtin_nyuzi_vector_mixi(mask, veci16_t(fTriangleId), ids);
+        return;
+    }
+
+    // Interpolate parameters. Constant parameters are already set.
+    for (int i = 0; i < fNumInterpolatedParams; i++)
+    {
+        vecf16_t value = fInterpolatedParams[i].linearInterpolator.getValuesAt(x, y);
+        if (kPerspective)
+            value *= zValues;
+
+        fParamValues[fInterpolatedParams[i].paramIndex] = value;
     }
 
     // Shade
     vecf16_t color[4];
-    fState->fShader->shadePixels(color, interpolatedParams, fState->fUniforms, fState->fTextures,
+    fState->fShader->shadePixels(color, fParamValues, fState->fUniforms, fState->fTextures,
                                  mask);
 
 
@@ -196,7 +223,7 @@ void TriangleFiller::fillMasked(int left, int top, vmask_t mask)
             vecu16_t bS = __builtin_convertvector(clamp(color[kColorB], 0.0, 1.0) * 255.0f, vecu16_t);
 
             // If all pixels are fully opaque, don't bother trying to blend them.
-            if (fState->fEnableBlend
+            if (kBlend
                     && (__builtin_nyuzi_mask_cmpf_lt(color[kColorA], vecf16_t(1.0f)) & mask) != 0)
             {
                 vecu16_t aS = __builtin_convertvector(clamp(color[kColorA], 0.0, 1.0) * 255.0f, vecu16_t)
@@ -232,5 +259,44 @@ void TriangleFiller::fillMasked(int left, int top, vmask_t mask)
     destSurface->writeBlockMasked(left, top, mask, vecu16_t(pixelValues));
 }
 
+template void TriangleFiller::fillMasked<0>(int left, int top, vmask_t mask);
+template void TriangleFiller::fillMasked<1>(int left, int top, vmask_t mask);
+template void TriangleFiller::fillMasked<2>(int left, int top, vmask_t mask);
+template void TriangleFiller::fillMasked<3>(int left, int top, vmask_t mask);
+template void TriangleFiller::fillMasked<4>(int left, int top, vmask_t mask);
+template void TriangleFiller::fillMasked<5>(int left, int top, vmask_t mask);
+template void TriangleFiller::fillMasked<6>(int left, int top, vmask_t mask);
+template void TriangleFiller::fillMasked<7>(int left, int top, vmask_t mask);
+template void TriangleFiller::fillMasked<8>(int left, int top, vmask_t mask);
+template void TriangleFiller::fillMasked<9>(int left, int top, vmask_t mask);
+template void TriangleFiller::fillMasked<10>(int left, int top, vmask_t mask);
+template void TriangleFiller::fillMasked<11>(int left, int top, vmask_t mask);
+template void TriangleFiller::fillMasked<12>(int left, int top, vmask_t mask);
+template void TriangleFiller::fillMasked<13>(int left, int top, vmask_t mask);
+template void TriangleFiller::fillMasked<14>(int left, int top, vmask_t mask);
+template void TriangleFiller::fillMasked<15>(int left, int top, vmask_t mask);
+
+void TriangleFiller::shadeVisiblePixels(int left, int top, int right, int bottom)
+{
+    // The depth test is already done, and visibility buffer triangles don't
+    // blend.
+    for (int y = top; y < bottom; y += 4)
+    {
+        const veci16_t *ids = fVisibilityBuffer + ((y - fTileTop) >> 2) * (kTileSize / 4)
+                              + ((left - fTileLeft) >> 2);
+        for (int x = left; x < right; x += 4, ids++)
+        {
+            const vmask_t mask = __builtin_nyuzi_mask_cmpi_eq(*ids, veci16_t(fTriangleId));
+            if (mask == 0)
+                continue;
+
+            if (fNeedPerspective)
+                fillMasked<kPerspectiveVariant>(x, y, mask);
+            else
+                fillMasked<0>(x, y, mask);
+        }
+    }
+}
+
 } // namespace librender
 
@@ -18,6 +18,7 @@
 #pragma once
 
 #include <stdint.h>
+#include "HierarchicalZ.h"
 #include "LinearInterpolator.h"
 #include "RenderState.h"
 #include "RenderTarget.h"
@@ -33,19 +34,84 @@ const int kMaxParams = 16;
 // It maintains state for one triangle at a time. The rasterizer calls
 // it for each 4x4 batch of pixels.
 //
+// fillMasked is specialized for each combination of the options that are
+// fixed for a triangle, so the checks for them are not in the inner loop.
+// The rasterizer calls getVariant once per triangle and uses the matching
+// instance.
+//
+// With a visibility buffer (setVisibilityBuffer), fillMasked only does the
+// depth test and records the ID of the triangle that covers each pixel.
+// shadeVisiblePixels then runs the pixel shader for the pixels that belong
+// to a triangle, once each.
+//
 class TriangleFiller
 {
 public:
-    explicit TriangleFiller(RenderTarget *target);
+    // Flags for the fillMasked template parameter
+    enum
+    {
+        kDepthBufferVariant = 1,
+        kBlendVariant = 2,
+        kPerspectiveVariant = 4,
+        kVisibilityVariant = 8,
+        kNumVariants = 16
+    };
+
+    // hierarchicalZ must match the depth buffer of the tile being filled.
+    // The filler updates it when it writes depth values.
+    TriangleFiller(RenderTarget *target, HierarchicalZ *hierarchicalZ);
 
     TriangleFiller(const TriangleFiller&) = delete;
     TriangleFiller& operator=(const TriangleFiller&) = delete;
 
     // The rasterizer calls this to fill a 4x4 block.  The left and top
     // coordinates are raster coordinates (count of pixels from the upper
-    // left corner).
+    // left corner). kVariant must be the value getVariant returns for the
+    // current triangle.
+    template <int kVariant>
     void fillMasked(int left, int top, vmask_t mask);
 
+    // Return the fillMasked variant for the current triangle. This is valid
+    // after setUpTriangle is called.
+    int getVariant() const
+    {
+        if (fVisibilityBuffer)
+        {
+            return kVisibilityVariant | kDepthBufferVariant
+                   | (fNeedPerspective ? kPerspectiveVariant : 0);
+        }
+
+        return (fState->fEnableDepthBuffer ? kDepthBufferVariant : 0)
+               | (fState->fEnableBlend ? kBlendVariant : 0)
+               | (fNeedPerspective ? kPerspectiveVariant : 0);
+    }
+
+    // buffer holds a triangle ID for each pixel of the tile at left, top.
+    // Each 4x4 block is one vector, and blocks are stored in rows. While
+    // this is set, fillMasked writes IDs instead of shading pixels. Only
+    // triangles with the depth buffer enabled and blending disabled can be
+    // drawn this way. Pass null to go back to shading pixels directly.
+    void setVisibilityBuffer(veci16_t *buffer, int left, int top)
+    {
+        fVisibilityBuffer = buffer;
+        fTileLeft = left;
+        fTileTop = top;
+    }
+
+    // The ID that fillMasked writes to the visibility buffer for the current
+    // triangle.
+    void setTriangleId(int id)
+    {
+        fTriangleId = id;
+    }
+
+    // Shade the pixels in the visibility buffer with the current triangle's
+    // ID, after all triangles have been drawn into it. This only checks
+    // blocks in the rectangle, which is in raster coordinates and must be
+    // inside the tile. left and top must be multiples of four. The
+    // triangle's parameters must be set up.
+    void shadeVisiblePixels(int left, int top, int right, int bottom);
+
     // This is called before setUpParam. The coordinates represent the
     // on-screen position of the triangle.
     void setUpTriangle(const RenderState *state,
@@ -58,30 +124,47 @@ public:
     // parameter at each of the three triangle points.
     void setUpParam(float c1, float c2, float c3);
 
+    // Number of 4x4 blocks where the depth test trivially passed, so this
+    // didn't read the depth buffer.
+    int getSkippedDepthReads() const
+    {
+        return fSkippedDepthReads;
+    }
+
 private:
     void setUpInterpolator(LinearInterpolator &interpolator, float c0, float c1,
                            float c2);
 
     const RenderState *fState = nullptr;
     RenderTarget *fTarget;
+    HierarchicalZ *fHierarchicalZ;
+    int fSkippedDepthReads = 0;
+    veci16_t *fVisibilityBuffer = nullptr;
+    int fTileLeft = 0;
+    int fTileTop = 0;
+    int fTriangleId = 0;
 
     // 2.0 divided by the resolution of the screen in pixels. Used to convert
     // from raster coordinates to screen space (-1.0 to 1.0).
     float fTwoOverWidth;
     float fTwoOverHeight;
 
-    // Parameter interpolation
+    // Parameter interpolation. fParamValues holds the values passed to the
+    // pixel shader. setUpParam fills in parameters that are constant across
+    // the triangle, and fillMasked only updates the interpolated ones.
     LinearInterpolator fOneOverZInterpolator;
+    vecf16_t fParamValues[kMaxParams];
     struct
     {
-        bool isConstant;
-        float constantValue;
+        int paramIndex;
         LinearInterpolator linearInterpolator;
-    } fParameters[kMaxParams] = {};
+    } fInterpolatedParams[kMaxParams] = {};
     int fNumParams = 0;
+    int fNumInterpolatedParams = 0;
     float fZ0;
     float fZ1;
     float fZ2;
+    float fMinZ;
     float fX0;
     float fY0;
     bool fNeedPerspective;
@@ -21,5 +21,6 @@ sys.path.insert(0, '../..')
 import test_harness
 
 test_harness.register_generic_assembly_tests(
-    test_harness.find_files(('.s', '.S')), ['emulator', 'verilator', 'fpga'])
+    test_harness.find_files(('.s', '.S')),
+    ['emulator', 'emulator-threaded', 'emulator-jit', 'verilator', 'fpga'])
 test_harness.execute_tests()
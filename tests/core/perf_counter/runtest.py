@@ -21,5 +21,5 @@ sys.path.insert(0, '../..')
 import test_harness
 
 test_harness.register_generic_assembly_tests(['perf_counter.S'],
-    ['verilator', 'fpga'])
+    ['emulator', 'verilator', 'fpga'])
 test_harness.execute_tests()
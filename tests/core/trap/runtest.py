@@ -67,8 +67,13 @@ test_harness.register_generic_assembly_tests([
     'unaligned_inst_fault.S',
     'unaligned_data_fault.S',
     'multicycle.S',
-    'illegal_instruction.S',
     'int_config.S'
 ], ['emulator', 'verilator', 'fpga'])
 
+# Threaded dispatch mode selects handlers per instruction, so also check that
+# it raises the same traps for invalid encodings.
+test_harness.register_generic_assembly_tests([
+    'illegal_instruction.S'
+], ['emulator', 'emulator-threaded', 'emulator-jit', 'verilator', 'fpga'])
+
 test_harness.execute_tests()
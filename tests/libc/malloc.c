@@ -0,0 +1,134 @@
+//
+// Copyright 2018 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+// Allocate blocks of every small size and some large ones, and check that
+// they don't overlap and keep their contents through realloc. Sizes up to
+// 1024 come from the thread caches, larger ones from dlmalloc.
+//
+
+#define NUM_BLOCKS 1200
+
+unsigned char *blocks[NUM_BLOCKS];
+
+int block_size(int index)
+{
+    return index < 1100 ? index : 1024 + (index - 1100) * 97;
+}
+
+int check_block(int index, int size)
+{
+    for (int i = 0; i < size; i++)
+    {
+        if (blocks[index][i] != (unsigned char) (index + i))
+            return 0;
+    }
+
+    return 1;
+}
+
+int main()
+{
+    int errors = 0;
+
+    for (int i = 0; i < NUM_BLOCKS; i++)
+    {
+        blocks[i] = (unsigned char*) malloc(block_size(i));
+        if (blocks[i] == NULL || ((uintptr_t) blocks[i] & 7) != 0)
+            errors++;
+
+        for (int j = 0; j < block_size(i); j++)
+            blocks[i][j] = (unsigned char) (i + j);
+    }
+
+    for (int i = 0; i < NUM_BLOCKS; i++)
+    {
+        if (!check_block(i, block_size(i)))
+            errors++;
+    }
+
+    printf("malloc errors %d\n", errors);
+    // CHECK: malloc errors 0
+
+    // Free every other block, then reuse the space.
+    for (int i = 0; i < NUM_BLOCKS; i += 2)
+        free(blocks[i]);
+
+    for (int i = 0; i < NUM_BLOCKS; i += 2)
+    {
+        blocks[i] = (unsigned char*) malloc(block_size(i));
+        for (int j = 0; j < block_size(i); j++)
+            blocks[i][j] = (unsigned char) (i + j);
+    }
+
+    for (int i = 0; i < NUM_BLOCKS; i++)
+    {
+        if (!check_block(i, block_size(i)))
+            errors++;
+    }
+
+    printf("reuse errors %d\n", errors);
+    // CHECK: reuse errors 0
+
+    // Grow each block across size classes and into dlmalloc.
+    for (int i = 0; i < NUM_BLOCKS; i += 7)
+    {
+        blocks[i] = (unsigned char*) realloc(blocks[i], block_size(i) * 3 + 20);
+        if (blocks[i] == NULL || !check_block(i, block_size(i)))
+            errors++;
+    }
+
+    printf("realloc errors %d\n", errors);
+    // CHECK: realloc errors 0
+
+    for (int i = 0; i < NUM_BLOCKS; i++)
+        free(blocks[i]);
+
+    {
+        unsigned char *small = (unsigned char*) calloc(10, 30);
+        unsigned char *large = (unsigned char*) calloc(100, 30);
+        for (int i = 0; i < 300; i++)
+            errors += small[i];
+
+        for (int i = 0; i < 3000; i++)
+            errors += large[i];
+
+        free(small);
+        free(large);
+    }
+
+    printf("calloc errors %d\n", errors);
+    // CHECK: calloc errors 0
+
+    for (int alignment = 4; alignment <= 4096; alignment *= 2)
+    {
+        void *small = memalign(alignment, 40);
+        void *large = memalign(alignment, 4000);
+        if (((uintptr_t) small & (alignment - 1)) || ((uintptr_t) large & (alignment - 1)))
+            errors++;
+
+        free(small);
+        free(large);
+    }
+
+    printf("memalign errors %d\n", errors);
+    // CHECK: memalign errors 0
+}
@@ -0,0 +1,120 @@
+//
+// Copyright 2018 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <nyuzi.h>
+#include <schedule.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+//
+// Allocate blocks on all threads, then free each block from a different
+// task than the one that allocated it, so blocks move between thread caches.
+// Each block is filled with a pattern that is checked before it is freed,
+// which catches blocks handed out twice.
+//
+
+#define NUM_SLOTS 32
+#define BLOCKS_PER_SLOT 48
+#define NUM_ROUNDS 6
+
+struct block
+{
+    unsigned char *ptr;
+    int size;
+    int owner;
+};
+
+static struct block blocks[NUM_SLOTS][BLOCKS_PER_SLOT];
+static int round;
+static volatile int errors;
+static volatile int cross_thread_frees;
+
+static unsigned char pattern(int slot, int index, int offset)
+{
+    return (unsigned char) (slot * 7 + index * 3 + offset + round);
+}
+
+static void allocate_blocks(void *context, int slot)
+{
+    (void) context;
+
+    for (int i = 0; i < BLOCKS_PER_SLOT; i++)
+    {
+        struct block *block = &blocks[slot][i];
+        block->size = (slot * 37 + i * 101 + round * 13) % 1024 + 1;
+        block->owner = get_current_thread_id();
+        block->ptr = (unsigned char*) malloc(block->size);
+        if (block->ptr == NULL)
+        {
+            __sync_fetch_and_add(&errors, 1);
+            continue;
+        }
+
+        for (int j = 0; j < block->size; j++)
+            block->ptr[j] = pattern(slot, i, j);
+    }
+}
+
+// Free the blocks allocated by another slot.
+static void free_blocks(void *context, int slot)
+{
+    int other = (slot + round + 1) % NUM_SLOTS;
+
+    (void) context;
+
+    for (int i = 0; i < BLOCKS_PER_SLOT; i++)
+    {
+        struct block *block = &blocks[other][i];
+        if (block->ptr == NULL)
+            continue;
+
+        for (int j = 0; j < block->size; j++)
+        {
+            if (block->ptr[j] != pattern(other, i, j))
+            {
+                __sync_fetch_and_add(&errors, 1);
+                break;
+            }
+        }
+
+        if (block->owner != get_current_thread_id())
+            __sync_fetch_and_add(&cross_thread_frees, 1);
+
+        free(block->ptr);
+        block->ptr = NULL;
+    }
+}
+
+int main()
+{
+    if (get_current_thread_id() != 0)
+        worker_thread();
+
+    start_all_threads();
+    for (round = 0; round < NUM_ROUNDS; round++)
+    {
+        parallel_execute(allocate_blocks, NULL, NUM_SLOTS);
+        parallel_execute(free_blocks, NULL, NUM_SLOTS);
+    }
+
+    printf("errors %d\n", errors);
+    // CHECK: errors 0
+
+    printf("freed on another thread: %s\n", cross_thread_frees > 0 ? "yes" : "no");
+    // CHECK: freed on another thread: yes
+
+    return 0;
+}
@@ -0,0 +1,78 @@
+//
+// Copyright 2018 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include <stdio.h>
+#include <string.h>
+
+//
+// Copy between overlapping parts of one buffer in both directions, with
+// a range of alignments and lengths. This exercises the forward and backward
+// copy paths.
+//
+
+unsigned char buffer[768] __attribute__ ((aligned (64)));
+unsigned char expected[768];
+
+int __attribute__ ((noinline)) memmove_trial(int destOffset, int sourceOffset, int length)
+{
+    for (int i = 0; i < sizeof(buffer); i++)
+        buffer[i] = expected[i] = i ^ 0x67;
+
+    for (int i = 0; i < length; i++)
+        expected[destOffset + i] = (sourceOffset + i) ^ 0x67;
+
+    memmove(buffer + destOffset, buffer + sourceOffset, length);
+    for (int i = 0; i < sizeof(buffer); i++)
+    {
+        if (buffer[i] != expected[i])
+        {
+            printf("mismatch @%d (%d,%d,%d) %02x %02x\n", i, destOffset, sourceOffset, length,
+                   buffer[i], expected[i]);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+const int kOffsets[] = {
+    0, 1, 2, 3, 4, 5, 8, 63, 64, 65, 66, 129, 200
+};
+
+const int kLengths[] = {
+    1, 2, 3, 4, 5, 7, 8, 9, 63, 64, 65, 127, 128, 129, 192, 300
+};
+
+int main()
+{
+    for (auto sourceOffset : kOffsets)
+    {
+        for (auto destOffset : kOffsets)
+        {
+            for (auto length : kLengths)
+            {
+                if (!memmove_trial(destOffset, sourceOffset, length))
+                    goto done;
+            }
+        }
+    }
+
+    printf("PASS\n"); // CHECK: PASS
+
+done:
+    return 0;
+}
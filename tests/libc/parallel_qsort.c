@@ -0,0 +1,108 @@
+//
+// Copyright 2015 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <nyuzi.h>
+#include <schedule.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+//
+// parallel_qsort only splits the work between threads for arrays with at
+// least 4096 elements. Sort ints, and records that are a multiple of 64
+// bytes, so the buckets are sorted with vector swaps. The comparison
+// function records which threads called it.
+//
+
+#define NUM_INTS 20000
+#define NUM_RECORDS 6000
+
+struct record
+{
+    int key;
+    int index;
+    int payload[14];
+} __attribute__((aligned(64)));
+
+static volatile unsigned int thread_mask;
+
+int cmpint(const void *a, const void *b)
+{
+    __sync_fetch_and_or(&thread_mask, 1u << get_current_thread_id());
+    return *((const int*) a) - *((const int*) b);
+}
+
+int main(void)
+{
+    static int ints[NUM_INTS];
+    static struct record records[NUM_RECORDS];
+    int i;
+    size_t j;
+
+    if (get_current_thread_id() != 0)
+        worker_thread();
+
+    start_all_threads();
+
+    // Keys are a permutation of 0 to count - 1.
+    for (i = 0; i < NUM_INTS; i++)
+        ints[i] = (i * 7919) % NUM_INTS;
+
+    parallel_qsort(ints, NUM_INTS, sizeof(int), cmpint);
+    for (i = 0; i < NUM_INTS; i++)
+    {
+        if (ints[i] != i)
+            break;
+    }
+
+    printf("ints %s\n", i == NUM_INTS ? "sorted" : "not sorted");
+
+    // CHECK: ints sorted
+
+    // The payload shows if any part of a record was not moved with the rest.
+    for (i = 0; i < NUM_RECORDS; i++)
+    {
+        records[i].key = (i * 7919) % NUM_RECORDS;
+        records[i].index = i;
+        for (j = 0; j < 14; j++)
+            records[i].payload[j] = i * 31 + j;
+    }
+
+    parallel_qsort(records, NUM_RECORDS, sizeof(struct record), cmpint);
+    for (i = 0; i < NUM_RECORDS; i++)
+    {
+        if (records[i].key != i || (records[i].index * 7919) % NUM_RECORDS != i)
+            break;
+
+        for (j = 0; j < 14; j++)
+        {
+            if (records[i].payload[j] != records[i].index * 31 + (int) j)
+                break;
+        }
+
+        if (j != 14)
+            break;
+    }
+
+    printf("records %s\n", i == NUM_RECORDS ? "sorted" : "not sorted");
+
+    // CHECK: records sorted
+
+    printf("%s threads\n", (thread_mask & (thread_mask - 1)) != 0 ? "multiple" : "one");
+
+    // CHECK: multiple threads
+
+    return 0;
+}
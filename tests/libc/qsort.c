@@ -14,23 +14,137 @@
 // limitations under the License.
 //
 
+#include <stdio.h>
 #include <stdlib.h>
 
 
 #define NUM_ELEMENTS 16
+#define NUM_LARGE_ELEMENTS 1000
+
+struct record
+{
+    int key;
+    int index;
+    char pad[5];
+} __attribute__((packed));
+
+// Sizes that are a multiple of 64 bytes, so qsort swaps a vector at a time.
+struct vector_record
+{
+    int key;
+    int index;
+    int payload[14];
+} __attribute__((aligned(64)));
+
+struct wide_vector_record
+{
+    int key;
+    int index;
+    int payload[46];
+} __attribute__((aligned(64)));
 
 int cmpint(const void *a, const void *b)
 {
     return *((int*)a) - *((int*)b);
 }
 
+int cmprecord(const void *a, const void *b)
+{
+    return ((const struct record*)a)->key - ((const struct record*)b)->key;
+}
+
+// Each record is an array of ints: the key, the original index, then a
+// payload computed from the index, which shows if any part of a record
+// was not swapped with the rest. Keys are a permutation of 0 to count - 1.
+void fill_records(char *base, size_t width, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        int *record = (int*) (base + i * width);
+        record[0] = (i * 7919) % count;
+        record[1] = i;
+        for (size_t j = 2; j < width / sizeof(int); j++)
+            record[j] = i * 31 + j;
+    }
+}
+
+int check_records(const char *base, size_t width, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        const int *record = (const int*) (base + i * width);
+        if (record[0] != i || (record[1] * 7919) % count != i)
+            return 0;
+
+        for (size_t j = 2; j < width / sizeof(int); j++)
+        {
+            if (record[j] != record[1] * 31 + (int) j)
+                return 0;
+        }
+    }
+
+    return 1;
+}
+
 int main(void)
 {
     int i;
+    static int largeArray[NUM_LARGE_ELEMENTS];
+    static struct record records[NUM_LARGE_ELEMENTS];
+    static struct vector_record vectorRecords[NUM_LARGE_ELEMENTS];
+    static struct wide_vector_record wideVectorRecords[NUM_LARGE_ELEMENTS];
     int sortArray[] = { 11, 6, 10, 9, 13, 12, 2, 15, 0, 14, 3, 1, 8, 4, 5, 7 };
     qsort(sortArray, NUM_ELEMENTS, sizeof(int), cmpint);
     for (i = 0; i < NUM_ELEMENTS; i++)
         printf("%d ", sortArray[i]);
 
     // CHECK: 0 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15
+
+    // Large enough to partition, with many duplicates.
+    for (i = 0; i < NUM_LARGE_ELEMENTS; i++)
+        largeArray[i] = (i * 7919) % 257;
+
+    qsort(largeArray, NUM_LARGE_ELEMENTS, sizeof(int), cmpint);
+    for (i = 1; i < NUM_LARGE_ELEMENTS; i++)
+    {
+        if (largeArray[i - 1] > largeArray[i])
+            break;
+    }
+
+    printf("\nints %s\n", i == NUM_LARGE_ELEMENTS ? "sorted" : "not sorted");
+
+    // CHECK: ints sorted
+
+    // Elements that are not a multiple of the word size use byte swaps.
+    for (i = 0; i < NUM_LARGE_ELEMENTS; i++)
+    {
+        records[i].key = NUM_LARGE_ELEMENTS - i;
+        records[i].index = i;
+    }
+
+    qsort(records, NUM_LARGE_ELEMENTS, sizeof(struct record), cmprecord);
+    for (i = 0; i < NUM_LARGE_ELEMENTS; i++)
+    {
+        if (records[i].key != i + 1 || records[i].index != NUM_LARGE_ELEMENTS - i - 1)
+            break;
+    }
+
+    printf("records %s\n", i == NUM_LARGE_ELEMENTS ? "sorted" : "not sorted");
+
+    // CHECK: records sorted
+
+    fill_records((char*) vectorRecords, sizeof(struct vector_record), NUM_LARGE_ELEMENTS);
+    qsort(vectorRecords, NUM_LARGE_ELEMENTS, sizeof(struct vector_record), cmpint);
+    printf("64 byte records %s\n", check_records((char*) vectorRecords,
+           sizeof(struct vector_record), NUM_LARGE_ELEMENTS) ? "sorted" : "not sorted");
+
+    // CHECK: 64 byte records sorted
+
+    fill_records((char*) wideVectorRecords, sizeof(struct wide_vector_record),
+                 NUM_LARGE_ELEMENTS);
+    qsort(wideVectorRecords, NUM_LARGE_ELEMENTS, sizeof(struct wide_vector_record), cmpint);
+    printf("192 byte records %s\n", check_records((char*) wideVectorRecords,
+           sizeof(struct wide_vector_record), NUM_LARGE_ELEMENTS) ? "sorted" : "not sorted");
+
+    // CHECK: 192 byte records sorted
 }
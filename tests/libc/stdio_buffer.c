@@ -0,0 +1,57 @@
+//
+// Copyright 2018 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <stdio.h>
+#include <string.h>
+
+//
+// Check that output is the same in each buffering mode, including writes
+// larger than the buffer and partial lines.
+//
+
+int main()
+{
+    char buf[16];
+    char long_str[100];
+
+    memset(long_str, 'x', sizeof(long_str) - 1);
+    long_str[sizeof(long_str) - 1] = '\0';
+
+    printf("line ");
+    fputs("buffered ", stdout);
+    fwrite("output\n", 1, 7, stdout);
+    // CHECK: line buffered output
+
+    setvbuf(stdout, buf, _IOFBF, sizeof(buf));
+    printf("full %d ", 1);
+    printf("%s\n", long_str);
+    // CHECK: full 1 xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx
+    puts("full 2");
+    fflush(stdout);
+    // CHECK: full 2
+
+    setvbuf(stdout, NULL, _IONBF, 0);
+    printf("unbuffered %c", 'a');
+    putchar('\n');
+    // CHECK: unbuffered a
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    printf("end\n");
+    // CHECK: end
+
+    printf("unterminated");
+    // CHECK: unterminated
+}
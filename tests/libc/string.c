@@ -90,6 +90,8 @@ char __attribute__((noinline)) *noinline_strcat(char *c, const char *s)
 int main()
 {
     char dest[64];
+    static char long_str1[256] __attribute__((aligned(64)));
+    static char long_str2[256] __attribute__((aligned(64)));
 
     printf("1.1 %d\n", get_sign(noinline_strcmp("foo", "foot")));   // CHECK: 1.1 -1
     printf("1.2 %d\n", get_sign(noinline_strcmp("foo", "fpo")));    // CHECK: 1.2 -1
@@ -164,4 +166,24 @@ int main()
 
     noinline_strcat(dest, "ghi");
     printf("11.3 %s\n", dest);  // CHECK: 11.3 abcdefghi
+
+    // Long enough to use vector compares and searches, with the differences
+    // and matches in the middle of a vector.
+    memset(long_str1, 'a', 200);
+    long_str1[200] = '\0';
+    long_str1[150] = 'x';
+    memcpy(long_str2, long_str1, 201);
+    long_str2[137] = 'b';
+    printf("12.1 %zu\n", noinline_strlen(long_str1));   // CHECK: 12.1 200
+    printf("12.2 %zu\n", noinline_strlen(long_str1 + 3));   // CHECK: 12.2 197
+    printf("12.3 %d\n", get_sign(noinline_strcmp(long_str1, long_str2))); // CHECK: 12.3 -1
+    printf("12.4 %d\n", get_sign(noinline_strcmp(long_str1 + 5, long_str2 + 5))); // CHECK: 12.4 -1
+    printf("12.5 %d\n", get_sign(noinline_strncmp(long_str2, long_str1, 138))); // CHECK: 12.5 1
+    printf("12.6 %d\n", get_sign(noinline_strncmp(long_str2, long_str1, 137))); // CHECK: 12.6 0
+    printf("12.7 %d\n", get_sign(noinline_memcmp(long_str1, long_str2, 200))); // CHECK: 12.7 -1
+    printf("12.8 %d\n", get_sign(noinline_memcmp(long_str1, long_str2, 137))); // CHECK: 12.8 0
+    printf("12.9 %d\n", noinline_strchr(long_str1, 'x') - long_str1); // CHECK: 12.9 150
+    printf("12.10 %p\n", noinline_strchr(long_str1, 'y')); // CHECK: 12.10 0
+    printf("12.11 %td\n", (char*) noinline_memchr(long_str1, 'x', 200) - long_str1); // CHECK: 12.11 150
+    printf("12.12 %p\n", noinline_memchr(long_str1, 'x', 150)); // CHECK: 12.12 0
 }
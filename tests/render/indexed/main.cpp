@@ -0,0 +1,169 @@
+//
+// Copyright 2018 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+//
+// Validates that indexed shading doesn't change the output. Each draw call
+// uses a scattered subset of a shared grid of vertices, in an arbitrary
+// order and with most vertices shared between triangles, so shaded vertices
+// are in a different order than in the attribute buffer. runtest.py builds
+// this with and without INDEXED_SHADING and compares the framebuffers. This
+// also checks that indexed shading runs the vertex shader on fewer vertices.
+//
+
+#include <math.h>
+#include <Matrix.h>
+#include <nyuzi.h>
+#include <RenderContext.h>
+#include <RenderTarget.h>
+#include <schedule.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vga.h>
+#include "ColorShader.h"
+
+using namespace librender;
+
+const int kFbWidth = 640;
+const int kFbHeight = 480;
+const int kGridColumns = 9;
+const int kGridRows = 7;
+const int kNumVertices = kGridColumns * kGridRows;
+const int kMaxIndices = (kGridColumns - 1) * (kGridRows - 1) * 6;
+
+float gVertices[kNumVertices * 7];
+int gIndices[2][kMaxIndices];
+
+// Each vertex has a different color, so a triangle that uses the wrong
+// shaded vertex is visible.
+void fillGrid()
+{
+    float *vertex = gVertices;
+    for (int row = 0; row < kGridRows; row++)
+    {
+        for (int column = 0; column < kGridColumns; column++)
+        {
+            *vertex++ = float(column) / (kGridColumns - 1) * 1.8f - 0.9f;
+            *vertex++ = float(row) / (kGridRows - 1) * 1.8f - 0.9f;
+            *vertex++ = -1.0f;
+            *vertex++ = float(column) / (kGridColumns - 1);
+            *vertex++ = float(row) / (kGridRows - 1);
+            *vertex++ = float((row * kGridColumns + column) % 5) / 4;
+            *vertex++ = 1.0f;
+        }
+    }
+}
+
+// Append two counterclockwise triangles covering a grid cell.
+int *addCell(int *index, int column, int row)
+{
+    int corner = row * kGridColumns + column;
+    *index++ = corner;
+    *index++ = corner + 1;
+    *index++ = corner + kGridColumns;
+    *index++ = corner + 1;
+    *index++ = corner + kGridColumns + 1;
+    *index++ = corner + kGridColumns;
+    return index;
+}
+
+// Number of different vertices the indices reference.
+int countReferenced(const int *begin, const int *end)
+{
+    bool referenced[kNumVertices] = {};
+    int count = 0;
+    for (const int *index = begin; index != end; index++)
+    {
+        if (!referenced[*index])
+        {
+            referenced[*index] = true;
+            count++;
+        }
+    }
+
+    return count;
+}
+
+// All threads start execution here.
+int main()
+{
+    void *frameBuffer;
+    if (get_current_thread_id() != 0)
+        worker_thread();
+
+    // Set up render context
+    frameBuffer = init_vga(VGA_MODE_640x480);
+
+    start_all_threads();
+
+    fillGrid();
+
+    // The first draw call covers every other cell in the left part of the
+    // grid, starting from the last row, so the first vertex referenced
+    // is near the end of the attribute buffer. The second covers a few
+    // cells on the right side. Some vertices aren't referenced by either.
+    int *end0 = gIndices[0];
+    for (int row = kGridRows - 2; row >= 0; row--)
+    {
+        for (int column = kGridColumns - 4; column >= 0; column--)
+        {
+            if ((row + column) % 2 == 0)
+                end0 = addCell(end0, column, row);
+        }
+    }
+
+    int *end1 = gIndices[1];
+    end1 = addCell(end1, kGridColumns - 2, 0);
+    end1 = addCell(end1, kGridColumns - 3, 3);
+    end1 = addCell(end1, kGridColumns - 2, kGridRows - 2);
+
+    RenderContext *context = new RenderContext();
+    RenderTarget *renderTarget = new RenderTarget();
+    Surface *colorBuffer = new Surface(kFbWidth, kFbHeight, Surface::RGBA8888, frameBuffer);
+    renderTarget->setColorBuffer(colorBuffer);
+    context->bindTarget(renderTarget);
+#ifdef INDEXED_SHADING
+    context->enableIndexedShading(true);
+#endif
+    context->bindShader(new ColorShader());
+    context->clearColorBuffer();
+
+    const RenderBuffer kVertices(gVertices, kNumVertices, 7 * sizeof(float));
+    const RenderBuffer kIndices0(gIndices[0], int(end0 - gIndices[0]), sizeof(int));
+    const RenderBuffer kIndices1(gIndices[1], int(end1 - gIndices[1]), sizeof(int));
+    context->bindVertexAttrs(&kVertices);
+    context->drawElements(&kIndices0);
+    context->drawElements(&kIndices1);
+    context->finish();
+
+    // With indexed shading, each draw call only shades the vertices it
+    // references.
+#ifdef INDEXED_SHADING
+    const int kExpectedShaded = countReferenced(gIndices[0], end0)
+                                + countReferenced(gIndices[1], end1);
+#else
+    const int kExpectedShaded = kNumVertices * 2;
+#endif
+    if (context->getShadedVertexCount() != kExpectedShaded
+            || context->getAttributeVertexCount() != kNumVertices * 2)
+    {
+        printf("FAIL: shaded %d vertices, %d in attribute buffers, expected %d\n",
+               context->getShadedVertexCount(), context->getAttributeVertexCount(),
+               kExpectedShaded);
+    }
+
+    return 0;
+}
@@ -0,0 +1,66 @@
+//
+// Copyright 2018 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <Shader.h>
+
+using namespace librender;
+
+struct OffsetUniforms
+{
+    float fOffsetX;
+    float fOffsetY;
+};
+
+// Like ColorShader in the other tests, but moves each vertex by an offset
+// in the uniforms.
+class OffsetShader : public Shader
+{
+public:
+    OffsetShader()
+        :	Shader(7, 8)
+    {
+    }
+
+    void shadeVertices(vecf16_t *outParams, const vecf16_t *inAttribs, const void *_uniforms,
+                       vmask_t) const override
+    {
+        const OffsetUniforms *uniforms = static_cast<const OffsetUniforms*>(_uniforms);
+
+        // Position
+        outParams[kParamX] = inAttribs[0] + uniforms->fOffsetX;
+        outParams[kParamY] = inAttribs[1] + uniforms->fOffsetY;
+        outParams[kParamZ] = inAttribs[2];
+        outParams[kParamW] = 1.0;
+
+        // Color
+        outParams[4] = inAttribs[3];
+        outParams[5] = inAttribs[4];
+        outParams[6] = inAttribs[5];
+        outParams[7] = inAttribs[6];
+    }
+
+    void shadePixels(vecf16_t *outColor, const vecf16_t *inParams,
+                     const void *, const Texture * const *,
+                     vmask_t) const override
+    {
+        outColor[0] = inParams[0] * inParams[3];
+        outColor[1] = inParams[1] * inParams[3];
+        outColor[2] = inParams[2] * inParams[3];
+        outColor[3] = inParams[3];
+    }
+};
@@ -0,0 +1,115 @@
+//
+// Copyright 2018 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+//
+// Validates that pipelining doesn't change the output. This renders several
+// frames into the same color buffer without clearing it, each blending over
+// the previous ones, so the result depends on the frames being drawn in
+// order. Each frame has its own uniforms, which come from the frame's
+// working memory, so this also checks that the two areas are reused
+// correctly. Partway through, it waits for rendering to finish and changes
+// the vertex colors, which frames already submitted must not see.
+// runtest.py builds this with and without PIPELINING and compares the
+// framebuffers.
+//
+
+#include <nyuzi.h>
+#include <RenderContext.h>
+#include <RenderTarget.h>
+#include <schedule.h>
+#include <stdlib.h>
+#include <vga.h>
+#include "OffsetShader.h"
+
+using namespace librender;
+
+const int kFbWidth = 640;
+const int kFbHeight = 480;
+const int kNumFrames = 6;
+const int kRecolorFrame = 3;
+
+static float gVertices[] =
+{
+    // Translucent, large
+    -0.7,  0.6, -1.0,    1.0, 0.2, 0.2, 0.4,
+    -0.7, -0.6, -1.0,    0.2, 1.0, 0.2, 0.4,
+    0.3,  0.0, -1.0,     0.2, 0.2, 1.0, 0.4,
+
+    // Opaque, small
+    -0.2,  0.2, -1.0,    1.0, 1.0, 0.0, 1.0,
+    -0.2, -0.2, -1.0,    1.0, 1.0, 0.0, 1.0,
+    0.0,  0.0, -1.0,     1.0, 1.0, 0.0, 1.0,
+};
+
+static int kTriangleIndices[] = { 0, 1, 2, 3, 4, 5 };
+
+// All threads start execution here.
+int main()
+{
+    void *frameBuffer;
+    if (get_current_thread_id() != 0)
+        worker_thread();
+
+    // Set up render context
+    frameBuffer = init_vga(VGA_MODE_640x480);
+
+    start_all_threads();
+
+    RenderContext *context = new RenderContext();
+    RenderTarget *renderTarget = new RenderTarget();
+    Surface *colorBuffer = new Surface(kFbWidth, kFbHeight, Surface::RGBA8888, frameBuffer);
+    renderTarget->setColorBuffer(colorBuffer);
+    context->bindTarget(renderTarget);
+#ifdef PIPELINING
+    context->enablePipelining(true);
+#endif
+    context->bindShader(new OffsetShader());
+    context->clearColorBuffer();
+
+    const RenderBuffer kVertices(gVertices, 6, 7 * sizeof(float));
+    const RenderBuffer kTranslucentIndices(kTriangleIndices, 3, sizeof(int));
+    const RenderBuffer kOpaqueIndices(kTriangleIndices + 3, 3, sizeof(int));
+    context->bindVertexAttrs(&kVertices);
+    for (int frame = 0; frame < kNumFrames; frame++)
+    {
+        if (frame == kRecolorFrame)
+        {
+            // Vertex attributes are read while rendering, so the frames that
+            // use them must finish before they can change.
+            context->waitForFrame();
+            for (int vertex = 0; vertex < 6; vertex++)
+                gVertices[vertex * 7 + 5] = 1.0f - gVertices[vertex * 7 + 5];
+        }
+
+        OffsetUniforms uniforms;
+        uniforms.fOffsetX = frame * 0.1f;
+        uniforms.fOffsetY = (frame % 3) * 0.1f - 0.1f;
+        context->bindUniforms(&uniforms, sizeof(uniforms));
+        context->enableBlend(true);
+        context->drawElements(&kTranslucentIndices);
+
+        uniforms.fOffsetX = 0.6f - frame * 0.15f;
+        uniforms.fOffsetY = 0.5f - frame * 0.15f;
+        context->bindUniforms(&uniforms, sizeof(uniforms));
+        context->enableBlend(false);
+        context->drawElements(&kOpaqueIndices);
+        context->finish();
+    }
+
+    context->waitForFrame();
+    return 0;
+}
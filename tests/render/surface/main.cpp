@@ -0,0 +1,172 @@
+//
+// Copyright 2018 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+//
+// Validates Surface::readPixels for the color spaces and layouts that
+// textures use. This decodes BC1 blocks in both modes and reads a tiled
+// surface at the edges of its 4x4 blocks, checking each color exactly.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <Surface.h>
+
+using namespace librender;
+
+struct Sample
+{
+    int x;
+    int y;
+    int color[4];   // Expected red, green, blue, alpha, scaled by kScale
+};
+
+// BC1 interpolates in thirds and halves, so compare thousandths, rounded.
+// The rounding hides single bit float errors.
+const int kScale = 1000;
+
+// Two BC1 blocks, side by side. In each, pixel n (counting across rows)
+// uses selector n & 3.
+const unsigned int kBC1Blocks[4] __attribute__((aligned(64))) =
+{
+    // color0 > color1, so this has four colors: red, blue, and 1/3 and 2/3
+    // of the way between them.
+    0x001ff800, 0xe4e4e4e4,
+
+    // color0 <= color1, so this has three colors: blue, green, halfway
+    // between them, and transparent black for selector 3.
+    0x07e0001f, 0xe4e4e4e4
+};
+
+const Sample kBC1Samples[16] =
+{
+    { 0, 0, { 1000, 0, 0, 1000 } },
+    { 1, 0, { 0, 0, 1000, 1000 } },
+    { 2, 0, { 667, 0, 333, 1000 } },
+    { 3, 0, { 333, 0, 667, 1000 } },
+    { 0, 3, { 1000, 0, 0, 1000 } },
+    { 1, 2, { 0, 0, 1000, 1000 } },
+    { 2, 1, { 667, 0, 333, 1000 } },
+    { 3, 3, { 333, 0, 667, 1000 } },
+    { 4, 0, { 0, 0, 1000, 1000 } },
+    { 5, 0, { 0, 1000, 0, 1000 } },
+    { 6, 0, { 0, 500, 500, 1000 } },
+    { 7, 0, { 0, 0, 0, 0 } },
+    { 4, 3, { 0, 0, 1000, 1000 } },
+    { 5, 1, { 0, 1000, 0, 1000 } },
+    { 6, 2, { 0, 500, 500, 1000 } },
+    { 7, 3, { 0, 0, 0, 0 } }
+};
+
+// Odd multiple of four, so rows of blocks don't start at a power of two.
+const int kTiledWidth = 68;
+const int kTiledHeight = 12;
+
+// Last row and column of one block and first of the next, in both
+// directions, plus the corners of the surface.
+const int kTiledCoords[16][2] =
+{
+    { 0, 0 }, { 3, 0 }, { 4, 0 }, { 3, 3 },
+    { 4, 4 }, { 3, 4 }, { 4, 3 }, { 7, 4 },
+    { 8, 3 }, { 63, 7 }, { 64, 8 }, { 67, 0 },
+    { 64, 3 }, { 0, 11 }, { 67, 11 }, { 35, 9 }
+};
+
+static unsigned int pixelValue(int x, int y)
+{
+    return 0xff000000 | ((x ^ y) << 16) | (y << 8) | x;
+}
+
+static int checkSamples(const char *name, const Surface &surface,
+                        const Sample *samples, int scale)
+{
+    veci16_t tx;
+    veci16_t ty;
+    vecf16_t color[4];
+    int failures = 0;
+
+    for (int lane = 0; lane < 16; lane++)
+    {
+        tx[lane] = samples[lane].x;
+        ty[lane] = samples[lane].y;
+    }
+
+    surface.readPixels(tx, ty, 0xffff, color);
+    for (int lane = 0; lane < 16; lane++)
+    {
+        for (int channel = 0; channel < 4; channel++)
+        {
+            int actual = static_cast<int>(color[channel][lane] * scale + 0.5f);
+            if (actual != samples[lane].color[channel])
+            {
+                printf("FAIL: %s (%d, %d) channel %d expected %d got %d\n", name,
+                       samples[lane].x, samples[lane].y, channel,
+                       samples[lane].color[channel], actual);
+                failures++;
+            }
+        }
+    }
+
+    return failures;
+}
+
+int main()
+{
+    int failures = 0;
+
+    Surface compressed(8, 4, Surface::BC1, const_cast<unsigned int*>(kBC1Blocks));
+    failures += checkSamples("bc1", compressed, kBC1Samples, kScale);
+
+    Surface linear(kTiledWidth, kTiledHeight, Surface::RGBA8888);
+    Surface tiled(kTiledWidth, kTiledHeight, Surface::RGBA8888, nullptr,
+                  Surface::TILED);
+    Surface roundTrip(kTiledWidth, kTiledHeight, Surface::RGBA8888);
+    unsigned int *pixels = static_cast<unsigned int*>(linear.bits());
+    for (int y = 0; y < kTiledHeight; y++)
+    {
+        for (int x = 0; x < kTiledWidth; x++)
+            pixels[y * kTiledWidth + x] = pixelValue(x, y);
+    }
+
+    tiled.copyPixels(linear);
+    roundTrip.copyPixels(tiled);
+
+    Sample tiledSamples[16];
+    for (int i = 0; i < 16; i++)
+    {
+        int x = kTiledCoords[i][0];
+        int y = kTiledCoords[i][1];
+        tiledSamples[i].x = x;
+        tiledSamples[i].y = y;
+        tiledSamples[i].color[0] = x;
+        tiledSamples[i].color[1] = y;
+        tiledSamples[i].color[2] = x ^ y;
+        tiledSamples[i].color[3] = 255;
+    }
+
+    failures += checkSamples("linear", linear, tiledSamples, 255);
+    failures += checkSamples("tiled", tiled, tiledSamples, 255);
+    if (memcmp(linear.bits(), roundTrip.bits(), kTiledWidth * kTiledHeight * 4) != 0)
+    {
+        printf("FAIL: copying back to linear changed pixels\n");
+        failures++;
+    }
+
+    if (failures == 0)
+        printf("PASS\n");
+
+    return 0;
+}
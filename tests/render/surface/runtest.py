@@ -0,0 +1,35 @@
+#!/usr/bin/env python3
+#
+# Copyright 2018 Jeff Bush
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+import os
+import sys
+
+sys.path.insert(0, '../..')
+import test_harness
+
+
+@test_harness.test(['emulator'])
+def render_surface(_, target):
+    hex_file = test_harness.build_program(['main.cpp'], cflags=[
+        '-I' + os.path.join(test_harness.LIB_INCLUDE_DIR, 'librender'),
+        os.path.join(test_harness.LIB_DIR, 'librender/librender.a')
+    ])
+    result = test_harness.run_program(hex_file, target)
+    if 'PASS' not in result or 'FAIL' in result:
+        raise test_harness.TestException('Test failed ' + result)
+
+test_harness.execute_tests()
@@ -25,6 +25,7 @@
 #include <RenderContext.h>
 #include <RenderTarget.h>
 #include <schedule.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <vga.h>
 #include "PhongShader.h"
@@ -83,7 +84,9 @@ int main()
         context->bindUniforms(&uniforms, sizeof(uniforms));
         context->clearColorBuffer();
         context->drawElements(&kIndices);
+        unsigned int startCycles = get_cycle_count();
         context->finish();
+        printf("rendered frame in %u cycles\n", get_cycle_count() - startCycles);
         modelViewMatrix *= rotationMatrix;
     }
 
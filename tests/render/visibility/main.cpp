@@ -0,0 +1,146 @@
+//
+// Copyright 2018 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+//
+// Validates that the visibility buffer doesn't change the output. This mixes
+// depth tested triangles, which are deferred, with blended and non-depth
+// tested ones, which are drawn directly, so the result depends on them all
+// being drawn in the order they were submitted. runtest.py builds this with
+// and without VISIBILITY_BUFFER and compares the framebuffers.
+//
+
+#include <math.h>
+#include <Matrix.h>
+#include <nyuzi.h>
+#include <RenderContext.h>
+#include <RenderTarget.h>
+#include <schedule.h>
+#include <stdlib.h>
+#include <vga.h>
+#include "ColorShader.h"
+
+using namespace librender;
+
+const int kFbWidth = 640;
+const int kFbHeight = 480;
+
+static float kOpaqueVertices[] =
+{
+    // Red, in back
+    0.0,  0.9, -5.0,     1.0, 0.0, 0.0, 1.0,
+    -0.9, -0.7, -5.0,    1.0, 0.0, 0.0, 1.0,
+    0.9, -0.7, -5.0,     1.0, 0.0, 0.0, 1.0,
+
+    // Green, intersecting the red triangle
+    0.0, -0.9, -2.0,     0.0, 1.0, 0.0, 1.0,
+    0.9,  0.7, -8.0,     0.0, 1.0, 0.0, 1.0,
+    -0.9,  0.7, -2.0,    0.0, 1.0, 0.0, 1.0,
+};
+
+static float kBlendedVertices[] =
+{
+    // Translucent white, in front of both
+    -0.8,  0.8, -1.5,    1.0, 1.0, 1.0, 0.5,
+    -0.8, -0.8, -1.5,    1.0, 1.0, 1.0, 0.5,
+    0.5,  0.0, -1.5,     1.0, 1.0, 1.0, 0.2,
+};
+
+static float kFrontVertices[] =
+{
+    // Blue, in front of the translucent triangle. Drawn after it, so it
+    // covers it.
+    -0.3,  0.5, -1.0,    0.0, 0.0, 1.0, 1.0,
+    -0.3, -0.5, -1.0,    0.0, 0.0, 1.0, 1.0,
+    0.8,  0.0, -1.0,     0.0, 0.0, 1.0, 1.0,
+};
+
+static float kOverlayVertices[] =
+{
+    // Yellow, drawn without the depth buffer, so it covers everything
+    // before it.
+    0.2,  0.6, -9.0,     1.0, 1.0, 0.0, 1.0,
+    0.2, -0.6, -9.0,     1.0, 1.0, 0.0, 1.0,
+    0.9,  0.0, -9.0,     1.0, 1.0, 0.0, 1.0,
+};
+
+static float kLastVertices[] =
+{
+    // Magenta, in front of the blue triangle. It isn't hidden by the yellow
+    // one, which doesn't write depth.
+    0.1,  0.3, -0.5,     1.0, 0.0, 1.0, 1.0,
+    0.1, -0.3, -0.5,     1.0, 0.0, 1.0, 1.0,
+    0.7,  0.0, -0.5,     1.0, 0.0, 1.0, 1.0,
+};
+
+static int kTriangleIndices[] = { 0, 1, 2, 3, 4, 5 };
+
+// All threads start execution here.
+int main()
+{
+    void *frameBuffer;
+    if (get_current_thread_id() != 0)
+        worker_thread();
+
+    // Set up render context
+    frameBuffer = init_vga(VGA_MODE_640x480);
+
+    start_all_threads();
+
+    RenderContext *context = new RenderContext();
+    RenderTarget *renderTarget = new RenderTarget();
+    Surface *colorBuffer = new Surface(kFbWidth, kFbHeight, Surface::RGBA8888, frameBuffer);
+    Surface *depthBuffer = new Surface(kFbWidth, kFbHeight, Surface::FLOAT);
+    renderTarget->setColorBuffer(colorBuffer);
+    renderTarget->setDepthBuffer(depthBuffer);
+    context->bindTarget(renderTarget);
+#ifdef VISIBILITY_BUFFER
+    context->enableVisibilityBuffer(true);
+#endif
+    context->bindShader(new ColorShader());
+    context->clearColorBuffer();
+
+    const RenderBuffer kOpaque(kOpaqueVertices, 6, 7 * sizeof(float));
+    const RenderBuffer kBlended(kBlendedVertices, 3, 7 * sizeof(float));
+    const RenderBuffer kFront(kFrontVertices, 3, 7 * sizeof(float));
+    const RenderBuffer kOverlay(kOverlayVertices, 3, 7 * sizeof(float));
+    const RenderBuffer kLast(kLastVertices, 3, 7 * sizeof(float));
+    const RenderBuffer kIndices6(kTriangleIndices, 6, sizeof(int));
+    const RenderBuffer kIndices3(kTriangleIndices, 3, sizeof(int));
+
+    context->enableDepthBuffer(true);
+    context->bindVertexAttrs(&kOpaque);
+    context->drawElements(&kIndices6);
+
+    context->enableBlend(true);
+    context->bindVertexAttrs(&kBlended);
+    context->drawElements(&kIndices3);
+
+    context->enableBlend(false);
+    context->bindVertexAttrs(&kFront);
+    context->drawElements(&kIndices3);
+
+    context->enableDepthBuffer(false);
+    context->bindVertexAttrs(&kOverlay);
+    context->drawElements(&kIndices3);
+
+    context->enableDepthBuffer(true);
+    context->bindVertexAttrs(&kLast);
+    context->drawElements(&kIndices3);
+
+    context->finish();
+    return 0;
+}
@@ -54,7 +54,7 @@ VSIM_PATH = os.path.join(TOOL_BIN_DIR, 'nyuzi_vsim')
 EMULATOR_PATH = os.path.join(TOOL_BIN_DIR, 'nyuzi_emulator')
 SERIAL_BOOT_PATH = os.path.join(TOOL_BIN_DIR, 'serial_boot')
 ALL_TARGETS = ['verilator', 'emulator']
-DEFAULT_TARGETS = ['verilator', 'emulator']
+DEFAULT_TARGETS = ['verilator', 'emulator', 'emulator-threaded', 'emulator-jit']
 
 class TestException(Exception):
     """This exception is raised for test failures"""
@@ -254,7 +254,7 @@ def run_program(
             This is usually the return value from build_program.
         target:
             Which target will run the program. Can be 'verilator',
-            'emulator', or 'fpga'.
+            'emulator', 'emulator-threaded', 'emulator-jit', or 'fpga'.
         block_device:
             Relative path to a file that contains a filesystem image.
             If passed, contents will appear as a virtual SDMMC device
@@ -267,6 +267,11 @@ def run_program(
             writing mempry from.
         dump_length:
             number of bytes of memory to write to dump_file
+        profile_file:
+            Path to a file to write profile information into (verilator or
+            emulator only). Verilator writes randomly sampled program
+            counters. The emulator writes exact counts in the format read by
+            tools/misc/emulator_profile.py.
 
     Returns:
         Output from program, anything written to virtual serial device
@@ -275,15 +280,23 @@ def run_program(
         TestException if emulated program crashes or the program cannot
         execute for some other reason.
     """
-    if target == 'emulator':
+    if target in ('emulator', 'emulator-threaded', 'emulator-jit'):
         args = [EMULATOR_PATH]
         args += ['-a']  # Enable thread scheduling randomization by default
+        if target == 'emulator-threaded':
+            args += ['-m', 'threaded']
+        elif target == 'emulator-jit':
+            args += ['-m', 'jit']
+
         if block_device is not None:
             args += ['-b', block_device]
 
         if dump_file is not None:
             args += ['-d', '{},0x{:x},0x{:x}'.format(dump_file, dump_base, dump_length)]
 
+        if profile_file is not None:
+            args += ['--profile', profile_file]
+
         args += [executable]
         if DEBUG:
             print('running emulator with args ' + str(args))
@@ -928,3 +941,58 @@ def register_render_test(name: str, source_files: List[str],
                 actual_hash, PNG_DUMP_FILE))
 
     register_tests(run_render_test, [name], targets)
+
+
+def register_render_variant_test(name: str, source_files: List[str],
+                                 variant_cflags: List[str],
+                                 targets: Optional[List[str]] = None) -> None:
+    """Register a test that checks a rendering option doesn't change output.
+
+    This compiles and runs the program twice, once with variant_cflags
+    (usually a -D option that enables the option being tested) and once
+    without, then checks that the framebuffers at 2M are identical. The
+    test also fails if either run prints FAIL, so the program can check
+    other results, such as statistics the option should change.
+
+    Args:
+        name:
+            Display name of the test in test result output
+        source_files:
+            List of source files to compile into one executable.
+        variant_cflags:
+            Additional compiler flags for the second build.
+
+    Returns:
+        Nothing
+
+    Raises:
+        TestException if the framebuffers differ or there is some other
+        test failure.
+    """
+
+    def run_render_variant_test(_, target):
+        render_cflags = [
+            '-I' + os.path.join(LIB_INCLUDE_DIR, 'librender'),
+            os.path.join(LIB_DIR, 'librender/librender.a'),
+            '-ffast-math'
+        ]
+
+        dump_files = []
+        for index, cflags in enumerate([render_cflags, render_cflags + variant_cflags]):
+            dump_file = os.path.join(WORK_DIR, 'fb{}.bin'.format(index))
+            hex_file = build_program(source_files=source_files, cflags=cflags)
+            result = run_program(hex_file,
+                                 target,
+                                 dump_file=dump_file,
+                                 dump_base=0x200000,
+                                 dump_length=0x12c000,
+                                 flush_l2=True)
+            if 'FAIL' in result:
+                raise TestException('Test failed ' + result)
+
+            dump_files.append(dump_file)
+
+        assert_files_equal(dump_files[0], dump_files[1],
+                           'output differs with ' + ' '.join(variant_cflags))
+
+    register_tests(run_render_variant_test, [name], targets)
@@ -73,6 +73,46 @@ def load_file(*unused):
                 raise test_harness.TestException('incorrect value, expected {:x} got {:x}'.format(check, value))
 
 
+@test_harness.test(['emulator'])
+def load_binary_file(*unused):
+    image_file = os.path.join(test_harness.WORK_DIR, 'image.bin')
+    binary_output = os.path.join(test_harness.WORK_DIR, 'mem.bin')
+
+    # Same contents as valid-file-hex.txt. This is larger than a page so
+    # the emulator will map part of it into memory.
+    words = [
+        0x00fcff0f,
+        0x1400008c,
+        0x000000fc,
+        0x20000088,
+        0x000000f6
+    ] + [random.randint(0, 0xffffffff) for __ in range(4096)]
+    with open(image_file, 'wb') as file:
+        for word in words:
+            file.write(struct.pack('>I', word))
+
+    args = [
+        test_harness.EMULATOR_PATH,
+        '-d{},0,{}'.format(binary_output, len(words) * 4),
+        image_file
+    ]
+    subprocess.check_output(args, stderr=subprocess.STDOUT)
+    with open(binary_output, 'rb') as file:
+        for check in words:
+            value = struct.unpack('>I', file.read(4))[0]
+            if check != value:
+                raise test_harness.TestException('incorrect value, expected {:x} got {:x}'.format(check, value))
+
+
+@test_harness.test(['emulator'])
+def load_elf_file(*unused):
+    hex_file = test_harness.build_program(['self_modifying_code.S'])
+    elf_file = test_harness.get_elf_file_for_hex(hex_file)
+    result = test_harness.run_test_with_timeout([test_harness.EMULATOR_PATH, elf_file], 60)
+    if 'PASS' not in result or 'FAIL' in result:
+        raise test_harness.TestException('Test failed ' + result)
+
+
 def test_emulator_error(args, expected_error):
     args = [test_harness.EMULATOR_PATH] + args
     try:
@@ -112,6 +152,69 @@ def missing_file(*unused):
 def no_file_specified(*unused):
     test_emulator_error([], 'No image filename specified')
 
+
+@test_harness.test(['emulator'])
+def self_modifying_code(*unused):
+    hex_file = test_harness.build_program(['self_modifying_code.S'])
+    result = test_harness.run_program(hex_file, 'emulator')
+    if 'PASS' not in result or 'FAIL' in result:
+        raise test_harness.TestException('Test failed ' + result)
+
+
+@test_harness.test(['emulator'])
+def self_modifying_code_multicore(*unused):
+    hex_file = test_harness.build_program(['self_modifying_code_multicore.S'])
+    for mode in ['normal', 'threaded', 'jit']:
+        args = [test_harness.EMULATOR_PATH, '-m', mode, '-p', '2', '-q',
+                '1000000', hex_file]
+        result = test_harness.run_test_with_timeout(args, 60)
+        if 'PASS' not in result or 'FAIL' in result:
+            raise test_harness.TestException(
+                'Test failed in {} mode: {}'.format(mode, result))
+
+
+@test_harness.test(['emulator', 'emulator-threaded', 'emulator-jit'])
+def movehi_compare(_, target):
+    hex_file = test_harness.build_program(['movehi_compare.S'])
+    result = test_harness.run_program(hex_file, target)
+    if 'PASS' not in result or 'FAIL' in result:
+        raise test_harness.TestException('Test failed ' + result)
+
+
+@test_harness.test(['emulator'])
+def parallel_execution(*unused):
+    hex_file = test_harness.build_program(['parallel_sync.S'])
+    args = [test_harness.EMULATOR_PATH, '-p', '8', '-q', '1000', hex_file]
+    result = test_harness.run_test_with_timeout(args, 60)
+    if 'PASS' not in result or 'FAIL' in result:
+        raise test_harness.TestException('Test failed ' + result)
+
+@test_harness.test(['emulator'])
+def snapshot(*unused):
+    hex_file = test_harness.build_program(['parallel_sync.S'])
+    snapshot_file = os.path.join(test_harness.WORK_DIR, 'test.snap')
+    args = [test_harness.EMULATOR_PATH, '-p', '8', '--save-snapshot',
+            snapshot_file, '--at', '20000', hex_file]
+    result = test_harness.run_test_with_timeout(args, 60)
+    if 'PASS' not in result or 'FAIL' in result:
+        raise test_harness.TestException('Test failed ' + result)
+
+    # The program only prints the result at the end, so this checks that the
+    # restored run continued from the saved state.
+    args = [test_harness.EMULATOR_PATH, '-p', '8', '--restore-snapshot',
+            snapshot_file]
+    result = test_harness.run_test_with_timeout(args, 60)
+    if 'PASS' not in result or 'FAIL' in result:
+        raise test_harness.TestException('Restored run failed ' + result)
+
+@test_harness.test(['emulator'])
+def cache_model(*unused):
+    hex_file = test_harness.build_program(['cache_model.S'])
+    args = [test_harness.EMULATOR_PATH, '--cache-model', hex_file]
+    result = test_harness.run_test_with_timeout(args, 60)
+    if 'PASS' not in result or 'FAIL' in result:
+        raise test_harness.TestException('Test failed ' + result)
+
 ############################################################################
 # Test the mechanism for delivering interrupts to the emulator from a
 # separate host process (useful for co-emulation)
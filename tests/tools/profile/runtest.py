@@ -15,7 +15,7 @@
 # limitations under the License.
 #
 
-"""Test profiling capabilities of hardware simulator."""
+"""Test profiling capabilities of hardware simulator and emulator."""
 
 import os
 import subprocess
@@ -63,4 +63,37 @@ def profile(*unused):
     test_harness.assert_greater(loop10k, loop5k * 1.75)
     test_harness.assert_greater(loop20k, loop10k * 1.75)
 
+
+@test_harness.test(['emulator', 'emulator-threaded', 'emulator-jit'])
+def emulator_profile(_, target):
+    hexfile = test_harness.build_program(['test_program.c'])
+    elffile = test_harness.get_elf_file_for_hex(hexfile)
+    profile_file = os.path.join(test_harness.WORK_DIR, 'profile.out')
+    test_harness.run_program(hexfile, target, profile_file=profile_file)
+
+    profile_args = [
+        os.path.join(test_harness.TOOL_BIN_DIR, 'emulator_profile.py'),
+        elffile,
+        profile_file
+    ]
+    profile_output = subprocess.check_output(profile_args)
+    profile_lines = profile_output.decode().split('\n')[1:]
+    profile_tuples = [line.split() for line in profile_lines if line]
+    instruction_counts = {func: int(count) for count, _, _, _, func in profile_tuples}
+    call_counts = {func: int(calls) for _, _, _, calls, func in profile_tuples}
+
+    # Unlike the hardware profiler, these counts are exact. Each loop
+    # executes the same instructions per iteration, with a small constant
+    # overhead.
+    loop5k = instruction_counts['loop5000']
+    loop10k = instruction_counts['loop10000']
+    loop20k = instruction_counts['loop20000']
+    test_harness.assert_greater(loop5k, 5000)
+    test_harness.assert_greater(loop10k, loop5k * 1.95)
+    test_harness.assert_greater(loop20k, loop10k * 1.95)
+    test_harness.assert_less(loop20k, loop10k * 2.05)
+    test_harness.assert_equal(call_counts['loop5000'], 1)
+    test_harness.assert_equal(call_counts['loop10000'], 1)
+    test_harness.assert_equal(call_counts['loop20000'], 1)
+
 test_harness.execute_tests()
@@ -0,0 +1,300 @@
+//
+// Copyright 2018 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cache-model.h"
+
+// These match hardware/core/config.svh
+#define L1D_WAYS 4
+#define L1D_SETS 64
+#define L1I_WAYS 4
+#define L1I_SETS 64
+#define L2_WAYS 8
+#define L2_SETS 256
+
+// Approximate number of cycles a thread waits for a load or instruction
+// fetch that misses the L1 cache. These are rough estimates of the L2
+// pipeline and external memory latency.
+#define L2_HIT_CYCLES 12
+#define L2_MISS_CYCLES 60
+
+#define INVALID_LINE 0xffffffffu
+
+struct cache_line
+{
+    uint32_t line;      // Address / CACHE_LINE_LENGTH, or INVALID_LINE
+    bool dirty;
+};
+
+// Within each set, lines are kept in order from most to least recently used.
+struct cache
+{
+    uint32_t num_sets;
+    uint32_t num_ways;
+    struct cache_line *lines;
+};
+
+struct core_caches
+{
+    struct cache l1i;
+    struct cache l1d;
+    uint64_t events[NUM_PERF_EVENTS];
+};
+
+struct cache_model
+{
+    uint32_t num_cores;
+    uint32_t threads_per_core;
+    struct core_caches *cores;
+    struct cache l2;
+    pthread_mutex_t l2_lock;
+    uint64_t *stall_cycles;     // Indexed by thread ID
+};
+
+static void init_cache(struct cache *cache, uint32_t num_sets, uint32_t num_ways)
+{
+    uint32_t i;
+
+    cache->num_sets = num_sets;
+    cache->num_ways = num_ways;
+    cache->lines = (struct cache_line*) calloc(num_sets * num_ways,
+                                               sizeof(struct cache_line));
+    for (i = 0; i < num_sets * num_ways; i++)
+        cache->lines[i].line = INVALID_LINE;
+}
+
+static struct cache_line *get_set(const struct cache *cache, uint32_t line)
+{
+    return &cache->lines[(line % cache->num_sets) * cache->num_ways];
+}
+
+// If the line is present, make it the most recently used and return true.
+static bool lookup_line(struct cache *cache, uint32_t line)
+{
+    struct cache_line *set = get_set(cache, line);
+    struct cache_line found;
+    uint32_t way;
+
+    for (way = 0; way < cache->num_ways; way++)
+    {
+        if (set[way].line == line)
+        {
+            found = set[way];
+            memmove(&set[1], &set[0], way * sizeof(struct cache_line));
+            set[0] = found;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Add a line that is not present as the most recently used, replacing the
+// least recently used line. Returns true if the replaced line was dirty.
+static bool insert_line(struct cache *cache, uint32_t line, bool dirty)
+{
+    struct cache_line *set = get_set(cache, line);
+    bool evicted_dirty = set[cache->num_ways - 1].line != INVALID_LINE
+                         && set[cache->num_ways - 1].dirty;
+
+    memmove(&set[1], &set[0], (cache->num_ways - 1) * sizeof(struct cache_line));
+    set[0].line = line;
+    set[0].dirty = dirty;
+    return evicted_dirty;
+}
+
+static void remove_line(struct cache *cache, uint32_t line)
+{
+    struct cache_line *set = get_set(cache, line);
+    uint32_t way;
+
+    for (way = 0; way < cache->num_ways; way++)
+    {
+        if (set[way].line == line)
+        {
+            // Move to the least recently used position, then clear.
+            memmove(&set[way], &set[way + 1], (cache->num_ways - way - 1)
+                    * sizeof(struct cache_line));
+            set[cache->num_ways - 1].line = INVALID_LINE;
+            set[cache->num_ways - 1].dirty = false;
+            break;
+        }
+    }
+}
+
+// Returns the number of cycles the request takes.
+static uint32_t access_l2(struct cache_model *model, uint32_t core_id, uint32_t line,
+                          bool is_store)
+{
+    struct core_caches *core = &model->cores[core_id];
+    uint32_t cycles;
+
+    pthread_mutex_lock(&model->l2_lock);
+    if (lookup_line(&model->l2, line))
+    {
+        core->events[PERF_L2_HIT]++;
+        if (is_store)
+            get_set(&model->l2, line)[0].dirty = true;
+
+        cycles = L2_HIT_CYCLES;
+    }
+    else
+    {
+        core->events[PERF_L2_MISS]++;
+        if (insert_line(&model->l2, line, is_store))
+            core->events[PERF_L2_WRITEBACK]++;
+
+        cycles = L2_MISS_CYCLES;
+    }
+
+    pthread_mutex_unlock(&model->l2_lock);
+
+    return cycles;
+}
+
+struct cache_model *init_cache_model(uint32_t num_cores, uint32_t threads_per_core)
+{
+    struct cache_model *model;
+    uint32_t core_id;
+
+    model = (struct cache_model*) calloc(1, sizeof(struct cache_model));
+    model->num_cores = num_cores;
+    model->threads_per_core = threads_per_core;
+    model->cores = (struct core_caches*) calloc(num_cores, sizeof(struct core_caches));
+    for (core_id = 0; core_id < num_cores; core_id++)
+    {
+        init_cache(&model->cores[core_id].l1i, L1I_SETS, L1I_WAYS);
+        init_cache(&model->cores[core_id].l1d, L1D_SETS, L1D_WAYS);
+    }
+
+    init_cache(&model->l2, L2_SETS, L2_WAYS);
+    pthread_mutex_init(&model->l2_lock, NULL);
+    model->stall_cycles = (uint64_t*) calloc(num_cores * threads_per_core,
+                                             sizeof(uint64_t));
+
+    return model;
+}
+
+void cache_model_fetch(struct cache_model *model, uint32_t core_id, uint32_t thread_id,
+                       uint32_t address)
+{
+    struct core_caches *core = &model->cores[core_id];
+    uint32_t line = address / CACHE_LINE_LENGTH;
+
+    if (lookup_line(&core->l1i, line))
+        core->events[PERF_ICACHE_HIT]++;
+    else
+    {
+        core->events[PERF_ICACHE_MISS]++;
+        model->stall_cycles[thread_id] += access_l2(model, core_id, line, false);
+        insert_line(&core->l1i, line, false);
+    }
+}
+
+void cache_model_load(struct cache_model *model, uint32_t core_id, uint32_t thread_id,
+                      uint32_t address)
+{
+    struct core_caches *core = &model->cores[core_id];
+    uint32_t line = address / CACHE_LINE_LENGTH;
+
+    if (lookup_line(&core->l1d, line))
+        core->events[PERF_DCACHE_HIT]++;
+    else
+    {
+        core->events[PERF_DCACHE_MISS]++;
+        model->stall_cycles[thread_id] += access_l2(model, core_id, line, false);
+        insert_line(&core->l1d, line, false);
+    }
+}
+
+// The L1 cache is write-through, and stores go into a store queue, so they
+// don't stall the thread.
+void cache_model_store(struct cache_model *model, uint32_t core_id, uint32_t address)
+{
+    access_l2(model, core_id, address / CACHE_LINE_LENGTH, true);
+}
+
+void cache_model_flush(struct cache_model *model, uint32_t core_id, uint32_t address)
+{
+    uint32_t line = address / CACHE_LINE_LENGTH;
+    struct cache_line *set;
+    uint32_t way;
+
+    pthread_mutex_lock(&model->l2_lock);
+    set = get_set(&model->l2, line);
+    for (way = 0; way < model->l2.num_ways; way++)
+    {
+        if (set[way].line == line && set[way].dirty)
+        {
+            set[way].dirty = false;
+            model->cores[core_id].events[PERF_L2_WRITEBACK]++;
+        }
+    }
+
+    pthread_mutex_unlock(&model->l2_lock);
+}
+
+// The L2 cache discards the line and all cores remove it from their L1 data
+// caches. In parallel mode, this may race with another core accessing its
+// L1 cache, which could leave the line in that cache. That is only a
+// small inaccuracy in the counts.
+void cache_model_invalidate(struct cache_model *model, uint32_t address)
+{
+    uint32_t line = address / CACHE_LINE_LENGTH;
+    uint32_t core_id;
+
+    pthread_mutex_lock(&model->l2_lock);
+    remove_line(&model->l2, line);
+    pthread_mutex_unlock(&model->l2_lock);
+    for (core_id = 0; core_id < model->num_cores; core_id++)
+        remove_line(&model->cores[core_id].l1d, line);
+}
+
+uint64_t get_cache_event_count(const struct cache_model *model, uint32_t core_id,
+                               enum performance_event event)
+{
+    return model->cores[core_id].events[event];
+}
+
+void dump_cache_stats(const struct cache_model *model)
+{
+    uint32_t core_id;
+    uint32_t thread_id;
+    const uint64_t *events;
+
+    for (core_id = 0; core_id < model->num_cores; core_id++)
+    {
+        events = model->cores[core_id].events;
+        printf("core %u: icache %" PRIu64 " hits %" PRIu64 " misses, dcache %"
+               PRIu64 " hits %" PRIu64 " misses, l2 %" PRIu64 " hits %" PRIu64
+               " misses %" PRIu64 " writebacks\n", core_id,
+               events[PERF_ICACHE_HIT], events[PERF_ICACHE_MISS],
+               events[PERF_DCACHE_HIT], events[PERF_DCACHE_MISS],
+               events[PERF_L2_HIT], events[PERF_L2_MISS],
+               events[PERF_L2_WRITEBACK]);
+        for (thread_id = 0; thread_id < model->threads_per_core; thread_id++)
+        {
+            printf("  thread %u: %" PRIu64 " stall cycles\n", thread_id,
+                   model->stall_cycles[core_id * model->threads_per_core
+                   + thread_id]);
+        }
+    }
+}
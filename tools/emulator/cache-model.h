@@ -0,0 +1,66 @@
+//
+// Copyright 2018 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef CACHE_MODEL_H
+#define CACHE_MODEL_H
+
+#include <stdint.h>
+#include "processor.h"
+
+//
+// Approximate model of the cache hierarchy, using the default configuration
+// in hardware/core/config.svh: each core has its own L1 instruction and data
+// caches, and all cores share an L2 cache. It only tracks which lines are
+// present (data always comes from emulated memory), and counts hits, misses,
+// and writebacks. Like the hardware, the L1 data cache is write-through and
+// doesn't allocate lines on stores, the L2 cache is write-back, and stores
+// from one core update lines cached by others rather than invalidating them.
+// Because of that, the model doesn't simulate coherence at all: a store never
+// removes a line from another core's L1 caches, and there are no coherence
+// misses or coherence traffic in the counts.
+// Replacement is least recently used, which is close to the pseudo-LRU the
+// hardware uses.
+//
+// It also estimates how many cycles each thread stalls waiting for misses.
+// These are rough: the model doesn't account for other threads running while
+// one waits, or for queueing.
+//
+// All addresses are physical. The model must be told the core and thread
+// making each access. Each core's L1 caches are only accessed from the host
+// thread running that core. The L2 cache has a lock, so this works in
+// parallel mode.
+//
+
+struct cache_model;
+
+struct cache_model *init_cache_model(uint32_t num_cores, uint32_t threads_per_core);
+void cache_model_fetch(struct cache_model*, uint32_t core_id, uint32_t thread_id,
+                       uint32_t address);
+void cache_model_load(struct cache_model*, uint32_t core_id, uint32_t thread_id,
+                      uint32_t address);
+void cache_model_store(struct cache_model*, uint32_t core_id, uint32_t address);
+
+// Cache control instructions (dflush and dinvalidate)
+void cache_model_flush(struct cache_model*, uint32_t core_id, uint32_t address);
+void cache_model_invalidate(struct cache_model*, uint32_t address);
+
+// Cache events are attributed to the core that caused them, including L2
+// events.
+uint64_t get_cache_event_count(const struct cache_model*, uint32_t core_id,
+                               enum performance_event);
+void dump_cache_stats(const struct cache_model*);
+
+#endif
@@ -19,9 +19,11 @@
 #include "device.h"
 #include "fbwindow.h"
 #include "sdmmc.h"
+#include "snapshot.h"
 
 #define KEY_BUFFER_SIZE 64
 #define SERIAL_BUFFER_SIZE 64
+#define NUM_PERF_COUNTERS 4
 
 extern void send_host_interrupt(uint32_t num);
 
@@ -34,6 +36,15 @@ static int serial_read_buf_tail;
 static struct processor *proc;
 static int last_sdmmc_response;
 
+// The frame buffer module owns this state, but it is tracked here so
+// snapshots can restore it.
+static uint32_t vga_enable;
+static uint32_t vga_base;
+
+// Memory mapped performance counters, used by libos. Each counter returns
+// the total number of times the selected event has occurred on all cores.
+static uint32_t perf_event_select[NUM_PERF_COUNTERS];
+
 void init_device(struct processor *_proc)
 {
     proc = _proc;
@@ -57,16 +68,25 @@ void write_device_register(uint32_t address, uint32_t value)
             break;
 
         case REG_VGA_ENABLE:
-            enable_frame_buffer(value & 1);
+            vga_enable = value & 1;
+            enable_frame_buffer(vga_enable);
             break;
 
         case REG_VGA_BASE:
+            vga_base = value;
             set_frame_buffer_address(value);
             break;
 
         case REG_HOST_INTERRUPT:
             send_host_interrupt(value);
             break;
+
+        case REG_PERF0_SEL:
+        case REG_PERF1_SEL:
+        case REG_PERF2_SEL:
+        case REG_PERF3_SEL:
+            perf_event_select[(address - REG_PERF0_SEL) / 4] = value;
+            break;
     }
 }
 
@@ -121,6 +141,16 @@ uint32_t read_device_register(uint32_t address)
         case REG_SD_STATUS:
             return 1;
 
+        case REG_PERF0_VAL:
+        case REG_PERF1_VAL:
+        case REG_PERF2_VAL:
+        case REG_PERF3_VAL:
+            value = perf_event_select[(address - REG_PERF0_VAL) / 4];
+            if (value >= NUM_PERF_EVENTS)
+                return 0;
+
+            return (uint32_t) get_perf_event_count(proc, (enum performance_event) value);
+
         default:
             return 0xffffffff;
     }
@@ -150,3 +180,49 @@ void enqueue_serial_char(uint32_t scan_code)
 
     raise_interrupt(proc, INT_UART_RX);
 }
+
+void write_device_state(FILE *file)
+{
+    int i;
+
+    for (i = 0; i < KEY_BUFFER_SIZE; i++)
+        write_snapshot_u32(file, key_buf[i]);
+
+    write_snapshot_u32(file, (uint32_t) key_buf_head);
+    write_snapshot_u32(file, (uint32_t) key_buf_tail);
+    fwrite(serial_read_buf, SERIAL_BUFFER_SIZE, 1, file);
+    write_snapshot_u32(file, (uint32_t) serial_read_buf_head);
+    write_snapshot_u32(file, (uint32_t) serial_read_buf_tail);
+    write_snapshot_u32(file, (uint32_t) last_sdmmc_response);
+    write_snapshot_u32(file, vga_enable);
+    write_snapshot_u32(file, vga_base);
+    for (i = 0; i < NUM_PERF_COUNTERS; i++)
+        write_snapshot_u32(file, perf_event_select[i]);
+
+    write_sdmmc_state(file);
+}
+
+void read_device_state(FILE *file)
+{
+    int i;
+
+    for (i = 0; i < KEY_BUFFER_SIZE; i++)
+        key_buf[i] = read_snapshot_u32(file);
+
+    key_buf_head = (int) read_snapshot_u32(file);
+    key_buf_tail = (int) read_snapshot_u32(file);
+    if (fread(serial_read_buf, SERIAL_BUFFER_SIZE, 1, file) != 1)
+        return;
+
+    serial_read_buf_head = (int) read_snapshot_u32(file);
+    serial_read_buf_tail = (int) read_snapshot_u32(file);
+    last_sdmmc_response = (int) read_snapshot_u32(file);
+    vga_enable = read_snapshot_u32(file);
+    vga_base = read_snapshot_u32(file);
+    for (i = 0; i < NUM_PERF_COUNTERS; i++)
+        perf_event_select[i] = read_snapshot_u32(file);
+
+    enable_frame_buffer(vga_enable);
+    set_frame_buffer_address(vga_base);
+    read_sdmmc_state(file);
+}
@@ -18,6 +18,7 @@
 #define DEVICE_H
 
 #include <stdint.h>
+#include <stdio.h>
 
 #define DEVICE_BASE_ADDRESS 0xffff0000
 
@@ -34,6 +35,14 @@
 #define REG_SD_CONTROL      0xffff00cc
 #define REG_VGA_ENABLE      0xffff0180
 #define REG_VGA_BASE        0xffff0188
+#define REG_PERF0_SEL       0xffff0200
+#define REG_PERF1_SEL       0xffff0204
+#define REG_PERF2_SEL       0xffff0208
+#define REG_PERF3_SEL       0xffff020c
+#define REG_PERF0_VAL       0xffff0210
+#define REG_PERF1_VAL       0xffff0214
+#define REG_PERF2_VAL       0xffff0218
+#define REG_PERF3_VAL       0xffff021c
 #define REG_TIMER_INT       0xffff0240
 
 // Interrupt bitmask
@@ -51,4 +60,8 @@ uint32_t read_device_register(uint32_t address);
 void enqueue_key(uint32_t scan_code);
 void enqueue_serial_char(uint32_t scan_code);
 
+// Serialize device state for snapshots (see snapshot.h)
+void write_device_state(FILE *file);
+void read_device_state(FILE *file);
+
 #endif
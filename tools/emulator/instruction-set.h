@@ -138,7 +138,13 @@ enum control_register
     CR_JTAG_DATA = 18,
     CR_SYSCALL_INDEX = 19,
     CR_SUSPEND_THREAD = 20,
-    CR_RESUME_THREAD = 21
+    CR_RESUME_THREAD = 21,
+    CR_PERF_EVENT_SELECT0 = 22,
+    CR_PERF_EVENT_SELECT1 = 23,
+    CR_PERF_EVENT_COUNT0_L = 24,
+    CR_PERF_EVENT_COUNT0_H = 25,
+    CR_PERF_EVENT_COUNT1_L = 26,
+    CR_PERF_EVENT_COUNT1_H = 27
 };
 
 enum trap_type
@@ -0,0 +1,569 @@
+//
+// Copyright 2018 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include "jit.h"
+#include "processor.h"
+
+//
+// Generated functions follow the System V calling convention. rdi points to
+// the scalar registers and rsi to the vector registers. Each instruction
+// loads its operands from the register files, computes the result in eax or
+// in vector register 0 or 1, and stores it back, so there is no register
+// allocation. This is still much faster than dispatching each instruction,
+// and instructions in a run don't need to be checked for traps.
+//
+// Scratch registers are rax, rcx and vector registers 0-4, which are all
+// caller saved. k1 holds masks with AVX-512. The AVX2 code handles each
+// half of a Nyuzi vector register separately.
+//
+
+#if defined(__x86_64__) && defined(__GNUC__) && defined(__linux__)
+#define USE_JIT 1
+#include <sys/mman.h>
+#endif
+
+#define JIT_BUFFER_SIZE 0x400000
+
+// Upper bound on the code generated for one instruction, checked before
+// translating each one.
+#define MAX_INST_CODE_SIZE 192
+
+// x86 register numbers
+#define REG_EAX 0
+#define REG_ECX 1
+#define REG_RSI 6
+#define REG_RDI 7
+
+struct jit
+{
+    uint8_t *buffer;
+    uint32_t used;
+    bool use_avx512;
+    bool use_avx2;
+};
+
+#ifdef USE_JIT
+
+// Bit for each lane, used to expand a mask register into lanes with AVX2.
+static const uint32_t lane_bits[NUM_VECTOR_LANES] __attribute__((aligned(32))) =
+{
+    0x0001, 0x0002, 0x0004, 0x0008, 0x0010, 0x0020, 0x0040, 0x0080,
+    0x0100, 0x0200, 0x0400, 0x0800, 0x1000, 0x2000, 0x4000, 0x8000
+};
+
+struct jit *jit_create(void)
+{
+    struct jit *jit;
+    void *buffer;
+
+    buffer = mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer == MAP_FAILED)
+        return NULL;
+
+    jit = (struct jit*) calloc(sizeof(struct jit), 1);
+    jit->buffer = (uint8_t*) buffer;
+    __builtin_cpu_init();
+    jit->use_avx512 = __builtin_cpu_supports("avx512f") != 0;
+    jit->use_avx2 = __builtin_cpu_supports("avx2") != 0;
+    return jit;
+}
+
+static bool is_integer_compare(enum arithmetic_op op)
+{
+    return op >= OP_CMPEQ_I && op <= OP_CMPLE_U;
+}
+
+static bool is_shift(enum arithmetic_op op)
+{
+    return op == OP_ASHR || op == OP_SHR || op == OP_SHL;
+}
+
+bool jit_can_translate(const struct jit *jit, const struct jit_inst *inst)
+{
+    switch (inst->op)
+    {
+        case OP_OR:
+        case OP_AND:
+        case OP_XOR:
+        case OP_ADD_I:
+        case OP_SUB_I:
+        case OP_MULL_I:
+        case OP_ASHR:
+        case OP_SHR:
+        case OP_SHL:
+        case OP_MOVE:
+            return !inst->is_vector || jit->use_avx512 || jit->use_avx2;
+
+        case OP_SEXT8:
+        case OP_SEXT16:
+            return !inst->is_vector;
+
+        default:
+            // Compares ignore the mask and write a scalar register. AVX2
+            // doesn't have unsigned compares or a way to pack the result
+            // without several more instructions, so those use the
+            // interpreter.
+            if (is_integer_compare(inst->op))
+                return !inst->is_vector || jit->use_avx512;
+
+            return false;
+    }
+}
+
+static void emit_byte(struct jit *jit, uint8_t value)
+{
+    jit->buffer[jit->used++] = value;
+}
+
+static void emit_u32(struct jit *jit, uint32_t value)
+{
+    memcpy(jit->buffer + jit->used, &value, sizeof(value));
+    jit->used += sizeof(value);
+}
+
+static void emit_u64(struct jit *jit, uint64_t value)
+{
+    memcpy(jit->buffer + jit->used, &value, sizeof(value));
+    jit->used += sizeof(value);
+}
+
+static void emit_bytes(struct jit *jit, const uint8_t *bytes, uint32_t count)
+{
+    memcpy(jit->buffer + jit->used, bytes, count);
+    jit->used += count;
+}
+
+#define EMIT(jit, ...) \
+    do { \
+        static const uint8_t bytes[] = { __VA_ARGS__ }; \
+        emit_bytes(jit, bytes, sizeof(bytes)); \
+    } while (0)
+
+// ModRM byte and 32-bit displacement for [base + offset]
+static void emit_memory_operand(struct jit *jit, int reg, int base, uint32_t offset)
+{
+    emit_byte(jit, (uint8_t)(0x80 | (reg << 3) | base));
+    emit_u32(jit, offset);
+}
+
+static uint32_t scalar_offset(uint32_t reg)
+{
+    return reg * sizeof(uint32_t);
+}
+
+static uint32_t vector_offset(uint32_t reg)
+{
+    return reg * NUM_VECTOR_LANES * sizeof(uint32_t);
+}
+
+//
+// Scalar instructions
+//
+
+static uint8_t get_setcc_opcode(enum arithmetic_op op)
+{
+    switch (op)
+    {
+        case OP_CMPEQ_I: return 0x94;   // sete
+        case OP_CMPNE_I: return 0x95;   // setne
+        case OP_CMPGT_I: return 0x9f;   // setg
+        case OP_CMPGE_I: return 0x9d;   // setge
+        case OP_CMPLT_I: return 0x9c;   // setl
+        case OP_CMPLE_I: return 0x9e;   // setle
+        case OP_CMPGT_U: return 0x97;   // seta
+        case OP_CMPGE_U: return 0x93;   // setae
+        case OP_CMPLT_U: return 0x92;   // setb
+        default: return 0x96;           // setbe (OP_CMPLE_U)
+    }
+}
+
+static void translate_scalar(struct jit *jit, const struct jit_inst *inst)
+{
+    // mov eax, [rdi + op1]
+    emit_byte(jit, 0x8b);
+    emit_memory_operand(jit, REG_EAX, REG_RDI, scalar_offset(inst->op1reg));
+
+    if (inst->op2_type == JIT_IMMEDIATE)
+    {
+        // mov ecx, imm32
+        emit_byte(jit, 0xb9);
+        emit_u32(jit, inst->imm);
+    }
+    else
+    {
+        // mov ecx, [rdi + op2]
+        emit_byte(jit, 0x8b);
+        emit_memory_operand(jit, REG_ECX, REG_RDI, scalar_offset(inst->op2reg));
+    }
+
+    // x86 shifts also use the low five bits of the count.
+    switch (inst->op)
+    {
+        case OP_OR: EMIT(jit, 0x09, 0xc8); break;           // or eax, ecx
+        case OP_AND: EMIT(jit, 0x21, 0xc8); break;          // and eax, ecx
+        case OP_XOR: EMIT(jit, 0x31, 0xc8); break;          // xor eax, ecx
+        case OP_ADD_I: EMIT(jit, 0x01, 0xc8); break;        // add eax, ecx
+        case OP_SUB_I: EMIT(jit, 0x29, 0xc8); break;        // sub eax, ecx
+        case OP_MULL_I: EMIT(jit, 0x0f, 0xaf, 0xc1); break; // imul eax, ecx
+        case OP_ASHR: EMIT(jit, 0xd3, 0xf8); break;         // sar eax, cl
+        case OP_SHR: EMIT(jit, 0xd3, 0xe8); break;          // shr eax, cl
+        case OP_SHL: EMIT(jit, 0xd3, 0xe0); break;          // shl eax, cl
+        case OP_MOVE: EMIT(jit, 0x89, 0xc8); break;         // mov eax, ecx
+        case OP_SEXT8: EMIT(jit, 0x0f, 0xbe, 0xc1); break;  // movsx eax, cl
+        case OP_SEXT16: EMIT(jit, 0x0f, 0xbf, 0xc1); break; // movsx eax, cx
+        default:
+            // Compare. The result is 0xffff if true, 0 if false.
+            EMIT(jit, 0x39, 0xc8);      // cmp eax, ecx
+            emit_byte(jit, 0x0f);       // setcc al
+            emit_byte(jit, get_setcc_opcode(inst->op));
+            emit_byte(jit, 0xc0);
+            EMIT(jit, 0x0f, 0xb6, 0xc0);    // movzx eax, al
+            EMIT(jit, 0x69, 0xc0, 0xff, 0xff, 0x00, 0x00); // imul eax, eax, 0xffff
+            break;
+    }
+
+    // mov [rdi + dest], eax
+    emit_byte(jit, 0x89);
+    emit_memory_operand(jit, REG_EAX, REG_RDI, scalar_offset(inst->destreg));
+}
+
+//
+// Vector instructions, AVX-512. One zmm register holds a whole Nyuzi vector
+// register.
+//
+
+// EVEX prefix for a 512-bit instruction whose registers are all below 8.
+// map is 1 for 0F, 2 for 0F38, 3 for 0F3A. pp is 1 for 66, 2 for F3.
+// vvvv is the first source register, or 0 if unused.
+static void emit_evex(struct jit *jit, int map, int pp, int vvvv, int opmask)
+{
+    emit_byte(jit, 0x62);
+    emit_byte(jit, (uint8_t)(0xf0 | map));
+    emit_byte(jit, (uint8_t)(((~vvvv & 15) << 3) | 4 | pp));
+    emit_byte(jit, (uint8_t)(0x48 | opmask));
+}
+
+// Opcode (in the 0F map if map is 1, 0F38 if 2) for zmm0/ymm0 = zmm0 op zmm1
+static void get_vector_opcode(enum arithmetic_op op, int *map, uint8_t *opcode)
+{
+    *map = 1;
+    switch (op)
+    {
+        case OP_OR: *opcode = 0xeb; break;      // vpor(d)
+        case OP_AND: *opcode = 0xdb; break;     // vpand(d)
+        case OP_XOR: *opcode = 0xef; break;     // vpxor(d)
+        case OP_ADD_I: *opcode = 0xfe; break;   // vpaddd
+        case OP_SUB_I: *opcode = 0xfa; break;   // vpsubd
+        case OP_MULL_I: *map = 2; *opcode = 0x40; break;   // vpmulld
+        case OP_ASHR: *map = 2; *opcode = 0x46; break;     // vpsravd
+        case OP_SHR: *map = 2; *opcode = 0x45; break;      // vpsrlvd
+        default: *map = 2; *opcode = 0x47; break;          // vpsllvd (OP_SHL)
+    }
+}
+
+// Predicate for vpcmpd/vpcmpud, comparing zmm0 to zmm1
+static uint8_t get_compare_predicate(enum arithmetic_op op)
+{
+    switch (op)
+    {
+        case OP_CMPEQ_I: return 0;
+        case OP_CMPNE_I: return 4;
+        case OP_CMPGT_I: case OP_CMPGT_U: return 6;
+        case OP_CMPGE_I: case OP_CMPGE_U: return 5;
+        case OP_CMPLT_I: case OP_CMPLT_U: return 1;
+        default: return 2;  // OP_CMPLE_I, OP_CMPLE_U
+    }
+}
+
+static void translate_vector_avx512(struct jit *jit, const struct jit_inst *inst)
+{
+    int map;
+    uint8_t opcode;
+    int result_reg = 0;
+
+    if (inst->op != OP_MOVE)
+    {
+        // vmovdqu32 zmm0, [rsi + op1]
+        emit_evex(jit, 1, 2, 0, 0);
+        emit_byte(jit, 0x6f);
+        emit_memory_operand(jit, 0, REG_RSI, vector_offset(inst->op1reg));
+    }
+
+    switch (inst->op2_type)
+    {
+        case JIT_VECTOR_REG:
+            // vmovdqu32 zmm1, [rsi + op2]
+            emit_evex(jit, 1, 2, 0, 0);
+            emit_byte(jit, 0x6f);
+            emit_memory_operand(jit, 1, REG_RSI, vector_offset(inst->op2reg));
+            break;
+
+        case JIT_SCALAR_REG:
+            // vpbroadcastd zmm1, [rdi + op2]
+            emit_evex(jit, 2, 1, 0, 0);
+            emit_byte(jit, 0x58);
+            emit_memory_operand(jit, 1, REG_RDI, scalar_offset(inst->op2reg));
+            break;
+
+        case JIT_IMMEDIATE:
+            emit_byte(jit, 0xb8);   // mov eax, imm32
+            emit_u32(jit, inst->imm);
+            emit_evex(jit, 2, 1, 0, 0); // vpbroadcastd zmm1, eax
+            EMIT(jit, 0x7c, 0xc8);
+            break;
+    }
+
+    if (is_shift(inst->op))
+    {
+        EMIT(jit, 0xb8, 0x1f, 0x00, 0x00, 0x00);    // mov eax, 31
+        emit_evex(jit, 2, 1, 0, 0);     // vpbroadcastd zmm2, eax
+        EMIT(jit, 0x7c, 0xd0);
+        emit_evex(jit, 1, 1, 1, 0);     // vpandd zmm1, zmm1, zmm2
+        EMIT(jit, 0xdb, 0xca);
+    }
+
+    if (is_integer_compare(inst->op))
+    {
+        // vpcmp(u)d k1, zmm0, zmm1, predicate
+        emit_evex(jit, 3, 1, 0, 0);
+        emit_byte(jit, inst->op >= OP_CMPGT_U ? 0x1e : 0x1f);
+        emit_byte(jit, 0xc9);
+        emit_byte(jit, get_compare_predicate(inst->op));
+        EMIT(jit, 0xc5, 0xf8, 0x93, 0xc1);  // kmovw eax, k1
+        emit_byte(jit, 0x89);               // mov [rdi + dest], eax
+        emit_memory_operand(jit, REG_EAX, REG_RDI, scalar_offset(inst->destreg));
+        return;
+    }
+
+    if (inst->op == OP_MOVE)
+        result_reg = 1;
+    else
+    {
+        // zmm0 = zmm0 op zmm1
+        get_vector_opcode(inst->op, &map, &opcode);
+        emit_evex(jit, map, 1, 0, 0);
+        emit_byte(jit, opcode);
+        emit_byte(jit, 0xc1);
+    }
+
+    if (inst->is_masked)
+    {
+        // kmovw k1, [rdi + mask]
+        EMIT(jit, 0xc5, 0xf8, 0x90);
+        emit_memory_operand(jit, 1, REG_RDI, scalar_offset(inst->maskreg));
+    }
+
+    // vmovdqu32 [rsi + dest]{k1}, zmm(result)
+    emit_evex(jit, 1, 2, 0, inst->is_masked ? 1 : 0);
+    emit_byte(jit, 0x7f);
+    emit_memory_operand(jit, result_reg, REG_RSI, vector_offset(inst->destreg));
+}
+
+//
+// Vector instructions, AVX2. Each half of a Nyuzi vector register is handled
+// separately. The halves of the destination don't overlap the other half of
+// any source, so writing the first half before reading the second is safe.
+//
+
+// Two byte VEX prefix for a 256-bit instruction in the 0F map. pp is 1 for
+// 66, 2 for F3.
+static void emit_vex2(struct jit *jit, int pp, int vvvv)
+{
+    emit_byte(jit, 0xc5);
+    emit_byte(jit, (uint8_t)(0x80 | ((~vvvv & 15) << 3) | 4 | pp));
+}
+
+// Three byte VEX prefix for a 256-bit instruction in the 0F38 map with the
+// 66 prefix.
+static void emit_vex3_0f38(struct jit *jit, int vvvv)
+{
+    emit_byte(jit, 0xc4);
+    emit_byte(jit, 0xe2);
+    emit_byte(jit, (uint8_t)(((~vvvv & 15) << 3) | 4 | 1));
+}
+
+static void translate_vector_avx2(struct jit *jit, const struct jit_inst *inst)
+{
+    int map;
+    uint8_t opcode;
+    int result_reg = inst->op == OP_MOVE ? 1 : 0;
+    uint32_t half;
+    uint32_t half_offset;
+
+    if (inst->op2_type == JIT_SCALAR_REG)
+    {
+        // vpbroadcastd ymm1, [rdi + op2]
+        emit_vex3_0f38(jit, 0);
+        emit_byte(jit, 0x58);
+        emit_memory_operand(jit, 1, REG_RDI, scalar_offset(inst->op2reg));
+    }
+    else if (inst->op2_type == JIT_IMMEDIATE)
+    {
+        emit_byte(jit, 0xb8);       // mov eax, imm32
+        emit_u32(jit, inst->imm);
+        EMIT(jit, 0xc5, 0xf9, 0x6e, 0xc8);          // vmovd xmm1, eax
+        EMIT(jit, 0xc4, 0xe2, 0x7d, 0x58, 0xc9);    // vpbroadcastd ymm1, xmm1
+    }
+
+    if (is_shift(inst->op))
+    {
+        EMIT(jit, 0xb8, 0x1f, 0x00, 0x00, 0x00);    // mov eax, 31
+        EMIT(jit, 0xc5, 0xf9, 0x6e, 0xd0);          // vmovd xmm2, eax
+        EMIT(jit, 0xc4, 0xe2, 0x7d, 0x58, 0xd2);    // vpbroadcastd ymm2, xmm2
+        if (inst->op2_type != JIT_VECTOR_REG)
+            EMIT(jit, 0xc5, 0xf5, 0xdb, 0xca);      // vpand ymm1, ymm1, ymm2
+    }
+
+    if (inst->is_masked)
+    {
+        // vpbroadcastd ymm3, [rdi + mask]
+        emit_vex3_0f38(jit, 0);
+        emit_byte(jit, 0x58);
+        emit_memory_operand(jit, 3, REG_RDI, scalar_offset(inst->maskreg));
+    }
+
+    for (half = 0; half < 2; half++)
+    {
+        half_offset = half * NUM_VECTOR_LANES / 2 * sizeof(uint32_t);
+        if (inst->op != OP_MOVE)
+        {
+            // vmovdqu ymm0, [rsi + op1]
+            emit_vex2(jit, 2, 0);
+            emit_byte(jit, 0x6f);
+            emit_memory_operand(jit, 0, REG_RSI, vector_offset(inst->op1reg)
+                                + half_offset);
+        }
+
+        if (inst->op2_type == JIT_VECTOR_REG)
+        {
+            // vmovdqu ymm1, [rsi + op2]
+            emit_vex2(jit, 2, 0);
+            emit_byte(jit, 0x6f);
+            emit_memory_operand(jit, 1, REG_RSI, vector_offset(inst->op2reg)
+                                + half_offset);
+            if (is_shift(inst->op))
+                EMIT(jit, 0xc5, 0xf5, 0xdb, 0xca);  // vpand ymm1, ymm1, ymm2
+        }
+
+        if (inst->op != OP_MOVE)
+        {
+            // ymm0 = ymm0 op ymm1
+            get_vector_opcode(inst->op, &map, &opcode);
+            if (map == 1)
+                emit_vex2(jit, 1, 0);
+            else
+                emit_vex3_0f38(jit, 0);
+
+            emit_byte(jit, opcode);
+            emit_byte(jit, 0xc1);
+        }
+
+        if (inst->is_masked)
+        {
+            // Set each lane of ymm4 to all ones if its mask bit is set.
+            emit_byte(jit, 0x48);   // mov rax, lane_bits
+            emit_byte(jit, 0xb8);
+            emit_u64(jit, (uint64_t)(uintptr_t) &lane_bits[half * NUM_VECTOR_LANES / 2]);
+            EMIT(jit, 0xc5, 0xe5, 0xdb, 0x20);  // vpand ymm4, ymm3, [rax]
+            EMIT(jit, 0xc5, 0xdd, 0x76, 0x20);  // vpcmpeqd ymm4, ymm4, [rax]
+
+            // vpmaskmovd [rsi + dest], ymm4, ymm(result)
+            emit_vex3_0f38(jit, 4);
+            emit_byte(jit, 0x8e);
+            emit_memory_operand(jit, result_reg, REG_RSI, vector_offset(inst->destreg)
+                                + half_offset);
+        }
+        else
+        {
+            // vmovdqu [rsi + dest], ymm(result)
+            emit_vex2(jit, 2, 0);
+            emit_byte(jit, 0x7f);
+            emit_memory_operand(jit, result_reg, REG_RSI, vector_offset(inst->destreg)
+                                + half_offset);
+        }
+    }
+}
+
+jit_func jit_translate(struct jit *jit, const struct jit_inst *insts, uint32_t count)
+{
+    uint32_t start = jit->used;
+    bool uses_vector = false;
+    uint32_t i;
+
+    for (i = 0; i < count; i++)
+    {
+        if (jit->used + MAX_INST_CODE_SIZE > JIT_BUFFER_SIZE)
+        {
+            jit->used = start;
+            return NULL;
+        }
+
+        if (!insts[i].is_vector)
+            translate_scalar(jit, &insts[i]);
+        else
+        {
+            uses_vector = true;
+            if (jit->use_avx512)
+                translate_vector_avx512(jit, &insts[i]);
+            else
+                translate_vector_avx2(jit, &insts[i]);
+        }
+    }
+
+    // Avoid the penalty for mixing AVX and SSE instructions in the caller.
+    if (uses_vector)
+        EMIT(jit, 0xc5, 0xf8, 0x77);    // vzeroupper
+
+    emit_byte(jit, 0xc3);   // ret
+    return (jit_func)(void*)(jit->buffer + start);
+}
+
+void jit_reset(struct jit *jit)
+{
+    jit->used = 0;
+}
+
+#else
+
+struct jit *jit_create(void)
+{
+    return NULL;
+}
+
+bool jit_can_translate(const struct jit *jit, const struct jit_inst *inst)
+{
+    (void) jit;
+    (void) inst;
+    return false;
+}
+
+jit_func jit_translate(struct jit *jit, const struct jit_inst *insts, uint32_t count)
+{
+    (void) jit;
+    (void) insts;
+    (void) count;
+    return NULL;
+}
+
+void jit_reset(struct jit *jit)
+{
+    (void) jit;
+}
+
+#endif
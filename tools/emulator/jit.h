@@ -0,0 +1,70 @@
+//
+// Copyright 2018 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "instruction-set.h"
+
+//
+// Translates runs of arithmetic instructions to x86-64 host code. Only
+// instructions that can't trap or change control flow are translated, so a
+// translated run always executes to the end. Vector instructions use AVX-512
+// if the host has it, otherwise AVX2. Results are bit-identical to the
+// interpreter. Other hosts don't support translation, and jit_create returns
+// NULL.
+//
+
+struct jit;
+
+// Where the second operand of an instruction comes from.
+enum jit_operand
+{
+    JIT_SCALAR_REG,         // Scalar register, broadcast for vector instructions
+    JIT_VECTOR_REG,
+    JIT_IMMEDIATE
+};
+
+struct jit_inst
+{
+    enum arithmetic_op op;
+    bool is_vector;         // Destination and first operand are vector registers
+    bool is_masked;
+    enum jit_operand op2_type;
+    uint8_t destreg;        // Scalar register for vector compares
+    uint8_t op1reg;
+    uint8_t op2reg;
+    uint8_t maskreg;
+    uint32_t imm;
+};
+
+// Executes the translated instructions, reading and writing the register
+// files of one thread.
+typedef void (*jit_func)(uint32_t *scalar_reg, uint32_t *vector_reg);
+
+// Returns NULL if the host doesn't support translation.
+struct jit *jit_create(void);
+
+bool jit_can_translate(const struct jit*, const struct jit_inst*);
+
+// Returns NULL if the code buffer is full. The caller must call jit_reset,
+// after which all previously returned functions are invalid.
+jit_func jit_translate(struct jit*, const struct jit_inst *insts, uint32_t count);
+void jit_reset(struct jit*);
+
+#endif
@@ -17,6 +17,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <inttypes.h>
 #include <limits.h>
 #include <signal.h>
 #include <stdbool.h>
@@ -28,12 +29,15 @@
 #include <termios.h>
 #include <unistd.h>
 #include "processor.h"
+#include "cache-model.h"
 #include "cosimulation.h"
 #include "device.h"
 #include "fbwindow.h"
 #include "instruction-set.h"
+#include "profile.h"
 #include "remote-gdb.h"
 #include "sdmmc.h"
+#include "snapshot.h"
 #include "util.h"
 
 void poll_inputs(struct processor*);
@@ -41,16 +45,41 @@ void poll_inputs(struct processor*);
 static int recv_interrupt_fd = -1;
 static int send_interrupt_fd = -1;
 static struct termios original_tconfig;
+static const char *save_snapshot_file;
+static uint64_t snapshot_instruction_count;
+
+enum
+{
+    OPT_SAVE_SNAPSHOT = 256,
+    OPT_SNAPSHOT_AT,
+    OPT_RESTORE_SNAPSHOT,
+    OPT_PROFILE,
+    OPT_CACHE_MODEL
+};
+
+static const struct option long_options[] =
+{
+    { "save-snapshot", required_argument, NULL, OPT_SAVE_SNAPSHOT },
+    { "at", required_argument, NULL, OPT_SNAPSHOT_AT },
+    { "restore-snapshot", required_argument, NULL, OPT_RESTORE_SNAPSHOT },
+    { "profile", required_argument, NULL, OPT_PROFILE },
+    { "cache-model", no_argument, NULL, OPT_CACHE_MODEL },
+    { NULL, 0, NULL, 0 }
+};
 
 static void usage(void)
 {
-    fprintf(stderr, "usage: emulator [options] <hex image file>\n");
+    fprintf(stderr, "usage: emulator [options] <image file>\n");
+    fprintf(stderr, "       emulator [options] --restore-snapshot <file>\n");
     fprintf(stderr, "options:\n");
     fprintf(stderr, "  -v Verbose, will print register transfer traces to stdout\n");
     fprintf(stderr, "  -m Mode, one of:\n");
     fprintf(stderr, "     normal  Run to completion (default)\n");
     fprintf(stderr, "     cosim   Cosimulation validation mode\n");
     fprintf(stderr, "     gdb     Start GDB listener on port 8000\n");
+    fprintf(stderr, "     threaded Run to completion, dispatching pre-decoded basic blocks\n");
+    fprintf(stderr, "     jit     Like threaded, also translating frequently executed\n");
+    fprintf(stderr, "             arithmetic instructions to host code\n");
     fprintf(stderr, "  -f <width>x<height> Display frame buffer output in window\n");
     fprintf(stderr, "  -d <filename>,<start>,<length>  Dump memory\n");
     fprintf(stderr, "  -b <filename> Load file into a virtual block device\n");
@@ -61,7 +90,16 @@ static void usage(void)
     fprintf(stderr, "  -s <file> Memory map file as shared memory\n");
     fprintf(stderr, "  -i <file> Named pipe to receive interrupts. Pipe must already be created.\n");
     fprintf(stderr, "  -o <file> Named pipe to send interrupts. Pipe must already be created\n");
-    fprintf(stderr, "  -a Enable random thread scheduling (slower)");
+    fprintf(stderr, "  -a Enable random thread scheduling (slower)\n");
+    fprintf(stderr, "  -q <instructions> Run each core on its own host thread, synchronizing\n");
+    fprintf(stderr, "     after this many instructions\n");
+    fprintf(stderr, "  --save-snapshot <file> --at <instructions> Save the state of the\n");
+    fprintf(stderr, "     system after executing this many instructions, then continue\n");
+    fprintf(stderr, "  --restore-snapshot <file> Start from a saved snapshot instead of an image\n");
+    fprintf(stderr, "  --profile <file> Write instruction and cache line counts to file\n");
+    fprintf(stderr, "  --cache-model Simulate caches, count hits and misses, and estimate stalls.\n");
+    fprintf(stderr, "     Coherence is not modeled: stores never remove lines from other cores'\n");
+    fprintf(stderr, "     L1 caches, so there are no coherence misses\n");
 }
 
 static uint32_t parse_num_arg(const char *argval)
@@ -72,6 +110,42 @@ static uint32_t parse_num_arg(const char *argval)
         return (uint32_t) strtoul(argval, NULL, 10);
 }
 
+static uint64_t parse_count_arg(const char *argval)
+{
+    if (argval[0] == '0' && argval[1] == 'x')
+        return (uint64_t) strtoull(argval + 2, NULL, 16);
+    else
+        return (uint64_t) strtoull(argval, NULL, 10);
+}
+
+// Execute the given number of instructions, saving a snapshot first if the
+// requested instruction count falls within them.
+static bool execute_with_snapshot(struct processor *proc, uint64_t instructions)
+{
+    uint64_t total;
+    uint64_t before_snapshot;
+
+    if (save_snapshot_file != NULL)
+    {
+        total = (uint64_t) get_total_instructions(proc);
+        if (total + instructions >= snapshot_instruction_count)
+        {
+            before_snapshot = snapshot_instruction_count > total
+                              ? snapshot_instruction_count - total : 0;
+            if (!execute_instructions(proc, before_snapshot))
+                return false;
+
+            if (save_snapshot(proc, save_snapshot_file) < 0)
+                exit(1);
+
+            save_snapshot_file = NULL;
+            instructions -= before_snapshot;
+        }
+    }
+
+    return execute_instructions(proc, instructions);
+}
+
 // Check for input events that would normally block.
 void poll_inputs(struct processor *proc)
 {
@@ -160,16 +234,25 @@ int main(int argc, char *argv[])
     const char *shared_memory_file = NULL;
     struct stat st;
     bool random_thread_sched = false;
+    uint32_t parallel_quantum = 0;
+    const char *restore_snapshot_file = NULL;
+    const char *profile_file = NULL;
+    struct profile *profile = NULL;
+    bool enable_cache_sim = false;
+    struct cache_model *cache_model = NULL;
     struct termios new_tconfig;
 
     enum
     {
         MODE_NORMAL,
         MODE_COSIMULATION,
-        MODE_GDB_REMOTE_DEBUG
+        MODE_GDB_REMOTE_DEBUG,
+        MODE_THREADED,
+        MODE_JIT
     } mode = MODE_NORMAL;
 
-    while ((option = getopt(argc, argv, "f:d:vm:b:t:p:c:r:s:i:o:a")) != -1)
+    while ((option = getopt_long(argc, argv, "f:d:vm:b:t:p:c:r:s:i:o:aq:",
+                                 long_options, NULL)) != -1)
     {
         switch (option)
         {
@@ -201,6 +284,10 @@ int main(int argc, char *argv[])
                     mode = MODE_COSIMULATION;
                 else if (strcmp(optarg, "gdb") == 0)
                     mode = MODE_GDB_REMOTE_DEBUG;
+                else if (strcmp(optarg, "threaded") == 0)
+                    mode = MODE_THREADED;
+                else if (strcmp(optarg, "jit") == 0)
+                    mode = MODE_JIT;
                 else
                 {
                     fprintf(stderr, "Unkown execution mode %s\n", optarg);
@@ -322,19 +409,62 @@ int main(int argc, char *argv[])
                 random_thread_sched = true;
                 break;
 
+            case 'q':
+                parallel_quantum = parse_num_arg(optarg);
+                if (parallel_quantum < 1)
+                {
+                    fprintf(stderr, "Quantum must be 1 or greater\n");
+                    return 1;
+                }
+
+                break;
+
+            case OPT_SAVE_SNAPSHOT:
+                save_snapshot_file = optarg;
+                break;
+
+            case OPT_SNAPSHOT_AT:
+                snapshot_instruction_count = parse_count_arg(optarg);
+                break;
+
+            case OPT_RESTORE_SNAPSHOT:
+                restore_snapshot_file = optarg;
+                break;
+
+            case OPT_PROFILE:
+                profile_file = optarg;
+                break;
+
+            case OPT_CACHE_MODEL:
+                enable_cache_sim = true;
+                break;
+
             case '?':
                 usage();
                 return 1;
         }
     }
 
-    if (optind == argc)
+    if (optind == argc && restore_snapshot_file == NULL)
     {
         fprintf(stderr, "No image filename specified\n");
         usage();
         return 1;
     }
 
+    if (save_snapshot_file != NULL && mode != MODE_NORMAL && mode != MODE_THREADED
+            && mode != MODE_JIT)
+    {
+        fprintf(stderr, "Snapshots can only be saved in normal, threaded and jit modes\n");
+        return 1;
+    }
+
+    if (restore_snapshot_file != NULL && mode == MODE_COSIMULATION)
+    {
+        fprintf(stderr, "Cannot restore a snapshot in cosimulation mode\n");
+        return 1;
+    }
+
     seed_random(current_time_us());
 
     // Don't randomize memory for cosimulation mode, because
@@ -344,14 +474,18 @@ int main(int argc, char *argv[])
     if (proc == NULL)
         return 1;
 
-    if (load_hex_file(proc, argv[optind]) < 0)
+    init_device(proc);
+    if (restore_snapshot_file != NULL)
+    {
+        if (restore_snapshot(proc, restore_snapshot_file) < 0)
+            return 1;
+    }
+    else if (load_image_file(proc, argv[optind]) < 0)
     {
         fprintf(stderr, "Error reading image %s\n", argv[optind]);
         return 1;
     }
 
-    init_device(proc);
-
     if (enable_fb_window)
     {
         if (init_frame_buffer(fb_width, fb_height) < 0)
@@ -361,6 +495,30 @@ int main(int argc, char *argv[])
     if (random_thread_sched)
         enable_random_thread_sched(proc);
 
+    if (profile_file != NULL)
+    {
+        profile = init_profile(get_total_threads(proc));
+        enable_profiling(proc, profile);
+    }
+
+    if (enable_cache_sim)
+    {
+        cache_model = init_cache_model(num_cores, threads_per_core);
+        enable_cache_model(proc, cache_model);
+    }
+
+    if (parallel_quantum != 0)
+    {
+        if (mode != MODE_NORMAL && mode != MODE_THREADED && mode != MODE_JIT)
+        {
+            fprintf(stderr, "Parallel execution only works in normal, threaded and jit modes\n");
+            return 1;
+        }
+
+        if (enable_parallel_execution(proc, parallel_quantum) < 0)
+            return 1;
+    }
+
     // Set up terminal for unbuffered operation for proper serial input.
     // tcgetattr will fail if we are not running in a terminal (for example,
     // input and output are pipes, which many tests do). In this case,
@@ -397,6 +555,16 @@ int main(int argc, char *argv[])
 
     switch (mode)
     {
+        case MODE_JIT:
+            if (enable_jit(proc) < 0)
+                return 1;
+
+            // Falls through
+
+        case MODE_THREADED:
+            enable_threaded_dispatch(proc);
+            // Falls through
+
         case MODE_NORMAL:
             if (verbose)
                 enable_tracing(proc);
@@ -404,7 +572,7 @@ int main(int argc, char *argv[])
             dbg_set_stop_on_fault(proc, false);
             if (enable_fb_window)
             {
-                while (execute_instructions(proc, screen_refresh_rate))
+                while (execute_with_snapshot(proc, screen_refresh_rate))
                 {
                     update_frame_buffer(proc);
                     poll_fb_window_event();
@@ -413,7 +581,7 @@ int main(int argc, char *argv[])
             }
             else
             {
-                while (execute_instructions(proc, 1000000))
+                while (execute_with_snapshot(proc, 1000000))
                     poll_inputs(proc);
             }
 
@@ -432,12 +600,24 @@ int main(int argc, char *argv[])
             break;
     }
 
+    if (save_snapshot_file != NULL)
+    {
+        fprintf(stderr, "Program stopped before instruction %" PRIu64 ", snapshot not saved\n",
+                snapshot_instruction_count);
+    }
+
+    if (profile != NULL && write_profile(profile, profile_file) < 0)
+        return 1;
+
     if (enable_memory_dump)
         write_memory_to_file(proc, mem_dump_filename, mem_dump_base, mem_dump_length);
 
     free(mem_dump_filename);
 
     dump_instruction_stats(proc);
+    if (cache_model != NULL)
+        dump_cache_stats(cache_model);
+
     if (block_device_open)
         close_sdmmc_device();
 
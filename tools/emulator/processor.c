@@ -18,19 +18,32 @@
 #include <fcntl.h>
 #include <inttypes.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
 #include <unistd.h>
 #include "processor.h"
+#include "cache-model.h"
 #include "cosimulation.h"
 #include "device.h"
 #include "instruction-set.h"
+#include "jit.h"
+#include "profile.h"
+#include "snapshot.h"
 #include "util.h"
+#include "vector-ops.h"
 
 #define TLB_SETS 16
 #define TLB_WAYS 4
+
+// Each thread caches successful translations in a direct mapped host TLB,
+// which is checked before searching the emulated TLB. There is a separate
+// table for each access type (load, store, instruction fetch) in each
+// privilege mode, because the permission checks differ.
+#define HOST_TLB_SIZE 64
+#define HOST_TLB_TABLES 6
 #define PAGE_SIZE 0x1000u
 #define ROUND_TO_PAGE(addr) ((addr) & ~(PAGE_SIZE - 1u))
 #define PAGE_OFFSET(addr) ((addr) & (PAGE_SIZE - 1u))
@@ -51,6 +64,83 @@
 // optimization. This is different than the native 'breakpoint' instruction.
 #define BREAKPOINT_INST 0x707fffff
 
+// Decoded instructions are cached in basic blocks, keyed by the physical
+// address of the first instruction. A block ends after a branch, at the end
+// of a page, or when it reaches MAX_BLOCK_LENGTH instructions. Each core has
+// its own direct mapped cache.
+#define BLOCK_CACHE_SIZE 4096
+#define MAX_BLOCK_LENGTH 32
+
+// In JIT mode, a block's instructions are translated to host code once it
+// has been entered this many times.
+#define JIT_THRESHOLD 32
+
+// In parallel mode, stores and synchronized loads hold a lock for the cache
+// line they access. Lines share locks by hashing.
+#define NUM_LINE_LOCKS 256
+
+// Each core has two event counters, which are selected with
+// CR_PERF_EVENT_SELECTn. The hardware numbers core events starting at
+// PERF_INTERRUPT (the L2 cache counts the first ones itself), and ignores
+// all but the low four bits of the select value.
+#define NUM_PERF_COUNTERS 2
+#define PERF_EVENT_SELECT_MASK 0xf
+
+enum instruction_type
+{
+    INST_REGISTER_ARITH,
+    INST_IMMEDIATE_ARITH,
+    INST_NOP,
+    INST_BREAKPOINT,
+    INST_MEMORY_ACCESS,
+    INST_BRANCH,
+    INST_CACHE_CONTROL,
+    INST_INVALID
+};
+
+struct thread;
+
+// Fields are extracted from the instruction word once, when the containing
+// basic block is built. The meaning of each field depends on the type.
+struct decoded_inst
+{
+    uint32_t instruction;   // Original encoding
+    uint8_t type;           // enum instruction_type
+    uint8_t op;
+    uint8_t fmt;
+    uint8_t op1reg;         // Also pointer register or control register index
+    uint8_t op2reg;
+    uint8_t destreg;        // Also store source register
+    uint8_t maskreg;
+    bool is_load;
+    uint32_t imm;           // Immediate value, memory offset or branch offset
+
+    // Used in threaded mode to execute this instruction directly. NULL if it
+    // must go through the interpreter.
+    void (*handler)(struct thread*, const struct decoded_inst*);
+
+    // Used in JIT mode. If jit_code isn't NULL, it is host code that
+    // executes jit_length instructions, starting with this one. jit_checked
+    // is set once translation has been tried, even if it failed.
+    jit_func jit_code;
+    uint32_t jit_length;
+    bool jit_checked;
+};
+
+struct basic_block
+{
+    uint32_t start_pc;      // Physical address
+    uint32_t length;        // Number of instructions
+    uint32_t execute_count; // Times entered, up to JIT_THRESHOLD
+    struct decoded_inst insts[MAX_BLOCK_LENGTH];
+};
+
+struct host_tlb_entry
+{
+    uint32_t virtual_page;      // INVALID_ADDR if unused
+    uint32_t physical_page;
+};
+
 struct thread
 {
     struct core *core;
@@ -65,6 +155,14 @@ struct thread
     bool enable_mmu;
     bool enable_supervisor;
     uint32_t subcycle;
+
+    // Block this thread is currently executing and the virtual address it
+    // was entered at. While the PC stays within it, instructions are
+    // fetched without translating the address. This is cleared whenever
+    // something changes that could alter the instruction translation.
+    const struct basic_block *current_block;
+    uint32_t block_virtual_pc;
+    struct host_tlb_entry host_tlb[HOST_TLB_TABLES][HOST_TLB_SIZE];
     uint32_t scalar_reg[NUM_REGISTERS];
     uint32_t vector_reg[NUM_REGISTERS][NUM_VECTOR_LANES];
 
@@ -95,6 +193,7 @@ struct tlb_entry
 struct core
 {
     struct processor *proc;
+    uint32_t id;
     struct thread *threads;
     uint32_t trap_handler_pc;
     uint32_t tlb_miss_handler_pc;
@@ -104,6 +203,22 @@ struct core
     uint32_t next_itlb_way;
     struct tlb_entry *dtlb;
     uint32_t next_dtlb_way;
+    struct basic_block *block_cache;
+    uint32_t *code_line_bitmap; // One bit per cache line, set if it holds cached code
+    bool flush_blocks;          // Another core modified cached code (parallel mode)
+    struct jit *jit;            // NULL if JIT mode is not enabled
+    int64_t total_instructions;
+
+    // Performance counters. Cache events come from the cache model instead.
+    uint64_t perf_events[NUM_PERF_EVENTS];
+    uint64_t rolled_back_instructions;
+    uint32_t perf_event_select[NUM_PERF_COUNTERS];
+    uint64_t perf_counter_base[NUM_PERF_COUNTERS];
+
+    // Used in parallel mode
+    pthread_t host_thread;
+    uint32_t next_thread;
+    uint32_t quantum_instructions;
 };
 
 struct processor
@@ -123,6 +238,10 @@ struct processor
     bool stop_on_fault;
     bool enable_tracing;
     bool enable_cosim;
+    bool enable_threaded_dispatch;
+    bool shared_memory;
+    struct profile *profile;    // NULL if profiling is not enabled
+    struct cache_model *cache_model;    // NULL if caches are not simulated
 #ifdef DUMP_INSTRUCTION_STATS
     int64_t stat_vector_inst;
     int64_t stat_load_inst;
@@ -132,7 +251,18 @@ struct processor
     int64_t stat_reg_arith_inst;
 #endif
     uint32_t current_timer_count;
-    int64_t total_instructions;
+
+    // Parallel mode. When parallel_quantum is non-zero, each core runs on
+    // its own host thread. They execute parallel_quantum instructions, then
+    // wait for the others before continuing.
+    uint32_t parallel_quantum;
+    pthread_mutex_t line_locks[NUM_LINE_LOCKS];
+    pthread_mutex_t device_lock;
+    pthread_mutex_t quantum_lock;
+    pthread_cond_t quantum_start;
+    pthread_cond_t quantum_done;
+    uint32_t quantum_generation;
+    uint32_t cores_running;
 };
 
 struct breakpoint
@@ -149,7 +279,17 @@ static void print_thread_registers(const struct thread*);
 static void set_scalar_reg(struct thread*, uint32_t reg, uint32_t value);
 static void set_vector_reg(struct thread*, uint32_t reg, uint32_t mask,
                            uint32_t *values);
-static void invalidate_sync_address(struct core*, uint32_t address);
+static void invalidate_sync_address(struct processor*, uint32_t address);
+static void invalidate_code_address(struct processor*, const struct core *writer,
+                                    uint32_t address);
+static void invalidate_code_line(struct core*, uint32_t line);
+static void release_block(struct core*, const struct basic_block*);
+static void clear_core_blocks(struct core*);
+static void flush_core_blocks(struct core*);
+static void check_flush_blocks(struct core*);
+static const struct basic_block *lookup_block(struct core*, uint32_t physical_pc);
+static void decode_instruction(uint32_t instruction, struct decoded_inst*);
+static void select_handler(struct decoded_inst*);
 static void try_to_dispatch_interrupt(struct thread*);
 static uint32_t get_pending_interrupts(struct thread*);
 static const char *get_trap_name(enum trap_type);
@@ -159,29 +299,47 @@ static void raise_trap(struct thread*, uint32_t address, enum trap_type type, bo
 // Translate addresses using the translation lookaside buffer. Returns true
 // if there was a valid translation, false otherwise (in the latter case, it
 // will also raise a trap or print an error as a side effect).
+static void flush_host_tlb(struct thread*);
+static void invalidate_host_tlb_page(struct core*, uint32_t virtual_address);
 static bool translate_address(struct thread*, uint32_t virtual_address, uint32_t
                               *physical_address, bool is_store, bool is_data_cache);
 static uint32_t scalar_arithmetic_op(enum arithmetic_op, uint32_t value1, uint32_t value2);
 static bool is_compare_op(uint32_t op);
 static struct breakpoint *lookup_breakpoint(struct processor*, uint32_t pc);
-static void execute_register_arith_inst(struct thread*, uint32_t instruction);
-static void execute_immediate_arith_inst(struct thread*, uint32_t instruction);
-static void execute_scalar_load_store_inst(struct thread*, uint32_t instruction);
-static void execute_block_load_store_inst(struct thread*, uint32_t instruction);
-static void execute_scatter_gather_inst(struct thread*, uint32_t instruction);
-static void execute_control_register_inst(struct thread*, uint32_t instruction);
+static void execute_register_arith_inst(struct thread*, const struct decoded_inst*);
+static void execute_immediate_arith_inst(struct thread*, const struct decoded_inst*);
+static void execute_scalar_load_store_inst(struct thread*, const struct decoded_inst*);
+static void execute_block_load_store_inst(struct thread*, const struct decoded_inst*);
+static void execute_scatter_gather_inst(struct thread*, const struct decoded_inst*);
+static void execute_control_register_inst(struct thread*, const struct decoded_inst*);
 static void read_control_register(struct thread*, uint32_t cr_index,
                                   uint32_t dst_src_reg);
 static void write_control_register(struct thread*, uint32_t cr_index,
                                    uint32_t dst_src_reg);
-static void execute_memory_access_inst(struct thread*, uint32_t instruction);
-static void execute_branch_inst(struct thread*, uint32_t instruction);
-static void execute_cache_control_inst(struct thread*, uint32_t instruction);
+static void execute_memory_access_inst(struct thread*, const struct decoded_inst*);
+static void execute_branch_inst(struct thread*, const struct decoded_inst*);
+static uint64_t get_core_event_count(const struct core*, enum performance_event);
+static uint64_t read_perf_counter(const struct core*, uint32_t counter);
+static void execute_cache_control_inst(struct thread*, const struct decoded_inst*);
 
 // Returns false if this hit a breakpoint and should break out of execution
 // loop.
+static void execute_nop_inst(struct thread*, const struct decoded_inst*);
 static bool execute_instruction(struct thread*);
+static uint32_t execute_block(struct thread*, uint64_t max_instructions);
+static void translate_run(struct core*, struct basic_block*, uint32_t start);
+static void reset_jit(struct core*);
+static bool can_run_translated(const struct thread*, uint32_t length,
+                               uint64_t max_instructions);
+static bool execute_parallel(struct processor*, uint64_t instructions);
+static void *core_thread_main(void *arg);
+static void execute_core_quantum(struct core*);
+static void lock_line(struct processor*, uint32_t address);
+static void unlock_line(struct processor*, uint32_t address);
+static void lock_devices(struct processor*);
+static void unlock_devices(struct processor*);
 static void timer_tick(struct processor *proc);
+static void advance_timer(struct processor *proc, uint32_t instructions);
 
 struct processor *init_processor(uint32_t memory_size, uint32_t num_cores,
                                  uint32_t threads_per_core, bool randomize_memory,
@@ -198,6 +356,7 @@ struct processor *init_processor(uint32_t memory_size, uint32_t num_cores,
     // Limited by enable mask
     assert(num_cores * threads_per_core <= 32);
 
+    init_vector_ops();
     proc = (struct processor*) calloc(sizeof(struct processor), 1);
     proc->memory_size = memory_size;
     if (shared_memory_file != NULL)
@@ -225,13 +384,18 @@ struct processor *init_processor(uint32_t memory_size, uint32_t num_cores,
             free(proc);
             return NULL;
         }
+
+        proc->shared_memory = true;
     }
     else
     {
-        proc->memory = (uint32_t*) malloc(memory_size);
-        if (proc->memory == NULL)
+        // This is page aligned so load_image_file can map parts of the
+        // image file over it.
+        proc->memory = mmap(NULL, memory_size, PROT_READ | PROT_WRITE, MAP_PRIVATE
+                            | MAP_ANONYMOUS, -1, 0);
+        if (proc->memory == MAP_FAILED)
         {
-            perror("init_processor: malloc failed");
+            perror("init_processor: mmap failed");
             free(proc);
             return NULL;
         }
@@ -250,6 +414,7 @@ struct processor *init_processor(uint32_t memory_size, uint32_t num_cores,
     {
         core = &proc->cores[core_id];
         core->proc = proc;
+        core->id = core_id;
         core->itlb = (struct tlb_entry*) malloc(sizeof(struct tlb_entry) * TLB_SETS * TLB_WAYS);
         core->dtlb = (struct tlb_entry*) malloc(sizeof(struct tlb_entry) * TLB_SETS * TLB_WAYS);
         for (i = 0; i < TLB_SETS * TLB_WAYS; i++)
@@ -259,6 +424,14 @@ struct processor *init_processor(uint32_t memory_size, uint32_t num_cores,
             core->dtlb[i].virtual_address = INVALID_ADDR;
         }
 
+        core->block_cache = (struct basic_block*) malloc(sizeof(struct basic_block)
+                                                         * BLOCK_CACHE_SIZE);
+        for (i = 0; i < BLOCK_CACHE_SIZE; i++)
+            core->block_cache[i].start_pc = INVALID_ADDR;
+
+        core->code_line_bitmap = (uint32_t*) calloc(memory_size / CACHE_LINE_LENGTH
+                                                    / 32 + 1, sizeof(uint32_t));
+
         core->threads = (struct thread*) calloc(sizeof(struct thread), threads_per_core);
         for (thread_id = 0; thread_id < threads_per_core; thread_id++)
         {
@@ -267,6 +440,7 @@ struct processor *init_processor(uint32_t memory_size, uint32_t num_cores,
             core->threads[thread_id].last_sync_load_addr = INVALID_ADDR;
             core->threads[thread_id].enable_supervisor = true;
             core->threads[thread_id].saved_trap_state[0].enable_supervisor = true;
+            flush_host_tlb(&core->threads[thread_id]);
         }
 
         core->trap_handler_pc = 0;
@@ -290,9 +464,24 @@ void enable_random_thread_sched(struct processor *proc)
     proc->random_thread_sched = true;
 }
 
-int load_hex_file(struct processor *proc, const char *filename)
+int load_image_file(struct processor *proc, const char *filename)
 {
-    return read_hex_file(filename, proc->memory, proc->memory_size);
+    size_t name_length = strlen(filename);
+
+    // Mapping the image over a shared memory file would disconnect those
+    // pages from the file, so copy it in that case.
+    if (is_elf_file(filename))
+    {
+        return read_elf_file(filename, proc->memory, proc->memory_size,
+                             !proc->shared_memory);
+    }
+    else if (name_length > 4 && strcmp(filename + name_length - 4, ".bin") == 0)
+    {
+        return read_binary_file(filename, proc->memory, proc->memory_size,
+                                !proc->shared_memory);
+    }
+    else
+        return read_hex_file(filename, proc->memory, proc->memory_size);
 }
 
 void write_memory_to_file(const struct processor *proc, const char *filename,
@@ -317,6 +506,388 @@ void write_memory_to_file(const struct processor *proc, const char *filename,
     fclose(file);
 }
 
+// Memory is stored a page at a time. Pages where every word has the same
+// value (which is common for cleared memory) only store that value. Other
+// pages are compressed into runs, each starting with a header word that has
+// the number of words in the run. If SNAPSHOT_RUN_REPEAT is set in the header,
+// the run is one value repeated, otherwise the words follow it. Pages that
+// don't get smaller this way are stored as is.
+#define SNAPSHOT_PAGE_SIZE 4096
+#define SNAPSHOT_PAGE_FILL 0
+#define SNAPSHOT_PAGE_DATA 1
+#define SNAPSHOT_PAGE_RUNS 2
+#define SNAPSHOT_RUN_REPEAT 0x80000000
+
+// A repeated run takes two words, so shorter ones are stored with the
+// surrounding words.
+#define SNAPSHOT_MIN_REPEAT 3
+
+// Returns false if this would make the encoded page as large as the original.
+static bool append_literal_run(const uint32_t *words, uint32_t count,
+                               uint32_t *encoded, uint32_t *encoded_length,
+                               uint32_t page_words)
+{
+    if (count == 0)
+        return true;
+
+    if (*encoded_length + count + 1 >= page_words)
+        return false;
+
+    encoded[(*encoded_length)++] = count;
+    memcpy(encoded + *encoded_length, words, count * sizeof(uint32_t));
+    *encoded_length += count;
+    return true;
+}
+
+// Returns the number of words in the encoded page, or zero if compressing
+// it doesn't save any space.
+static uint32_t encode_page_runs(const uint32_t *page, uint32_t page_words,
+                                 uint32_t *encoded)
+{
+    uint32_t encoded_length = 0;
+    uint32_t literal_start = 0;
+    uint32_t run_length;
+    uint32_t i = 0;
+
+    while (i < page_words)
+    {
+        run_length = 1;
+        while (i + run_length < page_words && page[i + run_length] == page[i])
+            run_length++;
+
+        if (run_length >= SNAPSHOT_MIN_REPEAT)
+        {
+            if (!append_literal_run(page + literal_start, i - literal_start,
+                                    encoded, &encoded_length, page_words)
+                    || encoded_length + 2 >= page_words)
+                return 0;
+
+            encoded[encoded_length++] = SNAPSHOT_RUN_REPEAT | run_length;
+            encoded[encoded_length++] = page[i];
+            literal_start = i + run_length;
+        }
+
+        i += run_length;
+    }
+
+    if (!append_literal_run(page + literal_start, page_words - literal_start,
+                            encoded, &encoded_length, page_words))
+        return 0;
+
+    return encoded_length;
+}
+
+static void write_memory_snapshot(const struct processor *proc, FILE *file)
+{
+    const uint32_t *page;
+    uint32_t encoded[SNAPSHOT_PAGE_SIZE / 4];
+    uint32_t encoded_length;
+    uint32_t address;
+    uint32_t page_length;
+    uint32_t i;
+
+    for (address = 0; address < proc->memory_size; address += SNAPSHOT_PAGE_SIZE)
+    {
+        page = UINT32_PTR(proc->memory, address);
+        page_length = MIN(SNAPSHOT_PAGE_SIZE, proc->memory_size - address);
+        for (i = 1; i < page_length / 4; i++)
+        {
+            if (page[i] != page[0])
+                break;
+        }
+
+        if (i == page_length / 4)
+        {
+            write_snapshot_u8(file, SNAPSHOT_PAGE_FILL);
+            write_snapshot_u32(file, page[0]);
+            continue;
+        }
+
+        encoded_length = encode_page_runs(page, page_length / 4, encoded);
+        if (encoded_length > 0)
+        {
+            write_snapshot_u8(file, SNAPSHOT_PAGE_RUNS);
+            write_snapshot_u32_array(file, encoded, encoded_length);
+        }
+        else
+        {
+            write_snapshot_u8(file, SNAPSHOT_PAGE_DATA);
+            write_snapshot_u32_array(file, page, page_length / 4);
+        }
+    }
+}
+
+// Returns -1 if a run doesn't fit in the page
+static int read_page_runs(uint32_t *page, uint32_t page_words, FILE *file)
+{
+    uint32_t offset = 0;
+    uint32_t header;
+    uint32_t run_length;
+    uint32_t value;
+    uint32_t i;
+
+    while (offset < page_words)
+    {
+        header = read_snapshot_u32(file);
+        run_length = header & ~SNAPSHOT_RUN_REPEAT;
+        if (run_length == 0 || run_length > page_words - offset)
+            return -1;
+
+        if (header & SNAPSHOT_RUN_REPEAT)
+        {
+            value = read_snapshot_u32(file);
+            for (i = 0; i < run_length; i++)
+                page[offset + i] = value;
+        }
+        else
+            read_snapshot_u32_array(file, page + offset, run_length);
+
+        offset += run_length;
+    }
+
+    return 0;
+}
+
+static int read_memory_snapshot(struct processor *proc, FILE *file)
+{
+    uint32_t *page;
+    uint32_t address;
+    uint32_t page_length;
+    uint32_t fill_value;
+    uint32_t i;
+    int result = 0;
+
+    for (address = 0; address < proc->memory_size; address += SNAPSHOT_PAGE_SIZE)
+    {
+        page = UINT32_PTR(proc->memory, address);
+        page_length = MIN(SNAPSHOT_PAGE_SIZE, proc->memory_size - address);
+        switch (read_snapshot_u8(file))
+        {
+            case SNAPSHOT_PAGE_FILL:
+                fill_value = read_snapshot_u32(file);
+                for (i = 0; i < page_length / 4; i++)
+                    page[i] = fill_value;
+
+                break;
+
+            case SNAPSHOT_PAGE_DATA:
+                read_snapshot_u32_array(file, page, page_length / 4);
+                break;
+
+            case SNAPSHOT_PAGE_RUNS:
+                result = read_page_runs(page, page_length / 4, file);
+                break;
+
+            default:
+                result = -1;
+        }
+
+        // The caller reports a truncated file
+        if (feof(file))
+            return 0;
+
+        if (result < 0)
+        {
+            fprintf(stderr, "read_memory_snapshot: bad page at address %08x\n",
+                    address);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void write_tlb_state(const struct tlb_entry *tlb, FILE *file)
+{
+    int i;
+
+    for (i = 0; i < TLB_SETS * TLB_WAYS; i++)
+    {
+        write_snapshot_u32(file, tlb[i].asid);
+        write_snapshot_u32(file, tlb[i].virtual_address);
+        write_snapshot_u32(file, tlb[i].phys_addr_and_flags);
+    }
+}
+
+static void read_tlb_state(struct tlb_entry *tlb, FILE *file)
+{
+    int i;
+
+    for (i = 0; i < TLB_SETS * TLB_WAYS; i++)
+    {
+        tlb[i].asid = read_snapshot_u32(file);
+        tlb[i].virtual_address = read_snapshot_u32(file);
+        tlb[i].phys_addr_and_flags = read_snapshot_u32(file);
+    }
+}
+
+static void write_thread_state(const struct thread *thread, FILE *file)
+{
+    int level;
+
+    write_snapshot_u32(file, thread->last_sync_load_addr);
+    write_snapshot_u32(file, thread->pc);
+    write_snapshot_u32(file, thread->asid);
+    write_snapshot_u32(file, thread->page_dir);
+    write_snapshot_u32(file, thread->interrupt_mask);
+    write_snapshot_u32(file, thread->latched_interrupts);
+    write_snapshot_bool(file, thread->enable_interrupt);
+    write_snapshot_bool(file, thread->enable_mmu);
+    write_snapshot_bool(file, thread->enable_supervisor);
+    write_snapshot_u32(file, thread->subcycle);
+    write_snapshot_u32_array(file, thread->scalar_reg, NUM_REGISTERS);
+    write_snapshot_u32_array(file, &thread->vector_reg[0][0],
+                             NUM_REGISTERS * NUM_VECTOR_LANES);
+    for (level = 0; level < TRAP_LEVELS; level++)
+    {
+        write_snapshot_u32(file, thread->saved_trap_state[level].trap_cause);
+        write_snapshot_u32(file, thread->saved_trap_state[level].pc);
+        write_snapshot_u32(file, thread->saved_trap_state[level].access_address);
+        write_snapshot_u32(file, thread->saved_trap_state[level].scratchpad0);
+        write_snapshot_u32(file, thread->saved_trap_state[level].scratchpad1);
+        write_snapshot_u32(file, thread->saved_trap_state[level].subcycle);
+        write_snapshot_u32(file, thread->saved_trap_state[level].syscall_index);
+        write_snapshot_bool(file, thread->saved_trap_state[level].enable_interrupt);
+        write_snapshot_bool(file, thread->saved_trap_state[level].enable_mmu);
+        write_snapshot_bool(file, thread->saved_trap_state[level].enable_supervisor);
+    }
+}
+
+static void read_thread_state(struct thread *thread, FILE *file)
+{
+    int level;
+
+    thread->last_sync_load_addr = read_snapshot_u32(file);
+    thread->pc = read_snapshot_u32(file);
+    thread->asid = read_snapshot_u32(file);
+    thread->page_dir = read_snapshot_u32(file);
+    thread->interrupt_mask = read_snapshot_u32(file);
+    thread->latched_interrupts = read_snapshot_u32(file);
+    thread->enable_interrupt = read_snapshot_bool(file);
+    thread->enable_mmu = read_snapshot_bool(file);
+    thread->enable_supervisor = read_snapshot_bool(file);
+    thread->subcycle = read_snapshot_u32(file);
+    read_snapshot_u32_array(file, thread->scalar_reg, NUM_REGISTERS);
+    read_snapshot_u32_array(file, &thread->vector_reg[0][0],
+                            NUM_REGISTERS * NUM_VECTOR_LANES);
+    for (level = 0; level < TRAP_LEVELS; level++)
+    {
+        thread->saved_trap_state[level].trap_cause = read_snapshot_u32(file);
+        thread->saved_trap_state[level].pc = read_snapshot_u32(file);
+        thread->saved_trap_state[level].access_address = read_snapshot_u32(file);
+        thread->saved_trap_state[level].scratchpad0 = read_snapshot_u32(file);
+        thread->saved_trap_state[level].scratchpad1 = read_snapshot_u32(file);
+        thread->saved_trap_state[level].subcycle = read_snapshot_u32(file);
+        thread->saved_trap_state[level].syscall_index = read_snapshot_u32(file);
+        thread->saved_trap_state[level].enable_interrupt = read_snapshot_bool(file);
+        thread->saved_trap_state[level].enable_mmu = read_snapshot_bool(file);
+        thread->saved_trap_state[level].enable_supervisor = read_snapshot_bool(file);
+    }
+}
+
+void write_processor_state(const struct processor *proc, FILE *file)
+{
+    uint32_t core_id;
+    uint32_t thread_id;
+    const struct core *core;
+    int i;
+
+    write_snapshot_u32(file, proc->num_cores);
+    write_snapshot_u32(file, proc->threads_per_core);
+    write_snapshot_u32(file, proc->memory_size);
+    write_snapshot_u32(file, proc->thread_enable_mask);
+    write_snapshot_u32(file, proc->interrupt_levels);
+    write_snapshot_u32(file, proc->current_timer_count);
+    for (core_id = 0; core_id < proc->num_cores; core_id++)
+    {
+        core = &proc->cores[core_id];
+        write_snapshot_u32(file, core->trap_handler_pc);
+        write_snapshot_u32(file, core->tlb_miss_handler_pc);
+        write_snapshot_u32(file, core->phys_tlb_update_addr);
+        write_snapshot_u32(file, core->is_level_triggered);
+        write_snapshot_u32(file, core->next_itlb_way);
+        write_snapshot_u32(file, core->next_dtlb_way);
+        write_snapshot_u64(file, (uint64_t) core->total_instructions);
+        for (i = 0; i < NUM_PERF_EVENTS; i++)
+            write_snapshot_u64(file, core->perf_events[i]);
+
+        write_snapshot_u64(file, core->rolled_back_instructions);
+        for (i = 0; i < NUM_PERF_COUNTERS; i++)
+        {
+            write_snapshot_u32(file, core->perf_event_select[i]);
+            write_snapshot_u64(file, core->perf_counter_base[i]);
+        }
+
+        write_tlb_state(core->itlb, file);
+        write_tlb_state(core->dtlb, file);
+        for (thread_id = 0; thread_id < proc->threads_per_core; thread_id++)
+            write_thread_state(&core->threads[thread_id], file);
+    }
+
+    write_memory_snapshot(proc, file);
+}
+
+int read_processor_state(struct processor *proc, FILE *file)
+{
+    uint32_t num_cores;
+    uint32_t threads_per_core;
+    uint32_t memory_size;
+    uint32_t core_id;
+    uint32_t thread_id;
+    struct core *core;
+    int i;
+
+    num_cores = read_snapshot_u32(file);
+    threads_per_core = read_snapshot_u32(file);
+    memory_size = read_snapshot_u32(file);
+    if (num_cores != proc->num_cores || threads_per_core != proc->threads_per_core
+            || memory_size != proc->memory_size)
+    {
+        fprintf(stderr, "read_processor_state: snapshot has %u cores, %u threads per core, "
+                "and %u bytes of memory. Use the same -p, -t, and -c options.\n",
+                num_cores, threads_per_core, memory_size);
+        return -1;
+    }
+
+    proc->thread_enable_mask = read_snapshot_u32(file);
+    proc->interrupt_levels = read_snapshot_u32(file);
+    proc->current_timer_count = read_snapshot_u32(file);
+    for (core_id = 0; core_id < proc->num_cores; core_id++)
+    {
+        core = &proc->cores[core_id];
+        core->trap_handler_pc = read_snapshot_u32(file);
+        core->tlb_miss_handler_pc = read_snapshot_u32(file);
+        core->phys_tlb_update_addr = read_snapshot_u32(file);
+        core->is_level_triggered = read_snapshot_u32(file);
+        core->next_itlb_way = read_snapshot_u32(file);
+        core->next_dtlb_way = read_snapshot_u32(file);
+        core->total_instructions = (int64_t) read_snapshot_u64(file);
+        for (i = 0; i < NUM_PERF_EVENTS; i++)
+            core->perf_events[i] = read_snapshot_u64(file);
+
+        core->rolled_back_instructions = read_snapshot_u64(file);
+        for (i = 0; i < NUM_PERF_COUNTERS; i++)
+        {
+            core->perf_event_select[i] = read_snapshot_u32(file);
+            core->perf_counter_base[i] = read_snapshot_u64(file);
+        }
+
+        read_tlb_state(core->itlb, file);
+        read_tlb_state(core->dtlb, file);
+        for (thread_id = 0; thread_id < proc->threads_per_core; thread_id++)
+        {
+            read_thread_state(&core->threads[thread_id], file);
+            flush_host_tlb(&core->threads[thread_id]);
+        }
+
+        // The code in memory is about to change
+        flush_core_blocks(core);
+        core->flush_blocks = false;
+    }
+
+    return read_memory_snapshot(proc, file);
+}
+
 const void *get_memory_region_ptr(const struct processor *proc, uint32_t address, uint32_t length)
 {
     assert(length < proc->memory_size);
@@ -338,6 +909,71 @@ void enable_cosimulation(struct processor *proc)
     proc->enable_cosim = true;
 }
 
+void enable_threaded_dispatch(struct processor *proc)
+{
+    proc->enable_threaded_dispatch = true;
+}
+
+int enable_jit(struct processor *proc)
+{
+    uint32_t core_id;
+
+    for (core_id = 0; core_id < proc->num_cores; core_id++)
+    {
+        proc->cores[core_id].jit = jit_create();
+        if (proc->cores[core_id].jit == NULL)
+        {
+            fprintf(stderr, "JIT mode is not supported on this host\n");
+            return -1;
+        }
+    }
+
+    proc->enable_threaded_dispatch = true;
+    return 0;
+}
+
+void enable_profiling(struct processor *proc, struct profile *profile)
+{
+    proc->profile = profile;
+}
+
+void enable_cache_model(struct processor *proc, struct cache_model *cache_model)
+{
+    proc->cache_model = cache_model;
+}
+
+int enable_parallel_execution(struct processor *proc, uint32_t quantum)
+{
+    uint32_t core_id;
+    int i;
+    int error;
+
+    assert(quantum > 0);
+    for (i = 0; i < NUM_LINE_LOCKS; i++)
+        pthread_mutex_init(&proc->line_locks[i], NULL);
+
+    pthread_mutex_init(&proc->device_lock, NULL);
+    pthread_mutex_init(&proc->quantum_lock, NULL);
+    pthread_cond_init(&proc->quantum_start, NULL);
+    pthread_cond_init(&proc->quantum_done, NULL);
+    proc->parallel_quantum = quantum;
+
+    // The calling thread executes the first core.
+    for (core_id = 1; core_id < proc->num_cores; core_id++)
+    {
+        error = pthread_create(&proc->cores[core_id].host_thread, NULL,
+                               core_thread_main, &proc->cores[core_id]);
+        if (error != 0)
+        {
+            fprintf(stderr, "enable_parallel_execution: pthread_create failed: %s\n",
+                    strerror(error));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
 void raise_interrupt(struct processor *proc, uint32_t int_bitmap)
 {
     uint32_t thread_id;
@@ -397,12 +1033,40 @@ bool is_stopped_on_fault(const struct processor *proc)
     return proc->crashed;
 }
 
+// In parallel mode, this may read counts from other cores while they are
+// being updated, but each only increases, so the result is still monotonic.
+int64_t get_total_instructions(const struct processor *proc)
+{
+    int64_t total = 0;
+    uint32_t core_id;
+
+    for (core_id = 0; core_id < proc->num_cores; core_id++)
+        total += proc->cores[core_id].total_instructions;
+
+    return total;
+}
+
+uint64_t get_perf_event_count(const struct processor *proc,
+                              enum performance_event event)
+{
+    uint64_t total = 0;
+    uint32_t core_id;
+
+    for (core_id = 0; core_id < proc->num_cores; core_id++)
+        total += get_core_event_count(&proc->cores[core_id], event);
+
+    return total;
+}
+
 bool execute_instructions(struct processor *proc, uint64_t total_instructions)
 {
     uint64_t instruction_count;
     uint32_t next_thread = 0;
 
     proc->single_stepping = false;
+    if (proc->parallel_quantum != 0)
+        return execute_parallel(proc, total_instructions);
+
     if (proc->random_thread_sched)
     {
         for (instruction_count = 0; instruction_count < total_instructions;
@@ -419,10 +1083,19 @@ bool execute_instructions(struct processor *proc, uint64_t total_instructions)
 
             next_thread = next_set_bit(proc->thread_enable_mask,
                 (uint32_t) next_random() % proc->total_threads);
-            if (!execute_instruction(get_thread(proc, next_thread)))
-                return false;  // Hit breakpoint
+            if (proc->enable_threaded_dispatch)
+            {
+                // Subtract one for the loop increment
+                instruction_count += execute_block(get_thread(proc, next_thread),
+                    total_instructions - instruction_count) - 1;
+            }
+            else
+            {
+                if (!execute_instruction(get_thread(proc, next_thread)))
+                    return false;  // Hit breakpoint
 
-            timer_tick(proc);
+                timer_tick(proc);
+            }
         }
     }
     else
@@ -442,10 +1115,18 @@ bool execute_instructions(struct processor *proc, uint64_t total_instructions)
 
             next_thread = next_set_bit(proc->thread_enable_mask,
                 ((next_thread + 31) & 31));
-            if (!execute_instruction(get_thread(proc, next_thread)))
-                return false;  // Hit breakpoint
+            if (proc->enable_threaded_dispatch)
+            {
+                instruction_count += execute_block(get_thread(proc, next_thread),
+                    total_instructions - instruction_count) - 1;
+            }
+            else
+            {
+                if (!execute_instruction(get_thread(proc, next_thread)))
+                    return false;  // Hit breakpoint
 
-            timer_tick(proc);
+                timer_tick(proc);
+            }
         }
     }
 
@@ -502,10 +1183,13 @@ uint32_t dbg_read_memory_byte(const struct processor *proc, uint32_t address)
     return ((uint8_t*)proc->memory)[address];
 }
 
-void dbg_write_memory_byte(const struct processor *proc, uint32_t address, uint8_t byte)
+void dbg_write_memory_byte(struct processor *proc, uint32_t address, uint8_t byte)
 {
     if (address < proc->memory_size)
+    {
         ((uint8_t*)proc->memory)[address] = byte;
+        invalidate_code_address(proc, NULL, address);
+    }
 }
 
 int dbg_set_breakpoint(struct processor *proc, uint32_t pc)
@@ -532,6 +1216,7 @@ int dbg_set_breakpoint(struct processor *proc, uint32_t pc)
         breakpoint->original_instruction = INSTRUCTION_NOP;	// Avoid infinite loop
 
     proc->memory[pc / 4] = BREAKPOINT_INST;
+    invalidate_code_address(proc, NULL, pc);
     return 0;
 }
 
@@ -546,6 +1231,7 @@ int dbg_clear_breakpoint(struct processor *proc, uint32_t pc)
         if (breakpoint->address == pc)
         {
             proc->memory[pc / 4] = breakpoint->original_instruction;
+            invalidate_code_address(proc, NULL, pc);
             *link = breakpoint->next;
             free(breakpoint);
             return 0;
@@ -562,10 +1248,12 @@ void dbg_set_stop_on_fault(struct processor *proc, bool stop_on_fault)
 
 void dump_instruction_stats(struct processor *proc)
 {
-    printf("%" PRId64 " total instructions\n", proc->total_instructions);
+    int64_t total_instructions = get_total_instructions(proc);
+
+    printf("%" PRId64 " total instructions\n", total_instructions);
 #ifdef DUMP_INSTRUCTION_STATS
 #define PRINT_STAT(name) printf("%s %" PRId64 " %.4g%%\n", #name, proc->stat ## name, \
-		(double) proc->stat ## name / proc->total_instructions * 100);
+		(double) proc->stat ## name / total_instructions * 100);
 
     PRINT_STAT(vector_inst);
     PRINT_STAT(load_inst);
@@ -664,29 +1352,263 @@ static void set_vector_reg(struct thread *thread, uint32_t reg, uint32_t mask,
     if (thread->core->proc->enable_cosim)
         cosim_check_set_vector_reg(thread->core->proc, thread->pc - 4, reg, mask, values);
 
-    for (lane = 0; lane < NUM_VECTOR_LANES; lane++)
-    {
-        if (mask & (1 << lane))
-            thread->vector_reg[reg][lane] = values[lane];
-    }
+    vector_masked_copy(thread->vector_reg[reg], values, mask);
 }
 
-static void invalidate_sync_address(struct core *core, uint32_t address)
+// Cancel synchronized loads from all threads to this cache line, so a
+// following synchronized store will fail. In parallel mode, the caller holds
+// the lock for this line, but threads on other cores may concurrently set
+// their reservation to a different line, so don't overwrite that.
+static void invalidate_sync_address(struct processor *proc, uint32_t address)
 {
+    uint32_t line = address / CACHE_LINE_LENGTH;
+    uint32_t expected;
+    uint32_t core_id;
     uint32_t thread_id;
+    struct thread *thread;
 
-    for (thread_id = 0; thread_id < core->proc->total_threads; thread_id++)
+    for (core_id = 0; core_id < proc->num_cores; core_id++)
     {
-        if (core->threads[thread_id].last_sync_load_addr == address / CACHE_LINE_LENGTH)
-            core->threads[thread_id].last_sync_load_addr = INVALID_ADDR;
+        for (thread_id = 0; thread_id < proc->threads_per_core; thread_id++)
+        {
+            thread = &proc->cores[core_id].threads[thread_id];
+            if (__atomic_load_n(&thread->last_sync_load_addr, __ATOMIC_RELAXED) == line)
+            {
+                expected = line;
+                __atomic_compare_exchange_n(&thread->last_sync_load_addr, &expected,
+                                            INVALID_ADDR, false, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED);
+            }
+        }
     }
 }
 
-static void try_to_dispatch_interrupt(struct thread *thread)
+// Remove cached instructions at this address. In parallel mode, other cores
+// may be executing from their caches on another host thread, so this sets
+// their flush_blocks flag instead, and they flush their caches before
+// executing the next instruction. The flag is set after the memory write,
+// so a core that sees a later write by this thread (for example, a flag
+// that says the code is ready) also sees the flag. writer is NULL for
+// debugger writes.
+static void invalidate_code_address(struct processor *proc, const struct core *writer,
+                                    uint32_t address)
 {
-    uint32_t pending = get_pending_interrupts(thread);
-    if (!thread->enable_interrupt)
-        return;
+    uint32_t line = address / CACHE_LINE_LENGTH;
+    uint32_t core_id;
+    struct core *core;
+
+    for (core_id = 0; core_id < proc->num_cores; core_id++)
+    {
+        core = &proc->cores[core_id];
+        if (__atomic_load_n(&core->code_line_bitmap[line / 32], __ATOMIC_RELAXED)
+                & (1u << (line % 32)))
+        {
+            if (core == writer || proc->parallel_quantum == 0)
+                invalidate_code_line(core, line);
+            else
+                __atomic_store_n(&core->flush_blocks, true, __ATOMIC_SEQ_CST);
+        }
+    }
+}
+
+// Remove all cached blocks that contain instructions in this cache line.
+// Blocks don't cross page boundaries and are at most MAX_BLOCK_LENGTH
+// instructions long, which bounds the set of start addresses to check.
+static void invalidate_code_line(struct core *core, uint32_t line)
+{
+    uint32_t line_address = line * CACHE_LINE_LENGTH;
+    uint32_t pc;
+    struct basic_block *block;
+
+    if (PAGE_OFFSET(line_address) < (MAX_BLOCK_LENGTH - 1) * 4)
+        pc = ROUND_TO_PAGE(line_address);
+    else
+        pc = line_address - (MAX_BLOCK_LENGTH - 1) * 4;
+
+    for (; pc < line_address + CACHE_LINE_LENGTH; pc += 4)
+    {
+        block = &core->block_cache[(pc / 4) % BLOCK_CACHE_SIZE];
+        if (block->start_pc == pc && pc + block->length * 4 > line_address)
+        {
+            release_block(core, block);
+            block->start_pc = INVALID_ADDR;
+        }
+    }
+
+    __atomic_fetch_and(&core->code_line_bitmap[line / 32], ~(1u << (line % 32)),
+                       __ATOMIC_RELAXED);
+}
+
+// Ensure no thread continues executing from a block that is about to be
+// removed or replaced.
+static void release_block(struct core *core, const struct basic_block *block)
+{
+    uint32_t thread_id;
+
+    for (thread_id = 0; thread_id < core->proc->threads_per_core; thread_id++)
+    {
+        if (core->threads[thread_id].current_block == block)
+            core->threads[thread_id].current_block = NULL;
+    }
+}
+
+// Called when the instruction TLB changes. The threads on this core must
+// translate their next instruction address again.
+static void clear_core_blocks(struct core *core)
+{
+    uint32_t thread_id;
+
+    for (thread_id = 0; thread_id < core->proc->threads_per_core; thread_id++)
+        core->threads[thread_id].current_block = NULL;
+}
+
+// Remove all cached blocks for this core.
+static void flush_core_blocks(struct core *core)
+{
+    int i;
+
+    clear_core_blocks(core);
+    for (i = 0; i < BLOCK_CACHE_SIZE; i++)
+        core->block_cache[i].start_pc = INVALID_ADDR;
+
+    memset(core->code_line_bitmap, 0, (core->proc->memory_size / CACHE_LINE_LENGTH
+           / 32 + 1) * sizeof(uint32_t));
+}
+
+// In parallel mode, another core may have modified code that this core has
+// cached. The flag is cleared before flushing, so a write that happens
+// during the flush sets it again and is not lost.
+static void check_flush_blocks(struct core *core)
+{
+    if (__atomic_load_n(&core->flush_blocks, __ATOMIC_ACQUIRE)
+            && __atomic_exchange_n(&core->flush_blocks, false, __ATOMIC_ACQ_REL))
+        flush_core_blocks(core);
+}
+
+static const struct basic_block *lookup_block(struct core *core,
+                                              uint32_t physical_pc)
+{
+    const struct processor *proc = core->proc;
+    struct basic_block *block = &core->block_cache[(physical_pc / 4)
+                                % BLOCK_CACHE_SIZE];
+    uint32_t pc;
+    uint32_t line;
+    struct decoded_inst *inst;
+
+    if (block->start_pc == physical_pc)
+        return block;
+
+    // Not cached, decode a new block, replacing the old one in this slot.
+    release_block(core, block);
+    block->start_pc = physical_pc;
+    block->length = 0;
+    block->execute_count = 0;
+    pc = physical_pc;
+    do
+    {
+        inst = &block->insts[block->length++];
+        decode_instruction(proc->memory[pc / 4], inst);
+        select_handler(inst);
+        line = pc / CACHE_LINE_LENGTH;
+        __atomic_fetch_or(&core->code_line_bitmap[line / 32], 1u << (line % 32),
+                          __ATOMIC_RELAXED);
+        pc += 4;
+    }
+    while (block->length < MAX_BLOCK_LENGTH
+           && inst->type != INST_BRANCH
+           && PAGE_OFFSET(pc) != 0
+           && pc < proc->memory_size);
+
+    return block;
+}
+
+static void decode_instruction(uint32_t instruction, struct decoded_inst *inst)
+{
+    memset(inst, 0, sizeof(*inst));
+    inst->instruction = instruction;
+    if ((instruction & 0xe0000000) == 0xc0000000)
+    {
+        inst->type = INST_REGISTER_ARITH;
+        inst->fmt = extract_unsigned_bits(instruction, 26, 3);
+        inst->op = extract_unsigned_bits(instruction, 20, 6);
+        inst->op1reg = extract_unsigned_bits(instruction, 0, 5);
+        inst->op2reg = extract_unsigned_bits(instruction, 15, 5);
+        inst->destreg = extract_unsigned_bits(instruction, 5, 5);
+        inst->maskreg = extract_unsigned_bits(instruction, 10, 5);
+    }
+    else if ((instruction & 0x80000000) == 0)
+    {
+        if (instruction == BREAKPOINT_INST)
+            inst->type = INST_BREAKPOINT;
+        else if (instruction == INSTRUCTION_NOP)
+            inst->type = INST_NOP;
+        else
+        {
+            inst->type = INST_IMMEDIATE_ARITH;
+            inst->fmt = extract_unsigned_bits(instruction, 29, 2);
+            inst->op = extract_unsigned_bits(instruction, 24, 5);
+            inst->op1reg = extract_unsigned_bits(instruction, 0, 5);
+            inst->maskreg = extract_unsigned_bits(instruction, 10, 5);
+            inst->destreg = extract_unsigned_bits(instruction, 5, 5);
+            switch (inst->fmt)
+            {
+                case FMT_IMM_VM:
+                    inst->imm = extract_signed_bits(instruction, 15, 9);
+                    break;
+
+                case FMT_IMM_MOVEHI:
+                    inst->imm = (extract_unsigned_bits(instruction, 10, 14) << 18)
+                        | (extract_unsigned_bits(instruction, 0, 5) << 13);
+                    break;
+
+                default:
+                    inst->imm = extract_signed_bits(instruction, 10, 14);
+                    break;
+            }
+        }
+    }
+    else if ((instruction & 0xc0000000) == 0x80000000)
+    {
+        inst->type = INST_MEMORY_ACCESS;
+        inst->op = extract_unsigned_bits(instruction, 25, 4);
+        inst->op1reg = extract_unsigned_bits(instruction, 0, 5);
+        inst->maskreg = extract_unsigned_bits(instruction, 10, 5);
+        inst->destreg = extract_unsigned_bits(instruction, 5, 5);
+        inst->is_load = extract_unsigned_bits(instruction, 29, 1);
+        if (inst->op == MEM_BLOCK_VECTOR_MASK || inst->op == MEM_SCGATH_MASK)
+            inst->imm = extract_signed_bits(instruction, 15, 10);
+        else
+            inst->imm = extract_signed_bits(instruction, 10, 15);
+    }
+    else if ((instruction & 0xf0000000) == 0xf0000000)
+    {
+        inst->type = INST_BRANCH;
+        inst->op = extract_unsigned_bits(instruction, 25, 3);
+        inst->op1reg = extract_unsigned_bits(instruction, 0, 5);
+
+        // Subtract 4 because PC was already incremented after fetching instruction
+        if (inst->op == BRANCH_ZERO || inst->op == BRANCH_NOT_ZERO)
+            inst->imm = extract_signed_bits(instruction, 5, 20) * 4 - 4;
+        else
+            inst->imm = extract_signed_bits(instruction, 0, 25) * 4 - 4;
+    }
+    else if ((instruction & 0xf0000000) == 0xe0000000)
+    {
+        inst->type = INST_CACHE_CONTROL;
+        inst->op = extract_unsigned_bits(instruction, 25, 3);
+        inst->op1reg = extract_unsigned_bits(instruction, 0, 5);
+        inst->destreg = extract_unsigned_bits(instruction, 5, 5);
+        inst->imm = extract_signed_bits(instruction, 15, 10);
+    }
+    else
+        inst->type = INST_INVALID;
+}
+
+static void try_to_dispatch_interrupt(struct thread *thread)
+{
+    uint32_t pending = get_pending_interrupts(thread);
+    if (!thread->enable_interrupt)
+        return;
 
     if ((pending & thread->interrupt_mask) != 0)
     {
@@ -752,6 +1674,16 @@ static void raise_trap(struct thread *thread, uint32_t trap_address, enum trap_t
         return;
     }
 
+    // Interrupts are taken between instructions. Faults on instruction
+    // fetch occur before the instruction issues. Any other trap cancels
+    // an instruction that was issued, so it doesn't retire.
+    if (type == TT_INTERRUPT)
+        thread->core->perf_events[PERF_INTERRUPT]++;
+    else if (is_data_cache || (type != TT_UNALIGNED_ACCESS && type != TT_PAGE_FAULT
+                               && type != TT_TLB_MISS && type != TT_SUPERVISOR_ACCESS
+                               && type != TT_NOT_EXECUTABLE))
+        thread->core->rolled_back_instructions++;
+
     // For nested interrupts, push the old saved state into
     // the second save slot.
     thread->saved_trap_state[1] = thread->saved_trap_state[0];
@@ -782,6 +1714,7 @@ static void raise_trap(struct thread *thread, uint32_t trap_address, enum trap_t
     thread->saved_trap_state[0].syscall_index = syscall_index;
 
     // Update thread state
+    thread->current_block = NULL;
     thread->enable_interrupt = false;
     if (type == TT_TLB_MISS)
     {
@@ -795,6 +1728,38 @@ static void raise_trap(struct thread *thread, uint32_t trap_address, enum trap_t
     thread->enable_supervisor = true;
 }
 
+static void flush_host_tlb(struct thread *thread)
+{
+    int table;
+    int index;
+
+    for (table = 0; table < HOST_TLB_TABLES; table++)
+    {
+        for (index = 0; index < HOST_TLB_SIZE; index++)
+            thread->host_tlb[table][index].virtual_page = INVALID_ADDR;
+    }
+}
+
+// Called when the emulated TLB entry for this page changes. The TLB is
+// shared by all threads on the core.
+static void invalidate_host_tlb_page(struct core *core, uint32_t virtual_address)
+{
+    uint32_t thread_id;
+    int table;
+    struct host_tlb_entry *entry;
+
+    for (thread_id = 0; thread_id < core->proc->threads_per_core; thread_id++)
+    {
+        for (table = 0; table < HOST_TLB_TABLES; table++)
+        {
+            entry = &core->threads[thread_id].host_tlb[table][(virtual_address / PAGE_SIZE)
+                    % HOST_TLB_SIZE];
+            if (entry->virtual_page == ROUND_TO_PAGE(virtual_address))
+                entry->virtual_page = INVALID_ADDR;
+        }
+    }
+}
+
 static bool translate_address(struct thread *thread, uint32_t virtual_address,
                               uint32_t *out_physical_address, bool is_store,
                               bool is_data_access)
@@ -802,6 +1767,7 @@ static bool translate_address(struct thread *thread, uint32_t virtual_address,
     int tlb_set;
     int way;
     struct tlb_entry *set_entries;
+    struct host_tlb_entry *host_entry;
 
     if (!thread->enable_mmu)
     {
@@ -821,6 +1787,16 @@ static bool translate_address(struct thread *thread, uint32_t virtual_address,
         return true;
     }
 
+    // Tables are ordered load, store, fetch, then the same for supervisor mode.
+    host_entry = &thread->host_tlb[(is_data_access ? (is_store ? 1 : 0) : 2)
+                                   + (thread->enable_supervisor ? 3 : 0)]
+                                  [(virtual_address / PAGE_SIZE) % HOST_TLB_SIZE];
+    if (host_entry->virtual_page == ROUND_TO_PAGE(virtual_address))
+    {
+        *out_physical_address = host_entry->physical_page | PAGE_OFFSET(virtual_address);
+        return true;
+    }
+
     tlb_set = (virtual_address / PAGE_SIZE) % TLB_SETS;
     set_entries = (is_data_access ? thread->core->dtlb : thread->core->itlb)
                   + tlb_set * TLB_WAYS;
@@ -875,11 +1851,14 @@ static bool translate_address(struct thread *thread, uint32_t virtual_address,
                 return false;
             }
 
+            host_entry->virtual_page = ROUND_TO_PAGE(virtual_address);
+            host_entry->physical_page = ROUND_TO_PAGE(*out_physical_address);
             return true;
         }
     }
 
     // No translation found
+    thread->core->perf_events[is_data_access ? PERF_DTLB_MISS : PERF_ITLB_MISS]++;
     raise_trap(thread, virtual_address, TT_TLB_MISS, is_store, is_data_access, 0);
     return false;
 }
@@ -983,6 +1962,125 @@ static bool is_compare_op(uint32_t op)
     return (op >= OP_CMPEQ_I && op <= OP_CMPLE_U) || (op >= OP_CMPGT_F && op <= OP_CMPNE_F);
 }
 
+// Common scalar arithmetic operations, used to generate specialized
+// handlers for threaded mode. Each takes value1 and value2 and produces the
+// result.
+#define THREADED_SCALAR_OPS(X) \
+    X(OP_OR, or, value1 | value2) \
+    X(OP_AND, and, value1 & value2) \
+    X(OP_XOR, xor, value1 ^ value2) \
+    X(OP_ADD_I, add_i, value1 + value2) \
+    X(OP_SUB_I, sub_i, value1 - value2) \
+    X(OP_MULL_I, mull_i, value1 * value2) \
+    X(OP_ASHR, ashr, (uint32_t)(((int32_t)value1) >> (value2 & 31))) \
+    X(OP_SHR, shr, value1 >> (value2 & 31)) \
+    X(OP_SHL, shl, value1 << (value2 & 31)) \
+    X(OP_MOVE, move, value2) \
+    X(OP_CMPEQ_I, cmpeq_i, value1 == value2 ? 0xffffu : 0) \
+    X(OP_CMPNE_I, cmpne_i, value1 != value2 ? 0xffffu : 0) \
+    X(OP_CMPGT_I, cmpgt_i, (int32_t)value1 > (int32_t)value2 ? 0xffffu : 0) \
+    X(OP_CMPGE_I, cmpge_i, (int32_t)value1 >= (int32_t)value2 ? 0xffffu : 0) \
+    X(OP_CMPLT_I, cmplt_i, (int32_t)value1 < (int32_t)value2 ? 0xffffu : 0) \
+    X(OP_CMPLE_I, cmple_i, (int32_t)value1 <= (int32_t)value2 ? 0xffffu : 0) \
+    X(OP_CMPGT_U, cmpgt_u, value1 > value2 ? 0xffffu : 0) \
+    X(OP_CMPGE_U, cmpge_u, value1 >= value2 ? 0xffffu : 0) \
+    X(OP_CMPLT_U, cmplt_u, value1 < value2 ? 0xffffu : 0) \
+    X(OP_CMPLE_U, cmple_u, value1 <= value2 ? 0xffffu : 0)
+
+#define THREADED_SCALAR_HANDLERS(opcode, name, expr) \
+    static void execute_ ## name ## _ss(struct thread *thread, \
+                                        const struct decoded_inst *inst) \
+    { \
+        uint32_t value1 = thread->scalar_reg[inst->op1reg]; \
+        uint32_t value2 = thread->scalar_reg[inst->op2reg]; \
+        (void) value1;  /* Not used by move */ \
+        TALLY_INSTRUCTION(reg_arith_inst); \
+        set_scalar_reg(thread, inst->destreg, expr); \
+    } \
+    static void execute_ ## name ## _si(struct thread *thread, \
+                                        const struct decoded_inst *inst) \
+    { \
+        uint32_t value1 = thread->scalar_reg[inst->op1reg]; \
+        uint32_t value2 = inst->imm; \
+        (void) value1; \
+        TALLY_INSTRUCTION(imm_arith_inst); \
+        set_scalar_reg(thread, inst->destreg, expr); \
+    }
+
+THREADED_SCALAR_OPS(THREADED_SCALAR_HANDLERS)
+
+#undef THREADED_SCALAR_HANDLERS
+
+// Pick the function that threaded mode calls to execute this instruction.
+// Scalar arithmetic with common operations gets a specialized handler,
+// other instructions use the same functions as the interpreter.
+static void select_handler(struct decoded_inst *inst)
+{
+    switch (inst->type)
+    {
+        case INST_REGISTER_ARITH:
+            inst->handler = execute_register_arith_inst;
+            if (inst->fmt == FMT_RA_SS)
+            {
+                switch (inst->op)
+                {
+#define SELECT_SS_HANDLER(opcode, name, expr) \
+                    case opcode: \
+                        inst->handler = execute_ ## name ## _ss; \
+                        break;
+
+                    THREADED_SCALAR_OPS(SELECT_SS_HANDLER)
+#undef SELECT_SS_HANDLER
+                }
+            }
+
+            break;
+
+        case INST_IMMEDIATE_ARITH:
+            inst->handler = execute_immediate_arith_inst;
+
+            // Compares in the movehi format are illegal instructions. The
+            // generic handler raises the trap.
+            if (inst->fmt == FMT_IMM_S || (inst->fmt == FMT_IMM_MOVEHI
+                    && !is_compare_op(inst->op)))
+            {
+                switch (inst->op)
+                {
+#define SELECT_SI_HANDLER(opcode, name, expr) \
+                    case opcode: \
+                        inst->handler = execute_ ## name ## _si; \
+                        break;
+
+                    THREADED_SCALAR_OPS(SELECT_SI_HANDLER)
+#undef SELECT_SI_HANDLER
+                }
+            }
+
+            break;
+
+        case INST_NOP:
+            inst->handler = execute_nop_inst;
+            break;
+
+        case INST_MEMORY_ACCESS:
+            inst->handler = execute_memory_access_inst;
+            break;
+
+        case INST_BRANCH:
+            inst->handler = execute_branch_inst;
+            break;
+
+        case INST_CACHE_CONTROL:
+            inst->handler = execute_cache_control_inst;
+            break;
+
+        default:
+            // Breakpoints and invalid instructions are handled by the
+            // interpreter.
+            inst->handler = NULL;
+    }
+}
+
 static struct breakpoint *lookup_breakpoint(struct processor *proc, uint32_t pc)
 {
     struct breakpoint *breakpoint;
@@ -997,14 +2095,15 @@ static struct breakpoint *lookup_breakpoint(struct processor *proc, uint32_t pc)
     return NULL;
 }
 
-static void execute_register_arith_inst(struct thread *thread, uint32_t instruction)
+static void execute_register_arith_inst(struct thread *thread,
+                                       const struct decoded_inst *inst)
 {
-    enum register_arith_format fmt = extract_unsigned_bits(instruction, 26, 3);
-    enum arithmetic_op op = extract_unsigned_bits(instruction, 20, 6);
-    uint32_t op1reg = extract_unsigned_bits(instruction, 0, 5);
-    uint32_t op2reg = extract_unsigned_bits(instruction, 15, 5);
-    uint32_t destreg = extract_unsigned_bits(instruction, 5, 5);
-    uint32_t maskreg = extract_unsigned_bits(instruction, 10, 5);
+    enum register_arith_format fmt = inst->fmt;
+    enum arithmetic_op op = inst->op;
+    uint32_t op1reg = inst->op1reg;
+    uint32_t op2reg = inst->op2reg;
+    uint32_t destreg = inst->destreg;
+    uint32_t maskreg = inst->maskreg;
     int lane;
 
     if (op == OP_BREAKPOINT)
@@ -1036,6 +2135,10 @@ static void execute_register_arith_inst(struct thread *thread, uint32_t instruct
                 // Vector/Scalar operation
                 // Pack compare results in low 16 bits of scalar register
                 uint32_t scalar_value = thread->scalar_reg[op2reg];
+                if (vector_scalar_compare_op(op, &result, thread->vector_reg[op1reg],
+                                             scalar_value))
+                    break;
+
                 for (lane = 0; lane < NUM_VECTOR_LANES; lane++)
                 {
                     result >>= 1;
@@ -1051,6 +2154,10 @@ static void execute_register_arith_inst(struct thread *thread, uint32_t instruct
 
                 // Vector/Vector operation
                 // Pack compare results in low 16 bits of scalar register
+                if (vector_compare_op(op, &result, thread->vector_reg[op1reg],
+                                      thread->vector_reg[op2reg]))
+                    break;
+
                 for (lane = 0; lane < NUM_VECTOR_LANES; lane++)
                 {
                     result >>= 1;
@@ -1109,13 +2216,18 @@ static void execute_register_arith_inst(struct thread *thread, uint32_t instruct
         {
             // Vector/Scalar operands
             uint32_t scalar_value = thread->scalar_reg[op2reg];
-            for (lane = 0; lane < NUM_VECTOR_LANES; lane++)
+            if (!vector_scalar_arith_op(op, result, thread->vector_reg[op1reg],
+                                        scalar_value))
             {
-                result[lane] = scalar_arithmetic_op(op, thread->vector_reg[op1reg][lane],
-                                                    scalar_value);
+                for (lane = 0; lane < NUM_VECTOR_LANES; lane++)
+                {
+                    result[lane] = scalar_arithmetic_op(op, thread->vector_reg[op1reg][lane],
+                                                        scalar_value);
+                }
             }
         }
-        else
+        else if (!vector_arith_op(op, result, thread->vector_reg[op1reg],
+                                  thread->vector_reg[op2reg]))
         {
             // Vector/Vector operands
             for (lane = 0; lane < NUM_VECTOR_LANES; lane++)
@@ -1129,36 +2241,22 @@ static void execute_register_arith_inst(struct thread *thread, uint32_t instruct
     }
 }
 
-static void execute_immediate_arith_inst(struct thread *thread, uint32_t instruction)
+static void execute_immediate_arith_inst(struct thread *thread,
+                                        const struct decoded_inst *inst)
 {
-    enum immediate_arith_format fmt = extract_unsigned_bits(instruction, 29, 2);
-    uint32_t imm_value;
-    enum arithmetic_op op = extract_unsigned_bits(instruction, 24, 5);
-    uint32_t op1reg = extract_unsigned_bits(instruction, 0, 5);
-    uint32_t maskreg = extract_unsigned_bits(instruction, 10, 5);
-    uint32_t destreg = extract_unsigned_bits(instruction, 5, 5);
+    enum immediate_arith_format fmt = inst->fmt;
+    uint32_t imm_value = inst->imm;
+    enum arithmetic_op op = inst->op;
+    uint32_t op1reg = inst->op1reg;
+    uint32_t maskreg = inst->maskreg;
+    uint32_t destreg = inst->destreg;
     int lane;
 
     TALLY_INSTRUCTION(imm_arith_inst);
-    switch (fmt) {
-        case FMT_IMM_VM:
-            imm_value = extract_signed_bits(instruction, 15, 9);
-            break;
-
-        case FMT_IMM_MOVEHI:
-            imm_value = (extract_unsigned_bits(instruction, 10, 14) << 18)
-                | (extract_unsigned_bits(instruction, 0, 5) << 13);
-            break;
-
-        default:
-            imm_value = extract_signed_bits(instruction, 10, 14);
-            break;
-    }
-
     if (op == OP_SYSCALL)
     {
         raise_trap(thread, 0, TT_SYSCALL, false, false,
-            extract_unsigned_bits(instruction, 10, 14));
+            extract_unsigned_bits(inst->instruction, 10, 14));
         return;
     }
     else if (op == OP_GETLANE)
@@ -1176,6 +2274,10 @@ static void execute_immediate_arith_inst(struct thread *thread, uint32_t instruc
                 TALLY_INSTRUCTION(vector_inst);
 
                 // Pack compare results into low 16 bits of scalar register
+                if (vector_scalar_compare_op(op, &result, thread->vector_reg[op1reg],
+                                             imm_value))
+                    break;
+
                 for (lane = 0; lane < NUM_VECTOR_LANES; lane++)
                 {
                     result >>= 1;
@@ -1225,23 +2327,27 @@ static void execute_immediate_arith_inst(struct thread *thread, uint32_t instruc
                 return;
         }
 
-        for (lane = 0; lane < NUM_VECTOR_LANES; lane++)
+        if (!vector_scalar_arith_op(op, result, thread->vector_reg[op1reg], imm_value))
         {
-            result[lane] = scalar_arithmetic_op(op, thread->vector_reg[op1reg][lane],
-                                                imm_value);
+            for (lane = 0; lane < NUM_VECTOR_LANES; lane++)
+            {
+                result[lane] = scalar_arithmetic_op(op, thread->vector_reg[op1reg][lane],
+                                                    imm_value);
+            }
         }
 
         set_vector_reg(thread, destreg, mask, result);
     }
 }
 
-static void execute_scalar_load_store_inst(struct thread *thread, uint32_t instruction)
+static void execute_scalar_load_store_inst(struct thread *thread,
+                                           const struct decoded_inst *inst)
 {
-    enum memory_op op = extract_unsigned_bits(instruction, 25, 4);
-    uint32_t ptrreg = extract_unsigned_bits(instruction, 0, 5);
-    uint32_t offset = extract_signed_bits(instruction, 10, 15);
-    uint32_t destsrcreg = extract_unsigned_bits(instruction, 5, 5);
-    bool is_load = extract_unsigned_bits(instruction, 29, 1);
+    enum memory_op op = inst->op;
+    uint32_t ptrreg = inst->op1reg;
+    uint32_t offset = inst->imm;
+    uint32_t destsrcreg = inst->destreg;
+    bool is_load = inst->is_load;
     uint32_t virtual_address;
     uint32_t physical_address;
     int is_device_access;
@@ -1277,6 +2383,9 @@ static void execute_scalar_load_store_inst(struct thread *thread, uint32_t instr
     if (!translate_address(thread, virtual_address, &physical_address, !is_load, true))
         return; // fault raised, bypass other side effects
 
+    if (thread->core->proc->profile != NULL)
+        profile_data_access(thread->core->proc->profile, thread->id, virtual_address);
+
     is_device_access = physical_address >= DEVICE_BASE_ADDRESS;
     if (is_device_access && op != MEM_LONG)
     {
@@ -1288,13 +2397,34 @@ static void execute_scalar_load_store_inst(struct thread *thread, uint32_t instr
         return;
     }
 
+    if (!is_load && !is_device_access)
+        thread->core->perf_events[PERF_STORE]++;
+
+    if (thread->core->proc->cache_model != NULL && !is_device_access)
+    {
+        if (is_load)
+        {
+            cache_model_load(thread->core->proc->cache_model, thread->core->id,
+                             thread->id, physical_address);
+        }
+        else
+        {
+            cache_model_store(thread->core->proc->cache_model, thread->core->id,
+                              physical_address);
+        }
+    }
+
     if (is_load)
     {
         switch (op)
         {
             case MEM_LONG:
                 if (is_device_access)
+                {
+                    lock_devices(thread->core->proc);
                     value = read_device_register(physical_address);
+                    unlock_devices(thread->core->proc);
+                }
                 else
                     value = (uint32_t) *UINT32_PTR(thread->core->proc->memory, physical_address);
 
@@ -1317,8 +2447,10 @@ static void execute_scalar_load_store_inst(struct thread *thread, uint32_t instr
                 break;
 
             case MEM_SYNC:
+                lock_line(thread->core->proc, physical_address);
                 value = *UINT32_PTR(thread->core->proc->memory, physical_address);
                 thread->last_sync_load_addr = physical_address / CACHE_LINE_LENGTH;
+                unlock_line(thread->core->proc, physical_address);
                 break;
 
             case MEM_CONTROL_REG:
@@ -1338,9 +2470,27 @@ static void execute_scalar_load_store_inst(struct thread *thread, uint32_t instr
         uint32_t value_to_store = thread->scalar_reg[destsrcreg];
 
         // Some instruction don't update memory, for example: a synchronized store
-        // that fails or writes to device memory. This tracks whether they
-        // did for the cosimulation code below.
+        // that fails. This tracks whether they did for the cosimulation code below.
         bool did_write = false;
+
+        if (is_device_access)
+        {
+            // IO address range (only 32-bit accesses get here, checked above)
+            lock_devices(thread->core->proc);
+            if (physical_address == REG_TIMER_INT)
+                thread->core->proc->current_timer_count = value_to_store;
+            else
+                write_device_register(physical_address, value_to_store);
+
+            unlock_devices(thread->core->proc);
+
+            // Bail to avoid logging and other side effects below.
+            return;
+        }
+
+        // In parallel mode, this makes checking the synchronized load address
+        // and updating memory atomic with respect to stores from other cores.
+        lock_line(thread->core->proc, physical_address);
         switch (op)
         {
             case MEM_BYTE:
@@ -1356,18 +2506,6 @@ static void execute_scalar_load_store_inst(struct thread *thread, uint32_t instr
                 break;
 
             case MEM_LONG:
-                if (physical_address >= DEVICE_BASE_ADDRESS)
-                {
-                    // IO address range
-                    if (physical_address == REG_TIMER_INT)
-                        thread->core->proc->current_timer_count = value_to_store;
-                    else
-                        write_device_register(physical_address, value_to_store);
-
-                    // Bail to avoid logging and other side effects below.
-                    return;
-                }
-
                 *UINT32_PTR(thread->core->proc->memory, physical_address) = value_to_store;
                 did_write = true;
                 break;
@@ -1394,16 +2532,17 @@ static void execute_scalar_load_store_inst(struct thread *thread, uint32_t instr
 
             case MEM_CONTROL_REG:
                 assert(0);	// Should have been handled in caller
-                return;
+                break;
 
             default:
                 raise_trap(thread, 0, TT_ILLEGAL_INSTRUCTION, false, false, 0);
-                return;
+                break;
         }
 
         if (did_write)
         {
-            invalidate_sync_address(thread->core, physical_address);
+            invalidate_sync_address(thread->core->proc, physical_address);
+            invalidate_code_address(thread->core->proc, thread->core, physical_address);
             if (thread->core->proc->enable_tracing)
             {
                 printf("%08x [th %u] memory store size %u %08x %02x\n", thread->pc - 4,
@@ -1416,17 +2555,20 @@ static void execute_scalar_load_store_inst(struct thread *thread, uint32_t instr
                                          value_to_store);
             }
         }
+
+        unlock_line(thread->core->proc, physical_address);
     }
 }
 
-static void execute_block_load_store_inst(struct thread *thread, uint32_t instruction)
+static void execute_block_load_store_inst(struct thread *thread,
+                                          const struct decoded_inst *inst)
 {
-    uint32_t op = extract_unsigned_bits(instruction, 25, 4);
-    uint32_t ptrreg = extract_unsigned_bits(instruction, 0, 5);
-    uint32_t maskreg = extract_unsigned_bits(instruction, 10, 5);
-    uint32_t destsrcreg = extract_unsigned_bits(instruction, 5, 5);
-    bool is_load = extract_unsigned_bits(instruction, 29, 1);
-    uint32_t offset;
+    uint32_t op = inst->op;
+    uint32_t ptrreg = inst->op1reg;
+    uint32_t maskreg = inst->maskreg;
+    uint32_t destsrcreg = inst->destreg;
+    bool is_load = inst->is_load;
+    uint32_t offset = inst->imm;
     uint32_t lane;
     uint32_t mask;
     uint32_t virtual_address;
@@ -1440,12 +2582,10 @@ static void execute_block_load_store_inst(struct thread *thread, uint32_t instru
     {
         case MEM_BLOCK_VECTOR:
             mask = 0xffff;
-            offset = extract_signed_bits(instruction, 10, 15);
             break;
 
         case MEM_BLOCK_VECTOR_MASK:
             mask = thread->scalar_reg[maskreg];
-            offset = extract_signed_bits(instruction, 15, 10);
             break;
 
         default:
@@ -1465,6 +2605,9 @@ static void execute_block_load_store_inst(struct thread *thread, uint32_t instru
     if (!translate_address(thread, virtual_address, &physical_address, !is_load, true))
         return; // fault raised, bypass other side effects
 
+    if (thread->core->proc->profile != NULL)
+        profile_data_access(thread->core->proc->profile, thread->id, virtual_address);
+
     if (physical_address >= DEVICE_BASE_ADDRESS)
     {
         printf("Illegal block access to device address\n");
@@ -1477,6 +2620,12 @@ static void execute_block_load_store_inst(struct thread *thread, uint32_t instru
     if (is_load)
     {
         uint32_t load_value[NUM_VECTOR_LANES];
+        if (thread->core->proc->cache_model != NULL)
+        {
+            cache_model_load(thread->core->proc->cache_model, thread->core->id,
+                             thread->id, physical_address);
+        }
+
         for (lane = 0; lane < NUM_VECTOR_LANES; lane++)
             load_value[lane] = block_ptr[lane];
 
@@ -1489,6 +2638,13 @@ static void execute_block_load_store_inst(struct thread *thread, uint32_t instru
         if ((mask & 0xffff) == 0)
             return;	// Hardware ignores block stores with a mask of zero
 
+        thread->core->perf_events[PERF_STORE]++;
+        if (thread->core->proc->cache_model != NULL)
+        {
+            cache_model_store(thread->core->proc->cache_model, thread->core->id,
+                              physical_address);
+        }
+
         if (thread->core->proc->enable_tracing)
         {
             printf("%08x [th %u] write_mem_block %08x\n", thread->pc - 4, thread->id,
@@ -1498,24 +2654,24 @@ static void execute_block_load_store_inst(struct thread *thread, uint32_t instru
         if (thread->core->proc->enable_cosim)
             cosim_check_vector_store(thread->core->proc, thread->pc - 4, virtual_address, mask, store_value);
 
-        for (lane = 0; lane < NUM_VECTOR_LANES; lane++)
-        {
-            if (mask & (1 << lane))
-                block_ptr[lane] = store_value[lane];
-        }
+        lock_line(thread->core->proc, physical_address);
+        vector_masked_copy(block_ptr, store_value, mask);
 
-        invalidate_sync_address(thread->core, physical_address);
+        invalidate_sync_address(thread->core->proc, physical_address);
+        invalidate_code_address(thread->core->proc, thread->core, physical_address);
+        unlock_line(thread->core->proc, physical_address);
     }
 }
 
-static void execute_scatter_gather_inst(struct thread *thread, uint32_t instruction)
+static void execute_scatter_gather_inst(struct thread *thread,
+                                        const struct decoded_inst *inst)
 {
-    uint32_t op = extract_unsigned_bits(instruction, 25, 4);
-    uint32_t ptrreg = extract_unsigned_bits(instruction, 0, 5);
-    uint32_t maskreg = extract_unsigned_bits(instruction, 10, 5);
-    uint32_t destsrcreg = extract_unsigned_bits(instruction, 5, 5);
-    bool is_load = extract_unsigned_bits(instruction, 29, 1);
-    uint32_t offset;
+    uint32_t op = inst->op;
+    uint32_t ptrreg = inst->op1reg;
+    uint32_t maskreg = inst->maskreg;
+    uint32_t destsrcreg = inst->destreg;
+    bool is_load = inst->is_load;
+    uint32_t offset = inst->imm;
     uint32_t lane;
     uint32_t mask;
     uint32_t virtual_address;
@@ -1528,12 +2684,10 @@ static void execute_scatter_gather_inst(struct thread *thread, uint32_t instruct
     {
         case MEM_SCGATH:
             mask = 0xffff;
-            offset = extract_signed_bits(instruction, 10, 15);
             break;
 
         case MEM_SCGATH_MASK:
             mask = thread->scalar_reg[maskreg];
-            offset = extract_signed_bits(instruction, 15, 10);
             break;
 
         default:
@@ -1552,6 +2706,9 @@ static void execute_scatter_gather_inst(struct thread *thread, uint32_t instruct
     if (!translate_address(thread, virtual_address, &physical_address, !is_load, true))
         return; // fault raised, bypass other side effects
 
+    if (thread->core->proc->profile != NULL && (mask & (1 << lane)))
+        profile_data_access(thread->core->proc->profile, thread->id, virtual_address);
+
     if (physical_address >= DEVICE_BASE_ADDRESS)
     {
         printf("Illegal scatter access to device address\n");
@@ -1560,6 +2717,23 @@ static void execute_scatter_gather_inst(struct thread *thread, uint32_t instruct
         return;
     }
 
+    if (!is_load && (mask & (1 << lane)))
+        thread->core->perf_events[PERF_STORE]++;
+
+    if (thread->core->proc->cache_model != NULL && (mask & (1 << lane)))
+    {
+        if (is_load)
+        {
+            cache_model_load(thread->core->proc->cache_model, thread->core->id,
+                             thread->id, physical_address);
+        }
+        else
+        {
+            cache_model_store(thread->core->proc->cache_model, thread->core->id,
+                              physical_address);
+        }
+    }
+
     if (is_load)
     {
         uint32_t load_value[NUM_VECTOR_LANES];
@@ -1578,9 +2752,12 @@ static void execute_scatter_gather_inst(struct thread *thread, uint32_t instruct
                    thread->vector_reg[destsrcreg][lane]);
         }
 
+        lock_line(thread->core->proc, physical_address);
         *UINT32_PTR(thread->core->proc->memory, physical_address)
             = thread->vector_reg[destsrcreg][lane];
-        invalidate_sync_address(thread->core, physical_address);
+        invalidate_sync_address(thread->core->proc, physical_address);
+        invalidate_code_address(thread->core->proc, thread->core, physical_address);
+        unlock_line(thread->core->proc, physical_address);
         if (thread->core->proc->enable_cosim)
         {
             cosim_check_scalar_store(thread->core->proc, thread->pc - 4, virtual_address, 4,
@@ -1594,10 +2771,11 @@ static void execute_scatter_gather_inst(struct thread *thread, uint32_t instruct
         thread->pc -= 4;	// repeat current instruction
 }
 
-static void execute_control_register_inst(struct thread *thread, uint32_t instruction)
+static void execute_control_register_inst(struct thread *thread,
+                                          const struct decoded_inst *inst)
 {
-    uint32_t cr_index = extract_unsigned_bits(instruction, 0, 5);
-    uint32_t dst_src_reg = extract_unsigned_bits(instruction, 5, 5);
+    uint32_t cr_index = inst->op1reg;
+    uint32_t dst_src_reg = inst->destreg;
 
     // Only threads in supervisor mode can access control registers.
     if (!thread->enable_supervisor)
@@ -1606,7 +2784,7 @@ static void execute_control_register_inst(struct thread *thread, uint32_t instru
         return;
     }
 
-    if (extract_unsigned_bits(instruction, 29, 1))
+    if (inst->is_load)
         read_control_register(thread, cr_index, dst_src_reg);
     else
         write_control_register(thread, cr_index, dst_src_reg);
@@ -1660,7 +2838,7 @@ static void read_control_register(struct thread *thread, uint32_t cr_index,
             break;
 
         case CR_CYCLE_COUNT:
-            value = (uint32_t) thread->core->proc->total_instructions;
+            value = (uint32_t) get_total_instructions(thread->core->proc);
             break;
 
         case CR_TLB_MISS_HANDLER:
@@ -1694,6 +2872,23 @@ static void read_control_register(struct thread *thread, uint32_t cr_index,
         case CR_SYSCALL_INDEX:
             value = thread->saved_trap_state[0].syscall_index;
             break;
+
+        case CR_PERF_EVENT_SELECT0:
+        case CR_PERF_EVENT_SELECT1:
+            value = thread->core->perf_event_select[cr_index - CR_PERF_EVENT_SELECT0];
+            break;
+
+        case CR_PERF_EVENT_COUNT0_L:
+        case CR_PERF_EVENT_COUNT1_L:
+            value = (uint32_t) read_perf_counter(thread->core,
+                                                 (cr_index - CR_PERF_EVENT_COUNT0_L) / 2);
+            break;
+
+        case CR_PERF_EVENT_COUNT0_H:
+        case CR_PERF_EVENT_COUNT1_H:
+            value = (uint32_t) (read_perf_counter(thread->core,
+                                (cr_index - CR_PERF_EVENT_COUNT0_H) / 2) >> 32);
+            break;
     }
 
     set_scalar_reg(thread, dst_src_reg, value);
@@ -1714,6 +2909,7 @@ static void write_control_register(struct thread *thread, uint32_t cr_index,
             break;
 
         case CR_FLAGS:
+            thread->current_block = NULL;
             thread->enable_interrupt = (value & 1) != 0;
             thread->enable_mmu = (value & 2) != 0;
             thread->enable_supervisor = (value & 4) != 0;
@@ -1732,11 +2928,14 @@ static void write_control_register(struct thread *thread, uint32_t cr_index,
             break;
 
         case CR_CURRENT_ASID:
+            thread->current_block = NULL;
             thread->asid = value;
+            flush_host_tlb(thread);
             break;
 
         case CR_PAGE_DIR:
             thread->page_dir = value;
+            flush_host_tlb(thread);
             break;
 
         case CR_TLB_MISS_HANDLER:
@@ -1768,22 +2967,81 @@ static void write_control_register(struct thread *thread, uint32_t cr_index,
             break;
 
         case CR_SUSPEND_THREAD:
-            thread->core->proc->thread_enable_mask &= ~value;
+            __atomic_fetch_and(&thread->core->proc->thread_enable_mask, ~value,
+                               __ATOMIC_RELAXED);
             break;
 
         case CR_RESUME_THREAD:
-            thread->core->proc->thread_enable_mask |= value
-                & ((1ull << thread->core->proc->total_threads) - 1);
+            __atomic_fetch_or(&thread->core->proc->thread_enable_mask, value
+                              & ((1ull << thread->core->proc->total_threads) - 1),
+                              __ATOMIC_RELAXED);
             break;
+
+        case CR_PERF_EVENT_SELECT0:
+        case CR_PERF_EVENT_SELECT1:
+        {
+            // Changing the event doesn't reset the counter. Adjust the base
+            // so it continues from its current value.
+            struct core *core = thread->core;
+            uint32_t counter = cr_index - CR_PERF_EVENT_SELECT0;
+            uint64_t current_value = read_perf_counter(core, counter);
+
+            core->perf_event_select[counter] = value & PERF_EVENT_SELECT_MASK;
+            core->perf_counter_base[counter] = 0;
+            core->perf_counter_base[counter] = current_value
+                                               - read_perf_counter(core, counter);
+            break;
+        }
+    }
+}
+
+static uint64_t get_core_event_count(const struct core *core,
+                                     enum performance_event event)
+{
+    switch (event)
+    {
+        case PERF_INSTRUCTION_ISSUED:
+            return (uint64_t) core->total_instructions;
+
+        case PERF_INSTRUCTION_RETIRED:
+            return (uint64_t) core->total_instructions - core->rolled_back_instructions;
+
+        case PERF_L2_WRITEBACK:
+        case PERF_L2_MISS:
+        case PERF_L2_HIT:
+        case PERF_ICACHE_MISS:
+        case PERF_ICACHE_HIT:
+        case PERF_DCACHE_MISS:
+        case PERF_DCACHE_HIT:
+            if (core->proc->cache_model == NULL)
+                return 0;
+
+            return get_cache_event_count(core->proc->cache_model, core->id, event);
+
+        default:
+            return core->perf_events[event];
     }
 }
 
-static void execute_memory_access_inst(struct thread *thread, uint32_t instruction)
+static uint64_t read_perf_counter(const struct core *core, uint32_t counter)
+{
+    uint32_t event = core->perf_event_select[counter] + PERF_INTERRUPT;
+
+    // Selecting an event that doesn't exist stops the counter.
+    if (event >= NUM_PERF_EVENTS)
+        return core->perf_counter_base[counter];
+
+    return core->perf_counter_base[counter]
+           + get_core_event_count(core, (enum performance_event) event);
+}
+
+static void execute_memory_access_inst(struct thread *thread,
+                                       const struct decoded_inst *inst)
 {
-    uint32_t type = extract_unsigned_bits(instruction, 25, 4);
+    uint32_t type = inst->op;
     if (type != MEM_CONTROL_REG)	// Don't count control register transfers
     {
-        if (extract_unsigned_bits(instruction, 29, 1))
+        if (inst->is_load)
             TALLY_INSTRUCTION(load_inst);
         else
             TALLY_INSTRUCTION(store_inst);
@@ -1797,21 +3055,21 @@ static void execute_memory_access_inst(struct thread *thread, uint32_t instructi
         case MEM_SHORT_EXT:
         case MEM_LONG:
         case MEM_SYNC:
-            execute_scalar_load_store_inst(thread, instruction);
+            execute_scalar_load_store_inst(thread, inst);
             break;
 
         case MEM_CONTROL_REG:
-            execute_control_register_inst(thread, instruction);
+            execute_control_register_inst(thread, inst);
             break;
 
         case MEM_BLOCK_VECTOR:
         case MEM_BLOCK_VECTOR_MASK:
-            execute_block_load_store_inst(thread, instruction);
+            execute_block_load_store_inst(thread, inst);
             break;
 
         case MEM_SCGATH:
         case MEM_SCGATH_MASK:
-            execute_scatter_gather_inst(thread, instruction);
+            execute_scatter_gather_inst(thread, inst);
             break;
 
         default:
@@ -1819,45 +3077,68 @@ static void execute_memory_access_inst(struct thread *thread, uint32_t instructi
     }
 }
 
-static void execute_branch_inst(struct thread *thread, uint32_t instruction)
+static void execute_branch_inst(struct thread *thread,
+                                const struct decoded_inst *inst)
 {
-    uint32_t src_reg = extract_unsigned_bits(instruction, 0, 5);
-
-    // Subtract 4 because PC was already incremented after fetching instruction
-    uint32_t offset20 = extract_signed_bits(instruction, 5, 20) * 4 - 4;
-    uint32_t offset25 = extract_signed_bits(instruction, 0, 25) * 4 - 4;
+    uint32_t src_reg = inst->op1reg;
 
     TALLY_INSTRUCTION(branch_inst);
-    switch (extract_unsigned_bits(instruction, 25, 3))
+    switch (inst->op)
     {
         case BRANCH_REGISTER:
+            thread->core->perf_events[PERF_UNCOND_BRANCH]++;
             thread->pc = thread->scalar_reg[src_reg];
             break;
 
         case BRANCH_ZERO:
             if (thread->scalar_reg[src_reg] == 0)
-                thread->pc += offset20;
+            {
+                thread->core->perf_events[PERF_COND_BRANCH_TAKEN]++;
+                thread->pc += inst->imm;
+            }
+            else
+                thread->core->perf_events[PERF_COND_BRANCH_NOT_TAKEN]++;
 
             break;
 
         case BRANCH_NOT_ZERO:
             if (thread->scalar_reg[src_reg] != 0)
-                thread->pc += offset20;
+            {
+                thread->core->perf_events[PERF_COND_BRANCH_TAKEN]++;
+                thread->pc += inst->imm;
+            }
+            else
+                thread->core->perf_events[PERF_COND_BRANCH_NOT_TAKEN]++;
 
             break;
 
         case BRANCH_ALWAYS:
-            thread->pc += offset25;
+            thread->core->perf_events[PERF_UNCOND_BRANCH]++;
+            thread->pc += inst->imm;
             break;
 
         case BRANCH_CALL_OFFSET:
+            thread->core->perf_events[PERF_UNCOND_BRANCH]++;
             set_scalar_reg(thread, LINK_REG, thread->pc);
-            thread->pc += offset25;
+            thread->pc += inst->imm;
+            if (thread->core->proc->profile != NULL)
+            {
+                profile_call(thread->core->proc->profile, thread->id,
+                             thread->scalar_reg[LINK_REG] - 4, thread->pc);
+            }
+
             break;
 
         case BRANCH_CALL_REGISTER:
+            thread->core->perf_events[PERF_UNCOND_BRANCH]++;
             set_scalar_reg(thread, LINK_REG, thread->pc);
             thread->pc = thread->scalar_reg[src_reg];
+            if (thread->core->proc->profile != NULL)
+            {
+                profile_call(thread->core->proc->profile, thread->id,
+                             thread->scalar_reg[LINK_REG] - 4, thread->pc);
+            }
+
             break;
 
         case BRANCH_ERET:
@@ -1867,6 +3148,8 @@ static void execute_branch_inst(struct thread *thread, uint32_t instruction)
                 return;
             }
 
+            thread->core->perf_events[PERF_UNCOND_BRANCH]++;
+            thread->current_block = NULL;
             thread->enable_interrupt = thread->saved_trap_state[0].enable_interrupt;
             thread->enable_mmu = thread->saved_trap_state[0].enable_mmu;
             thread->pc = thread->saved_trap_state[0].pc;
@@ -1888,10 +3171,11 @@ static void execute_branch_inst(struct thread *thread, uint32_t instruction)
     }
 }
 
-static void execute_cache_control_inst(struct thread *thread, uint32_t instruction)
+static void execute_cache_control_inst(struct thread *thread,
+                                       const struct decoded_inst *inst)
 {
-    uint32_t op = extract_unsigned_bits(instruction, 25, 3);
-    uint32_t ptr_reg = extract_unsigned_bits(instruction, 0, 5);
+    uint32_t op = inst->op;
+    uint32_t ptr_reg = inst->op1reg;
     uint32_t way;
     bool updated_entry;
 
@@ -1910,10 +3194,20 @@ static void execute_cache_control_inst(struct thread *thread, uint32_t instructi
         {
             // This needs to fault if the TLB entry isn't present. translate_address
             // will do that as a side effect.
-            uint32_t offset = extract_signed_bits(instruction, 15, 10);
             uint32_t physical_address;
-            translate_address(thread, thread->scalar_reg[ptr_reg] + offset,
-                              &physical_address, false, true);
+            if (translate_address(thread, thread->scalar_reg[ptr_reg] + inst->imm,
+                                  &physical_address, false, true)
+                    && thread->core->proc->cache_model != NULL)
+            {
+                if (op == CC_DFLUSH)
+                {
+                    cache_model_flush(thread->core->proc->cache_model, thread->core->id,
+                                      physical_address);
+                }
+                else
+                    cache_model_invalidate(thread->core->proc->cache_model, physical_address);
+            }
+
             break;
         }
 
@@ -1921,7 +3215,7 @@ static void execute_cache_control_inst(struct thread *thread, uint32_t instructi
         case CC_ITLB_INSERT:
         {
             uint32_t virtual_address = ROUND_TO_PAGE(thread->scalar_reg[ptr_reg]);
-            uint32_t phys_addr_reg = extract_unsigned_bits(instruction, 5, 5);
+            uint32_t phys_addr_reg = inst->destreg;
             uint32_t phys_addr_and_flags = thread->scalar_reg[phys_addr_reg];
             uint32_t *way_ptr;
             struct tlb_entry *tlb;
@@ -1958,22 +3252,28 @@ static void execute_cache_control_inst(struct thread *thread, uint32_t instructi
                 }
             }
 
+            invalidate_host_tlb_page(thread->core, virtual_address);
             if (!updated_entry)
             {
                 // Replace entry with a new one
+                if (entry[*way_ptr].virtual_address != INVALID_ADDR)
+                    invalidate_host_tlb_page(thread->core, entry[*way_ptr].virtual_address);
+
                 entry[*way_ptr].virtual_address = virtual_address;
                 entry[*way_ptr].phys_addr_and_flags = phys_addr_and_flags;
                 entry[*way_ptr].asid = thread->asid;
             }
 
             *way_ptr = (*way_ptr + 1) % TLB_WAYS;
+            if (op == CC_ITLB_INSERT)
+                clear_core_blocks(thread->core);
+
             break;
         }
 
         case CC_INVALIDATE_TLB:
         {
-            uint32_t offset = extract_signed_bits(instruction, 15, 10);
-            uint32_t virtual_address = ROUND_TO_PAGE(thread->scalar_reg[ptr_reg] + offset);
+            uint32_t virtual_address = ROUND_TO_PAGE(thread->scalar_reg[ptr_reg] + inst->imm);
             uint32_t tlb_index = ((virtual_address / PAGE_SIZE) % TLB_SETS) * TLB_WAYS;
 
             if (!thread->enable_supervisor)
@@ -1991,6 +3291,9 @@ static void execute_cache_control_inst(struct thread *thread, uint32_t instructi
                     thread->core->dtlb[tlb_index + way].virtual_address = INVALID_ADDR;
             }
 
+            invalidate_host_tlb_page(thread->core, virtual_address);
+            clear_core_blocks(thread->core);
+
             break;
         }
 
@@ -2011,6 +3314,10 @@ static void execute_cache_control_inst(struct thread *thread, uint32_t instructi
                 thread->core->dtlb[i].virtual_address = INVALID_ADDR;
             }
 
+            for (i = 0; i < (int) thread->core->proc->threads_per_core; i++)
+                flush_host_tlb(&thread->core->threads[i]);
+
+            clear_core_blocks(thread->core);
             break;
         }
     }
@@ -2018,9 +3325,14 @@ static void execute_cache_control_inst(struct thread *thread, uint32_t instructi
 
 static bool execute_instruction(struct thread *thread)
 {
-    uint32_t instruction;
+    const struct decoded_inst *inst;
+    struct decoded_inst uncached_inst;
     uint32_t physical_pc;
     unsigned int fetch_pc = thread->pc;
+    uint32_t block_offset;
+
+    check_flush_blocks(thread->core);
+    block_offset = fetch_pc - thread->block_virtual_pc;
     thread->pc += 4;
 
     // Check PC alignment
@@ -2030,20 +3342,67 @@ static bool execute_instruction(struct thread *thread)
         return true;   // XXX if stop on fault was enabled, should return false
     }
 
-    if (!translate_address(thread, fetch_pc, &physical_pc, false, false))
-        return true;	// On next execution will start in TLB miss handler
+    if (thread->current_block != NULL
+            && block_offset < thread->current_block->length * 4)
+    {
+        // Fast path: still within the current block. It is on the same
+        // page and nothing has changed the translation since it was entered.
+        inst = &thread->current_block->insts[block_offset / 4];
+        physical_pc = thread->current_block->start_pc + block_offset;
+    }
+    else
+    {
+        if (!translate_address(thread, fetch_pc, &physical_pc, false, false))
+            return true;	// On next execution will start in TLB miss handler
+
+        // XXX if stop on fault was enabled, should return false
 
-    // XXX if stop on fault was enabled, should return false
+        if (physical_pc < thread->core->proc->memory_size)
+        {
+            thread->current_block = lookup_block(thread->core, physical_pc);
+            thread->block_virtual_pc = fetch_pc;
+            inst = &thread->current_block->insts[0];
+        }
+        else
+        {
+            decode_instruction(*UINT32_PTR(thread->core->proc->memory, physical_pc),
+                               &uncached_inst);
+            inst = &uncached_inst;
+        }
+    }
 
-    instruction = *UINT32_PTR(thread->core->proc->memory, physical_pc);
-    thread->core->proc->total_instructions++;
+    thread->core->total_instructions++;
+    if (thread->core->proc->profile != NULL)
+    {
+        profile_instruction(thread->core->proc->profile, thread->id, fetch_pc,
+                            thread->subcycle != 0);
+    }
+
+    if (thread->core->proc->cache_model != NULL)
+    {
+        cache_model_fetch(thread->core->proc->cache_model, thread->core->id,
+                          thread->id, physical_pc);
+    }
 
 restart:
-    if ((instruction & 0xe0000000) == 0xc0000000)
-        execute_register_arith_inst(thread, instruction);
-    else if ((instruction & 0x80000000) == 0)
+    switch (inst->type)
     {
-        if (instruction == BREAKPOINT_INST)
+        case INST_REGISTER_ARITH:
+            execute_register_arith_inst(thread, inst);
+            break;
+
+        case INST_IMMEDIATE_ARITH:
+            execute_immediate_arith_inst(thread, inst);
+            break;
+
+        case INST_NOP:
+            // Don't execute nop instructions. Although executing
+            // the instruction (or s0, s0, s0) has no effect, it would
+            // cause a cosimulation mismatch because the verilog model
+            // does not generate an event for it.
+            break;
+
+        case INST_BREAKPOINT:
         {
             struct breakpoint *breakpoint = lookup_breakpoint(thread->core->proc, thread->pc - 4);
             if (breakpoint == NULL)
@@ -2061,8 +3420,9 @@ restart:
             if (breakpoint->restart || thread->core->proc->single_stepping)
             {
                 breakpoint->restart = false;
-                instruction = breakpoint->original_instruction;
-                assert(instruction != BREAKPOINT_INST);
+                assert(breakpoint->original_instruction != BREAKPOINT_INST);
+                decode_instruction(breakpoint->original_instruction, &uncached_inst);
+                inst = &uncached_inst;
                 goto restart;
             }
             else
@@ -2073,33 +3433,442 @@ restart:
                 return false;
             }
         }
-        else if (instruction != INSTRUCTION_NOP)
+
+        case INST_MEMORY_ACCESS:
+            execute_memory_access_inst(thread, inst);
+            break;
+
+        case INST_BRANCH:
+            execute_branch_inst(thread, inst);
+            break;
+
+        case INST_CACHE_CONTROL:
+            execute_cache_control_inst(thread, inst);
+            break;
+
+        default:
+            printf("Bad instruction @%08x\n", thread->pc - 4);
+    }
+
+    return true;
+}
+
+static void execute_nop_inst(struct thread *thread,
+                             const struct decoded_inst *inst)
+{
+    // Nothing to do. This is a separate function only so threaded mode does
+    // not need to exit to the interpreter for it.
+    (void) thread;
+    (void) inst;
+}
+
+// Used in threaded mode. Execute instructions in this thread until it reaches the
+// end of the current basic block, then return the number of instructions
+// executed. This avoids rescheduling and looking up the block for each
+// instruction. Execution returns to the interpreter for anything that leaves
+// the sequential path: a trap (including interrupts and TLB misses), a change
+// to the address translation, the block being invalidated, or the thread
+// halting. Timer ticks still occur after each instruction. In JIT mode,
+// translated runs of instructions execute as one step, when that has the
+// same result.
+static uint32_t execute_block(struct thread *thread, uint64_t max_instructions)
+{
+    struct processor *proc = thread->core->proc;
+    const struct basic_block *block;
+    const struct decoded_inst *inst;
+    uint32_t block_offset;
+    uint32_t count;
+
+    // The first instruction goes through the interpreter, which translates
+    // the PC, finds the block, and handles faults. The debugger is not
+    // supported in threaded mode, so this cannot hit a breakpoint.
+    execute_instruction(thread);
+    timer_tick(proc);
+    count = 1;
+    block = thread->current_block;
+    if (block == NULL)
+        return count;
+
+    if (thread->core->jit != NULL && block->execute_count < JIT_THRESHOLD)
+        ((struct basic_block*) block)->execute_count++;
+
+    while (count < max_instructions)
+    {
+        if (thread->current_block != block
+                || (proc->thread_enable_mask & (1u << thread->id)) == 0
+                || proc->crashed
+                || __atomic_load_n(&thread->core->flush_blocks, __ATOMIC_ACQUIRE))
+            break;
+
+        block_offset = thread->pc - thread->block_virtual_pc;
+        if (block_offset >= block->length * 4 || (block_offset & 3) != 0)
+            break;
+
+        inst = &block->insts[block_offset / 4];
+        if (block->execute_count == JIT_THRESHOLD && !inst->jit_checked)
         {
-            // Don't call this for nop instructions. Although executing
-            // the instruction (or s0, s0, s0) has no effect, it would
-            // cause a cosimulation mismatch because the verilog model
-            // does not generate an event for it.
+            translate_run(thread->core, (struct basic_block*) block,
+                          block_offset / 4);
+        }
+
+        if (inst->jit_code != NULL && can_run_translated(thread, inst->jit_length,
+                max_instructions - count))
+        {
+            inst->jit_code(thread->scalar_reg, &thread->vector_reg[0][0]);
+            thread->pc += inst->jit_length * 4;
+            thread->core->total_instructions += inst->jit_length;
+            if (proc->parallel_quantum == 0)
+                advance_timer(proc, inst->jit_length);
+
+            count += inst->jit_length;
+            if (inst + inst->jit_length == &block->insts[block->length])
+                break;
 
-            execute_immediate_arith_inst(thread, instruction);
+            continue;
+        }
+
+        if (inst->handler == NULL)
+            break;
+
+        thread->pc += 4;
+        thread->core->total_instructions++;
+        if (proc->profile != NULL)
+        {
+            profile_instruction(proc->profile, thread->id, thread->pc - 4,
+                                thread->subcycle != 0);
+        }
+
+        if (proc->cache_model != NULL)
+        {
+            cache_model_fetch(proc->cache_model, thread->core->id, thread->id,
+                              block->start_pc + block_offset);
+        }
+
+        inst->handler(thread, inst);
+        timer_tick(proc);
+        count++;
+
+        // Let other threads run after each pass through the block, so a
+        // thread spinning in a loop doesn't starve them.
+        if (inst == &block->insts[block->length - 1])
+            break;
+    }
+
+    return count;
+}
+
+// Fill in the JIT fields of a decoded instruction. Returns false if it can't
+// be translated.
+static bool get_jit_inst(const struct jit *jit, const struct decoded_inst *inst,
+                         struct jit_inst *out)
+{
+    memset(out, 0, sizeof(*out));
+    out->op = (enum arithmetic_op) inst->op;
+    out->destreg = inst->destreg;
+    out->op1reg = inst->op1reg;
+    out->op2reg = inst->op2reg;
+    out->maskreg = inst->maskreg;
+    out->imm = inst->imm;
+    if (inst->type == INST_REGISTER_ARITH)
+    {
+        switch (inst->fmt)
+        {
+            case FMT_RA_SS:
+                out->op2_type = JIT_SCALAR_REG;
+                break;
+
+            case FMT_RA_VS_M:
+                out->is_masked = true;
+                // Falls through
+
+            case FMT_RA_VS:
+                out->is_vector = true;
+                out->op2_type = JIT_SCALAR_REG;
+                break;
+
+            case FMT_RA_VV_M:
+                out->is_masked = true;
+                // Falls through
+
+            case FMT_RA_VV:
+                out->is_vector = true;
+                out->op2_type = JIT_VECTOR_REG;
+                break;
+
+            default:
+                return false;
+        }
+    }
+    else if (inst->type == INST_IMMEDIATE_ARITH)
+    {
+        out->op2_type = JIT_IMMEDIATE;
+        switch (inst->fmt)
+        {
+            case FMT_IMM_MOVEHI:
+                // Compares in this format are illegal instructions.
+                if (is_compare_op(inst->op))
+                    return false;
+
+                break;
+
+            case FMT_IMM_S:
+                break;
+
+            case FMT_IMM_VM:
+                out->is_masked = true;
+                // Falls through
+
+            case FMT_IMM_V:
+                out->is_vector = true;
+                break;
+
+            default:
+                return false;
         }
     }
-    else if ((instruction & 0xc0000000) == 0x80000000)
-        execute_memory_access_inst(thread, instruction);
-    else if ((instruction & 0xf0000000) == 0xf0000000)
-        execute_branch_inst(thread, instruction);
-    else if ((instruction & 0xf0000000) == 0xe0000000)
-        execute_cache_control_inst(thread, instruction);
     else
-        printf("Bad instruction @%08x\n", thread->pc - 4);
+        return false;
+
+    return jit_can_translate(jit, out);
+}
+
+// Translate the run of consecutive instructions that the JIT supports,
+// starting with this one. This happens the first time execution reaches
+// each instruction of a hot block, so a run can start wherever execution
+// enters it, such as a branch target in the middle of the block.
+static void translate_run(struct core *core, struct basic_block *block,
+                          uint32_t start)
+{
+#ifndef DUMP_INSTRUCTION_STATS
+    struct jit_inst run[MAX_BLOCK_LENGTH];
+    uint32_t end;
+    jit_func code;
+
+    block->insts[start].jit_checked = true;
+    for (end = start; end < block->length
+            && get_jit_inst(core->jit, &block->insts[end], &run[end - start]); end++)
+        ;
+
+    // A single instruction is about as fast through its handler.
+    if (end - start < 2)
+        return;
+
+    code = jit_translate(core->jit, run, end - start);
+    if (code == NULL)
+    {
+        // The code buffer is full. Start over. Blocks that are still in use
+        // will be translated again once they are hot.
+        reset_jit(core);
+        return;
+    }
+
+    block->insts[start].jit_code = code;
+    block->insts[start].jit_length = end - start;
+#else
+    // Translated code doesn't count instructions by type.
+    block->insts[start].jit_checked = true;
+    (void) core;
+#endif
+}
+
+// Discard all translated code for this core.
+static void reset_jit(struct core *core)
+{
+    int block_index;
+    uint32_t inst_index;
+    struct basic_block *block;
+
+    jit_reset(core->jit);
+    for (block_index = 0; block_index < BLOCK_CACHE_SIZE; block_index++)
+    {
+        block = &core->block_cache[block_index];
+        block->execute_count = 0;
+        for (inst_index = 0; inst_index < MAX_BLOCK_LENGTH; inst_index++)
+        {
+            block->insts[inst_index].jit_code = NULL;
+            block->insts[inst_index].jit_checked = false;
+        }
+    }
+}
+
+// Translated code skips the per-instruction work in execute_block, so it
+// can only be used when none is needed. If the timer would expire in the
+// middle of the run, the instructions go through their handlers, so the
+// interrupt is taken at the same instruction.
+static bool can_run_translated(const struct thread *thread, uint32_t length,
+                               uint64_t max_instructions)
+{
+    const struct processor *proc = thread->core->proc;
+
+    return length <= max_instructions
+           && proc->profile == NULL
+           && proc->cache_model == NULL
+           && !proc->enable_tracing
+           && !proc->enable_cosim
+           && (proc->parallel_quantum != 0 || proc->current_timer_count == 0
+               || proc->current_timer_count >= length);
+}
+
+// Run all cores until they have executed the requested number of
+// instructions, one quantum at a time. Between quanta, all other host threads
+// are stopped, so this can safely deliver interrupts and flush block caches.
+static bool execute_parallel(struct processor *proc, uint64_t total_instructions)
+{
+    uint64_t instruction_count = 0;
+    uint32_t quantum_count;
+    uint32_t core_id;
+
+    while (instruction_count < total_instructions)
+    {
+        if (proc->thread_enable_mask == 0)
+        {
+            printf("thread enable mask is now zero\n");
+            return false;
+        }
+
+        if (proc->crashed)
+            return false;
+
+        pthread_mutex_lock(&proc->quantum_lock);
+        proc->cores_running = proc->num_cores - 1;
+        proc->quantum_generation++;
+        pthread_cond_broadcast(&proc->quantum_start);
+        pthread_mutex_unlock(&proc->quantum_lock);
+
+        execute_core_quantum(&proc->cores[0]);
+
+        pthread_mutex_lock(&proc->quantum_lock);
+        while (proc->cores_running > 0)
+            pthread_cond_wait(&proc->quantum_done, &proc->quantum_lock);
+
+        pthread_mutex_unlock(&proc->quantum_lock);
+
+        quantum_count = 0;
+        for (core_id = 0; core_id < proc->num_cores; core_id++)
+        {
+            quantum_count += proc->cores[core_id].quantum_instructions;
+        }
+
+        advance_timer(proc, quantum_count);
+        instruction_count += quantum_count;
+    }
 
     return true;
 }
 
+// Host thread that runs one core in parallel mode.
+static void *core_thread_main(void *arg)
+{
+    struct core *core = (struct core*) arg;
+    struct processor *proc = core->proc;
+    uint32_t generation = 0;
+
+    pthread_mutex_lock(&proc->quantum_lock);
+    while (true)
+    {
+        while (proc->quantum_generation == generation)
+            pthread_cond_wait(&proc->quantum_start, &proc->quantum_lock);
+
+        generation = proc->quantum_generation;
+        pthread_mutex_unlock(&proc->quantum_lock);
+
+        execute_core_quantum(core);
+
+        pthread_mutex_lock(&proc->quantum_lock);
+        if (--proc->cores_running == 0)
+            pthread_cond_signal(&proc->quantum_done);
+    }
+
+    return NULL;
+}
+
+// Execute threads on this core in round robin order until they have run
+// parallel_quantum instructions or all have halted.
+static void execute_core_quantum(struct core *core)
+{
+    struct processor *proc = core->proc;
+    uint32_t first_thread_id = (uint32_t)(core - proc->cores) * proc->threads_per_core;
+    uint32_t core_thread_mask = (uint32_t)((1ull << proc->threads_per_core) - 1);
+    uint32_t enabled_threads;
+    uint32_t count = 0;
+
+    while (count < proc->parallel_quantum && !proc->crashed)
+    {
+        enabled_threads = (__atomic_load_n(&proc->thread_enable_mask, __ATOMIC_RELAXED)
+                           >> first_thread_id) & core_thread_mask;
+        if (enabled_threads == 0)
+            break;
+
+        core->next_thread = next_set_bit(enabled_threads, (core->next_thread + 31) & 31);
+        if (proc->enable_threaded_dispatch)
+        {
+            count += execute_block(&core->threads[core->next_thread],
+                                   proc->parallel_quantum - count);
+        }
+        else
+        {
+            execute_instruction(&core->threads[core->next_thread]);
+            count++;
+        }
+    }
+
+    core->quantum_instructions = count;
+}
+
+static void lock_line(struct processor *proc, uint32_t address)
+{
+    if (proc->parallel_quantum != 0)
+    {
+        pthread_mutex_lock(&proc->line_locks[(address / CACHE_LINE_LENGTH)
+                                             % NUM_LINE_LOCKS]);
+    }
+}
+
+static void unlock_line(struct processor *proc, uint32_t address)
+{
+    if (proc->parallel_quantum != 0)
+    {
+        pthread_mutex_unlock(&proc->line_locks[(address / CACHE_LINE_LENGTH)
+                                               % NUM_LINE_LOCKS]);
+    }
+}
+
+static void lock_devices(struct processor *proc)
+{
+    if (proc->parallel_quantum != 0)
+        pthread_mutex_lock(&proc->device_lock);
+}
+
+static void unlock_devices(struct processor *proc)
+{
+    if (proc->parallel_quantum != 0)
+        pthread_mutex_unlock(&proc->device_lock);
+}
+
 static void timer_tick(struct processor *proc)
 {
+    // In parallel mode, advance_timer updates this at the end of each
+    // quantum instead.
+    if (proc->parallel_quantum != 0)
+        return;
+
     if (proc->current_timer_count > 0)
     {
         if (proc->current_timer_count-- == 1)
             raise_interrupt(proc, INT_TIMER);
     }
 }
+
+static void advance_timer(struct processor *proc, uint32_t instructions)
+{
+    if (proc->current_timer_count > 0)
+    {
+        if (proc->current_timer_count <= instructions)
+        {
+            proc->current_timer_count = 0;
+            raise_interrupt(proc, INT_TIMER);
+        }
+        else
+            proc->current_timer_count -= instructions;
+    }
+}
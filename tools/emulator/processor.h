@@ -19,6 +19,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 
 #define SIM_CLOCK_MHZ 50000000
 #define NUM_REGISTERS 32
@@ -26,6 +27,33 @@
 #define CACHE_LINE_LENGTH 64u
 #define CACHE_LINE_MASK (CACHE_LINE_LENGTH - 1)
 
+struct cache_model;
+struct profile;
+
+// Numbers for events that performance counters can count. These match
+// enum performance_event in software/libs/libos/performance_counters.h.
+enum performance_event
+{
+    PERF_L2_WRITEBACK,
+    PERF_L2_MISS,
+    PERF_L2_HIT,
+    PERF_INTERRUPT,
+    PERF_STORE_ROLLBACK,
+    PERF_STORE,
+    PERF_INSTRUCTION_RETIRED,
+    PERF_INSTRUCTION_ISSUED,
+    PERF_ICACHE_MISS,
+    PERF_ICACHE_HIT,
+    PERF_ITLB_MISS,
+    PERF_DCACHE_MISS,
+    PERF_DCACHE_HIT,
+    PERF_DTLB_MISS,
+    PERF_UNCOND_BRANCH,
+    PERF_COND_BRANCH_TAKEN,
+    PERF_COND_BRANCH_NOT_TAKEN,
+    NUM_PERF_EVENTS
+};
+
 struct processor *init_processor(uint32_t memsize, uint32_t num_cores,
                                  uint32_t threads_per_core,
                                  bool randomize_memory,
@@ -40,15 +68,47 @@ void enable_tracing(struct processor*);
 // coverage by exposing more potential race conditions.
 void enable_random_thread_sched(struct processor*);
 
-// Open a file formatted in the Verilog $readmemh format into memory starting
-// address 0.
-int load_hex_file(struct processor*, const char *filename);
+// Load an executable image into memory starting at address 0. This may be an
+// ELF file, a raw binary file (with a .bin extension), or a file in the
+// Verilog $readmemh format.
+int load_image_file(struct processor*, const char *filename);
 void write_memory_to_file(const struct processor*, const char *filename,
                           uint32_t base_address, uint32_t length);
+
+// Serialize processor state and memory for snapshots (see snapshot.h).
+// read_processor_state returns -1 if the processor configuration doesn't
+// match.
+void write_processor_state(const struct processor*, FILE *file);
+int read_processor_state(struct processor*, FILE *file);
 const void *get_memory_region_ptr(const struct processor*, uint32_t address,
                                   uint32_t length);
 void print_registers(const struct processor*, uint32_t thread_id);
 void enable_cosimulation(struct processor*);
+
+// Execute each thread a basic block at a time, using specialized handlers
+// for common instructions. Not compatible with the debugger.
+void enable_threaded_dispatch(struct processor*);
+
+// Like threaded dispatch, but also translate frequently executed runs of
+// arithmetic instructions to host code (see jit.h). Tracing, cosimulation,
+// profiling and the cache model need each instruction to go through the
+// interpreter, so translated code isn't used while they are enabled.
+// Returns -1 if the host doesn't support this.
+int enable_jit(struct processor*);
+
+// Execute each core on a separate host thread. Cores run the given number of
+// instructions, then wait for each other. Device and timer interrupts are
+// delivered between these quanta. Not compatible with the debugger or
+// cosimulation. Returns -1 if it couldn't create the host threads.
+int enable_parallel_execution(struct processor*, uint32_t quantum);
+
+// Record execution counts for each instruction executed from now on. See
+// profile.h.
+void enable_profiling(struct processor*, struct profile*);
+
+// Simulate caches for all memory accesses from now on (see cache-model.h).
+// Cache events are only counted when this is enabled.
+void enable_cache_model(struct processor*, struct cache_model*);
 void raise_interrupt(struct processor*, uint32_t int_bitmap);
 void clear_interrupt(struct processor*, uint32_t int_bitmap);
 
@@ -57,6 +117,10 @@ void cosim_interrupt(struct processor*, uint32_t thread_id, uint32_t pc);
 uint32_t get_total_threads(const struct processor*);
 bool is_proc_halted(const struct processor*);
 bool is_stopped_on_fault(const struct processor*);
+int64_t get_total_instructions(const struct processor*);
+
+// Total for all cores
+uint64_t get_perf_event_count(const struct processor*, enum performance_event);
 
 // Return false if this hit a breakpoint or crashed
 bool execute_instructions(struct processor*,
@@ -73,7 +137,7 @@ void dbg_get_vector_reg(const struct processor*, uint32_t thread_id,
 void dbg_set_vector_reg(struct processor*, uint32_t thread_id,
                         uint32_t reg_id, uint32_t *values);
 uint32_t dbg_read_memory_byte(const struct processor*, uint32_t addr);
-void dbg_write_memory_byte(const struct processor*, uint32_t addr, uint8_t byte);
+void dbg_write_memory_byte(struct processor*, uint32_t addr, uint8_t byte);
 int dbg_set_breakpoint(struct processor*, uint32_t pc);
 int dbg_clear_breakpoint(struct processor*, uint32_t pc);
 void dbg_set_stop_on_fault(struct processor*, bool stop_on_fault);
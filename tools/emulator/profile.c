@@ -0,0 +1,272 @@
+//
+// Copyright 2018 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "processor.h"
+#include "profile.h"
+
+#define PROFILE_MAGIC "NYUZIPRF"
+#define PROFILE_VERSION 1
+#define INITIAL_TABLE_SIZE 1024
+#define EMPTY_KEY 0xffffffffffffffffull
+#define INVALID_PC 0xffffffffu
+
+// Open addressed hash table that maps an address (or, for calls, a pair of
+// addresses) to a count. The size is always a power of two.
+struct count_table
+{
+    uint64_t *keys;
+    uint64_t *counts;
+    uint32_t size;
+    uint32_t used;
+};
+
+struct thread_profile
+{
+    uint32_t last_pc;
+    struct count_table instructions;
+    struct count_table blocks;
+    struct count_table data_lines;
+    struct count_table calls;
+};
+
+struct profile
+{
+    uint32_t total_threads;
+    struct thread_profile *threads;
+};
+
+static void init_table(struct count_table *table, uint32_t size)
+{
+    uint32_t i;
+
+    table->size = size;
+    table->used = 0;
+    table->keys = (uint64_t*) malloc(size * sizeof(uint64_t));
+    table->counts = (uint64_t*) calloc(size, sizeof(uint64_t));
+    for (i = 0; i < size; i++)
+        table->keys[i] = EMPTY_KEY;
+}
+
+static inline uint32_t hash_key(uint64_t key, uint32_t size)
+{
+    return (uint32_t) ((key * 0x9e3779b97f4a7c15ull) >> 32) & (size - 1);
+}
+
+static void grow_table(struct count_table *table)
+{
+    struct count_table old_table = *table;
+    uint32_t old_index;
+    uint32_t index;
+
+    init_table(table, old_table.size * 2);
+    for (old_index = 0; old_index < old_table.size; old_index++)
+    {
+        if (old_table.keys[old_index] == EMPTY_KEY)
+            continue;
+
+        index = hash_key(old_table.keys[old_index], table->size);
+        while (table->keys[index] != EMPTY_KEY)
+            index = (index + 1) & (table->size - 1);
+
+        table->keys[index] = old_table.keys[old_index];
+        table->counts[index] = old_table.counts[old_index];
+    }
+
+    table->used = old_table.used;
+    free(old_table.keys);
+    free(old_table.counts);
+}
+
+static inline void increment_count(struct count_table *table, uint64_t key)
+{
+    uint32_t index = hash_key(key, table->size);
+
+    while (table->keys[index] != key)
+    {
+        if (table->keys[index] == EMPTY_KEY)
+        {
+            // Keep the load factor under 1/2 so probe sequences stay short.
+            if ((table->used + 1) * 2 > table->size)
+            {
+                grow_table(table);
+                increment_count(table, key);
+                return;
+            }
+
+            table->keys[index] = key;
+            table->used++;
+            break;
+        }
+
+        index = (index + 1) & (table->size - 1);
+    }
+
+    table->counts[index]++;
+}
+
+static int compare_entries(const void *entry1, const void *entry2)
+{
+    uint64_t key1 = *(const uint64_t*) entry1;
+    uint64_t key2 = *(const uint64_t*) entry2;
+
+    if (key1 < key2)
+        return -1;
+    else if (key1 > key2)
+        return 1;
+    else
+        return 0;
+}
+
+static void write_u32(FILE *file, uint32_t value)
+{
+    uint8_t bytes[4] = { (uint8_t) value, (uint8_t) (value >> 8),
+                         (uint8_t) (value >> 16), (uint8_t) (value >> 24) };
+
+    fwrite(bytes, sizeof(bytes), 1, file);
+}
+
+static void write_u64(FILE *file, uint64_t value)
+{
+    write_u32(file, (uint32_t) value);
+    write_u32(file, (uint32_t) (value >> 32));
+}
+
+// Write entries sorted by key, which makes the file deterministic. For
+// calls, the call site is in the upper 32 bits of the key, so this writes it
+// first. The result is an array of (key, count) pairs.
+static void write_table(FILE *file, const struct count_table *table, bool is_pair)
+{
+    uint64_t *entries;
+    uint32_t num_entries = 0;
+    uint32_t i;
+
+    entries = (uint64_t*) malloc(table->used * 2 * sizeof(uint64_t));
+    for (i = 0; i < table->size; i++)
+    {
+        if (table->keys[i] != EMPTY_KEY)
+        {
+            entries[num_entries * 2] = table->keys[i];
+            entries[num_entries * 2 + 1] = table->counts[i];
+            num_entries++;
+        }
+    }
+
+    qsort(entries, num_entries, 2 * sizeof(uint64_t), compare_entries);
+    write_u32(file, num_entries);
+    for (i = 0; i < num_entries; i++)
+    {
+        if (is_pair)
+            write_u32(file, (uint32_t) (entries[i * 2] >> 32));
+
+        write_u32(file, (uint32_t) entries[i * 2]);
+        write_u64(file, entries[i * 2 + 1]);
+    }
+
+    free(entries);
+}
+
+struct profile *init_profile(uint32_t total_threads)
+{
+    struct profile *profile;
+    struct thread_profile *thread;
+    uint32_t thread_id;
+
+    profile = (struct profile*) calloc(1, sizeof(struct profile));
+    profile->total_threads = total_threads;
+    profile->threads = (struct thread_profile*) calloc(total_threads,
+                       sizeof(struct thread_profile));
+    for (thread_id = 0; thread_id < total_threads; thread_id++)
+    {
+        thread = &profile->threads[thread_id];
+        thread->last_pc = INVALID_PC;
+        init_table(&thread->instructions, INITIAL_TABLE_SIZE);
+        init_table(&thread->blocks, INITIAL_TABLE_SIZE);
+        init_table(&thread->data_lines, INITIAL_TABLE_SIZE);
+        init_table(&thread->calls, INITIAL_TABLE_SIZE);
+    }
+
+    return profile;
+}
+
+int write_profile(const struct profile *profile, const char *filename)
+{
+    FILE *file;
+    uint32_t thread_id;
+    const struct thread_profile *thread;
+    int result = 0;
+
+    file = fopen(filename, "wb");
+    if (file == NULL)
+    {
+        perror("write_profile: error opening profile file");
+        return -1;
+    }
+
+    fwrite(PROFILE_MAGIC, strlen(PROFILE_MAGIC), 1, file);
+    write_u32(file, PROFILE_VERSION);
+    write_u32(file, profile->total_threads);
+    for (thread_id = 0; thread_id < profile->total_threads; thread_id++)
+    {
+        thread = &profile->threads[thread_id];
+        write_table(file, &thread->instructions, false);
+        write_table(file, &thread->blocks, false);
+        write_table(file, &thread->data_lines, false);
+        write_table(file, &thread->calls, true);
+    }
+
+    if (ferror(file))
+    {
+        perror("write_profile: error writing profile file");
+        result = -1;
+    }
+
+    if (fclose(file) != 0)
+    {
+        perror("write_profile: error writing profile file");
+        result = -1;
+    }
+
+    return result;
+}
+
+void profile_instruction(struct profile *profile, uint32_t thread_id, uint32_t pc,
+                         bool is_subcycle)
+{
+    struct thread_profile *thread = &profile->threads[thread_id];
+
+    increment_count(&thread->instructions, pc);
+    if (pc != thread->last_pc + 4 && !is_subcycle)
+        increment_count(&thread->blocks, pc);
+
+    thread->last_pc = pc;
+}
+
+void profile_call(struct profile *profile, uint32_t thread_id, uint32_t call_pc,
+                  uint32_t target)
+{
+    increment_count(&profile->threads[thread_id].calls,
+                    ((uint64_t) call_pc << 32) | target);
+}
+
+void profile_data_access(struct profile *profile, uint32_t thread_id, uint32_t address)
+{
+    increment_count(&profile->threads[thread_id].data_lines,
+                    address & ~CACHE_LINE_MASK);
+}
@@ -0,0 +1,67 @@
+//
+// Copyright 2018 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+//
+// Exact execution profile. For each hardware thread, this counts how many
+// times each instruction executed, how many times each basic block was
+// entered (an instruction executed that didn't follow the previous one
+// sequentially), each call site/target pair, and the number of accesses to
+// each data cache line. All addresses are virtual. Instruction cache line
+// touches can be computed from the instruction counts. Like the total
+// instruction count, scatter/gather instructions count once per lane.
+//
+// Each thread's counts are only updated by the host thread executing its
+// core, so no locking is required in parallel mode.
+//
+// tools/misc/emulator_profile.py reads the output file, which has this
+// format (all values little endian):
+//
+//   char magic[8]          "NYUZIPRF"
+//   uint32_t version       1
+//   uint32_t num_threads
+//   For each thread:
+//     uint32_t count, then count * { uint32_t pc; uint64_t count; }
+//         Instruction counts
+//     uint32_t count, then count * { uint32_t pc; uint64_t count; }
+//         Basic block entry counts
+//     uint32_t count, then count * { uint32_t line_address; uint64_t count; }
+//         Data cache line accesses
+//     uint32_t count, then count * { uint32_t call_pc; uint32_t target; uint64_t count; }
+//         Calls
+//
+// Entries in each table are sorted by address.
+//
+
+struct profile;
+
+struct profile *init_profile(uint32_t total_threads);
+int write_profile(const struct profile*, const char *filename);
+
+// is_subcycle is true when this is another lane of a scatter/gather
+// instruction, which doesn't start a new basic block.
+void profile_instruction(struct profile*, uint32_t thread_id, uint32_t pc,
+                         bool is_subcycle);
+void profile_call(struct profile*, uint32_t thread_id, uint32_t call_pc,
+                  uint32_t target);
+void profile_data_access(struct profile*, uint32_t thread_id, uint32_t address);
+
+#endif
@@ -20,11 +20,13 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include "device.h"
 #include "sdmmc.h"
+#include "snapshot.h"
 #include "util.h"
 
 // SD/MMC interface, SPI mode.
@@ -65,6 +67,8 @@ enum sd_state
 };
 
 static int block_fd = -1;
+static uint8_t *block_data;
+static uint32_t block_device_size;
 static enum sd_state current_state;
 static uint32_t chip_select;
 static uint32_t state_delay;
@@ -99,6 +103,23 @@ int open_sdmmc_device(const char *filename)
         return -1;
     }
 
+    // Map the file rather than reading it. Blocks are only read from disk
+    // when accessed, and multiple instances share the host page cache.
+    // Writes go back to the file.
+    block_device_size = (uint32_t) fs.st_size;
+    if (block_device_size > 0)
+    {
+        block_data = mmap(NULL, block_device_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED, block_fd, 0);
+        if (block_data == MAP_FAILED)
+        {
+            perror("open_sdmmc_device: failed to map block device file");
+            close(block_fd);
+            block_fd = -1;
+            return -1;
+        }
+    }
+
     block_length = 512;
     block_buffer = malloc(block_length);
 
@@ -108,6 +129,9 @@ int open_sdmmc_device(const char *filename)
 void close_sdmmc_device(void)
 {
     assert(block_fd > 0);
+    if (block_device_size > 0)
+        munmap(block_data, block_device_size);
+
     close(block_fd);
 }
 
@@ -182,18 +206,15 @@ static void process_command(const uint8_t *command)
                 }
 
                 transfer_address = read_little_endian(command + 1) * block_length;
-                if (lseek(block_fd, transfer_address, SEEK_SET) < 0)
-                {
-                    perror("CMD_READ_SINGLE_BLOCK: seek failed");
-                    exit(1);
-                }
-
-                if (read(block_fd, block_buffer, block_length) != block_length)
+                if (transfer_address > block_device_size
+                        || block_length > block_device_size - transfer_address)
                 {
                     printf("CMD_READ_SINGLE_BLOCK: read failed for block\n");
                     exit(1);
                 }
 
+                memcpy(block_buffer, block_data + transfer_address, block_length);
+
                 transfer_count = 0;
                 current_state = STATE_READ_CMD_RESPONSE;
                 state_delay = next_random() & 0xf; // Wait a random amount of time
@@ -366,17 +387,14 @@ int transfer_sdmmc_byte(int value)
             current_state = STATE_IDLE;
             result = 0x05;  // Data accepted
 
-            if (lseek(block_fd, transfer_address, SEEK_SET) < 0)
+            if (transfer_address > block_device_size
+                    || block_length > block_device_size - transfer_address)
             {
-                perror("CMD_READ_SINGLE_BLOCK: seek failed");
+                printf("CMD_WRITE_SINGLE_BLOCK: write failed for block\n");
                 exit(1);
             }
 
-            if (write(block_fd, block_buffer, block_length) != block_length)
-            {
-                printf("CMD_READ_SINGLE_BLOCK: write failed for block\n");
-                exit(1);
-            }
+            memcpy(block_data + transfer_address, block_buffer, block_length);
 
             break;
     }
@@ -388,3 +406,51 @@ void set_sdmmc_cs(int value)
 {
     chip_select = value & 1;
 }
+
+// This doesn't include the contents of the block device file. The same file
+// must be passed with -b when restoring.
+void write_sdmmc_state(FILE *file)
+{
+    write_snapshot_u32(file, (uint32_t) current_state);
+    write_snapshot_u32(file, chip_select);
+    write_snapshot_u32(file, state_delay);
+    write_snapshot_u32(file, transfer_address);
+    write_snapshot_u32(file, transfer_count);
+    write_snapshot_u32(file, block_length);
+    write_snapshot_u32(file, init_clock_count);
+    fwrite(command, SD_COMMAND_LENGTH, 1, file);
+    write_snapshot_u32(file, command_length);
+    write_snapshot_bool(file, in_idle_state);
+    write_snapshot_u8(file, check_pattern);
+    write_snapshot_u8(file, voltage);
+    write_snapshot_bool(file, is_app_cmd);
+    write_snapshot_bool(file, block_buffer != NULL);
+    if (block_buffer != NULL)
+        fwrite(block_buffer, block_length, 1, file);
+}
+
+void read_sdmmc_state(FILE *file)
+{
+    current_state = (enum sd_state) read_snapshot_u32(file);
+    chip_select = read_snapshot_u32(file);
+    state_delay = read_snapshot_u32(file);
+    transfer_address = read_snapshot_u32(file);
+    transfer_count = read_snapshot_u32(file);
+    block_length = read_snapshot_u32(file);
+    init_clock_count = read_snapshot_u32(file);
+    if (fread(command, SD_COMMAND_LENGTH, 1, file) != 1)
+        return;
+
+    command_length = read_snapshot_u32(file);
+    in_idle_state = read_snapshot_bool(file);
+    check_pattern = read_snapshot_u8(file);
+    voltage = read_snapshot_u8(file);
+    is_app_cmd = read_snapshot_bool(file);
+    if (read_snapshot_bool(file))
+    {
+        free(block_buffer);
+        block_buffer = malloc(block_length);
+        if (fread(block_buffer, block_length, 1, file) != 1)
+            return;
+    }
+}
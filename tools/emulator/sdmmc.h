@@ -17,9 +17,13 @@
 #ifndef SDMMC_H
 #define SDMMC_H
 
+#include <stdio.h>
+
 int open_sdmmc_device(const char *filename);
 void close_sdmmc_device(void);
 int transfer_sdmmc_byte(int value);
 void set_sdmmc_cs(int value);
+void write_sdmmc_state(FILE *file);
+void read_sdmmc_state(FILE *file);
 
 #endif
@@ -0,0 +1,210 @@
+//
+// Copyright 2018 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <stdint.h>
+#include <string.h>
+#include "device.h"
+#include "processor.h"
+#include "snapshot.h"
+
+#define SNAPSHOT_MAGIC "NYUZISNP"
+#define SNAPSHOT_VERSION 5
+
+// Number of words converted at a time by the array functions
+#define ARRAY_CHUNK_SIZE 256
+
+void write_snapshot_u8(FILE *file, uint8_t value)
+{
+    fwrite(&value, 1, 1, file);
+}
+
+void write_snapshot_u32(FILE *file, uint32_t value)
+{
+    uint8_t bytes[4] = { (uint8_t) value, (uint8_t) (value >> 8),
+                         (uint8_t) (value >> 16), (uint8_t) (value >> 24) };
+
+    fwrite(bytes, sizeof(bytes), 1, file);
+}
+
+void write_snapshot_u64(FILE *file, uint64_t value)
+{
+    write_snapshot_u32(file, (uint32_t) value);
+    write_snapshot_u32(file, (uint32_t) (value >> 32));
+}
+
+void write_snapshot_bool(FILE *file, bool value)
+{
+    write_snapshot_u8(file, value ? 1 : 0);
+}
+
+void write_snapshot_u32_array(FILE *file, const uint32_t *values, size_t count)
+{
+    uint8_t bytes[ARRAY_CHUNK_SIZE * 4];
+    size_t chunk_size;
+    size_t i;
+
+    while (count > 0)
+    {
+        chunk_size = count < ARRAY_CHUNK_SIZE ? count : ARRAY_CHUNK_SIZE;
+        for (i = 0; i < chunk_size; i++)
+        {
+            bytes[i * 4] = (uint8_t) values[i];
+            bytes[i * 4 + 1] = (uint8_t) (values[i] >> 8);
+            bytes[i * 4 + 2] = (uint8_t) (values[i] >> 16);
+            bytes[i * 4 + 3] = (uint8_t) (values[i] >> 24);
+        }
+
+        fwrite(bytes, chunk_size * 4, 1, file);
+        values += chunk_size;
+        count -= chunk_size;
+    }
+}
+
+uint8_t read_snapshot_u8(FILE *file)
+{
+    uint8_t value = 0;
+
+    if (fread(&value, 1, 1, file) != 1)
+        return 0;
+
+    return value;
+}
+
+uint32_t read_snapshot_u32(FILE *file)
+{
+    uint8_t bytes[4];
+
+    if (fread(bytes, sizeof(bytes), 1, file) != 1)
+        return 0;
+
+    return (uint32_t) bytes[0] | ((uint32_t) bytes[1] << 8)
+           | ((uint32_t) bytes[2] << 16) | ((uint32_t) bytes[3] << 24);
+}
+
+uint64_t read_snapshot_u64(FILE *file)
+{
+    uint64_t low = read_snapshot_u32(file);
+
+    return low | ((uint64_t) read_snapshot_u32(file) << 32);
+}
+
+bool read_snapshot_bool(FILE *file)
+{
+    return read_snapshot_u8(file) != 0;
+}
+
+void read_snapshot_u32_array(FILE *file, uint32_t *values, size_t count)
+{
+    uint8_t bytes[ARRAY_CHUNK_SIZE * 4];
+    size_t chunk_size;
+    size_t i;
+
+    while (count > 0)
+    {
+        chunk_size = count < ARRAY_CHUNK_SIZE ? count : ARRAY_CHUNK_SIZE;
+        if (fread(bytes, chunk_size * 4, 1, file) != 1)
+            return;
+
+        for (i = 0; i < chunk_size; i++)
+        {
+            values[i] = (uint32_t) bytes[i * 4] | ((uint32_t) bytes[i * 4 + 1] << 8)
+                        | ((uint32_t) bytes[i * 4 + 2] << 16)
+                        | ((uint32_t) bytes[i * 4 + 3] << 24);
+        }
+
+        values += chunk_size;
+        count -= chunk_size;
+    }
+}
+
+int save_snapshot(const struct processor *proc, const char *filename)
+{
+    FILE *file;
+    int result = 0;
+
+    file = fopen(filename, "wb");
+    if (file == NULL)
+    {
+        perror("save_snapshot: error opening snapshot file");
+        return -1;
+    }
+
+    fwrite(SNAPSHOT_MAGIC, strlen(SNAPSHOT_MAGIC), 1, file);
+    write_snapshot_u32(file, SNAPSHOT_VERSION);
+    write_processor_state(proc, file);
+    write_device_state(file);
+    if (ferror(file))
+    {
+        perror("save_snapshot: error writing snapshot file");
+        result = -1;
+    }
+
+    if (fclose(file) != 0)
+    {
+        perror("save_snapshot: error writing snapshot file");
+        result = -1;
+    }
+
+    return result;
+}
+
+int restore_snapshot(struct processor *proc, const char *filename)
+{
+    FILE *file;
+    char magic[sizeof(SNAPSHOT_MAGIC) - 1];
+    uint32_t version;
+
+    file = fopen(filename, "rb");
+    if (file == NULL)
+    {
+        perror("restore_snapshot: error opening snapshot file");
+        return -1;
+    }
+
+    if (fread(magic, sizeof(magic), 1, file) != 1
+            || memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) != 0)
+    {
+        fprintf(stderr, "restore_snapshot: %s is not a snapshot file\n", filename);
+        fclose(file);
+        return -1;
+    }
+
+    version = read_snapshot_u32(file);
+    if (version != SNAPSHOT_VERSION)
+    {
+        fprintf(stderr, "restore_snapshot: %s has unsupported version %u (expected %u)\n",
+                filename, version, SNAPSHOT_VERSION);
+        fclose(file);
+        return -1;
+    }
+
+    if (read_processor_state(proc, file) < 0)
+    {
+        fclose(file);
+        return -1;
+    }
+
+    read_device_state(file);
+    if (ferror(file) || feof(file))
+    {
+        fprintf(stderr, "restore_snapshot: snapshot file is truncated\n");
+        fclose(file);
+        return -1;
+    }
+
+    fclose(file);
+    return 0;
+}
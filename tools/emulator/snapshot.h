@@ -0,0 +1,56 @@
+//
+// Copyright 2018 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+struct processor;
+
+//
+// A snapshot holds the complete state of the emulated system: memory,
+// registers, TLBs, pending interrupts, and device state. Restoring it into
+// a processor created with the same number of cores, threads, and memory
+// size resumes execution where it was saved. It does not include the
+// contents of the block device file, or host state like open pipes.
+//
+// Each field is written separately as a little endian value of a fixed
+// size, so the format does not depend on the host's struct layout, pointer
+// width, or byte order. The header has a version number, which must be
+// incremented whenever fields are added, removed, or reordered.
+//
+
+int save_snapshot(const struct processor*, const char *filename);
+int restore_snapshot(struct processor*, const char *filename);
+
+// Used by the modules that own each part of the state. Errors are detected
+// by checking the stream after everything has been read or written. At the
+// end of the file, the read functions return zero.
+void write_snapshot_u8(FILE*, uint8_t value);
+void write_snapshot_u32(FILE*, uint32_t value);
+void write_snapshot_u64(FILE*, uint64_t value);
+void write_snapshot_bool(FILE*, bool value);
+void write_snapshot_u32_array(FILE*, const uint32_t *values, size_t count);
+uint8_t read_snapshot_u8(FILE*);
+uint32_t read_snapshot_u32(FILE*);
+uint64_t read_snapshot_u64(FILE*);
+bool read_snapshot_bool(FILE*);
+void read_snapshot_u32_array(FILE*, uint32_t *values, size_t count);
+
+#endif
@@ -15,11 +15,17 @@
 //
 
 #include <ctype.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <time.h>
+#include <unistd.h>
+#include "elf.h"
 #include "processor.h"
 #include "util.h"
 
@@ -266,3 +272,218 @@ int read_hex_file(const char *filename, uint32_t *memory, uint32_t memory_size)
     fclose(file);
     return 0;
 }
+
+static int read_file_fully(int fd, uint32_t offset, uint8_t *dest, uint32_t length)
+{
+    ssize_t got;
+
+    while (length > 0)
+    {
+        got = pread(fd, dest, length, offset);
+        if (got <= 0)
+        {
+            if (got < 0 && errno == EINTR)
+                continue;
+
+            return -1;
+        }
+
+        dest += got;
+        offset += (uint32_t) got;
+        length -= (uint32_t) got;
+    }
+
+    return 0;
+}
+
+// Copy length bytes at offset in the file to dest. If map_file is set, this
+// maps whole pages copy-on-write instead of reading them, as long as the file
+// offset and destination are at the same alignment within a page. Pages that
+// the program doesn't modify share host memory with the page cache, and are
+// only read from disk when they are first accessed.
+static int load_file_region(int fd, uint32_t offset, uint8_t *dest, uint32_t length,
+                            bool map_file)
+{
+    uint32_t page_size = (uint32_t) sysconf(_SC_PAGESIZE);
+    uint32_t head_length;
+    uint32_t map_length;
+
+    if (map_file && (uintptr_t) dest % page_size == offset % page_size)
+    {
+        // Partial pages at the beginning and end must be read, because
+        // the rest of those pages hold other data.
+        head_length = (page_size - offset % page_size) % page_size;
+        if (head_length < length)
+        {
+            map_length = (length - head_length) / page_size * page_size;
+            if (map_length > 0)
+            {
+                if (mmap(dest + head_length, map_length, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_FIXED, fd, offset + head_length) == MAP_FAILED)
+                {
+                    perror("load_file_region: mmap failed");
+                    return -1;
+                }
+
+                if (read_file_fully(fd, offset, dest, head_length) < 0
+                        || read_file_fully(fd, offset + head_length + map_length,
+                                           dest + head_length + map_length,
+                                           length - head_length - map_length) < 0)
+                    return -1;
+
+                return 0;
+            }
+        }
+    }
+
+    return read_file_fully(fd, offset, dest, length);
+}
+
+bool is_elf_file(const char *filename)
+{
+    char magic[4];
+    int fd;
+    bool is_elf;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    is_elf = read(fd, magic, sizeof(magic)) == sizeof(magic)
+             && memcmp(magic, ELF_MAGIC, sizeof(magic)) == 0;
+    close(fd);
+    return is_elf;
+}
+
+//
+// The emulator starts execution at address 0, so this loads segments
+// relative to the entry point, the same as elf2hex with the -b option.
+// Segments below the entry point (for example, ELF headers) are skipped.
+//
+int read_elf_file(const char *filename, uint32_t *memory, uint32_t memory_size,
+                  bool map_file)
+{
+    int fd;
+    struct elf32_ehdr header;
+    struct elf32_phdr *segments;
+    const struct elf32_phdr *segment;
+    uint32_t segment_index;
+    uint32_t address;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        perror("read_elf_file: error opening ELF file");
+        return -1;
+    }
+
+    if (read_file_fully(fd, 0, (uint8_t*) &header, sizeof(header)) < 0
+            || memcmp(header.e_ident, ELF_MAGIC, 4) != 0
+            || header.e_ident[EI_CLASS] != ELFCLASS32)
+    {
+        fprintf(stderr, "read_elf_file: bad ELF header\n");
+        close(fd);
+        return -1;
+    }
+
+    if (header.e_machine != EM_NYUZI)
+    {
+        fprintf(stderr, "read_elf_file: incorrect architecture\n");
+        close(fd);
+        return -1;
+    }
+
+    if (header.e_phentsize != sizeof(struct elf32_phdr) || header.e_phnum == 0)
+    {
+        fprintf(stderr, "read_elf_file: bad segment table\n");
+        close(fd);
+        return -1;
+    }
+
+    segments = (struct elf32_phdr*) malloc(sizeof(struct elf32_phdr) * header.e_phnum);
+    if (read_file_fully(fd, header.e_phoff, (uint8_t*) segments,
+                        sizeof(struct elf32_phdr) * header.e_phnum) < 0)
+    {
+        fprintf(stderr, "read_elf_file: error reading segment table\n");
+        free(segments);
+        close(fd);
+        return -1;
+    }
+
+    for (segment_index = 0; segment_index < header.e_phnum; segment_index++)
+    {
+        segment = &segments[segment_index];
+        if (segment->p_type != PT_LOAD || segment->p_memsz == 0)
+            continue;
+
+        if ((uint64_t) segment->p_vaddr + segment->p_memsz <= header.e_entry)
+            continue;
+
+        address = segment->p_vaddr - header.e_entry;
+        if (segment->p_vaddr < header.e_entry || segment->p_filesz > segment->p_memsz
+                || address >= memory_size || segment->p_memsz > memory_size - address)
+        {
+            fprintf(stderr, "read_elf_file: segment %u out of range\n", segment_index);
+            free(segments);
+            close(fd);
+            return -1;
+        }
+
+        if (load_file_region(fd, segment->p_offset, (uint8_t*) memory + address,
+                             segment->p_filesz, map_file) < 0)
+        {
+            fprintf(stderr, "read_elf_file: error reading segment %u\n", segment_index);
+            free(segments);
+            close(fd);
+            return -1;
+        }
+
+        // Clear BSS
+        memset((uint8_t*) memory + address + segment->p_filesz, 0,
+               segment->p_memsz - segment->p_filesz);
+    }
+
+    free(segments);
+
+    // Mappings remain valid after the file is closed.
+    close(fd);
+    return 0;
+}
+
+int read_binary_file(const char *filename, uint32_t *memory, uint32_t memory_size,
+                     bool map_file)
+{
+    int fd;
+    struct stat st;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        perror("read_binary_file: error opening binary file");
+        return -1;
+    }
+
+    if (fstat(fd, &st) < 0)
+    {
+        perror("read_binary_file: stat failed");
+        close(fd);
+        return -1;
+    }
+
+    if (st.st_size > memory_size)
+    {
+        fprintf(stderr, "read_binary_file: binary file too big to fit in memory\n");
+        close(fd);
+        return -1;
+    }
+
+    if (load_file_region(fd, 0, (uint8_t*) memory, (uint32_t) st.st_size, map_file) < 0)
+    {
+        fprintf(stderr, "read_binary_file: error reading file\n");
+        close(fd);
+        return -1;
+    }
+
+    close(fd);
+    return 0;
+}
@@ -132,4 +132,13 @@ uint64_t current_time_us(void);
 
 int read_hex_file(const char *filename, uint32_t *memory, uint32_t memory_size);
 
+// Load an executable image into memory. If map_file is set, these map file
+// pages into memory copy-on-write where possible, which requires memory to
+// be page aligned. Otherwise, they copy the contents.
+bool is_elf_file(const char *filename);
+int read_elf_file(const char *filename, uint32_t *memory, uint32_t memory_size,
+                  bool map_file);
+int read_binary_file(const char *filename, uint32_t *memory, uint32_t memory_size,
+                     bool map_file);
+
 #endif
@@ -0,0 +1,395 @@
+//
+// Copyright 2018 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <string.h>
+#include "processor.h"
+#include "vector-ops.h"
+
+//
+// The AVX2 functions are compiled for that instruction set regardless of the
+// compiler flags, and only called if the host CPU supports it. Each handles
+// half of a vector register at a time. Other hosts fall back to the lane at a
+// time implementation in processor.c.
+//
+// The packed floating point instructions use the same MXCSR rounding mode as
+// the scalar SSE instructions the compiler generates for the lane at a time
+// code, so results are the same either way. This isn't true of 32-bit x87
+// builds, so those don't use this path.
+//
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define USE_AVX2 1
+#include <immintrin.h>
+#define AVX2_FUNC __attribute__((target("avx2")))
+#endif
+
+static bool host_has_avx2;
+
+void init_vector_ops(void)
+{
+#ifdef USE_AVX2
+    __builtin_cpu_init();
+    host_has_avx2 = __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+#ifdef USE_AVX2
+
+static bool avx2_supports_arith(enum arithmetic_op op)
+{
+    switch (op)
+    {
+        case OP_OR:
+        case OP_AND:
+        case OP_XOR:
+        case OP_ADD_I:
+        case OP_SUB_I:
+        case OP_MULL_I:
+        case OP_ASHR:
+        case OP_SHR:
+        case OP_SHL:
+        case OP_MOVE:
+        case OP_FTOI:
+        case OP_RECIPROCAL:
+        case OP_SEXT8:
+        case OP_SEXT16:
+        case OP_ADD_F:
+        case OP_SUB_F:
+        case OP_MUL_F:
+        case OP_ITOF:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+// x86 propagates the NaN payload, but Nyuzi uses a single NaN representation
+// (see value_as_int). Replace lanes of result where check is NaN.
+AVX2_FUNC static inline __m256i avx2_canonical_nan(__m256 result, __m256 check)
+{
+    return _mm256_castps_si256(_mm256_blendv_ps(result,
+        _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff)),
+        _mm256_cmp_ps(check, check, _CMP_UNORD_Q)));
+}
+
+AVX2_FUNC static inline __m256i avx2_arith(enum arithmetic_op op, __m256i value1,
+                                           __m256i value2)
+{
+    const __m256i shift_mask = _mm256_set1_epi32(31);
+    __m256 fvalue1 = _mm256_castsi256_ps(value1);
+    __m256 fvalue2 = _mm256_castsi256_ps(value2);
+    __m256 fresult;
+
+    switch (op)
+    {
+        case OP_OR:
+            return _mm256_or_si256(value1, value2);
+        case OP_AND:
+            return _mm256_and_si256(value1, value2);
+        case OP_XOR:
+            return _mm256_xor_si256(value1, value2);
+        case OP_ADD_I:
+            return _mm256_add_epi32(value1, value2);
+        case OP_SUB_I:
+            return _mm256_sub_epi32(value1, value2);
+        case OP_MULL_I:
+            return _mm256_mullo_epi32(value1, value2);
+        case OP_ASHR:
+            return _mm256_srav_epi32(value1, _mm256_and_si256(value2, shift_mask));
+        case OP_SHR:
+            return _mm256_srlv_epi32(value1, _mm256_and_si256(value2, shift_mask));
+        case OP_SHL:
+            return _mm256_sllv_epi32(value1, _mm256_and_si256(value2, shift_mask));
+        case OP_FTOI:
+            return _mm256_cvttps_epi32(fvalue2);
+        case OP_RECIPROCAL:
+        {
+            // Truncate to 6 bits of accuracy, but only if the result is not NaN
+            const __m256 truncate_mask = _mm256_castsi256_ps(
+                _mm256_set1_epi32((int) 0xfffe0000));
+            fresult = _mm256_div_ps(_mm256_set1_ps(1.0f),
+                                    _mm256_and_ps(fvalue2, truncate_mask));
+            return avx2_canonical_nan(_mm256_and_ps(fresult, truncate_mask), fresult);
+        }
+
+        case OP_SEXT8:
+            return _mm256_srai_epi32(_mm256_slli_epi32(value2, 24), 24);
+        case OP_SEXT16:
+            return _mm256_srai_epi32(_mm256_slli_epi32(value2, 16), 16);
+        case OP_ADD_F:
+            fresult = _mm256_add_ps(fvalue1, fvalue2);
+            return avx2_canonical_nan(fresult, fresult);
+        case OP_SUB_F:
+            fresult = _mm256_sub_ps(fvalue1, fvalue2);
+            return avx2_canonical_nan(fresult, fresult);
+        case OP_MUL_F:
+            fresult = _mm256_mul_ps(fvalue1, fvalue2);
+            return avx2_canonical_nan(fresult, fresult);
+        case OP_ITOF:
+            return _mm256_castps_si256(_mm256_cvtepi32_ps(value2));
+        default: // OP_MOVE
+            return value2;
+    }
+}
+
+// Returns a bitmask with one bit for each of the 8 lanes.
+AVX2_FUNC static inline uint32_t avx2_compare(enum arithmetic_op op, __m256i value1,
+                                              __m256i value2)
+{
+    const __m256i sign_bit = _mm256_set1_epi32((int) 0x80000000);
+    __m256 fvalue1 = _mm256_castsi256_ps(value1);
+    __m256 fvalue2 = _mm256_castsi256_ps(value2);
+    __m256 result;
+
+    // There are only signed integer comparisons. Flipping the sign bit
+    // converts the unsigned ones.
+    if (op >= OP_CMPGT_U && op <= OP_CMPLE_U)
+    {
+        value1 = _mm256_xor_si256(value1, sign_bit);
+        value2 = _mm256_xor_si256(value2, sign_bit);
+    }
+
+    switch (op)
+    {
+        case OP_CMPEQ_I:
+        case OP_CMPNE_I:
+            result = _mm256_castsi256_ps(_mm256_cmpeq_epi32(value1, value2));
+            break;
+        case OP_CMPGT_I:
+        case OP_CMPLE_I:
+        case OP_CMPGT_U:
+        case OP_CMPLE_U:
+            result = _mm256_castsi256_ps(_mm256_cmpgt_epi32(value1, value2));
+            break;
+        case OP_CMPLT_I:
+        case OP_CMPGE_I:
+        case OP_CMPLT_U:
+        case OP_CMPGE_U:
+            result = _mm256_castsi256_ps(_mm256_cmpgt_epi32(value2, value1));
+            break;
+
+        // The ordered predicates are false if either operand is NaN, the same
+        // as C comparison operators. != is true in that case.
+        case OP_CMPGT_F:
+            result = _mm256_cmp_ps(fvalue1, fvalue2, _CMP_GT_OQ);
+            break;
+        case OP_CMPGE_F:
+            result = _mm256_cmp_ps(fvalue1, fvalue2, _CMP_GE_OQ);
+            break;
+        case OP_CMPLT_F:
+            result = _mm256_cmp_ps(fvalue1, fvalue2, _CMP_LT_OQ);
+            break;
+        case OP_CMPLE_F:
+            result = _mm256_cmp_ps(fvalue1, fvalue2, _CMP_LE_OQ);
+            break;
+        case OP_CMPEQ_F:
+            result = _mm256_cmp_ps(fvalue1, fvalue2, _CMP_EQ_OQ);
+            break;
+        default: // OP_CMPNE_F
+            result = _mm256_cmp_ps(fvalue1, fvalue2, _CMP_NEQ_UQ);
+            break;
+    }
+
+    switch (op)
+    {
+        case OP_CMPNE_I:
+        case OP_CMPLE_I:
+        case OP_CMPGE_I:
+        case OP_CMPLE_U:
+        case OP_CMPGE_U:
+            return ~(uint32_t) _mm256_movemask_ps(result) & 0xff;
+
+        default:
+            return (uint32_t) _mm256_movemask_ps(result);
+    }
+}
+
+AVX2_FUNC static void avx2_vector_arith(enum arithmetic_op op, uint32_t *result,
+                                        const uint32_t *value1, const uint32_t *value2)
+{
+    int i;
+
+    for (i = 0; i < NUM_VECTOR_LANES; i += 8)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i*) (value1 + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*) (value2 + i));
+        _mm256_storeu_si256((__m256i*) (result + i), avx2_arith(op, a, b));
+    }
+}
+
+AVX2_FUNC static void avx2_vector_scalar_arith(enum arithmetic_op op, uint32_t *result,
+                                               const uint32_t *value1, uint32_t value2)
+{
+    __m256i b = _mm256_set1_epi32((int) value2);
+    int i;
+
+    for (i = 0; i < NUM_VECTOR_LANES; i += 8)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i*) (value1 + i));
+        _mm256_storeu_si256((__m256i*) (result + i), avx2_arith(op, a, b));
+    }
+}
+
+AVX2_FUNC static uint32_t avx2_vector_compare(enum arithmetic_op op, const uint32_t *value1,
+                                              const uint32_t *value2)
+{
+    uint32_t mask = 0;
+    int i;
+
+    for (i = 0; i < NUM_VECTOR_LANES; i += 8)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i*) (value1 + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*) (value2 + i));
+        mask |= avx2_compare(op, a, b) << i;
+    }
+
+    return mask;
+}
+
+AVX2_FUNC static uint32_t avx2_vector_scalar_compare(enum arithmetic_op op,
+                                                     const uint32_t *value1, uint32_t value2)
+{
+    __m256i b = _mm256_set1_epi32((int) value2);
+    uint32_t mask = 0;
+    int i;
+
+    for (i = 0; i < NUM_VECTOR_LANES; i += 8)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i*) (value1 + i));
+        mask |= avx2_compare(op, a, b) << i;
+    }
+
+    return mask;
+}
+
+AVX2_FUNC static void avx2_masked_copy(uint32_t *dest, const uint32_t *values,
+                                       uint32_t mask)
+{
+    const __m256i lane_bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    int i;
+
+    for (i = 0; i < NUM_VECTOR_LANES; i += 8)
+    {
+        __m256i lane_mask = _mm256_cmpeq_epi32(_mm256_and_si256(
+            _mm256_set1_epi32((int) (mask >> i)), lane_bits), lane_bits);
+        _mm256_maskstore_epi32((int*) (dest + i), lane_mask,
+                               _mm256_loadu_si256((const __m256i*) (values + i)));
+    }
+}
+
+#endif
+
+bool vector_arith_op(enum arithmetic_op op, uint32_t *result, const uint32_t *value1,
+                     const uint32_t *value2)
+{
+#ifdef USE_AVX2
+    if (host_has_avx2 && avx2_supports_arith(op))
+    {
+        avx2_vector_arith(op, result, value1, value2);
+        return true;
+    }
+#else
+    (void) op;
+    (void) result;
+    (void) value1;
+    (void) value2;
+#endif
+
+    return false;
+}
+
+bool vector_scalar_arith_op(enum arithmetic_op op, uint32_t *result,
+                            const uint32_t *value1, uint32_t value2)
+{
+#ifdef USE_AVX2
+    if (host_has_avx2 && avx2_supports_arith(op))
+    {
+        avx2_vector_scalar_arith(op, result, value1, value2);
+        return true;
+    }
+#else
+    (void) op;
+    (void) result;
+    (void) value1;
+    (void) value2;
+#endif
+
+    return false;
+}
+
+bool vector_compare_op(enum arithmetic_op op, uint32_t *result_mask,
+                       const uint32_t *value1, const uint32_t *value2)
+{
+#ifdef USE_AVX2
+    if (host_has_avx2)
+    {
+        *result_mask = avx2_vector_compare(op, value1, value2);
+        return true;
+    }
+#else
+    (void) op;
+    (void) result_mask;
+    (void) value1;
+    (void) value2;
+#endif
+
+    return false;
+}
+
+bool vector_scalar_compare_op(enum arithmetic_op op, uint32_t *result_mask,
+                              const uint32_t *value1, uint32_t value2)
+{
+#ifdef USE_AVX2
+    if (host_has_avx2)
+    {
+        *result_mask = avx2_vector_scalar_compare(op, value1, value2);
+        return true;
+    }
+#else
+    (void) op;
+    (void) result_mask;
+    (void) value1;
+    (void) value2;
+#endif
+
+    return false;
+}
+
+void vector_masked_copy(uint32_t *dest, const uint32_t *values, uint32_t mask)
+{
+    int lane;
+
+    if ((mask & 0xffff) == 0xffff)
+    {
+        memcpy(dest, values, NUM_VECTOR_LANES * sizeof(uint32_t));
+        return;
+    }
+
+#ifdef USE_AVX2
+    if (host_has_avx2)
+    {
+        avx2_masked_copy(dest, values, mask);
+        return;
+    }
+#endif
+
+    for (lane = 0; lane < NUM_VECTOR_LANES; lane++)
+    {
+        if (mask & (1 << lane))
+            dest[lane] = values[lane];
+    }
+}
@@ -0,0 +1,51 @@
+//
+// Copyright 2018 Jeff Bush
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef VECTOR_OPS_H
+#define VECTOR_OPS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "instruction-set.h"
+
+//
+// Operations on all lanes of a vector register at once, using host SIMD
+// instructions when available. The arithmetic and comparison functions return
+// false if the host or the operation isn't supported. In that case, the caller
+// must compute the result one lane at a time. Results are bit-identical to
+// computing each lane separately.
+//
+
+// Checks which instruction set extensions the host supports. This must be
+// called before the other functions.
+void init_vector_ops(void);
+
+bool vector_arith_op(enum arithmetic_op, uint32_t *result, const uint32_t *value1,
+                     const uint32_t *value2);
+bool vector_scalar_arith_op(enum arithmetic_op, uint32_t *result,
+                            const uint32_t *value1, uint32_t value2);
+
+// The result of a comparison is a bitmask, with lane 0 in the least
+// significant bit.
+bool vector_compare_op(enum arithmetic_op, uint32_t *result_mask,
+                       const uint32_t *value1, const uint32_t *value2);
+bool vector_scalar_compare_op(enum arithmetic_op, uint32_t *result_mask,
+                              const uint32_t *value1, uint32_t value2);
+
+// Copy each lane from values to dest if the corresponding bit in mask is set.
+void vector_masked_copy(uint32_t *dest, const uint32_t *values, uint32_t mask);
+
+#endif
@@ -0,0 +1,316 @@
+#!/usr/bin/env python3
+#
+# Copyright 2018 Jeff Bush
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+"""Symbolize a profile written by the emulator's --profile option.
+
+USAGE: emulator_profile.py [options] <elf file> <profile file>
+
+By default, this prints a flat profile: the number of instructions executed
+in each function, the number of basic blocks entered, and the number of times
+it was called. Other options print a call graph, the most frequently entered
+basic blocks, and the cache lines each thread touched. The elf file must be
+the one that was executed, with symbols.
+"""
+
+import argparse
+import bisect
+import struct
+import sys
+
+CACHE_LINE_LENGTH = 64
+PROFILE_MAGIC = b'NYUZIPRF'
+PROFILE_VERSION = 1
+SHT_SYMTAB = 2
+STT_OBJECT = 1
+STT_FUNC = 2
+
+
+class SymbolTable(object):
+    """Map addresses to the names of the symbols that contain them."""
+
+    def __init__(self, symbols):
+        """symbols is a list of (address: int, size: int, name: str)"""
+        self.symbols = sorted(symbols)
+        self.addresses = [sym[0] for sym in self.symbols]
+
+    def lookup(self, address):
+        """Return (name, start address) or (None, None) if not found."""
+        index = bisect.bisect_right(self.addresses, address) - 1
+        if index < 0:
+            return None, None
+
+        start, size, name = self.symbols[index]
+        if size != 0 and address >= start + size:
+            return None, None
+
+        return name, start
+
+    def format(self, address):
+        name, start = self.lookup(address)
+        if name is None:
+            return '0x{:08x}'.format(address)
+
+        if address == start:
+            return name
+
+        return '{}+0x{:x}'.format(name, address - start)
+
+
+def read_elf_symbols(filename):
+    """Return (function symbols, data symbols) from the ELF symbol table.
+
+    Each is a SymbolTable.
+    """
+    with open(filename, 'rb') as f:
+        contents = f.read()
+
+    if contents[0:4] != b'\x7fELF' or contents[4] != 1:
+        raise Exception(filename + ' is not a 32-bit ELF file')
+
+    shoff, = struct.unpack_from('<I', contents, 32)
+    shentsize, shnum = struct.unpack_from('<HH', contents, 46)
+    sections = [struct.unpack_from('<10I', contents, shoff + index * shentsize)
+                for index in range(shnum)]
+
+    functions = []
+    objects = []
+    for section in sections:
+        if section[1] != SHT_SYMTAB:
+            continue
+
+        sym_offset, sym_size, strtab_index = section[4], section[5], section[6]
+        strtab_offset = sections[strtab_index][4]
+        for sym in range(sym_offset, sym_offset + sym_size, 16):
+            st_name, st_value, st_size, st_info, _, st_shndx = struct.unpack_from(
+                '<IIIBBH', contents, sym)
+            if st_shndx == 0:
+                continue    # Undefined
+
+            name_end = contents.index(b'\0', strtab_offset + st_name)
+            name = contents[strtab_offset + st_name:name_end].decode()
+            if (st_info & 0xf) == STT_FUNC:
+                functions.append((st_value, st_size, name))
+            elif (st_info & 0xf) == STT_OBJECT:
+                objects.append((st_value, st_size, name))
+
+    return SymbolTable(functions), SymbolTable(objects)
+
+
+class ThreadProfile(object):
+    def __init__(self):
+        self.instructions = {}  # pc -> count
+        self.blocks = {}        # pc -> count
+        self.data_lines = {}    # line address -> count
+        self.calls = {}         # (call pc, target) -> count
+
+
+def read_profile(filename):
+    """Return a list of ThreadProfile, indexed by thread ID."""
+    with open(filename, 'rb') as f:
+        contents = f.read()
+
+    if contents[0:8] != PROFILE_MAGIC:
+        raise Exception(filename + ' is not a profile file')
+
+    version, num_threads = struct.unpack_from('<II', contents, 8)
+    if version != PROFILE_VERSION:
+        raise Exception('unsupported profile version {}'.format(version))
+
+    offset = 16
+
+    def read_table(entry_format):
+        nonlocal offset
+        count, = struct.unpack_from('<I', contents, offset)
+        offset += 4
+        entries = list(struct.iter_unpack(
+            entry_format, contents[offset:offset + count * struct.calcsize(entry_format)]))
+        offset += count * struct.calcsize(entry_format)
+        return entries
+
+    threads = []
+    for _ in range(num_threads):
+        thread = ThreadProfile()
+        thread.instructions = dict(read_table('<IQ'))
+        thread.blocks = dict(read_table('<IQ'))
+        thread.data_lines = dict(read_table('<IQ'))
+        thread.calls = {(call_pc, target): count for call_pc, target, count
+                        in read_table('<IIQ')}
+        threads.append(thread)
+
+    return threads
+
+
+def merge_threads(threads):
+    """Sum the counts of several threads into one ThreadProfile."""
+    total = ThreadProfile()
+    for thread in threads:
+        for field in ('instructions', 'blocks', 'data_lines', 'calls'):
+            dest = getattr(total, field)
+            for key, count in getattr(thread, field).items():
+                dest[key] = dest.get(key, 0) + count
+
+    return total
+
+
+def function_name(functions, address):
+    name, _ = functions.lookup(address)
+    return name if name is not None else '[unknown]'
+
+
+def print_flat_profile(functions, profile):
+    instructions = {}
+    blocks = {}
+    calls = {}
+    for pc, count in profile.instructions.items():
+        name = function_name(functions, pc)
+        instructions[name] = instructions.get(name, 0) + count
+
+    for pc, count in profile.blocks.items():
+        name = function_name(functions, pc)
+        blocks[name] = blocks.get(name, 0) + count
+
+    for (_, target), count in profile.calls.items():
+        name = function_name(functions, target)
+        calls[name] = calls.get(name, 0) + count
+
+    total = sum(instructions.values())
+    print('{:>12} {:>7} {:>10} {:>9}  {}'.format('instructions', 'self%', 'blocks',
+                                                'calls', 'function'))
+    for name, count in sorted(instructions.items(), key=lambda item: item[1],
+                              reverse=True):
+        print('{:12d} {:6.2f}% {:10d} {:9d}  {}'.format(
+            count, count / total * 100, blocks.get(name, 0), calls.get(name, 0),
+            name))
+
+
+def print_call_graph(functions, profile):
+    instructions = {}
+    callers = {}
+    callees = {}
+    for pc, count in profile.instructions.items():
+        name = function_name(functions, pc)
+        instructions[name] = instructions.get(name, 0) + count
+
+    for (call_pc, target), count in profile.calls.items():
+        caller = function_name(functions, call_pc)
+        callee = function_name(functions, target)
+        callers.setdefault(callee, {})
+        callers[callee][caller] = callers[callee].get(caller, 0) + count
+        callees.setdefault(caller, {})
+        callees[caller][callee] = callees[caller].get(callee, 0) + count
+
+    def print_edges(label, edges):
+        if not edges:
+            return
+
+        print('    ' + label)
+        for name, count in sorted(edges.items(), key=lambda item: item[1],
+                                  reverse=True):
+            print('    {:12d}  {}'.format(count, name))
+
+    for name, count in sorted(instructions.items(), key=lambda item: item[1],
+                              reverse=True):
+        print('{} ({} instructions, called {} times)'.format(
+            name, count, sum(callers.get(name, {}).values())))
+        print_edges('called by:', callers.get(name))
+        print_edges('calls:', callees.get(name))
+        print('')
+
+
+def print_blocks(functions, profile, max_blocks):
+    print('{:>12}  {:<10}  {}'.format('entries', 'address', 'location'))
+    for pc, count in sorted(profile.blocks.items(), key=lambda item: item[1],
+                            reverse=True)[:max_blocks]:
+        print('{:12d}  0x{:08x}  {}'.format(count, pc, functions.format(pc)))
+
+
+def print_cache_lines(objects, threads, max_lines):
+    """threads is a list of (thread ID, ThreadProfile)"""
+    print('{:>6} {:>10} {:>12} {:>10} {:>12}'.format(
+        'thread', 'icache', 'fetches', 'dcache', 'accesses'))
+    for thread_id, thread in threads:
+        if not thread.instructions and not thread.data_lines:
+            continue
+
+        icache_lines = {pc & ~(CACHE_LINE_LENGTH - 1) for pc in thread.instructions}
+        print('{:6d} {:10d} {:12d} {:10d} {:12d}'.format(
+            thread_id, len(icache_lines), sum(thread.instructions.values()),
+            len(thread.data_lines), sum(thread.data_lines.values())))
+
+    # Lines accessed by more than one thread may be shared or falsely shared.
+    line_threads = {}
+    line_counts = {}
+    for thread_id, thread in threads:
+        for line, count in thread.data_lines.items():
+            line_threads.setdefault(line, set()).add(thread_id)
+            line_counts[line] = line_counts.get(line, 0) + count
+
+    print('')
+    print('{:>12} {:>8}  {:<10}  {}'.format('accesses', 'threads', 'line',
+                                           'location'))
+    for line, count in sorted(line_counts.items(), key=lambda item: item[1],
+                              reverse=True)[:max_lines]:
+        print('{:12d} {:8d}  0x{:08x}  {}'.format(count, len(line_threads[line]),
+                                                 line, objects.format(line)))
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Symbolize a profile written by the emulator --profile option')
+    parser.add_argument('elf_file', help='Executable that was profiled')
+    parser.add_argument('profile_file', help='File written by the emulator')
+    parser.add_argument('-g', '--call-graph', action='store_true',
+                        help='Print callers and callees of each function')
+    parser.add_argument('-b', '--blocks', type=int, metavar='COUNT',
+                        help='Print the most frequently entered basic blocks')
+    parser.add_argument('-c', '--cache', type=int, metavar='COUNT',
+                        help='Print cache line usage for each thread and the '
+                        'most frequently accessed data cache lines')
+    parser.add_argument('-t', '--thread', type=int, action='append',
+                        help='Only include counts from this thread (may be '
+                        'repeated)')
+    args = parser.parse_args()
+
+    functions, objects = read_elf_symbols(args.elf_file)
+    threads = read_profile(args.profile_file)
+    if args.thread:
+        for thread_id in args.thread:
+            if thread_id >= len(threads):
+                print('invalid thread {}, profile has {} threads'.format(
+                    thread_id, len(threads)))
+                sys.exit(1)
+
+        selected = [(thread_id, threads[thread_id]) for thread_id in args.thread]
+    else:
+        selected = list(enumerate(threads))
+
+    profile = merge_threads([thread for _, thread in selected])
+    if not profile.instructions:
+        print('No instructions were executed')
+        sys.exit(1)
+
+    if args.call_graph:
+        print_call_graph(functions, profile)
+    elif args.blocks is not None:
+        print_blocks(functions, profile, args.blocks)
+    elif args.cache is not None:
+        print_cache_lines(objects, selected, args.cache)
+    else:
+        print_flat_profile(functions, profile)
+
+if __name__ == '__main__':
+    main()